@@ -5,6 +5,7 @@
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
+#include "NodeArena.h"
 
 template <typename KeyType, typename ValueType>
 class BPlusTree {
@@ -19,16 +20,16 @@ public:
     void traverse() const;
 
 private:
-    // Node structure
+    // Node structure. The arrays live inline in the node's arena block, right
+    // after this header, with capacities fixed by the tree order.
     struct Node {
         bool isLeaf;
-        std::vector<KeyType> keys;
-        std::vector<Node*> children;    // Used if internal node
-        std::vector<ValueType> values;  // Used if leaf node
+        FixedArray<KeyType> keys;
+        FixedArray<Node*> children;    // Used if internal node
+        FixedArray<ValueType> values;  // Used if leaf node
         Node* next;  // Pointer to next leaf node (used if leaf node)
 
-        Node(bool leaf);
-        ~Node();
+        Node(bool leaf, void* keyStorage, void* slotStorage, int capacity);
     };
 
     // Root node of the B+ tree
@@ -37,6 +38,15 @@ private:
     // Order of the tree (maximum number of keys in a node)
     int order;
 
+    // Placement of the inline arrays in a node block, and the slabs nodes come from
+    NodeLayout layout;
+    NodeArena arena;
+
+    // Node allocation
+    Node* createNode(bool leaf);
+    void destroyNode(Node* node);
+    void destroySubtree(Node* node);
+
     // Helper functions
     void insertInternal(const KeyType& key, Node* current, Node* child);
     void removeInternal(const KeyType& key, Node* current, Node* child);
@@ -59,30 +69,54 @@ private:
 
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::BPlusTree(int order) : root(nullptr), order(order) {
+BPlusTree<KeyType, ValueType>::BPlusTree(int order)
+    : root(nullptr), order(order),
+      layout(NodeLayout::make<Node, KeyType, Node*, ValueType>(std::max(order, 3))),
+      arena(layout.blockSize) {
     if (order < 3) {
         throw std::invalid_argument("Order must be at least 3");
     }
     // Create an empty root node
-    root = new Node(true);
+    root = createNode(true);
 }
 
 template <typename KeyType, typename ValueType>
 BPlusTree<KeyType, ValueType>::~BPlusTree() {
-    delete root;
+    destroySubtree(root);
+}
+
+template <typename KeyType, typename ValueType>
+BPlusTree<KeyType, ValueType>::Node::Node(bool leaf, void* keyStorage, void* slotStorage, int capacity)
+    : isLeaf(leaf),
+      keys(keyStorage, capacity),
+      children(leaf ? nullptr : slotStorage, leaf ? 0 : capacity + 1),
+      values(leaf ? slotStorage : nullptr, leaf ? capacity : 0),
+      next(nullptr) {
+}
+
+template <typename KeyType, typename ValueType>
+typename BPlusTree<KeyType, ValueType>::Node* BPlusTree<KeyType, ValueType>::createNode(bool leaf) {
+    // Allocate the node and its inline arrays from the tree's arena
+    char* block = static_cast<char*>(arena.allocate());
+    return new (block) Node(leaf, block + layout.keyOffset, block + layout.slotOffset, order);
 }
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::Node(bool leaf) : isLeaf(leaf), next(nullptr) {
+void BPlusTree<KeyType, ValueType>::destroyNode(Node* node) {
+    // Destroy a single node (not its children) and recycle its block
+    node->~Node();
+    arena.deallocate(node);
 }
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::~Node() {
-    if (!isLeaf) {
-        for (auto child : children) {
-            delete child;
+void BPlusTree<KeyType, ValueType>::destroySubtree(Node* node) {
+    if (!node) return;
+    if (!node->isLeaf) {
+        for (auto child : node->children) {
+            destroySubtree(child);
         }
     }
+    destroyNode(node);
 }
 
 
@@ -123,7 +157,7 @@ void BPlusTree<KeyType, ValueType>::splitLeaf(Node* leaf) {
     int mid = (order + 1) / 2;
 
     // Create a new leaf node
-    Node* newLeaf = new Node(true);
+    Node* newLeaf = createNode(true);
     newLeaf->next = leaf->next;
     leaf->next = newLeaf;
 
@@ -139,7 +173,7 @@ void BPlusTree<KeyType, ValueType>::splitLeaf(Node* leaf) {
 
     if (leaf == root) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(newKey);
         newRoot->children.push_back(leaf);
         newRoot->children.push_back(newLeaf);
@@ -174,7 +208,7 @@ void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
     int mid = internal->keys.size() / 2;
 
     // Create a new internal node
-    Node* newInternal = new Node(false);
+    Node* newInternal = createNode(false);
 
     // Promote the middle key
     KeyType upKey = internal->keys[mid];
@@ -189,7 +223,7 @@ void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
 
     if (internal == root) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(upKey);
         newRoot->children.push_back(internal);
         newRoot->children.push_back(newInternal);
@@ -300,7 +334,7 @@ void BPlusTree<KeyType, ValueType>::remove(const KeyType& key) {
 
     // If the leaf node is the root, and it's empty, update the root
     if (leaf == root && leaf->keys.empty()) {
-        delete root;
+        destroyNode(root);
         root = nullptr;
         return;
     }
@@ -391,12 +425,12 @@ void BPlusTree<KeyType, ValueType>::mergeLeaf(Node* left, Node* right, Node* par
     // Remove right sibling
     parent->keys.erase(parent->keys.begin() + index);
     parent->children.erase(parent->children.begin() + index + 1);
-    delete right;
+    destroyNode(right);
 
     // Handle parent underflow
     if (parent == root && parent->keys.empty()) {
         root = left;
-        delete parent;
+        destroyNode(parent);
     } else if (parent->keys.size() < (order - 1) / 2) {
         // Implement further underflow handling for internal nodes
     }
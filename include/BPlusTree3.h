@@ -5,6 +5,7 @@
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
+#include "NodeArena.h"
 
 template <typename KeyType, typename ValueType>
 class BPlusTree {
@@ -28,21 +29,28 @@ public:
     void traverse() const;
 
 private:
-    // Node structure
+    // Node structure. The arrays live inline in the node's arena block, right
+    // after this header, with capacities fixed by the tree order.
     struct Node {
         bool isLeaf;
-        std::vector<KeyType> keys;
-        std::vector<Node*> children; // Used if internal node
+        FixedArray<KeyType> keys;
+        FixedArray<Node*> children; // Used if internal node
         // For leaf nodes, we store a vector of vectors of values:
-        std::vector<std::vector<ValueType>> values;  // Used if leaf node
+        FixedArray<std::vector<ValueType>> values;  // Used if leaf node
         Node* next;  // Pointer to next leaf node
 
-        Node(bool leaf);
-        ~Node();
+        Node(bool leaf, void* keyStorage, void* slotStorage, int capacity);
     };
 
     Node* root;   // Root node of the B+ tree
     int order;     // Maximum number of keys in a node
+    NodeLayout layout; // Placement of the inline arrays in a node block
+    NodeArena arena;   // Per-tree slabs all nodes are allocated from
+
+    // Node allocation
+    Node* createNode(bool leaf);
+    void destroyNode(Node* node);
+    void destroySubtree(Node* node);
 
     // Helper functions
     void insertInternal(const KeyType& key, Node* current, Node* child);
@@ -65,7 +73,10 @@ private:
 // Implementation
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::BPlusTree(int order) : root(nullptr), order(order) {
+BPlusTree<KeyType, ValueType>::BPlusTree(int order)
+    : root(nullptr), order(order),
+      layout(NodeLayout::make<Node, KeyType, Node*, std::vector<ValueType>>(std::max(order, 3))),
+      arena(layout.blockSize) {
     /**
      * @brief Constructor for the BPlusTree.
      * @param order The maximum number of keys a node can hold. Must be at least 3.
@@ -75,7 +86,7 @@ BPlusTree<KeyType, ValueType>::BPlusTree(int order) : root(nullptr), order(order
         throw std::invalid_argument("Order must be at least 3");
     }
     // Create an empty root node
-    root = new Node(true);
+    root = createNode(true);
 }
 
 template <typename KeyType, typename ValueType>
@@ -83,28 +94,56 @@ BPlusTree<KeyType, ValueType>::~BPlusTree() {
     /**
      * @brief Destructor for the BPlusTree.
      */
-    delete root;
+    destroySubtree(root);
 }
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::Node(bool leaf) : isLeaf(leaf), next(nullptr) {
+BPlusTree<KeyType, ValueType>::Node::Node(bool leaf, void* keyStorage, void* slotStorage, int capacity)
+    : isLeaf(leaf),
+      keys(keyStorage, capacity),
+      children(leaf ? nullptr : slotStorage, leaf ? 0 : capacity + 1),
+      values(leaf ? slotStorage : nullptr, leaf ? capacity : 0),
+      next(nullptr) {
     /**
      * @brief Constructor for a BPlusTree Node.
      * @param leaf Indicates whether the node is a leaf.
+     * @param keyStorage Inline storage for the keys.
+     * @param slotStorage Inline storage for the children (internal node) or values (leaf).
+     * @param capacity Maximum number of keys, i.e. the tree order.
+     */
+}
+
+template <typename KeyType, typename ValueType>
+typename BPlusTree<KeyType, ValueType>::Node* BPlusTree<KeyType, ValueType>::createNode(bool leaf) {
+    /**
+     * @brief Allocates a node and its inline arrays from the tree's arena.
+     * @param leaf Indicates whether the node is a leaf.
+     */
+    char* block = static_cast<char*>(arena.allocate());
+    return new (block) Node(leaf, block + layout.keyOffset, block + layout.slotOffset, order);
+}
+
+template <typename KeyType, typename ValueType>
+void BPlusTree<KeyType, ValueType>::destroyNode(Node* node) {
+    /**
+     * @brief Destroys a single node (not its children) and returns its block to the arena.
      */
+    node->~Node();
+    arena.deallocate(node);
 }
 
 template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::~Node() {
+void BPlusTree<KeyType, ValueType>::destroySubtree(Node* node) {
     /**
-     * @brief Destructor for a BPlusTree Node.
-     * Frees all dynamically allocated children if the node is an internal node.
+     * @brief Destroys a node and everything below it.
      */
-    if (!isLeaf) {
-        for (auto child : children) {
-            delete child;
+    if (!node) return;
+    if (!node->isLeaf) {
+        for (auto child : node->children) {
+            destroySubtree(child);
         }
     }
+    destroyNode(node);
 }
 
 template <typename KeyType, typename ValueType>
@@ -151,7 +190,7 @@ void BPlusTree<KeyType, ValueType>::splitLeaf(Node* leaf) {
     int mid = (order + 1) / 2;
 
     // Create a new leaf node
-    Node* newLeaf = new Node(true);
+    Node* newLeaf = createNode(true);
     newLeaf->next = leaf->next;
     leaf->next = newLeaf;
 
@@ -167,7 +206,7 @@ void BPlusTree<KeyType, ValueType>::splitLeaf(Node* leaf) {
 
     if (leaf == root) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(newKey);
         newRoot->children.push_back(leaf);
         newRoot->children.push_back(newLeaf);
@@ -211,7 +250,7 @@ void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
     int mid = (int)internal->keys.size() / 2;
 
     // Create a new internal node
-    Node* newInternal = new Node(false);
+    Node* newInternal = createNode(false);
 
     // Promote the middle key
     KeyType upKey = internal->keys[mid];
@@ -226,7 +265,7 @@ void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
 
     if (internal == root) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(upKey);
         newRoot->children.push_back(internal);
         newRoot->children.push_back(newInternal);
@@ -384,7 +423,7 @@ void BPlusTree<KeyType, ValueType>::remove(const KeyType& key) {
 
     // If the leaf node is the root, and it's empty, update the root
     if (leaf == root && leaf->keys.empty()) {
-        delete root;
+        destroyNode(root);
         root = nullptr;
         return;
     }
@@ -495,12 +534,12 @@ void BPlusTree<KeyType, ValueType>::mergeLeaf(Node* left, Node* right, Node* par
     // Remove right sibling
     parent->keys.erase(parent->keys.begin() + index);
     parent->children.erase(parent->children.begin() + index + 1);
-    delete right;
+    destroyNode(right);
 
     // Handle parent underflow
     if (parent == root && parent->keys.empty()) {
         root = left;
-        delete parent;
+        destroyNode(parent);
     } else if ((int)parent->keys.size() < (order - 1) / 2) {
         // Implement further underflow handling for internal nodes if needed
     }
@@ -5,73 +5,578 @@
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
-
-template <typename KeyType, typename ValueType>
+#include <limits>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <random>
+#include <cmath>
+#include <type_traits>
+#include <deque>
+#include "NodeArena.h"
+#include "KeySearch.h"
+#include "Snapshot.h"
+#include "Epoch.h"
+
+// Order = 0 takes the order at run time. A non-zero Order fixes it at compile time:
+// node capacities, split points and fill limits become constants, and node searches
+// run a fixed number of unrolled steps (see KeySearch). withTreeOrder() picks the
+// fixed variant for an order known only at run time.
+template <typename KeyType, typename ValueType, int Order = 0>
 class BPlusTree {
+    static_assert(Order == 0 || Order >= 3, "Order must be at least 3");
+
 public:
 
-    // Node structure
+    // Node structure. The arrays live inline in the node's arena block, right
+    // after this header, with capacities fixed by the tree order.
     struct Node {
         bool isLeaf;
-        std::vector<KeyType> keys;
-        std::vector<Node*> children; // Used if internal node
-        // For leaf nodes, we store a vector of vectors of values:
-        std::vector<std::vector<ValueType>> values;  // Used if leaf node
+        FixedArray<KeyType> keys;
+        FixedArray<Node*> children; // Used if internal node
+        // For leaf nodes, the values of all keys are stored back to back in one
+        // array. Key i owns values[valueBegin(i), valueEnds[i]).
+        FixedArray<int> valueEnds;      // Used if leaf node
+        std::vector<ValueType> values;  // Used if leaf node
         Node* next;  // Pointer to next leaf node
-        int subtree_size; // NEW: number of total values in this node's subtree
+        // Number of values in this node's subtree. Atomic because in concurrent
+        // mode readers sum the sizes of children they have not latched.
+        std::atomic<int> subtree_size;
+        mutable NodeLatch latch; // Used in concurrent mode
+        uint64_t stamp; // The write that created the node, in versioned mode
+
+        Node(bool leaf, void* keyStorage, void* slotStorage, int capacity);
+
+        int valueBegin(int i) const { return i == 0 ? 0 : valueEnds[i - 1]; }
+    };
+
+    // Read-only view of the values of one key. It points into the key's leaf
+    // and is invalidated by the next modification of the tree (one taken from a
+    // Version stays valid as long as the Version).
+    struct Postings {
+        const ValueType* first;
+        const ValueType* last;
+
+        const ValueType* begin() const { return first; }
+        const ValueType* end() const { return last; }
+        size_t size() const { return (size_t)(last - first); }
+        bool empty() const { return first == last; }
+        const ValueType& operator[](size_t i) const { return first[i]; }
+    };
 
-        Node(bool leaf);
-        ~Node();
+private:
+
+    // What a read holds while it runs: the structure lock in concurrent mode, a pin on
+    // the version it reads in versioned mode. `top` is that version's root; nullptr
+    // means the live root, latched as the read descends.
+    struct ReadScope {
+        std::shared_lock<std::shared_mutex> structure;
+        EpochManager::Guard pin;
+        Node* top = nullptr;
     };
 
+    // Visits the leaves in key order, starting from the one where a key belongs.
+    // Outside versioned mode it follows the `next` links, lock-coupled in concurrent
+    // mode. Versioned mode cannot keep those links current (the left neighbour of a
+    // copied leaf still points at the original), so the walk keeps its path from the
+    // root and climbs to the nearest subtree on the right instead.
+    class LeafWalk {
+    public:
+        // Descends from top (the live root if nullptr) to the leaf where *key belongs,
+        // or to the leftmost leaf if key is nullptr, and holds it latched shared
+        LeafWalk(const BPlusTree* tree, Node* top, const KeyType* key) : tree(tree), descended(1) {
+            Node* node = tree->latchFrom(top);
+            while (!node->isLeaf) {
+                int i = key ? upperIndex(node, *key) : 0;
+                Node* child = node->children[i];
+                tree->latchShared(child);
+                tree->unlatchShared(node);
+                if (tree->versioned) {
+                    path.push_back({node, i});
+                }
+                node = child;
+                descended++;
+            }
+            leaf = node;
+        }
+
+        LeafWalk(LeafWalk&& other) noexcept
+            : tree(other.tree), leaf(other.leaf), descended(other.descended), path(std::move(other.path)) {
+            other.leaf = nullptr;
+        }
+        LeafWalk& operator=(LeafWalk&& other) noexcept {
+            if (this != &other) {
+                release();
+                tree = other.tree;
+                leaf = other.leaf;
+                descended = other.descended;
+                path = std::move(other.path);
+                other.leaf = nullptr;
+            }
+            return *this;
+        }
+        ~LeafWalk() { release(); }
+
+        LeafWalk(const LeafWalk&) = delete;
+        LeafWalk& operator=(const LeafWalk&) = delete;
+
+        // The current leaf, nullptr past the last one
+        Node* current() const { return leaf; }
+
+        // Nodes the descent went through, root and leaf included
+        uint64_t nodesDescended() const { return descended; }
+
+        void advance() {
+            Node* nextLeaf = nullptr;
+            if (tree->versioned) {
+                while (!path.empty() && path.back().second + 1 >= (int)path.back().first->children.size()) {
+                    path.pop_back();
+                }
+                if (!path.empty()) {
+                    nextLeaf = path.back().first->children[++path.back().second];
+                    while (!nextLeaf->isLeaf) {
+                        path.push_back({nextLeaf, 0});
+                        nextLeaf = nextLeaf->children[0];
+                    }
+                }
+            } else {
+                nextLeaf = leaf->next;
+                if (nextLeaf) tree->latchShared(nextLeaf);
+            }
+            tree->unlatchShared(leaf);
+            leaf = nextLeaf;
+        }
+
+        void release() {
+            if (leaf) {
+                tree->unlatchShared(leaf);
+                leaf = nullptr;
+            }
+        }
+
+    private:
+        const BPlusTree* tree;
+        Node* leaf;
+        uint64_t descended;
+        std::vector<std::pair<Node*, int>> path; // versioned mode: the ancestors and the child taken
+    };
 
+public:
 
     BPlusTree(int order);
+
+    // Only for a fixed Order
+    template <int O = Order, typename = typename std::enable_if<(O > 0)>::type>
+    BPlusTree() : BPlusTree(O) {}
+
+    // Build the tree bottom-up from (key, value) pairs, see bulkLoad()
+    BPlusTree(int order, std::vector<std::pair<KeyType, ValueType>> entries, double fillFactor = 1.0);
+
     ~BPlusTree();
 
     Node* getRoot() const {
-        return root;
+        return root.load(std::memory_order_acquire);
+    }
+
+    // Concurrent mode: inserts and reads (search, counts, range queries) may run
+    // from any number of threads at once. Inserts latch-crab down the tree and only
+    // keep latches on the nodes a split can still reach; readers use lock coupling.
+    // remove() and bulkLoad() take the whole tree exclusively. Counts include every
+    // insert that finished before the call and possibly some that are in flight.
+    // Switch modes only while no other thread is using the tree.
+    void setConcurrent(bool enabled) {
+        if (enabled) {
+            setVersioned(false);
+        }
+        concurrent = enabled;
+    }
+
+    bool isConcurrent() const {
+        return concurrent;
+    }
+
+    // Versioned mode (instead of concurrent mode): a write copies every node it changes
+    // rather than changing it in place (path copying) and then publishes the new root
+    // with one atomic store. Reads take no lock and never wait: each one runs on the
+    // version published when it started, and snapshot() keeps a version readable for
+    // as long as it is held. Writes take turns. The nodes a write replaced are freed
+    // once no reader that started before it is still running (see EpochManager), so a
+    // long-held snapshot keeps the nodes changed since then alive.
+    // Switch modes only while no other thread is using the tree.
+    void setVersioned(bool enabled);
+
+    bool isVersioned() const {
+        return versioned;
     }
 
     // Insert a (key, value) pair
     void insert(const KeyType& key, const ValueType& value);
 
+    // Replace the contents of the tree with (key, value) pairs, packing nodes to fillFactor
+    void bulkLoad(std::vector<std::pair<KeyType, ValueType>> entries, double fillFactor = 1.0);
+
     // Remove all values associated with a key
     void remove(const KeyType& key);
 
+    // Remove one value from a key's postings (the key goes when its last value does).
+    // Returns false if the pair is not in the tree.
+    bool removeValue(const KeyType& key, const ValueType& value);
+
+    // Apply many changes under one exclusive hold of the tree: one occurrence of each
+    // pair of `removals` is removed (pairs not in the tree are skipped), then every pair
+    // of `insertions` is added. A batch that is large next to the tree is sorted and
+    // merged into the leaves in one pass. Returns the number of pairs removed.
+    int applyBatch(std::vector<std::pair<KeyType, ValueType>> removals,
+                   std::vector<std::pair<KeyType, ValueType>> insertions);
+
+    // Write the tree in a flat, pointer-free layout (sorted keys, value run ends,
+    // values) that load() rebuilds bottom-up without a single key comparison.
+    // KeyType and ValueType must be trivially copyable.
+    void save(std::ostream& out) const;
+    void save(const std::string& path) const;
+
+    // Replace the contents of the tree with a saved one (the tree keeps its own order)
+    void load(std::istream& in);
+    void load(const std::string& path);
+
     // Returns the first value associated with the key (if any)
-    ValueType search(const KeyType& key) const;
+    ValueType search(const KeyType& key) const {
+        return search(beginRead(), key);
+    }
 
-    // Returns a pointer to the vector of values associated with the key or nullptr if not found
-    const std::vector<ValueType>* searchAll(const KeyType& key) const;
+    // Returns the values associated with the key (empty if not found). In concurrent
+    // or versioned mode the view is only stable while no write runs; take it from a
+    // snapshot() to keep it.
+    Postings searchAll(const KeyType& key) const {
+        return searchAll(beginRead(), key);
+    }
 
     // Traverse and print keys for debugging
     void traverse() const;
 
     // Count how many keys are ≤ x
-    int countLessOrEqual(const KeyType& x) const;
+    int countLessOrEqual(const KeyType& x) const {
+        return countLessOrEqual(beginRead(), x);
+    }
+
+    // Count how many keys are < x
+    int countLess(const KeyType& x) const {
+        return countLess(beginRead(), x);
+    }
+
+    // Count how many keys are in [Smin, Smax]. Both bounds are read from one scope,
+    // so in versioned mode the count is exact for the version it reads. In plain
+    // concurrent mode it is approximate: the bounds are separate descents, and an
+    // insert running alongside may be seen by one only.
+    int countInRange(const KeyType& Smin, const KeyType& Smax) const {
+        return countInRange(beginRead(), Smin, Smax);
+    }
+
+    // Work done by reads since construction or resetReadStats(). The counters are
+    // relaxed atomics bumped once per call, so concurrent readers share them without
+    // waiting on each other.
+    struct ReadStats {
+        uint64_t counts;        // countLess, countLessOrEqual and countInRange calls
+        uint64_t rangeScans;    // rangeQuery, forEachInRange and range() calls
+        uint64_t nodesVisited;  // nodes the counts and range scans latched on their way
+        uint64_t valuesScanned; // values rangeQuery and forEachInRange returned or offered
+    };
+
+    ReadStats readStats() const {
+        const std::memory_order relaxed = std::memory_order_relaxed;
+        return ReadStats{statCounts.load(relaxed), statRangeScans.load(relaxed),
+                         statNodes.load(relaxed), statValues.load(relaxed)};
+    }
 
-    // Count how many keys are in [Smin, Smax]
-    int countInRange(const KeyType& Smin, const KeyType& Smax) const;
+    void resetReadStats() {
+        statCounts = 0;
+        statRangeScans = 0;
+        statNodes = 0;
+        statValues = 0;
+    }
+
+    // Number of values in the tree
+    int size() const {
+        if (versioned) {
+            return snapshot().size();
+        }
+        return getRoot()->subtree_size;
+    }
+
+    // The i-th value in key order (0-based; values of one key in insertion order),
+    // found in O(log n) from the subtree sizes. Throws std::out_of_range if i >= size().
+    ValueType select(int i) const {
+        return select(beginRead(), i);
+    }
+
+    // n values drawn uniformly, with replacement, from those with keys in [Smin, Smax]
+    // (empty if there are none), in O(n log N)
+    template <typename Rng>
+    std::vector<ValueType> sampleInRange(const KeyType& Smin, const KeyType& Smax, int n, Rng& rng) const {
+        return sampleInRange(beginRead(), Smin, Smax, n, rng);
+    }
+    std::vector<ValueType> sampleInRange(const KeyType& Smin, const KeyType& Smax, int n) const {
+        std::mt19937_64 rng(std::random_device{}());
+        return sampleInRange(Smin, Smax, n, rng);
+    }
 
     // Range query: return all values associated with keys in [Smin, Smax]
-    std::vector<ValueType> rangeQuery(const KeyType& Smin, const KeyType& Smax) const; 
+    std::vector<ValueType> rangeQuery(const KeyType& Smin, const KeyType& Smax) const {
+        return rangeQuery(beginRead(), Smin, Smax);
+    }
+
+    // Calls fn(key, postings) for each key in [Smin, Smax] in ascending order, with the
+    // key's values viewed in place in its leaf, until fn returns false. Nothing is
+    // copied. In concurrent mode the current leaf stays latched while fn runs, so fn
+    // must not modify the tree.
+    template <typename Fn>
+    void forEachInRange(const KeyType& Smin, const KeyType& Smax, Fn fn) const {
+        forEachInRange(beginRead(), Smin, Smax, fn);
+    }
+
+    // Forward cursor over the keys in [Smin, Smax], walking the leaves lazily:
+    //     for (auto c = tree.range(a, b); c.valid(); c.next()) use(c.key(), c.values());
+    // In concurrent mode it holds the tree shared and its current leaf latched until it
+    // reaches the end or is destroyed; do not modify the tree while one is alive. In
+    // versioned mode it reads the version current when it was created, and writes may
+    // go on meanwhile.
+    class RangeCursor {
+    public:
+        RangeCursor(RangeCursor&&) noexcept = default;
+        RangeCursor& operator=(RangeCursor&&) noexcept = default;
+
+        RangeCursor(const RangeCursor&) = delete;
+        RangeCursor& operator=(const RangeCursor&) = delete;
+
+        bool valid() const { return walk.current() != nullptr; }
+        const KeyType& key() const { return walk.current()->keys[index]; }
+        Postings values() const {
+            const Node* leaf = walk.current();
+            const ValueType* data = leaf->values.data();
+            return Postings{data + leaf->valueBegin(index), data + leaf->valueEnds[index]};
+        }
+
+        // Moves to the next key in range (the cursor becomes invalid past Smax)
+        void next() {
+            index++;
+            settle();
+        }
+
+    private:
+        friend class BPlusTree;
+
+        const BPlusTree* tree;
+        ReadScope scope;
+        LeafWalk walk; // nullptr once exhausted
+        int index;     // current key in the walk's leaf
+        int end;       // first key of that leaf beyond Smax
+        KeyType Smax;
+
+        RangeCursor(const BPlusTree* tree, ReadScope readScope, const KeyType& Smin, const KeyType& Smax)
+            : tree(tree), scope(std::move(readScope)), walk(tree, scope.top, &Smin), Smax(Smax) {
+            tree->statRangeScans.fetch_add(1, std::memory_order_relaxed);
+            tree->statNodes.fetch_add(walk.nodesDescended(), std::memory_order_relaxed);
+            index = lowerIndex(walk.current(), Smin);
+            end = upperIndex(walk.current(), Smax);
+            settle();
+        }
+
+        // Advances to the next leaf while the current one has no key left in range
+        void settle() {
+            while (walk.current() != nullptr && index >= end) {
+                if (end < (int)walk.current()->keys.size()) {
+                    walk.release(); // the next key is beyond Smax
+                    break;
+                }
+                walk.advance();
+                if (walk.current()) {
+                    tree->statNodes.fetch_add(1, std::memory_order_relaxed);
+                    index = 0;
+                    end = upperIndex(walk.current(), Smax);
+                }
+            }
+            if (walk.current() == nullptr) {
+                // Done: let writers in, or let the version go
+                scope = ReadScope();
+            }
+        }
+    };
+
+    RangeCursor range(const KeyType& Smin, const KeyType& Smax) const {
+        return RangeCursor(this, beginRead(), Smin, Smax);
+    }
+
+    // The tree as it was when snapshot() was called, unaffected by later writes: the
+    // reads above on one consistent, immutable version. It takes no lock, so holding
+    // it never delays a writer, but it keeps the nodes written since alive until it is
+    // destroyed. Versioned mode only (throws std::logic_error otherwise).
+    class Version {
+    public:
+        int size() const { return scope.top->subtree_size; }
+        ValueType search(const KeyType& key) const { return tree->search(scope, key); }
+        Postings searchAll(const KeyType& key) const { return tree->searchAll(scope, key); }
+        int countLessOrEqual(const KeyType& x) const { return tree->countLessOrEqual(scope, x); }
+        int countLess(const KeyType& x) const { return tree->countLess(scope, x); }
+        int countInRange(const KeyType& Smin, const KeyType& Smax) const {
+            return tree->countInRange(scope, Smin, Smax);
+        }
+        ValueType select(int i) const { return tree->select(scope, i); }
+        template <typename Rng>
+        std::vector<ValueType> sampleInRange(const KeyType& Smin, const KeyType& Smax, int n, Rng& rng) const {
+            return tree->sampleInRange(scope, Smin, Smax, n, rng);
+        }
+        std::vector<ValueType> rangeQuery(const KeyType& Smin, const KeyType& Smax) const {
+            return tree->rangeQuery(scope, Smin, Smax);
+        }
+        template <typename Fn>
+        void forEachInRange(const KeyType& Smin, const KeyType& Smax, Fn fn) const {
+            tree->forEachInRange(scope, Smin, Smax, fn);
+        }
+
+    private:
+        friend class BPlusTree;
+
+        const BPlusTree* tree;
+        ReadScope scope;
+
+        Version(const BPlusTree* tree, ReadScope scope) : tree(tree), scope(std::move(scope)) {}
+    };
+
+    Version snapshot() const {
+        if (!versioned) {
+            throw std::logic_error("snapshot() needs versioned mode, see setVersioned()");
+        }
+        return Version(this, beginRead());
+    }
 
 
 private:
     
 
-    Node* root;   // Root node of the B+ tree
-    int order;     // Maximum number of keys in a node
+    std::atomic<Node*> root;   // Root node of the B+ tree
+    int order;     // Maximum number of keys in a node, Order if that is fixed
+    NodeLayout layout; // Placement of the inline arrays in a node block
+    NodeArena arena;   // Per-tree slabs all nodes are allocated from
+
+    // Concurrency control
+    bool concurrent;                        // latches are taken only if set
+    mutable std::shared_mutex structureLock; // shared: insert and reads, exclusive: remove, bulkLoad
+                                            // (versioned mode: exclusive for every write)
+    std::mutex arenaMutex;                  // guards the arena against concurrent splits
+
+    // Versioned mode. `root` is the writer's working root; readers start from
+    // `published`, which a write only moves once its copies are complete.
+    bool versioned;
+    std::atomic<Node*> published;
+    uint64_t writeStamp;         // stamp of the nodes the running write creates
+    std::vector<Node*> replaced; // nodes the running write took out of the tree
+    std::deque<std::pair<uint64_t, std::vector<Node*>>> retired; // replaced nodes, by epoch
+    EpochManager epochs;
+
+    // See readStats()
+    mutable std::atomic<uint64_t> statCounts;
+    mutable std::atomic<uint64_t> statRangeScans;
+    mutable std::atomic<uint64_t> statNodes;
+    mutable std::atomic<uint64_t> statValues;
+
+    // Node latching, no-ops outside concurrent mode
+    void latchShared(const Node* node) const { if (concurrent) node->latch.lockShared(); }
+    void unlatchShared(const Node* node) const { if (concurrent) node->latch.unlockShared(); }
+    void latchExclusive(const Node* node) const { if (concurrent) node->latch.lock(); }
+    void unlatchExclusive(const Node* node) const { if (concurrent) node->latch.unlock(); }
+
+    // Latch the current root; retries if the root changes before the latch is held
+    Node* latchRootShared() const;
+    Node* latchRootExclusive() const;
+
+    std::shared_lock<std::shared_mutex> sharedStructure() const {
+        return concurrent ? std::shared_lock<std::shared_mutex>(structureLock)
+                          : std::shared_lock<std::shared_mutex>(structureLock, std::defer_lock);
+    }
+    std::unique_lock<std::shared_mutex> exclusiveStructure() {
+        return concurrent || versioned ? std::unique_lock<std::shared_mutex>(structureLock)
+                                       : std::unique_lock<std::shared_mutex>(structureLock, std::defer_lock);
+    }
+
+    ReadScope beginRead() const {
+        ReadScope scope;
+        if (versioned) {
+            scope.pin = epochs.pin();
+            scope.top = published.load();
+        } else {
+            scope.structure = sharedStructure();
+        }
+        return scope;
+    }
+
+    // The root a read in `scope` starts from, latched / not latched
+    Node* latchFrom(Node* top) const {
+        if (top == nullptr) {
+            return latchRootShared();
+        }
+        latchShared(top);
+        return top;
+    }
+    Node* rootOf(const ReadScope& scope) const {
+        return scope.top ? scope.top : getRoot();
+    }
+
+    // Versioned mode: the root, or child i of a node the running write already owns,
+    // ready to be changed. A node of the published version is first replaced by a copy,
+    // so a write copies each node at most once however many times it changes it.
+    // Outside versioned mode the node itself.
+    Node* writableRoot();
+    Node* writableChild(Node* parent, int i);
+    Node* copyNode(const Node* node);
+
+    // Ends a write in versioned mode: publishes the working root and retires the nodes
+    // the write replaced, freeing those no reader can reach any more
+    void publish();
+    void reclaim(uint64_t oldestPinned);
+
+    // The order, a constant when it is fixed at compile time
+    int nodeOrder() const { return Order > 0 ? Order : order; }
+
+    // True if inserting one value below the node cannot split it
+    bool insertSafe(const Node* node) const {
+        if (node->isLeaf) {
+            return (int)node->keys.size() < nodeOrder() - 1 && (int)node->values.size() < maxLeafValues();
+        }
+        return (int)node->keys.size() < nodeOrder() - 1;
+    }
+
+    // Node allocation. In versioned mode destroyNode() only retires the node (see
+    // publish()); freeNode() releases it at once.
+    Node* createNode(bool leaf);
+    void destroyNode(Node* node);
+    void freeNode(Node* node);
+    void destroySubtree(Node* node);
 
     // Helper functions
-    void insertInternal(const KeyType& key, Node* current, Node* child);
+    // `path` holds the ancestors of the node being modified (root first), as
+    // recorded during the descent, so no operation has to search for a parent.
+    void insertUnlocked(const KeyType& key, const ValueType& value);
+    void insertInternal(const KeyType& key, Node* current, Node* child, std::vector<Node*>& path);
     void removeInternal(const KeyType& key, Node* current, Node* child);
-    Node* findParent(Node* current, Node* child);
+
+    // Removal shared by remove() and removeValue(): descends to the key's leaf, recording
+    // the path, erases the values findValues picks from the key's run (and the key if
+    // that empties it), then rebalances. The caller holds the tree exclusively.
+    template <typename FindValues>
+    bool eraseFromKey(const KeyType& key, FindValues findValues);
+
+    // Restores the minimum fill of an underflowing leaf and then of its ancestors,
+    // borrowing from a sibling or merging with one, and shrinks the root when it is
+    // left with a single child. `path` holds the leaf's ancestors, root first.
+    void rebalanceAfterRemove(Node* leaf, std::vector<Node*>& path);
 
     // Utility functions for splitting and merging nodes
-    void splitLeaf(Node* leaf);
-    void splitInternal(Node* internal);
+    void splitLeaf(Node* leaf, std::vector<Node*>& path);
+    void splitInternal(Node* internal, std::vector<Node*>& path);
     void mergeLeaf(Node* left, Node* right, Node* parent, int index);
     void mergeInternal(Node* left, Node* right, Node* parent, int index);
     void borrowFromLeftLeaf(Node* leaf, Node* leftSibling, Node* parent, int index);
@@ -81,66 +586,280 @@ private:
 
     // Subtree size maintenance
     void updateSubtreeSize(Node* node);
-    void updateSubtreeSizesUpwards(Node* node);
+    void adjustSubtreeSizes(const std::vector<Node*>& path, int delta);
 
-    // Counting
-    int countLessOrEqualRecursive(Node* node, const KeyType& x) const;
+    // Adds delta to the value run ends of a leaf, from key index `from` on
+    void shiftValueEnds(Node* leaf, int from, int delta);
+
+    // Position of x among a node's keys: first key > x / first key >= x
+    static int upperIndex(const Node* node, const KeyType& x) {
+        return KeySearch<KeyType, Order>::upperBound(node->keys.data(), (int)node->keys.size(), x);
+    }
+    static int lowerIndex(const Node* node, const KeyType& x) {
+        return KeySearch<KeyType, Order>::lowerBound(node->keys.data(), (int)node->keys.size(), x);
+    }
+
+    // Number of values beyond which a leaf with several keys is split
+    int maxLeafValues() const { return 4 * nodeOrder(); }
+
+    // Fill of the nodes applyBatch() rebuilds, leaving room for the inserts that follow
+    static constexpr double MergeFillFactor = 0.75;
+
+    // Builds the tree over distinct sorted keys, where key i owns the values
+    // valueAt(ends[i - 1]) .. valueAt(ends[i] - 1). The caller holds the structure lock.
+    template <typename ValueAt>
+    void buildFromRuns(const std::vector<KeyType>& keys, const std::vector<size_t>& ends,
+                       ValueAt valueAt, double fillFactor);
+
+    // Counting from top (see ReadScope), without taking the structure lock: keys <= x,
+    // or keys < x if Strict
+    template <bool Strict = false>
+    int countLessOrEqualUnlocked(const KeyType& x, Node* top) const;
+    ValueType selectUnlocked(int i, Node* top) const;
+
+    // The reads, within a scope from beginRead() or a Version's
+    ValueType search(const ReadScope& scope, const KeyType& key) const;
+    Postings searchAll(const ReadScope& scope, const KeyType& key) const;
+    int countLessOrEqual(const ReadScope& scope, const KeyType& x) const;
+    int countLess(const ReadScope& scope, const KeyType& x) const;
+    int countInRange(const ReadScope& scope, const KeyType& Smin, const KeyType& Smax) const;
+    ValueType select(const ReadScope& scope, int i) const;
+    template <typename Rng>
+    std::vector<ValueType> sampleInRange(const ReadScope& scope, const KeyType& Smin, const KeyType& Smax,
+                                         int n, Rng& rng) const;
+    std::vector<ValueType> rangeQuery(const ReadScope& scope, const KeyType& Smin, const KeyType& Smax) const;
+    template <typename Fn>
+    void forEachInRange(const ReadScope& scope, const KeyType& Smin, const KeyType& Smax, Fn fn) const;
 };
 
-#endif // BPLUSTREE2_H
 
 
 
 
-template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::BPlusTree(int order) : root(nullptr), order(order) {
+template <typename KeyType, typename ValueType, int Order>
+BPlusTree<KeyType, ValueType, Order>::BPlusTree(int order)
+    : root(nullptr), order(order),
+      layout(NodeLayout::make<Node, KeyType, Node*, int>(std::max(order, 3))),
+      arena(layout.blockSize), concurrent(false), versioned(false), published(nullptr), writeStamp(1),
+      statCounts(0), statRangeScans(0), statNodes(0), statValues(0) {
 
     /**
      * @brief Constructor for BPlusTree.
      * @param order Maximum number of keys in a node. Must be at least 3.
-     * @throws std::invalid_argument if order is less than 3.
+     * @throws std::invalid_argument if order is less than 3, or differs from a fixed Order.
      */
 
     if (order < 3) {
         throw std::invalid_argument("Order must be at least 3");
     }
+    if (Order > 0 && order != Order) {
+        throw std::invalid_argument("Order " + std::to_string(order) + " does not match the tree's fixed order " +
+                                    std::to_string(Order));
+    }
     // Create an empty root node
-    root = new Node(true);
-    updateSubtreeSize(root); // Initially empty
+    root = createNode(true);
+    updateSubtreeSize(root.load()); // Initially empty
+}
+
+
+
+template <typename KeyType, typename ValueType, int Order>
+BPlusTree<KeyType, ValueType, Order>::BPlusTree(int order, std::vector<std::pair<KeyType, ValueType>> entries, double fillFactor)
+    : BPlusTree(order) {
+
+    /**
+     * @brief Constructor that bulk-loads the tree from a set of key-value pairs.
+     * @param order Maximum number of keys in a node. Must be at least 3.
+     * @param entries The key-value pairs, in any order.
+     * @param fillFactor Fraction of each node's capacity to fill, in (0, 1].
+     * @throws std::invalid_argument if order is less than 3 or fillFactor is out of range.
+     */
+
+    bulkLoad(std::move(entries), fillFactor);
 }
 
 
 
-template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::~BPlusTree() {
+template <typename KeyType, typename ValueType, int Order>
+BPlusTree<KeyType, ValueType, Order>::~BPlusTree() {
     /**
     * @brief Destructor for BPlusTree.
     */
-    delete root;
+    versioned = false;
+    reclaim(std::numeric_limits<uint64_t>::max());
+    destroySubtree(root);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+BPlusTree<KeyType, ValueType, Order>::Node::Node(bool leaf, void* keyStorage, void* slotStorage, int capacity)
+    : isLeaf(leaf),
+      keys(keyStorage, capacity),
+      children(leaf ? nullptr : slotStorage, leaf ? 0 : capacity + 1),
+      valueEnds(leaf ? slotStorage : nullptr, leaf ? capacity : 0),
+      next(nullptr), subtree_size(0), stamp(0) {
+}
+
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::createNode(bool leaf) {
+    /**
+     * @brief Allocates a node and its inline arrays from the tree's arena.
+     * @param leaf Whether the node is a leaf.
+     * @return The new, empty node.
+     */
+    char* block;
+    if (concurrent) {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        block = static_cast<char*>(arena.allocate());
+    } else {
+        block = static_cast<char*>(arena.allocate());
+    }
+    Node* node = new (block) Node(leaf, block + layout.keyOffset, block + layout.slotOffset, nodeOrder());
+    node->stamp = writeStamp;
+    return node;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::destroyNode(Node* node) {
+    /**
+     * @brief Destroys a single node (not its children) and returns its block to the arena.
+     *        In versioned mode the node may still be part of a version a reader holds,
+     *        so it is only handed to publish() to retire.
+     * @param node The node to destroy.
+     */
+    if (versioned) {
+        replaced.push_back(node);
+        return;
+    }
+    freeNode(node);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::freeNode(Node* node) {
+    node->~Node();
+    if (concurrent) {
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        arena.deallocate(node);
+    } else {
+        arena.deallocate(node);
+    }
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::destroySubtree(Node* node) {
+    /**
+     * @brief Destroys a node and everything below it.
+     * @param node The root of the subtree.
+     */
+    if (!node) return;
+    if (!node->isLeaf) {
+        for (auto child : node->children) {
+            destroySubtree(child);
+        }
+    }
+    destroyNode(node);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::setVersioned(bool enabled) {
+    /**
+     * @brief Enters or leaves versioned mode, see the declaration. Leaving it frees
+     *        every retired node, so no snapshot may be alive then.
+     */
+    if (enabled == versioned) {
+        return;
+    }
+    if (enabled) {
+        concurrent = false;
+        // The nodes so far make up the first published version
+        writeStamp++;
+        published.store(root.load());
+    } else {
+        reclaim(std::numeric_limits<uint64_t>::max());
+        published.store(nullptr);
+        // Copies kept the next links of the nodes they replaced, which versioned reads
+        // never follow; point them at the current leaves again
+        Node* previous = nullptr;
+        for (LeafWalk walk(this, getRoot(), nullptr); walk.current() != nullptr; walk.advance()) {
+            if (previous) previous->next = walk.current();
+            previous = walk.current();
+        }
+        previous->next = nullptr;
+    }
+    versioned = enabled;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::writableRoot() {
+    Node* node = root;
+    if (versioned && node->stamp != writeStamp) {
+        Node* copy = copyNode(node);
+        replaced.push_back(node);
+        root = copy;
+        return copy;
+    }
+    return node;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::writableChild(Node* parent, int i) {
+    Node* node = parent->children[i];
+    if (versioned && node->stamp != writeStamp) {
+        // The parent is already the write's own, so the copy takes the original's place
+        Node* copy = copyNode(node);
+        replaced.push_back(node);
+        parent->children[i] = copy;
+        return copy;
+    }
+    return node;
 }
 
-template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::Node(bool leaf) : isLeaf(leaf), next(nullptr), subtree_size(0) {
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::copyNode(const Node* node) {
+    Node* copy = createNode(node->isLeaf);
+    copy->keys.assign(node->keys.begin(), node->keys.end());
+    copy->children.assign(node->children.begin(), node->children.end());
+    copy->valueEnds.assign(node->valueEnds.begin(), node->valueEnds.end());
+    copy->values = node->values;
+    copy->next = node->next;
+    copy->subtree_size = node->subtree_size.load();
+    return copy;
 }
 
-template <typename KeyType, typename ValueType>
-BPlusTree<KeyType, ValueType>::Node::~Node() {
-    if (!isLeaf) {
-        for (auto child : children) {
-            delete child;
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::publish() {
+    /**
+     * @brief Makes the working root the published one. A reader that still loads the
+     *        old root pinned its epoch before this store, so it holds oldestPinned() at
+     *        or below the epoch the replaced nodes are tagged with until it is done.
+     */
+    if (!versioned) {
+        return;
+    }
+    published.store(root.load());
+    uint64_t closed = epochs.advance();
+    if (!replaced.empty()) {
+        retired.emplace_back(closed, std::move(replaced));
+        replaced.clear();
+    }
+    reclaim(epochs.oldestPinned());
+    writeStamp++;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::reclaim(uint64_t oldestPinned) {
+    while (!retired.empty() && retired.front().first < oldestPinned) {
+        for (Node* node : retired.front().second) {
+            freeNode(node);
         }
+        retired.pop_front();
     }
 }
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::updateSubtreeSize(Node* node) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::updateSubtreeSize(Node* node) {
     if (!node) return;
     if (node->isLeaf) {
-        int count = 0;
-        for (auto &valVec : node->values) {
-            count += (int)valVec.size();
-        }
-        node->subtree_size = count;
+        node->subtree_size = (int)node->values.size();
     } else {
         int count = 0;
         for (auto child : node->children) {
@@ -150,23 +869,62 @@ void BPlusTree<KeyType, ValueType>::updateSubtreeSize(Node* node) {
     }
 }
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::updateSubtreeSizesUpwards(Node* node) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::shiftValueEnds(Node* leaf, int from, int delta) {
+    for (int i = from; i < (int)leaf->valueEnds.size(); i++) {
+        leaf->valueEnds[i] += delta;
+    }
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::adjustSubtreeSizes(const std::vector<Node*>& path, int delta) {
+    /**
+     * @brief Adds delta to the subtree size of every node on a root-to-node path.
+     * @param path The nodes recorded during the descent.
+     * @param delta The number of values added (positive) or removed (negative).
+     */
+    for (Node* node : path) {
+        node->subtree_size += delta;
+    }
+}
+
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::latchRootShared() const {
+    /**
+     * @brief Returns the root with a shared latch held on it (in concurrent mode).
+     *        The root only changes while a writer holds the old root exclusively, so
+     *        once the latch is held and the root is unchanged, it stays the root.
+     */
+    while (true) {
+        Node* node = root.load(std::memory_order_acquire);
+        latchShared(node);
+        if (!concurrent || node == root.load(std::memory_order_acquire)) {
+            return node;
+        }
+        unlatchShared(node);
+    }
+}
+
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Node* BPlusTree<KeyType, ValueType, Order>::latchRootExclusive() const {
     /**
-     * @brief Updates subtree sizes upwards from a given node to the root.
-     * @param node The starting node for the update.
+     * @brief Returns the root with an exclusive latch held on it (in concurrent mode).
      */
-    while (node != nullptr) {
-        updateSubtreeSize(node);
-        node = findParent(root, node);
+    while (true) {
+        Node* node = root.load(std::memory_order_acquire);
+        latchExclusive(node);
+        if (!concurrent || node == root.load(std::memory_order_acquire)) {
+            return node;
+        }
+        unlatchExclusive(node);
     }
 }
 
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::insert(const KeyType& key, const ValueType& value) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::insert(const KeyType& key, const ValueType& value) {
 
     /**
      * @brief Inserts a key-value pair into the B+ Tree.
@@ -174,107 +932,294 @@ void BPlusTree<KeyType, ValueType>::insert(const KeyType& key, const ValueType&
      * @param value The value associated with the key.
      */
 
-    Node* leaf = root;
+    if (versioned) {
+        auto structure = exclusiveStructure();
+        insertUnlocked(key, value);
+        publish();
+        return;
+    }
+    auto structure = sharedStructure();
+    insertUnlocked(key, value);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::insertUnlocked(const KeyType& key, const ValueType& value) {
+
+    /**
+     * @brief The insert itself, for callers already holding the structure lock.
+     */
+
+    Node* leaf = versioned ? writableRoot() : latchRootExclusive();
+    // Ancestors of the leaf that a split can still reach, root first. Once a child
+    // is known to absorb the insert without splitting, the nodes above it are done
+    // with and (in concurrent mode) their latches are released.
+    std::vector<Node*> path;
 
-    // Traverse the tree to find the appropriate leaf node
+    // Traverse the tree to find the appropriate leaf node. The new value ends up
+    // in every subtree on the way down, so sizes are counted during the descent.
     while (!leaf->isLeaf) {
-        int i = (int)(std::upper_bound(leaf->keys.begin(), leaf->keys.end(), key) - leaf->keys.begin());
-        leaf = leaf->children[i];
+        leaf->subtree_size++;
+        int i = upperIndex(leaf, key);
+        Node* child = writableChild(leaf, i);
+        latchExclusive(child);
+        path.push_back(leaf);
+        if (insertSafe(child)) {
+            for (Node* ancestor : path) {
+                unlatchExclusive(ancestor);
+            }
+            path.clear();
+        }
+        leaf = child;
     }
+    leaf->subtree_size++;
 
     // Insert the key and value into the leaf node
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-    int index = (int)(it - leaf->keys.begin());
+    int index = lowerIndex(leaf, key);
+    auto it = leaf->keys.begin() + index;
 
     if (it != leaf->keys.end() && *it == key) {
-        // Key already exists, append the value
-        leaf->values[index].push_back(value);
+        // Key already exists, append the value at the end of its run
+        leaf->values.insert(leaf->values.begin() + leaf->valueEnds[index], value);
     } else {
-        // Insert new key
+        // Insert new key, with a run holding just this value
+        int begin = leaf->valueBegin(index);
         leaf->keys.insert(it, key);
-        leaf->values.insert(leaf->values.begin() + index, std::vector<ValueType>{value});
+        leaf->valueEnds.insert(leaf->valueEnds.begin() + index, begin);
+        leaf->values.insert(leaf->values.begin() + begin, value);
+    }
+    shiftValueEnds(leaf, index, 1);
+
+    // Check for overflow and split if necessary. A leaf whose run of values
+    // grows too long is split as well, so inserts never shift unbounded arrays.
+    // Splitting consumes `path`, so keep the list of latched nodes aside.
+    std::vector<Node*> latched;
+    if (concurrent) {
+        latched = path;
+        latched.push_back(leaf);
+    }
+    if ((int)leaf->keys.size() >= nodeOrder() ||
+        ((int)leaf->values.size() > maxLeafValues() && leaf->keys.size() > 1)) {
+        splitLeaf(leaf, path);
+    }
+    for (Node* node : latched) {
+        unlatchExclusive(node);
+    }
+}
+
+
+
+
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::bulkLoad(std::vector<std::pair<KeyType, ValueType>> entries, double fillFactor) {
+
+    /**
+     * @brief Replaces the contents of the tree by building it bottom-up from key-value pairs.
+     *        Leaves are filled left to right, then each internal level is built over the
+     *        level below it, so every subtree size is computed exactly once.
+     * @param entries The key-value pairs. They are sorted by key if they are not already;
+     *                values sharing a key keep their relative order.
+     * @param fillFactor Fraction of each node's capacity to fill, in (0, 1]. Lower values
+     *                   leave room for later inserts before nodes have to split.
+     * @throws std::invalid_argument if fillFactor is out of range.
+     */
+
+    if (!(fillFactor > 0.0 && fillFactor <= 1.0)) {
+        throw std::invalid_argument("Fill factor must be in (0, 1]");
     }
+    auto structure = exclusiveStructure();
 
-    // Check for overflow and split if necessary
-    if ((int)leaf->keys.size() >= order) {
-        splitLeaf(leaf);
-    } else {
-        // Just update subtree sizes upwards
-        updateSubtreeSizesUpwards(leaf);
+    auto byKey = [](const std::pair<KeyType, ValueType>& a, const std::pair<KeyType, ValueType>& b) {
+        return a.first < b.first;
+    };
+    if (!std::is_sorted(entries.begin(), entries.end(), byKey)) {
+        std::stable_sort(entries.begin(), entries.end(), byKey);
+    }
+
+    // Find the distinct keys and where the run of values of each one ends
+    std::vector<KeyType> keys;
+    std::vector<size_t> ends;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (keys.empty() || keys.back() < entries[i].first) {
+            keys.push_back(entries[i].first);
+            ends.push_back(i);
+        }
+        ends.back() = i + 1;
+    }
+
+    buildFromRuns(keys, ends, [&entries](size_t i) -> ValueType&& {
+        return std::move(entries[i].second);
+    }, fillFactor);
+    publish();
+}
+
+template <typename KeyType, typename ValueType, int Order>
+template <typename ValueAt>
+void BPlusTree<KeyType, ValueType, Order>::buildFromRuns(const std::vector<KeyType>& keys, const std::vector<size_t>& ends,
+                                                  ValueAt valueAt, double fillFactor) {
+
+    /**
+     * @brief Replaces the contents of the tree, bottom-up, with the given runs of values.
+     *        Shared by bulkLoad() and load(). The new nodes are built aside and replace
+     *        the old tree at the end, which in versioned mode readers may still be on.
+     */
+
+    Node* old = root;
+    root = createNode(true);
+    if (keys.empty()) {
+        destroySubtree(old);
+        return;
+    }
+
+    // Splits `total` items into the fewest groups of at most `perNode` items,
+    // spreading them evenly so the last node is not left nearly empty. Internal
+    // nodes need two children, which may take one extra child per group.
+    auto groupSizes = [](size_t total, size_t perNode, size_t minPerNode) {
+        size_t groups = (total + perNode - 1) / perNode;
+        if (groups > 1 && total / groups < minPerNode) {
+            groups--;
+        }
+        std::vector<size_t> sizes(groups, total / groups);
+        for (size_t g = 0; g < total % groups; g++) {
+            sizes[g]++;
+        }
+        return sizes;
+    };
+
+    // A node splits once it holds `order` keys, so a full node has order - 1 keys
+    size_t keysPerLeaf = std::max<size_t>(1, (size_t)(fillFactor * (nodeOrder() - 1)));
+    size_t childrenPerNode = std::max<size_t>(2, (size_t)(fillFactor * nodeOrder()));
+
+    // Build the leaf level
+    std::vector<Node*> level;
+    std::vector<KeyType> lowKeys; // smallest key stored under each node of the level
+    size_t pos = 0;
+    Node* prev = nullptr;
+    for (size_t count : groupSizes(keys.size(), keysPerLeaf, 1)) {
+        Node* leaf = level.empty() ? root.load() : createNode(true);
+        size_t base = pos == 0 ? 0 : ends[pos - 1];
+        leaf->keys.assign(keys.begin() + pos, keys.begin() + pos + count);
+        for (size_t k = pos; k < pos + count; k++) {
+            leaf->valueEnds.push_back((int)(ends[k] - base));
+        }
+        leaf->values.reserve(ends[pos + count - 1] - base);
+        for (size_t i = base; i < ends[pos + count - 1]; i++) {
+            leaf->values.push_back(valueAt(i));
+        }
+        updateSubtreeSize(leaf);
+        if (prev) prev->next = leaf;
+        prev = leaf;
+        level.push_back(leaf);
+        lowKeys.push_back(keys[pos]);
+        pos += count;
+    }
+
+    // Build internal levels until a single root remains
+    while (level.size() > 1) {
+        std::vector<Node*> parents;
+        std::vector<KeyType> parentLowKeys;
+        pos = 0;
+        for (size_t count : groupSizes(level.size(), childrenPerNode, 2)) {
+            Node* parent = createNode(false);
+            parent->children.assign(level.begin() + pos, level.begin() + pos + count);
+            parent->keys.assign(lowKeys.begin() + pos + 1, lowKeys.begin() + pos + count);
+            updateSubtreeSize(parent);
+            parents.push_back(parent);
+            parentLowKeys.push_back(lowKeys[pos]);
+            pos += count;
+        }
+        level.swap(parents);
+        lowKeys.swap(parentLowKeys);
     }
+    root = level.front();
+    destroySubtree(old);
 }
 
 
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::splitLeaf(Node* leaf) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::splitLeaf(Node* leaf, std::vector<Node*>& path) {
 
     /**
-     * @brief Splits a leaf node into two when it exceeds the maximum allowed keys.
+     * @brief Splits a leaf node into two when it exceeds the maximum allowed keys
+     *        or values.
      * @param leaf The leaf node to be split.
+     * @param path The ancestors of the leaf, root first.
      */
     
-    int mid = (order + 1) / 2;
+    int mid = (nodeOrder() + 1) / 2;
+    if ((int)leaf->keys.size() < nodeOrder()) {
+        // Too many values: split at the key closest to the middle value
+        int half = (int)leaf->values.size() / 2;
+        mid = (int)(std::upper_bound(leaf->valueEnds.begin(), leaf->valueEnds.end(), half) - leaf->valueEnds.begin());
+        mid = std::max(1, std::min(mid, (int)leaf->keys.size() - 1));
+    }
 
     // Create a new leaf node
-    Node* newLeaf = new Node(true);
+    Node* newLeaf = createNode(true);
     newLeaf->next = leaf->next;
     leaf->next = newLeaf;
 
-    // Move half of the keys and values to the new leaf
+    // Move half of the keys and their runs of values to the new leaf
+    int cut = leaf->valueBegin(mid);
     newLeaf->keys.assign(leaf->keys.begin() + mid, leaf->keys.end());
-    newLeaf->values.assign(leaf->values.begin() + mid, leaf->values.end());
+    for (size_t i = mid; i < leaf->valueEnds.size(); i++) {
+        newLeaf->valueEnds.push_back(leaf->valueEnds[i] - cut);
+    }
+    newLeaf->values.assign(std::make_move_iterator(leaf->values.begin() + cut),
+                           std::make_move_iterator(leaf->values.end()));
 
     leaf->keys.resize(mid);
-    leaf->values.resize(mid);
+    leaf->valueEnds.resize(mid);
+    leaf->values.erase(leaf->values.begin() + cut, leaf->values.end());
 
     // Promote the first key of the new leaf to the parent
     KeyType newKey = newLeaf->keys.front();
 
-    updateSubtreeSize(leaf);
+    // The two halves still hold the same values, so ancestors keep their sizes
     updateSubtreeSize(newLeaf);
+    leaf->subtree_size -= newLeaf->subtree_size;
 
-    if (leaf == root) {
+    if (path.empty()) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(newKey);
         newRoot->children.push_back(leaf);
         newRoot->children.push_back(newLeaf);
         updateSubtreeSize(newRoot);
         root = newRoot;
-        updateSubtreeSizesUpwards(newRoot);
     } else {
         // Insert the new key into the parent node
-        Node* parent = findParent(root, leaf);
-        insertInternal(newKey, parent, newLeaf);
+        Node* parent = path.back();
+        path.pop_back();
+        insertInternal(newKey, parent, newLeaf, path);
     }
 }
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::insertInternal(const KeyType& key, Node* current, Node* child) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::insertInternal(const KeyType& key, Node* current, Node* child, std::vector<Node*>& path) {
 
     /**
      * @brief Inserts a key and child pointer into an internal node.
      * @param key The key to be inserted.
      * @param current The current internal node.
      * @param child The child pointer to be inserted.
+     * @param path The ancestors of the current node, root first.
      */
 
     // Find the position to insert the key
-    auto it = std::upper_bound(current->keys.begin(), current->keys.end(), key);
-    int index = (int)(it - current->keys.begin());
+    int index = upperIndex(current, key);
+    auto it = current->keys.begin() + index;
 
     // Insert the key and child pointer
     current->keys.insert(it, key);
     current->children.insert(current->children.begin() + index + 1, child);
 
     // Check for overflow and split if necessary
-    if ((int)current->keys.size() >= order) {
-        splitInternal(current);
-    } else {
-        updateSubtreeSizesUpwards(current);
+    if ((int)current->keys.size() >= nodeOrder()) {
+        splitInternal(current, path);
     }
 }
 
@@ -283,19 +1228,20 @@ void BPlusTree<KeyType, ValueType>::insertInternal(const KeyType& key, Node* cur
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::splitInternal(Node* internal, std::vector<Node*>& path) {
 
     /**
      * @brief Splits an internal node when it exceeds the allowed number of keys.
      * @param internal The internal node to be split.
+     * @param path The ancestors of the internal node, root first.
      */
 
 
     int mid = (int)internal->keys.size() / 2;
 
     // Create a new internal node
-    Node* newInternal = new Node(false);
+    Node* newInternal = createNode(false);
 
     // Promote the middle key
     KeyType upKey = internal->keys[mid];
@@ -308,53 +1254,23 @@ void BPlusTree<KeyType, ValueType>::splitInternal(Node* internal) {
     internal->keys.resize(mid);
     internal->children.resize(mid + 1);
 
-    updateSubtreeSize(internal);
     updateSubtreeSize(newInternal);
+    internal->subtree_size -= newInternal->subtree_size;
 
-    if (internal == root) {
+    if (path.empty()) {
         // Create a new root node
-        Node* newRoot = new Node(false);
+        Node* newRoot = createNode(false);
         newRoot->keys.push_back(upKey);
         newRoot->children.push_back(internal);
         newRoot->children.push_back(newInternal);
         updateSubtreeSize(newRoot);
         root = newRoot;
-        updateSubtreeSizesUpwards(newRoot);
     } else {
         // Insert the promoted key into the parent node
-        Node* parent = findParent(root, internal);
-        insertInternal(upKey, parent, newInternal);
-    }
-}
-
-
-
-
-
-template <typename KeyType, typename ValueType>
-typename BPlusTree<KeyType, ValueType>::Node* BPlusTree<KeyType, ValueType>::findParent(Node* current, Node* child) {
-    /**
-     * @brief Finds the parent node of a given child node.
-     * @param current The current node being inspected.
-     * @param child The child node whose parent is being searched for.
-     * @return The parent node, or nullptr if no parent exists.
-     */
-
-    if (current == nullptr || current->isLeaf) {
-        return nullptr;
+        Node* parent = path.back();
+        path.pop_back();
+        insertInternal(upKey, parent, newInternal, path);
     }
-
-    for (size_t i = 0; i < current->children.size(); ++i) {
-        if (current->children[i] == child) {
-            return current;
-        } else {
-            Node* parent = findParent(current->children[i], child);
-            if (parent != nullptr) {
-                return parent;
-            }
-        }
-    }
-    return nullptr;
 }
 
 
@@ -362,35 +1278,36 @@ typename BPlusTree<KeyType, ValueType>::Node* BPlusTree<KeyType, ValueType>::fin
 
 
 
-template <typename KeyType, typename ValueType>
-ValueType BPlusTree<KeyType, ValueType>::search(const KeyType& key) const {
+template <typename KeyType, typename ValueType, int Order>
+ValueType BPlusTree<KeyType, ValueType, Order>::search(const ReadScope& scope, const KeyType& key) const {
 
     /**
      * @brief Searches for the first value associated with a key.
      * @param key The key to search for.
      * @return The first value associated with the key, or a default value if the key is not found.
      */
-    Node* current = root;
-    if (!current) return ValueType();
+    Node* current = latchFrom(scope.top);
 
     // Traverse the tree to find the leaf node
-    while (current && !current->isLeaf) {
-        int i = (int)(std::upper_bound(current->keys.begin(), current->keys.end(), key) - current->keys.begin());
-        current = current->children[i];
+    while (!current->isLeaf) {
+        int i = upperIndex(current, key);
+        Node* child = current->children[i];
+        latchShared(child);
+        unlatchShared(current);
+        current = child;
     }
 
-    if (!current) return ValueType();
-
     // Search for the key in the leaf node
-    auto it = std::lower_bound(current->keys.begin(), current->keys.end(), key);
-    int index = (int)(it - current->keys.begin());
+    int index = lowerIndex(current, key);
+    auto it = current->keys.begin() + index;
 
+    ValueType result = ValueType();
     if (it != current->keys.end() && *it == key) {
         // Return the first value associated with this key
-        return current->values[index].empty() ? ValueType() : current->values[index].front();
-    } else {
-        return ValueType();
+        result = current->values[current->valueBegin(index)];
     }
+    unlatchShared(current);
+    return result;
 }
 
 
@@ -401,31 +1318,36 @@ ValueType BPlusTree<KeyType, ValueType>::search(const KeyType& key) const {
 
 
 
-template <typename KeyType, typename ValueType>
-const std::vector<ValueType>* BPlusTree<KeyType, ValueType>::searchAll(const KeyType& key) const {
+template <typename KeyType, typename ValueType, int Order>
+typename BPlusTree<KeyType, ValueType, Order>::Postings
+BPlusTree<KeyType, ValueType, Order>::searchAll(const ReadScope& scope, const KeyType& key) const {
     /**
      * @brief Searches for all values associated with a key.
      * @param key The key to search for.
-     * @return A pointer to a vector of values associated with the key, or nullptr if the key is not found.
+     * @return A view of the values associated with the key, empty if the key is not found.
      */
-    Node* current = root;
-    if (!current) return nullptr;
+    Node* current = latchFrom(scope.top);
 
     // Traverse the tree to find the leaf node
     while (!current->isLeaf) {
-        int i = (int)(std::upper_bound(current->keys.begin(), current->keys.end(), key) - current->keys.begin());
-        current = current->children[i];
+        int i = upperIndex(current, key);
+        Node* child = current->children[i];
+        latchShared(child);
+        unlatchShared(current);
+        current = child;
     }
 
     // Search for the key in the leaf node
-    auto it = std::lower_bound(current->keys.begin(), current->keys.end(), key);
-    int index = (int)(it - current->keys.begin());
+    int index = lowerIndex(current, key);
+    auto it = current->keys.begin() + index;
 
+    Postings result{nullptr, nullptr};
     if (it != current->keys.end() && *it == key) {
-        return &current->values[index];
-    } else {
-        return nullptr;
+        const ValueType* values = current->values.data();
+        result = Postings{values + current->valueBegin(index), values + current->valueEnds[index]};
     }
+    unlatchShared(current);
+    return result;
 }
 
 
@@ -434,31 +1356,25 @@ const std::vector<ValueType>* BPlusTree<KeyType, ValueType>::searchAll(const Key
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::traverse() const {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::traverse() const {
     /**
      * @brief Traverses the B+ Tree and prints the keys in leaf nodes for debugging purposes.
      */
 
 
-    if (!root) return;
-    Node* current = root;
-    // Go to the leftmost leaf
-    while (current && !current->isLeaf) {
-        current = current->children.front();
-    }
-
-    // Traverse through the leaf nodes
-    while (current != nullptr) {
+    ReadScope scope = beginRead();
+    // Start at the leftmost leaf and traverse through the leaf nodes
+    for (LeafWalk walk(this, scope.top, nullptr); walk.current() != nullptr; walk.advance()) {
+        const Node* current = walk.current();
         for (size_t i = 0; i < current->keys.size(); ++i) {
             std::cout << current->keys[i] << ":["; 
-            for (size_t j = 0; j < current->values[i].size(); j++) {
-                std::cout << current->values[i][j];
-                if (j+1 < current->values[i].size()) std::cout << ", ";
+            for (int j = current->valueBegin((int)i); j < current->valueEnds[i]; j++) {
+                std::cout << current->values[j];
+                if (j+1 < current->valueEnds[i]) std::cout << ", ";
             }
             std::cout << "] ";
         }
-        current = current->next;
     }
     std::cout << std::endl;
 }
@@ -470,96 +1386,379 @@ void BPlusTree<KeyType, ValueType>::traverse() const {
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::remove(const KeyType& key) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::save(std::ostream& out) const {
+
+    /**
+     * @brief Writes the tree as one "BPT4TREE" snapshot section: the distinct keys in
+     *        order, the end of each key's run of values, and the values. Node layout
+     *        and pointers are not stored, so the section does not depend on the order.
+     * @param out The stream to write to.
+     * @throws std::runtime_error if the stream fails.
+     */
+
+    ReadScope scope = beginRead();
+    std::vector<KeyType> keys;
+    std::vector<uint64_t> ends;
+    std::vector<ValueType> values;
+    values.reserve(rootOf(scope)->subtree_size);
+
+    for (LeafWalk walk(this, scope.top, nullptr); walk.current() != nullptr; walk.advance()) {
+        const Node* current = walk.current();
+        uint64_t base = values.size();
+        for (size_t i = 0; i < current->keys.size(); i++) {
+            keys.push_back(current->keys[i]);
+            ends.push_back(base + current->valueEnds[i]);
+        }
+        values.insert(values.end(), current->values.begin(), current->values.end());
+    }
+
+    snapshot::writeTag(out, "BPT4TREE");
+    snapshot::write<uint32_t>(out, sizeof(KeyType));
+    snapshot::write<uint32_t>(out, sizeof(ValueType));
+    snapshot::write<uint64_t>(out, keys.size());
+    snapshot::write<uint64_t>(out, values.size());
+    snapshot::writeArray(out, keys.data(), keys.size());
+    snapshot::writeArray(out, ends.data(), ends.size());
+    snapshot::writeArray(out, values.data(), values.size());
+    if (!out) {
+        throw std::runtime_error("Failed to write B+ tree snapshot");
+    }
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::save(const std::string& path) const {
+
+    /**
+     * @brief Writes the tree to a file, see save(std::ostream&).
+     */
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Cannot open " + path + " for writing");
+    }
+    save(out);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::load(std::istream& in) {
+
+    /**
+     * @brief Replaces the contents of the tree with a section written by save(). The
+     *        keys are already sorted and grouped, so the tree is built bottom-up as in
+     *        bulkLoad() without sorting or searching.
+     * @param in The stream to read from.
+     * @throws std::runtime_error if the section is malformed or stores other types.
+     */
+
+    snapshot::expectTag(in, "BPT4TREE");
+    if (snapshot::read<uint32_t>(in) != sizeof(KeyType) || snapshot::read<uint32_t>(in) != sizeof(ValueType)) {
+        throw std::runtime_error("B+ tree snapshot stores different key or value types");
+    }
+    uint64_t keyCount = snapshot::read<uint64_t>(in);
+    uint64_t valueCount = snapshot::read<uint64_t>(in);
+
+    std::vector<KeyType> keys(keyCount);
+    std::vector<uint64_t> storedEnds(keyCount);
+    std::vector<ValueType> values(valueCount);
+    snapshot::readArray(in, keys.data(), keys.size());
+    snapshot::readArray(in, storedEnds.data(), storedEnds.size());
+    snapshot::readArray(in, values.data(), values.size());
+
+    std::vector<size_t> ends(storedEnds.begin(), storedEnds.end());
+    for (size_t i = 0; i < keyCount; i++) {
+        size_t begin = i == 0 ? 0 : ends[i - 1];
+        if (ends[i] <= begin || ends[i] > valueCount || (i > 0 && !(keys[i - 1] < keys[i]))) {
+            throw std::runtime_error("Corrupt B+ tree snapshot");
+        }
+    }
+    if ((keyCount > 0 ? ends.back() : 0) != valueCount) {
+        throw std::runtime_error("Corrupt B+ tree snapshot");
+    }
+
+    auto structure = exclusiveStructure();
+    buildFromRuns(keys, ends, [&values](size_t i) -> ValueType& { return values[i]; }, 1.0);
+    publish();
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::load(const std::string& path) {
+
+    /**
+     * @brief Replaces the contents of the tree with one saved to a file.
+     */
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    load(in);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::remove(const KeyType& key) {
     /**
      * @brief Removes all values associated with a key from the B+ Tree.
      * @param key The key to be removed.
      */
-    if (!root) return;
+    auto structure = exclusiveStructure();
+    eraseFromKey(key, [](const ValueType*, const ValueType* end) {
+        return end; // the whole run
+    });
+    publish();
+}
+
+template <typename KeyType, typename ValueType, int Order>
+bool BPlusTree<KeyType, ValueType, Order>::removeValue(const KeyType& key, const ValueType& value) {
+    /**
+     * @brief Removes a single (key, value) pair, keeping the key's other values.
+     * @param key The key the value is stored under.
+     * @param value The value to remove (its first occurrence under the key).
+     * @return True if the pair was found and removed.
+     */
+    auto structure = exclusiveStructure();
+    bool removed = eraseFromKey(key, [&value](const ValueType* begin, const ValueType* end) {
+        const ValueType* it = std::find(begin, end, value);
+        return it == end ? nullptr : it;
+    });
+    publish();
+    return removed;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+int BPlusTree<KeyType, ValueType, Order>::applyBatch(std::vector<std::pair<KeyType, ValueType>> removals,
+                                              std::vector<std::pair<KeyType, ValueType>> insertions) {
+
+    /**
+     * @brief Removes and inserts a batch of pairs. Applying b changes one at a time costs
+     *        b descents; once b × log2(n) reaches the size n of the tree it is cheaper to
+     *        sort the batch and merge it with the leaves, which are read in key order, then
+     *        rebuild the tree bottom-up from the merged runs.
+     * @param removals Pairs to remove, one occurrence each, in any order.
+     * @param insertions Pairs to add, in any order; values sharing a key keep their order
+     *                   and follow the key's existing values.
+     * @return The number of pairs of @p removals that were found and removed.
+     */
+
+    auto structure = exclusiveStructure();
+    int removed = 0;
+    size_t n = (size_t)getRoot()->subtree_size;
+    size_t batch = removals.size() + insertions.size();
+    if (batch == 0) {
+        return 0;
+    }
+    if ((double)batch * std::log2((double)n + 2.0) < (double)n) {
+        for (const auto& pair : removals) {
+            removed += eraseFromKey(pair.first, [&pair](const ValueType* begin, const ValueType* end) {
+                const ValueType* it = std::find(begin, end, pair.second);
+                return it == end ? nullptr : it;
+            });
+        }
+        for (const auto& pair : insertions) {
+            insertUnlocked(pair.first, pair.second);
+        }
+        publish();
+        return removed;
+    }
+
+    auto byKey = [](const std::pair<KeyType, ValueType>& a, const std::pair<KeyType, ValueType>& b) {
+        return a.first < b.first;
+    };
+    std::stable_sort(removals.begin(), removals.end(), byKey);
+    std::stable_sort(insertions.begin(), insertions.end(), byKey);
+
+    std::vector<KeyType> keys;
+    std::vector<size_t> ends;
+    std::vector<ValueType> values;
+    values.reserve(n + insertions.size());
+    size_t nextRemoval = 0, nextInsertion = 0;
+    // Appends v to the run of key, starting a new run unless key is the last one
+    auto emit = [&](const KeyType& key, const ValueType& v) {
+        if (keys.empty() || keys.back() < key) {
+            keys.push_back(key);
+            ends.push_back(values.size());
+        }
+        values.push_back(v);
+        ends.back() = values.size();
+    };
+    auto emitInsertionsBelow = [&](const KeyType* bound) {
+        while (nextInsertion < insertions.size() &&
+               (bound == nullptr || insertions[nextInsertion].first < *bound)) {
+            emit(insertions[nextInsertion].first, insertions[nextInsertion].second);
+            nextInsertion++;
+        }
+    };
+
+    std::vector<ValueType> run;
+    for (LeafWalk walk(this, getRoot(), nullptr); walk.current() != nullptr; walk.advance()) {
+        const Node* leaf = walk.current();
+        for (int i = 0; i < (int)leaf->keys.size(); i++) {
+            const KeyType& key = leaf->keys[i];
+            emitInsertionsBelow(&key);
+            run.assign(leaf->values.begin() + leaf->valueBegin(i), leaf->values.begin() + leaf->valueEnds[i]);
+            while (nextRemoval < removals.size() && removals[nextRemoval].first < key) {
+                nextRemoval++; // key not in the tree
+            }
+            while (nextRemoval < removals.size() && !(key < removals[nextRemoval].first)) {
+                auto it = std::find(run.begin(), run.end(), removals[nextRemoval].second);
+                if (it != run.end()) {
+                    run.erase(it);
+                    removed++;
+                }
+                nextRemoval++;
+            }
+            for (const ValueType& v : run) {
+                emit(key, v);
+            }
+            // New values of an existing key go after the ones already there
+            while (nextInsertion < insertions.size() && !(key < insertions[nextInsertion].first)) {
+                emit(insertions[nextInsertion].first, insertions[nextInsertion].second);
+                nextInsertion++;
+            }
+        }
+    }
+    emitInsertionsBelow(nullptr);
+
+    buildFromRuns(keys, ends, [&values](size_t i) -> ValueType&& {
+        return std::move(values[i]);
+    }, MergeFillFactor);
+    publish();
+    return removed;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+template <typename FindValues>
+bool BPlusTree<KeyType, ValueType, Order>::eraseFromKey(const KeyType& key, FindValues findValues) {
+
+    /**
+     * @brief findValues(begin, end) is given the key's run of values and returns `end`
+     *        to erase all of it, a pointer to the one value to erase, or nullptr to
+     *        erase nothing.
+     * @return True if something was erased.
+     */
 
     Node* leaf = root;
-    // Traverse the tree to find the leaf node
+    // Traverse the tree to find the leaf node, remembering the ancestors
     std::vector<Node*> path;
+    std::vector<int> slots; // the child taken at each ancestor
     while (!leaf->isLeaf) {
         path.push_back(leaf);
-        int i = (int)(std::upper_bound(leaf->keys.begin(), leaf->keys.end(), key) - leaf->keys.begin());
-        leaf = leaf->children[i];
+        slots.push_back(upperIndex(leaf, key));
+        leaf = leaf->children[slots.back()];
     }
 
-    path.push_back(leaf);
-
     // Find the key in the leaf node
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-    int index = (int)(it - leaf->keys.begin());
-
+    int index = lowerIndex(leaf, key);
+    auto it = leaf->keys.begin() + index;
     if (it == leaf->keys.end() || *it != key) {
         // Key not found
-        return;
+        return false;
+    }
+
+    int begin = leaf->valueBegin(index);
+    int end = leaf->valueEnds[index];
+    const ValueType* values = leaf->values.data();
+    const ValueType* found = findValues(values + begin, values + end);
+    if (found == nullptr) {
+        return false;
+    }
+    int from = found == values + end ? begin : (int)(found - values);
+    int removed = found == values + end ? end - begin : 1;
+
+    if (versioned) {
+        // Only now that something goes, take the path over (see writableChild)
+        leaf = writableRoot();
+        for (size_t d = 0; d < path.size(); d++) {
+            path[d] = leaf;
+            leaf = writableChild(leaf, slots[d]);
+        }
     }
 
-    // Remove the key and all its associated values
-    leaf->keys.erase(it);
-    leaf->values.erase(leaf->values.begin() + index);
+    leaf->values.erase(leaf->values.begin() + from, leaf->values.begin() + from + removed);
+    if (removed == end - begin) {
+        // The key has no values left
+        leaf->keys.erase(leaf->keys.begin() + index);
+        leaf->valueEnds.erase(leaf->valueEnds.begin() + index);
+    }
+    shiftValueEnds(leaf, index, -removed);
+    leaf->subtree_size -= removed;
+    adjustSubtreeSizes(path, -removed);
+
+    rebalanceAfterRemove(leaf, path);
+    return true;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::rebalanceAfterRemove(Node* leaf, std::vector<Node*>& path) {
+
+    /**
+     * @brief Fixes underflows from the leaf up. Borrowing and merging only move values
+     *        between siblings, so the sizes of the ancestors are already correct.
+     */
 
-    // If the leaf node is the root, and it's empty, update the root
-    if (leaf == root && leaf->keys.empty()) {
-        delete root;
-        root = nullptr;
+    // An empty root leaf simply stays in place as the empty tree
+    int minKeys = (nodeOrder() - 1) / 2;
+    if (path.empty() || (int)leaf->keys.size() >= minKeys) {
         return;
     }
 
-    // Handle underflow
-    int minKeys = (order - 1) / 2;
-    if ((int)leaf->keys.size() < minKeys && leaf != root) {
-        Node* parent = nullptr;
-        int indexInParent = -1;
+    Node* parent = path.back();
+    int indexInParent = (int)(std::find(parent->children.begin(), parent->children.end(), leaf) - parent->children.begin());
 
-        // Find parent and index of leaf in parent's children
-        for (int i = (int)path.size() - 2; i >= 0; --i) {
-            parent = path[i];
-            for (size_t j = 0; j < parent->children.size(); ++j) {
-                if (parent->children[j] == leaf) {
-                    indexInParent = (int)j;
-                    break;
-                }
-            }
-            if (indexInParent != -1) break;
+    // Try to borrow from left sibling. Siblings are changed as well, so in versioned
+    // mode they are copied first like the path.
+    if (indexInParent > 0) {
+        Node* leftSibling = parent->children[indexInParent - 1];
+        if ((int)leftSibling->keys.size() > minKeys) {
+            borrowFromLeftLeaf(leaf, writableChild(parent, indexInParent - 1), parent, indexInParent);
+            return;
         }
+    }
 
-        // Try to borrow from left sibling
-        if (indexInParent > 0) {
-            Node* leftSibling = parent->children[indexInParent - 1];
-            if ((int)leftSibling->keys.size() > minKeys) {
-                borrowFromLeftLeaf(leaf, leftSibling, parent, indexInParent);
-                updateSubtreeSizesUpwards(leaf);
-                return;
-            }
+    // Try to borrow from right sibling
+    if (indexInParent < (int)parent->children.size() - 1) {
+        Node* rightSibling = parent->children[indexInParent + 1];
+        if ((int)rightSibling->keys.size() > minKeys) {
+            borrowFromRightLeaf(leaf, writableChild(parent, indexInParent + 1), parent, indexInParent);
+            return;
         }
+    }
 
-        // Try to borrow from right sibling
-        if (indexInParent < (int)parent->children.size() - 1) {
-            Node* rightSibling = parent->children[indexInParent + 1];
-            if ((int)rightSibling->keys.size() > minKeys) {
-                borrowFromRightLeaf(leaf, rightSibling, parent, indexInParent);
-                updateSubtreeSizesUpwards(leaf);
-                return;
-            }
-        }
+    // Merge with sibling
+    if (indexInParent > 0) {
+        mergeLeaf(writableChild(parent, indexInParent - 1), leaf, parent, indexInParent - 1);
+    } else if (indexInParent < (int)parent->children.size() - 1) {
+        mergeLeaf(leaf, writableChild(parent, indexInParent + 1), parent, indexInParent);
+    }
 
-        // Merge with sibling
-        if (indexInParent > 0) {
-            Node* leftSibling = parent->children[indexInParent - 1];
-            mergeLeaf(leftSibling, leaf, parent, indexInParent - 1);
-            updateSubtreeSizesUpwards(leftSibling);
-        } else if (indexInParent < (int)parent->children.size() - 1) {
-            Node* rightSibling = parent->children[indexInParent + 1];
-            mergeLeaf(leaf, rightSibling, parent, indexInParent);
-            updateSubtreeSizesUpwards(leaf);
+    // The parent lost a child; walk up while internal nodes underflow
+    path.pop_back();
+    Node* node = parent;
+    while (!path.empty() && (int)node->keys.size() < minKeys) {
+        parent = path.back();
+        path.pop_back();
+        int index = (int)(std::find(parent->children.begin(), parent->children.end(), node) - parent->children.begin());
+        if (index > 0 && (int)parent->children[index - 1]->keys.size() > minKeys) {
+            borrowFromLeftInternal(node, writableChild(parent, index - 1), parent, index);
+            return;
         }
-    } else {
-        // Just update sizes if no merge/borrow happened
-        updateSubtreeSizesUpwards(leaf);
+        if (index < (int)parent->children.size() - 1 && (int)parent->children[index + 1]->keys.size() > minKeys) {
+            borrowFromRightInternal(node, writableChild(parent, index + 1), parent, index);
+            return;
+        }
+        if (index > 0) {
+            mergeInternal(writableChild(parent, index - 1), node, parent, index - 1);
+        } else {
+            mergeInternal(node, parent->children[index + 1], parent, index);
+        }
+        node = parent;
+    }
+
+    // A root left with one child is replaced by it, so the tree gets shorter
+    Node* top = root;
+    if (path.empty() && !top->isLeaf && top->keys.empty()) {
+        root = top->children[0];
+        destroyNode(top);
     }
 }
 
@@ -572,8 +1771,8 @@ void BPlusTree<KeyType, ValueType>::remove(const KeyType& key) {
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::borrowFromLeftLeaf(Node* leaf, Node* leftSibling, Node* parent, int index) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::borrowFromLeftLeaf(Node* leaf, Node* leftSibling, Node* parent, int index) {
     /**
      * @brief Borrows a key-value pair from the left sibling of a leaf node.
      * @param leaf The underflowing leaf node.
@@ -583,13 +1782,21 @@ void BPlusTree<KeyType, ValueType>::borrowFromLeftLeaf(Node* leaf, Node* leftSib
      */
 
 
+    // Move the last key of the left sibling, with its run of values, to the front of leaf
+    int begin = leftSibling->valueBegin((int)leftSibling->keys.size() - 1);
+    int moved = (int)leftSibling->values.size() - begin;
     leaf->keys.insert(leaf->keys.begin(), leftSibling->keys.back());
-    leaf->values.insert(leaf->values.begin(), leftSibling->values.back());
+    leaf->values.insert(leaf->values.begin(), std::make_move_iterator(leftSibling->values.begin() + begin),
+                        std::make_move_iterator(leftSibling->values.end()));
+    leaf->valueEnds.insert(leaf->valueEnds.begin(), 0);
+    shiftValueEnds(leaf, 0, moved);
     leftSibling->keys.pop_back();
-    leftSibling->values.pop_back();
+    leftSibling->valueEnds.pop_back();
+    leftSibling->values.erase(leftSibling->values.begin() + begin, leftSibling->values.end());
 
     parent->keys[index - 1] = leaf->keys.front();
-    updateSubtreeSizesUpwards(leaf);
+    updateSubtreeSize(leaf);
+    updateSubtreeSize(leftSibling);
 }
 
 
@@ -602,8 +1809,8 @@ void BPlusTree<KeyType, ValueType>::borrowFromLeftLeaf(Node* leaf, Node* leftSib
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::borrowFromRightLeaf(Node* leaf, Node* rightSibling, Node* parent, int index) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::borrowFromRightLeaf(Node* leaf, Node* rightSibling, Node* parent, int index) {
 
     /**
      * @brief Borrows a key-value pair from the right sibling of a leaf node.
@@ -613,15 +1820,21 @@ void BPlusTree<KeyType, ValueType>::borrowFromRightLeaf(Node* leaf, Node* rightS
      * @param index The index of the leaf in the parent's children.
      */
 
-    // Move the first key-value pair from right sibling to the end of leaf
+    // Move the first key of right sibling, with its run of values, to the end of leaf
+    int moved = rightSibling->valueEnds[0];
     leaf->keys.push_back(rightSibling->keys.front());
-    leaf->values.push_back(rightSibling->values.front());
+    leaf->values.insert(leaf->values.end(), std::make_move_iterator(rightSibling->values.begin()),
+                        std::make_move_iterator(rightSibling->values.begin() + moved));
+    leaf->valueEnds.push_back((int)leaf->values.size());
     rightSibling->keys.erase(rightSibling->keys.begin());
-    rightSibling->values.erase(rightSibling->values.begin());
+    rightSibling->valueEnds.erase(rightSibling->valueEnds.begin());
+    rightSibling->values.erase(rightSibling->values.begin(), rightSibling->values.begin() + moved);
+    shiftValueEnds(rightSibling, 0, -moved);
 
     // Update parent key
     parent->keys[index] = rightSibling->keys.front();
-    updateSubtreeSizesUpwards(leaf);
+    updateSubtreeSize(leaf);
+    updateSubtreeSize(rightSibling);
 }
 
 
@@ -636,8 +1849,8 @@ void BPlusTree<KeyType, ValueType>::borrowFromRightLeaf(Node* leaf, Node* rightS
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::mergeLeaf(Node* left, Node* right, Node* parent, int index) {
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::mergeLeaf(Node* left, Node* right, Node* parent, int index) {
 
     /**
      * @brief Merges two leaf nodes when one of them underflows.
@@ -648,28 +1861,22 @@ void BPlusTree<KeyType, ValueType>::mergeLeaf(Node* left, Node* right, Node* par
      */
 
     // Move all keys and values from right to left
+    int base = (int)left->values.size();
     left->keys.insert(left->keys.end(), right->keys.begin(), right->keys.end());
-    left->values.insert(left->values.end(), right->values.begin(), right->values.end());
+    for (int end : right->valueEnds) {
+        left->valueEnds.push_back(base + end);
+    }
+    left->values.insert(left->values.end(), std::make_move_iterator(right->values.begin()),
+                        std::make_move_iterator(right->values.end()));
     left->next = right->next;
 
     // Remove right sibling
     parent->keys.erase(parent->keys.begin() + index);
     parent->children.erase(parent->children.begin() + index + 1);
-    delete right;
+    destroyNode(right);
 
+    // The caller handles an underflow of the parent (see rebalanceAfterRemove)
     updateSubtreeSize(left);
-    updateSubtreeSize(parent);
-
-    // Handle parent underflow
-    if (parent == root && parent->keys.empty()) {
-        root = left;
-        delete parent;
-    } else if ((int)parent->keys.size() < (order - 1) / 2 && parent != root) {
-        // If parent underflows, handle it similarly (not fully implemented for internal merges)
-        // For simplicity, assume large order or that this situation rarely occurs.
-        // You can implement internal node merges if needed.
-    }
-    updateSubtreeSizesUpwards(left);
 }
 
 
@@ -680,71 +1887,115 @@ void BPlusTree<KeyType, ValueType>::mergeLeaf(Node* left, Node* right, Node* par
 
 
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::mergeInternal(Node* left, Node* right, Node* parent, int index) {
-    // Implement if needed for internal node merging
-    // If implemented, remember to update subtree sizes afterwards.
-}
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::mergeInternal(Node* left, Node* right, Node* parent, int index) {
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::borrowFromLeftInternal(Node* node, Node* leftSibling, Node* parent, int index) {
-    // Implement if needed for internal node balancing
+    /**
+     * @brief Merges two internal siblings, pulling their separator down from the parent.
+     * @param left The left node.
+     * @param right The right node, destroyed by the merge.
+     * @param parent The parent of both nodes.
+     * @param index The index of the left node in the parent's children.
+     */
+
+    left->keys.push_back(parent->keys[index]);
+    left->keys.insert(left->keys.end(), right->keys.begin(), right->keys.end());
+    left->children.insert(left->children.end(), right->children.begin(), right->children.end());
+
+    parent->keys.erase(parent->keys.begin() + index);
+    parent->children.erase(parent->children.begin() + index + 1);
+    destroyNode(right);
+
+    updateSubtreeSize(left);
 }
 
-template <typename KeyType, typename ValueType>
-void BPlusTree<KeyType, ValueType>::borrowFromRightInternal(Node* node, Node* rightSibling, Node* parent, int index) {
-    // Implement if needed for internal node balancing
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::borrowFromLeftInternal(Node* node, Node* leftSibling, Node* parent, int index) {
+
+    /**
+     * @brief Rotates the last child of the left sibling into an underflowing internal node:
+     *        the separator comes down in front of the node's keys and the sibling's last
+     *        key goes up in its place.
+     * @param index The index of the node in the parent's children.
+     */
+
+    node->keys.insert(node->keys.begin(), parent->keys[index - 1]);
+    node->children.insert(node->children.begin(), leftSibling->children.back());
+    parent->keys[index - 1] = leftSibling->keys.back();
+    leftSibling->keys.pop_back();
+    leftSibling->children.pop_back();
+
+    updateSubtreeSize(node);
+    updateSubtreeSize(leftSibling);
 }
 
+template <typename KeyType, typename ValueType, int Order>
+void BPlusTree<KeyType, ValueType, Order>::borrowFromRightInternal(Node* node, Node* rightSibling, Node* parent, int index) {
 
+    /**
+     * @brief Rotates the first child of the right sibling into an underflowing internal
+     *        node, the mirror image of borrowFromLeftInternal().
+     * @param index The index of the node in the parent's children.
+     */
 
+    node->keys.push_back(parent->keys[index]);
+    node->children.push_back(rightSibling->children.front());
+    parent->keys[index] = rightSibling->keys.front();
+    rightSibling->keys.erase(rightSibling->keys.begin());
+    rightSibling->children.erase(rightSibling->children.begin());
 
+    updateSubtreeSize(node);
+    updateSubtreeSize(rightSibling);
+}
 
 
 
-template <typename KeyType, typename ValueType>
-int BPlusTree<KeyType, ValueType>::countLessOrEqualRecursive(Node* node, const KeyType& x) const {
 
 
-    if (!node) return 0;
 
-    if (node->isLeaf) {
-        // Binary search on keys in the leaf
-        auto it = std::upper_bound(node->keys.begin(), node->keys.end(), x);
-        int idx = (int)(it - node->keys.begin());
-        int count = 0;
-        for (int i = 0; i < idx; i++) {
-            count += (int)node->values[i].size();
-        }
-        return count;
-    } else {
-        // Internal node
-        int i = (int)(std::upper_bound(node->keys.begin(), node->keys.end(), x) - node->keys.begin());
-        int count = 0;
+
+template <typename KeyType, typename ValueType, int Order>
+template <bool Strict>
+int BPlusTree<KeyType, ValueType, Order>::countLessOrEqualUnlocked(const KeyType& x, Node* top) const {
+
+    // Child i holds the keys in [keys[i-1], keys[i]), so the keys <= x end in the
+    // child upperIndex picks and the keys < x in the one lowerIndex picks
+    Node* node = latchFrom(top);
+    int count = 0;
+    uint64_t visited = 1;
+    while (!node->isLeaf) {
+        int i = Strict ? lowerIndex(node, x) : upperIndex(node, x);
         // sum counts of all children < i
         for (int c = 0; c < i; c++) {
             count += node->children[c]->subtree_size;
         }
-        // plus recursively count in the i-th child
-        if (i < (int)node->children.size()) {
-            count += countLessOrEqualRecursive(node->children[i], x);
-        }
-        return count;
+        // plus the count in the i-th child
+        Node* child = node->children[i];
+        latchShared(child);
+        unlatchShared(node);
+        node = child;
+        visited++;
     }
+    // The runs of the first idx keys end where key idx's run begins
+    count += node->valueBegin(Strict ? lowerIndex(node, x) : upperIndex(node, x));
+    unlatchShared(node);
+    statNodes.fetch_add(visited, std::memory_order_relaxed);
+    return count;
 }
 
 
 
 
 
-template <typename KeyType, typename ValueType>
-int BPlusTree<KeyType, ValueType>::countLessOrEqual(const KeyType& x) const {
+template <typename KeyType, typename ValueType, int Order>
+int BPlusTree<KeyType, ValueType, Order>::countLessOrEqual(const ReadScope& scope, const KeyType& x) const {
     /**
      * @brief Counts the number of keys less than or equal to a given value.
      * @param x The value to compare keys against.
      * @return The count of keys less than or equal to x.
      */
-    return countLessOrEqualRecursive(root, x);
+    statCounts.fetch_add(1, std::memory_order_relaxed);
+    return countLessOrEqualUnlocked(x, scope.top);
 }
 
 
@@ -753,24 +2004,100 @@ int BPlusTree<KeyType, ValueType>::countLessOrEqual(const KeyType& x) const {
 
 
 
-template <typename KeyType, typename ValueType>
-int BPlusTree<KeyType, ValueType>::countInRange(const KeyType& Smin, const KeyType& Smax) const {
+template <typename KeyType, typename ValueType, int Order>
+int BPlusTree<KeyType, ValueType, Order>::countInRange(const ReadScope& scope, const KeyType& Smin, const KeyType& Smax) const {
 
     /**
      * @brief Counts the number of keys within a given range [Smin, Smax].
      * @param Smin The minimum value of the range.
      * @param Smax The maximum value of the range.
-     * @return The count of keys in the specified range.
+     * @return The count of keys in the specified range (approximate in concurrent mode).
      */
 
-    if (!root) return 0;
-    // For simplicity, assume KeyType is an integer type so (Smin-1) is valid.
-    int highCount = countLessOrEqual(Smax);
-    int lowCount = 0;
-    if (Smin > std::numeric_limits<KeyType>::lowest()) {
-        lowCount = countLessOrEqual(Smin - 1);
+    if (Smax < Smin) {
+        return 0;
+    }
+    statCounts.fetch_add(1, std::memory_order_relaxed);
+    // (keys <= Smax) - (keys < Smin): exact for any key type, floats included. In
+    // concurrent mode an insert below Smin can land between the two descents and be
+    // seen by the second only, so the difference is clamped at zero.
+    int count = countLessOrEqualUnlocked(Smax, scope.top) - countLessOrEqualUnlocked<true>(Smin, scope.top);
+    return std::max(count, 0);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+int BPlusTree<KeyType, ValueType, Order>::countLess(const ReadScope& scope, const KeyType& x) const {
+    /**
+     * @brief Counts the number of keys strictly less than a given value.
+     * @param x The value to compare keys against.
+     * @return The count of keys less than x.
+     */
+    statCounts.fetch_add(1, std::memory_order_relaxed);
+    return countLessOrEqualUnlocked<true>(x, scope.top);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+ValueType BPlusTree<KeyType, ValueType, Order>::select(const ReadScope& scope, int i) const {
+    /**
+     * @brief Returns the value of rank i in key order.
+     * @param i The rank, 0 <= i < size().
+     * @throws std::out_of_range if i is negative or not below size().
+     */
+    if (i < 0 || i >= rootOf(scope)->subtree_size) {
+        throw std::out_of_range("select: rank " + std::to_string(i) + " is outside the tree");
+    }
+    return selectUnlocked(i, scope.top);
+}
+
+template <typename KeyType, typename ValueType, int Order>
+ValueType BPlusTree<KeyType, ValueType, Order>::selectUnlocked(int i, Node* top) const {
+
+    // Skip whole subtrees while their sizes are below the remaining rank. In concurrent
+    // mode the sizes of unlatched children can include in-flight inserts, so the rank
+    // is clamped to the last child and the last value rather than running off the end.
+    Node* node = latchFrom(top);
+    while (!node->isLeaf) {
+        size_t c = 0;
+        for (; c + 1 < node->children.size(); c++) {
+            int size = node->children[c]->subtree_size;
+            if (i < size) break;
+            i -= size;
+        }
+        Node* child = node->children[c];
+        latchShared(child);
+        unlatchShared(node);
+        node = child;
+    }
+    ValueType result = node->values[std::min<size_t>((size_t)i, node->values.size() - 1)];
+    unlatchShared(node);
+    return result;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+template <typename Rng>
+std::vector<ValueType> BPlusTree<KeyType, ValueType, Order>::sampleInRange(const ReadScope& scope, const KeyType& Smin,
+                                                                           const KeyType& Smax, int n, Rng& rng) const {
+    /**
+     * @brief Draws n uniform random values among those with keys in [Smin, Smax]:
+     *        the range is the rank interval [countLess(Smin), countLessOrEqual(Smax)),
+     *        so each draw is one select().
+     * @param rng A uniform random bit generator, e.g. std::mt19937_64.
+     */
+    std::vector<ValueType> sample;
+    if (n <= 0 || Smax < Smin) {
+        return sample;
+    }
+    int low = countLessOrEqualUnlocked<true>(Smin, scope.top);
+    int high = countLessOrEqualUnlocked(Smax, scope.top);
+    if (high <= low) {
+        return sample;
+    }
+    std::uniform_int_distribution<int> rank(low, high - 1);
+    sample.reserve(n);
+    for (int j = 0; j < n; j++) {
+        sample.push_back(selectUnlocked(rank(rng), scope.top));
     }
-    return highCount - lowCount;
+    return sample;
 }
 
 
@@ -779,8 +2106,9 @@ int BPlusTree<KeyType, ValueType>::countInRange(const KeyType& Smin, const KeyTy
 
 
 
-template <typename KeyType, typename ValueType>
-std::vector<ValueType> BPlusTree<KeyType, ValueType>::rangeQuery(const KeyType& Smin, const KeyType& Smax) const{
+template <typename KeyType, typename ValueType, int Order>
+std::vector<ValueType> BPlusTree<KeyType, ValueType, Order>::rangeQuery(const ReadScope& scope, const KeyType& Smin,
+                                                                        const KeyType& Smax) const {
 
     /**
      * @brief Performs a range query to retrieve all values associated with keys in a specified range.
@@ -789,32 +2117,105 @@ std::vector<ValueType> BPlusTree<KeyType, ValueType>::rangeQuery(const KeyType&
      * @return A vector of values associated with keys in the range.
      */
 
+    // The counts make the result a single allocation (in concurrent mode they can
+    // be short by the inserts that land meanwhile)
     std::vector<ValueType> results;
-    if (!root) return results;
-    
+    statRangeScans.fetch_add(1, std::memory_order_relaxed);
+    if (!(Smax < Smin)) {
+        results.reserve(std::max(0, countLessOrEqualUnlocked(Smax, scope.top) -
+                                    countLessOrEqualUnlocked<true>(Smin, scope.top)));
+    }
+
     // Find the leaf node where Smin would be located
-    Node* current = root;
-    while (!current->isLeaf) {
-        int i = (int)(std::upper_bound(current->keys.begin(), current->keys.end(), Smin) - current->keys.begin());
-        current = current->children[i];
+    LeafWalk walk(this, scope.top, &Smin);
+    uint64_t leaves = walk.nodesDescended();
+
+    // Now traverse the leaf nodes. The keys of a leaf within [Smin, Smax] are
+    // adjacent, so their values form one contiguous block that is copied at once.
+    while (walk.current() != nullptr) {
+        const Node* current = walk.current();
+        int lo = lowerIndex(current, Smin);
+        int hi = upperIndex(current, Smax);
+        if (lo < hi) {
+            const ValueType* values = current->values.data();
+            results.insert(results.end(), values + current->valueBegin(lo), values + current->valueEnds[hi - 1]);
+        }
+        if (hi < (int)current->keys.size()) {
+            // We have exceeded the upper bound
+            break;
+        }
+        // Move to the next leaf, latching it before letting go of this one
+        walk.advance();
+        leaves++;
     }
 
-    // Now traverse the leaf nodes
-    while (current != nullptr) {
-        for (size_t i = 0; i < current->keys.size(); i++) {
-            const KeyType& key = current->keys[i];
-            if (key > Smax) {
-                // We have exceeded the upper bound
-                return results;
-            }
-            if (key >= Smin && key <= Smax) {
-                // Insert all values associated with this key
-                const auto& vals = current->values[i];
-                results.insert(results.end(), vals.begin(), vals.end());
+    statNodes.fetch_add(leaves, std::memory_order_relaxed);
+    statValues.fetch_add(results.size(), std::memory_order_relaxed);
+    return results;
+}
+
+template <typename KeyType, typename ValueType, int Order>
+template <typename Fn>
+void BPlusTree<KeyType, ValueType, Order>::forEachInRange(const ReadScope& scope, const KeyType& Smin,
+                                                          const KeyType& Smax, Fn fn) const {
+
+    /**
+     * @brief Visits the keys in [Smin, Smax] and their values in place, leaf by leaf.
+     * @param fn Called as fn(key, postings); returning false stops the scan.
+     */
+
+    statRangeScans.fetch_add(1, std::memory_order_relaxed);
+    LeafWalk walk(this, scope.top, &Smin);
+    int lo = lowerIndex(walk.current(), Smin);
+    uint64_t leaves = walk.nodesDescended();
+    uint64_t offered = 0;
+    bool stopped = false;
+    while (walk.current() != nullptr && !stopped) {
+        const Node* current = walk.current();
+        int hi = upperIndex(current, Smax);
+        const ValueType* values = current->values.data();
+        for (int i = lo; i < hi; i++) {
+            offered += (uint64_t)(current->valueEnds[i] - current->valueBegin(i));
+            if (!fn(current->keys[i], Postings{values + current->valueBegin(i), values + current->valueEnds[i]})) {
+                stopped = true;
+                break;
             }
         }
-        current = current->next; // Move to the next leaf
+        if (stopped || hi < (int)current->keys.size()) {
+            break;
+        }
+        walk.advance();
+        lo = 0;
+        leaves++;
     }
+    statNodes.fetch_add(leaves, std::memory_order_relaxed);
+    statValues.fetch_add(offered, std::memory_order_relaxed);
+}
 
-    return results;
+/**
+ * @brief Factory dispatch from a run-time order to a compile-time one. Calls
+ *        fn(std::integral_constant<int, O>()) with O = order when order is one of the
+ *        orders compiled in, and with O = 0, the run-time fallback, otherwise:
+ *
+ *            withTreeOrder(order, [&](auto fixed) {
+ *                BPlusTree<float, int, decltype(fixed)::value> tree(order);
+ *                ...
+ *            });
+ *
+ * @return Whatever fn returns (the same type for every O).
+ */
+template <typename Fn>
+auto withTreeOrder(int order, Fn&& fn) -> decltype(fn(std::integral_constant<int, 0>())) {
+    switch (order) {
+        case 4: return fn(std::integral_constant<int, 4>());
+        case 8: return fn(std::integral_constant<int, 8>());
+        case 16: return fn(std::integral_constant<int, 16>());
+        case 32: return fn(std::integral_constant<int, 32>());
+        case 64: return fn(std::integral_constant<int, 64>());
+        case 128: return fn(std::integral_constant<int, 128>());
+        case 256: return fn(std::integral_constant<int, 256>());
+        default: return fn(std::integral_constant<int, 0>());
+    }
 }
+
+#endif // BPLUSTREE2_H
@@ -0,0 +1,262 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
+
+/**
+ * @brief A compressed set of row ids in the style of roaring bitmaps.
+ *
+ * Ids are split into their high and low 16 bits. Each distinct high half owns a
+ * container of low halves: a sorted array while it holds at most ArrayLimit of them
+ * (2 bytes per id), a 65536-bit bitset beyond that (8 KiB, never larger than the array
+ * would be). Sparse sets therefore cost little more than a sorted id list, dense ones
+ * one bit per row, and the set operations work container by container with the
+ * cheapest method for each pair: word-wise AND/OR of bitsets, probing a bitset with
+ * an array's ids, or merging two arrays.
+ *
+ * contains() costs a binary search over the containers (one per 65536 rows) and a
+ * bit test or a short binary search, so the bitmap also serves as the membership
+ * test of a filtered graph search.
+ */
+class Bitmap {
+public:
+    Bitmap() : total(0) {}
+
+    /**
+     * @brief The bitmap of ids[0..n), which must be sorted ascending (duplicates allowed).
+     */
+    static Bitmap fromSorted(const int* ids, size_t n) {
+        Bitmap result;
+        size_t i = 0;
+        while (i < n) {
+            uint16_t high = (uint16_t)((uint32_t)ids[i] >> 16);
+            size_t end = i;
+            while (end < n && (uint16_t)((uint32_t)ids[end] >> 16) == high) {
+                end++;
+            }
+            Container c;
+            c.key = high;
+            c.array.reserve(end - i);
+            for (size_t j = i; j < end; j++) {
+                uint16_t low = (uint16_t)ids[j];
+                if (c.array.empty() || c.array.back() != low) {
+                    c.array.push_back(low);
+                }
+            }
+            c.count = (uint32_t)c.array.size();
+            if (c.count > ArrayLimit) {
+                c.toBitset();
+            }
+            result.total += c.count;
+            result.containers.push_back(std::move(c));
+            i = end;
+        }
+        return result;
+    }
+
+    static Bitmap fromSorted(const std::vector<int>& ids) {
+        return fromSorted(ids.data(), ids.size());
+    }
+
+    size_t cardinality() const { return total; }
+    bool empty() const { return total == 0; }
+
+    bool contains(uint32_t id) const {
+        auto it = std::lower_bound(containers.begin(), containers.end(), (uint16_t)(id >> 16),
+                                   [](const Container& c, uint16_t key) { return c.key < key; });
+        if (it == containers.end() || it->key != (uint16_t)(id >> 16)) {
+            return false;
+        }
+        return it->contains((uint16_t)id);
+    }
+
+    // Ids in both bitmaps
+    static Bitmap intersect(const Bitmap& a, const Bitmap& b) {
+        Bitmap result;
+        size_t i = 0, j = 0;
+        while (i < a.containers.size() && j < b.containers.size()) {
+            const Container& x = a.containers[i];
+            const Container& y = b.containers[j];
+            if (x.key < y.key) {
+                i++;
+            } else if (y.key < x.key) {
+                j++;
+            } else {
+                Container c = Container::intersect(x, y);
+                if (c.count > 0) {
+                    result.total += c.count;
+                    result.containers.push_back(std::move(c));
+                }
+                i++;
+                j++;
+            }
+        }
+        return result;
+    }
+
+    // Ids in either bitmap
+    static Bitmap unite(const Bitmap& a, const Bitmap& b) {
+        Bitmap result;
+        size_t i = 0, j = 0;
+        while (i < a.containers.size() || j < b.containers.size()) {
+            Container c;
+            if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key)) {
+                c = a.containers[i++];
+            } else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key) {
+                c = b.containers[j++];
+            } else {
+                c = Container::unite(a.containers[i++], b.containers[j++]);
+            }
+            result.total += c.count;
+            result.containers.push_back(std::move(c));
+        }
+        return result;
+    }
+
+    /**
+     * @brief Calls fn(id) for every id in ascending order.
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const Container& c : containers) {
+            uint32_t base = (uint32_t)c.key << 16;
+            if (c.bits.empty()) {
+                for (uint16_t low : c.array) {
+                    fn((int)(base | low));
+                }
+                continue;
+            }
+            for (size_t w = 0; w < c.bits.size(); w++) {
+                uint64_t word = c.bits[w];
+                while (word != 0) {
+                    fn((int)(base | (uint32_t)(w * 64 + __builtin_ctzll(word))));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    // Appends the ids, ascending, to out
+    void toVector(std::vector<int>& out) const {
+        out.reserve(out.size() + total);
+        forEach([&out](int id) { out.push_back(id); });
+    }
+
+private:
+    // Containers with more ids than this are bitsets: 4096 × 2 bytes = the 8 KiB bitset
+    static const uint32_t ArrayLimit = 4096;
+    static const size_t Words = 65536 / 64;
+
+    struct Container {
+        uint16_t key;
+        uint32_t count;
+        std::vector<uint16_t> array; // sorted low halves, used while bits is empty
+        std::vector<uint64_t> bits;  // Words words once the container is a bitset
+
+        Container() : key(0), count(0) {}
+
+        bool contains(uint16_t low) const {
+            if (!bits.empty()) {
+                return (bits[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(array.begin(), array.end(), low);
+        }
+
+        void toBitset() {
+            bits.assign(Words, 0);
+            for (uint16_t low : array) {
+                bits[low >> 6] |= (uint64_t)1 << (low & 63);
+            }
+            array.clear();
+            array.shrink_to_fit();
+        }
+
+        void toArray() {
+            array.clear();
+            array.reserve(count);
+            for (size_t w = 0; w < Words; w++) {
+                uint64_t word = bits[w];
+                while (word != 0) {
+                    array.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+                    word &= word - 1;
+                }
+            }
+            bits.clear();
+            bits.shrink_to_fit();
+        }
+
+        static Container intersect(const Container& x, const Container& y) {
+            Container c;
+            c.key = x.key;
+            if (!x.bits.empty() && !y.bits.empty()) {
+                c.bits.resize(Words);
+                uint32_t n = 0;
+                for (size_t w = 0; w < Words; w++) {
+                    c.bits[w] = x.bits[w] & y.bits[w];
+                    n += (uint32_t)__builtin_popcountll(c.bits[w]);
+                }
+                c.count = n;
+                if (n <= ArrayLimit) {
+                    c.toArray();
+                }
+                return c;
+            }
+            if (!x.bits.empty() || !y.bits.empty()) {
+                const Container& dense = x.bits.empty() ? y : x;
+                const Container& sparse = x.bits.empty() ? x : y;
+                for (uint16_t low : sparse.array) {
+                    if (dense.contains(low)) {
+                        c.array.push_back(low);
+                    }
+                }
+            } else {
+                std::set_intersection(x.array.begin(), x.array.end(), y.array.begin(), y.array.end(),
+                                      std::back_inserter(c.array));
+            }
+            c.count = (uint32_t)c.array.size();
+            return c;
+        }
+
+        static Container unite(const Container& x, const Container& y) {
+            Container c;
+            c.key = x.key;
+            if (x.bits.empty() && y.bits.empty()) {
+                std::set_union(x.array.begin(), x.array.end(), y.array.begin(), y.array.end(),
+                               std::back_inserter(c.array));
+                c.count = (uint32_t)c.array.size();
+                if (c.count > ArrayLimit) {
+                    c.toBitset();
+                }
+                return c;
+            }
+            c.bits.assign(Words, 0);
+            for (const Container* part : {&x, &y}) {
+                if (part->bits.empty()) {
+                    for (uint16_t low : part->array) {
+                        c.bits[low >> 6] |= (uint64_t)1 << (low & 63);
+                    }
+                } else {
+                    for (size_t w = 0; w < Words; w++) {
+                        c.bits[w] |= part->bits[w];
+                    }
+                }
+            }
+            uint32_t n = 0;
+            for (uint64_t word : c.bits) {
+                n += (uint32_t)__builtin_popcountll(word);
+            }
+            c.count = n;
+            return c;
+        }
+    };
+
+    std::vector<Container> containers; // ascending by key
+    size_t total;
+};
+
+#endif // BITMAP_H
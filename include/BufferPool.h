@@ -0,0 +1,245 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t PageId;
+
+/**
+ * @brief A file of fixed-size pages addressed by PageId (page i starts at byte i * pageSize).
+ */
+class PageFile {
+public:
+    /**
+     * @param path     File to open; it is created if it does not exist.
+     * @param pageSize Size of every page in bytes.
+     * @throws std::runtime_error if the file cannot be opened or created.
+     */
+    PageFile(const std::string& path, size_t pageSize) : pageSize(pageSize) {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            // Create it, then reopen for reading and writing
+            std::ofstream create(path, std::ios::binary);
+            create.close();
+            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        }
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open page file " + path);
+        }
+        file.seekg(0, std::ios::end);
+        pages = (size_t)file.tellg() / pageSize;
+    }
+
+    size_t getPageSize() const { return pageSize; }
+    size_t pageCount() const { return pages; }
+
+    // Reserves a new page at the end of the file; it is written on first eviction or flush
+    PageId allocate() {
+        return (PageId)pages++;
+    }
+
+    void read(PageId id, char* out) {
+        file.seekg((std::streamoff)id * pageSize);
+        file.read(out, pageSize);
+        if (!file) {
+            // A page allocated but never written reads as zeros
+            file.clear();
+            std::memset(out, 0, pageSize);
+        }
+    }
+
+    void write(PageId id, const char* data) {
+        file.seekp((std::streamoff)id * pageSize);
+        file.write(data, pageSize);
+        if (!file) {
+            throw std::runtime_error("Failed to write page " + std::to_string(id));
+        }
+    }
+
+    void sync() {
+        file.flush();
+    }
+
+private:
+    std::fstream file;
+    size_t pageSize;
+    size_t pages;
+};
+
+/**
+ * @brief Caches the pages of a PageFile in a fixed number of frames.
+ *
+ * Pages are pinned while in use and replaced with the CLOCK algorithm: each frame
+ * has a reference bit set on access, and the hand sweeps the frames, clearing bits,
+ * until it finds an unpinned frame whose bit is clear. That approximates LRU with
+ * one bit per frame and no list to update on every hit. Dirty pages are written
+ * back when they are evicted or on flush().
+ */
+class BufferPool {
+public:
+    /**
+     * @brief A pinned page. The page stays in memory until the handle is destroyed.
+     */
+    class Page {
+    public:
+        Page() : pool(nullptr), id(0), bytes(nullptr) {}
+        Page(BufferPool* pool, PageId id, char* bytes) : pool(pool), id(id), bytes(bytes) {}
+        Page(Page&& other) noexcept : pool(other.pool), id(other.id), bytes(other.bytes) {
+            other.pool = nullptr;
+        }
+        Page& operator=(Page&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool = other.pool;
+                id = other.id;
+                bytes = other.bytes;
+                other.pool = nullptr;
+            }
+            return *this;
+        }
+        ~Page() { release(); }
+
+        Page(const Page&) = delete;
+        Page& operator=(const Page&) = delete;
+
+        PageId getId() const { return id; }
+        char* data() const { return bytes; }
+
+        // Marks the page as modified so it is written back before its frame is reused
+        void markDirty() { pool->frames[pool->table[id]].dirty = true; }
+
+    private:
+        BufferPool* pool;
+        PageId id;
+        char* bytes;
+
+        void release() {
+            if (pool) pool->unpin(id);
+            pool = nullptr;
+        }
+    };
+
+    /**
+     * @param file         The page file to cache.
+     * @param memoryBudget Bytes of page memory to use; at least MinFrames pages.
+     */
+    BufferPool(PageFile& file, size_t memoryBudget)
+        : file(file), pageSize(file.getPageSize()), hand(0), hits(0), misses(0) {
+        size_t count = std::max(MinFrames, memoryBudget / pageSize);
+        memory.resize(count * pageSize);
+        frames.resize(count);
+    }
+
+    ~BufferPool() {
+        flush();
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Pins an existing page, reading it from the file on a miss
+    Page fetch(PageId id) {
+        auto it = table.find(id);
+        if (it != table.end()) {
+            hits++;
+            Frame& frame = frames[it->second];
+            frame.pins++;
+            frame.referenced = true;
+            return Page(this, id, memory.data() + it->second * pageSize);
+        }
+        misses++;
+        size_t f = claimFrame(id);
+        file.read(id, memory.data() + f * pageSize);
+        return Page(this, id, memory.data() + f * pageSize);
+    }
+
+    // Allocates a new zeroed page in the file and pins it
+    Page allocate() {
+        PageId id = file.allocate();
+        size_t f = claimFrame(id);
+        std::memset(memory.data() + f * pageSize, 0, pageSize);
+        frames[f].dirty = true;
+        return Page(this, id, memory.data() + f * pageSize);
+    }
+
+    // Writes every dirty page back to the file
+    void flush() {
+        for (size_t f = 0; f < frames.size(); f++) {
+            if (frames[f].used && frames[f].dirty) {
+                file.write(frames[f].page, memory.data() + f * pageSize);
+                frames[f].dirty = false;
+            }
+        }
+        file.sync();
+    }
+
+    size_t frameCount() const { return frames.size(); }
+    size_t hitCount() const { return hits; }
+    size_t missCount() const { return misses; }
+
+    // Enough frames for a root-to-leaf path plus the pages a split touches
+    static constexpr size_t MinFrames = 16;
+
+private:
+    struct Frame {
+        PageId page = 0;
+        int pins = 0;
+        bool used = false;
+        bool dirty = false;
+        bool referenced = false;
+    };
+
+    PageFile& file;
+    size_t pageSize;
+    std::vector<char> memory;
+    std::vector<Frame> frames;
+    std::unordered_map<PageId, size_t> table; // page -> frame
+    size_t hand;
+    size_t hits;
+    size_t misses;
+
+    void unpin(PageId id) {
+        frames[table[id]].pins--;
+    }
+
+    // Picks a frame with CLOCK, writes back its old page if dirty, and pins it for `id`
+    size_t claimFrame(PageId id) {
+        // Two sweeps clear every reference bit, so a third finds a victim if any is unpinned
+        for (size_t step = 0; step < 3 * frames.size(); step++) {
+            size_t f = hand;
+            hand = (hand + 1) % frames.size();
+            Frame& frame = frames[f];
+            if (frame.used && frame.pins > 0) {
+                continue;
+            }
+            if (frame.used && frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            if (frame.used) {
+                if (frame.dirty) {
+                    file.write(frame.page, memory.data() + f * pageSize);
+                }
+                table.erase(frame.page);
+            }
+            frame.page = id;
+            frame.pins = 1;
+            frame.used = true;
+            frame.dirty = false;
+            frame.referenced = true;
+            table[id] = f;
+            return f;
+        }
+        throw std::runtime_error("Buffer pool exhausted: every frame is pinned");
+    }
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,410 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+#include "./Snapshot.h"
+#include "./parallelFor.h"
+
+/**
+ * @brief Vectors and s values loaded by DataLoader, stored back to back so they can
+ *        be handed to insertBatch() in one call:
+ *
+ *            index.insertBatch(data.rows(), data.size(), data.dimension(), data.scalars());
+ *
+ * A dataset loaded from the raw binary layout points into the mapped file instead of
+ * owning a copy; the mapping lives as long as the dataset (or any copy of it).
+ */
+class VectorDataset {
+public:
+    VectorDataset() : dim(0), count(0), mappedRows(nullptr), mappedScalars(nullptr) {}
+
+    int dimension() const { return dim; }
+    size_t size() const { return count; }
+
+    // count × dim floats, row i at rows() + i * dim
+    const float* rows() const { return file ? mappedRows : ownedRows.data(); }
+    const float* row(size_t i) const { return rows() + i * (size_t)dim; }
+
+    // One s value per row, or nullptr if the source carried none (.fvecs, .bvecs)
+    bool hasScalars() const { return scalars() != nullptr; }
+    const float* scalars() const {
+        if (!ownedScalars.empty()) {
+            return ownedScalars.data();
+        }
+        return file ? mappedScalars : nullptr;
+    }
+
+    /**
+     * @brief Attaches s values to a dataset, e.g. to .fvecs rows from a separate file.
+     * @throws std::invalid_argument if @p s does not hold one value per row.
+     */
+    void setScalars(std::vector<float> s) {
+        if (s.size() != count) {
+            throw std::invalid_argument("Expected " + std::to_string(count) + " s values, got " +
+                                        std::to_string(s.size()));
+        }
+        ownedScalars = std::move(s);
+    }
+
+private:
+    friend class DataLoader;
+
+    int dim;
+    size_t count;
+    std::vector<float> ownedRows;
+    std::vector<float> ownedScalars;
+    std::shared_ptr<snapshot::MappedFile> file; // set for the raw layout only
+    const float* mappedRows;
+    const float* mappedScalars;
+};
+
+/**
+ * @brief Loads vectors and s values from CSV, .fvecs/.bvecs and a raw binary layout.
+ *
+ * Every format is read through a read-only memory mapping (see snapshot::MappedFile)
+ * and written straight into the dataset's flat buffers, without a temporary per row.
+ *
+ * CSV: v1,...,vD,s per line, like the files in tests/_Data, with an optional header
+ *      line (any first line not starting with a number). The body is cut at line
+ *      boundaries into chunks that are parsed in parallel with std::from_chars: one
+ *      pass counts the rows of each chunk, so every chunk knows where its rows go,
+ *      and a second pass parses them into place.
+ * .fvecs / .bvecs: the TEXMEX format, each record an int32 dimension followed by that
+ *      many float32 or uint8 components. They carry no s values; attach them with
+ *      VectorDataset::setScalars() (e.g. from loadScalars()).
+ * Raw (.f32): a "VECROWS " snapshot section (magic, version, uint32 dim, uint64
+ *      count, uint32 hasScalars) padded to 64 bytes, then count × dim float32
+ *      components and, if present, count float32 s values. Written by saveRaw() and
+ *      used in place from the mapping, so loading costs no parsing and no copy.
+ *
+ * All errors (unreadable files, malformed or truncated data) throw
+ * std::runtime_error naming the file.
+ */
+class DataLoader {
+public:
+    enum class Format { Auto, Csv, Fvecs, Bvecs, Raw };
+
+    // The format implied by a file's extension; Csv for anything unrecognised
+    static Format formatOf(const std::string& path) {
+        if (endsWith(path, ".fvecs")) return Format::Fvecs;
+        if (endsWith(path, ".bvecs")) return Format::Bvecs;
+        if (endsWith(path, ".f32")) return Format::Raw;
+        return Format::Csv;
+    }
+
+    /**
+     * @param numThreads Threads parsing or converting the input; 0 means hardware concurrency.
+     */
+    static VectorDataset load(const std::string& path, Format format = Format::Auto, int numThreads = 0) {
+        if (format == Format::Auto) {
+            format = formatOf(path);
+        }
+        switch (format) {
+            case Format::Fvecs: return loadFvecs(path, numThreads);
+            case Format::Bvecs: return loadBvecs(path, numThreads);
+            case Format::Raw: return loadRaw(path);
+            default: return loadCsv(path, true, numThreads);
+        }
+    }
+
+    /**
+     * @param withScalars Whether the last column holds s (true for the files in
+     *                    tests/_Data); without it every column is a vector component.
+     */
+    static VectorDataset loadCsv(const std::string& path, bool withScalars = true, int numThreads = 0) {
+        snapshot::MappedFile file(path);
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+
+        // The header, if any, and the dimension from the first non-blank line
+        const char* body = begin;
+        while (body < end && isBlankLine(body, end)) {
+            body = nextLine(body, end);
+        }
+        VectorDataset data;
+        if (body == end) {
+            return data;
+        }
+        size_t columns = 1;
+        for (const char* p = body; p < end && *p != '\n'; p++) {
+            columns += *p == ',';
+        }
+        if (!startsWithNumber(body, end)) {
+            body = nextLine(body, end);
+        }
+        if (withScalars && columns < 2) {
+            throw std::runtime_error(path + ": expected at least one vector column before s");
+        }
+        data.dim = (int)(withScalars ? columns - 1 : columns);
+
+        // Cut the body into chunks at line boundaries, a few per thread to balance them
+        size_t threads = numThreads > 0 ? (size_t)numThreads : std::max(1u, std::thread::hardware_concurrency());
+        size_t bytes = (size_t)(end - body);
+        size_t chunkCount = std::max<size_t>(1, std::min(threads * 4, bytes / MinChunkBytes));
+        std::vector<const char*> bounds(1, body);
+        for (size_t c = 1; c < chunkCount; c++) {
+            const char* cut = std::max(bounds.back(), body + bytes / chunkCount * c);
+            const char* newline = static_cast<const char*>(std::memchr(cut, '\n', (size_t)(end - cut)));
+            cut = newline ? newline + 1 : end;
+            if (cut > bounds.back() && cut < end) {
+                bounds.push_back(cut);
+            }
+        }
+        bounds.push_back(end);
+        chunkCount = bounds.size() - 1;
+
+        // Pass 1: rows per chunk, then the first row of each chunk
+        std::vector<size_t> firstRow(chunkCount + 1, 0);
+        parallelFor(chunkCount, numThreads, [&](size_t c) {
+            size_t rows = 0;
+            for (const char* line = bounds[c]; line < bounds[c + 1]; line = nextLine(line, bounds[c + 1])) {
+                rows += !isBlankLine(line, bounds[c + 1]);
+            }
+            firstRow[c + 1] = rows;
+        });
+        for (size_t c = 0; c < chunkCount; c++) {
+            firstRow[c + 1] += firstRow[c];
+        }
+        data.count = firstRow[chunkCount];
+        data.ownedRows.resize(data.count * (size_t)data.dim);
+        if (withScalars) {
+            data.ownedScalars.resize(data.count);
+        }
+
+        // Pass 2: parse every chunk into its rows
+        size_t dim = (size_t)data.dim;
+        parallelFor(chunkCount, numThreads, [&](size_t c) {
+            size_t r = firstRow[c];
+            for (const char* line = bounds[c]; line < bounds[c + 1]; line = nextLine(line, bounds[c + 1])) {
+                if (isBlankLine(line, bounds[c + 1])) {
+                    continue;
+                }
+                float* out = &data.ownedRows[r * dim];
+                const char* p = line;
+                for (size_t j = 0; j < columns; j++) {
+                    float& value = j < dim ? out[j] : data.ownedScalars[r];
+                    p = parseField(p, bounds[c + 1], value);
+                    if (!p) {
+                        throw std::runtime_error(path + ": row " + std::to_string(r + 1) + ", column " +
+                                                 std::to_string(j + 1) + " is not a number");
+                    }
+                    p = skipSpaces(p, bounds[c + 1]);
+                    bool last = j + 1 == columns;
+                    bool atEnd = p == bounds[c + 1] || *p == '\n' || (*p == '\r' && (p + 1 == bounds[c + 1] || p[1] == '\n'));
+                    if (last ? !atEnd : (p == bounds[c + 1] || *p != ',')) {
+                        throw std::runtime_error(path + ": row " + std::to_string(r + 1) + " should have " +
+                                                 std::to_string(columns) + " columns");
+                    }
+                    p++;
+                }
+                r++;
+            }
+        });
+        return data;
+    }
+
+    static VectorDataset loadFvecs(const std::string& path, int numThreads = 0) {
+        return loadVecs(path, sizeof(float), numThreads, [](const char* in, float* out, size_t dim) {
+            std::memcpy(out, in, dim * sizeof(float));
+        });
+    }
+
+    static VectorDataset loadBvecs(const std::string& path, int numThreads = 0) {
+        return loadVecs(path, sizeof(uint8_t), numThreads, [](const char* in, float* out, size_t dim) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(in);
+            for (size_t j = 0; j < dim; j++) {
+                out[j] = (float)bytes[j];
+            }
+        });
+    }
+
+    /**
+     * @brief A flat little-endian float32 file with one s value per row, e.g. written
+     *        by numpy's s.astype('float32').tofile(path).
+     */
+    static std::vector<float> loadScalars(const std::string& path) {
+        snapshot::MappedFile file(path);
+        if (file.size() % sizeof(float) != 0) {
+            throw std::runtime_error(path + ": size is not a multiple of 4 bytes");
+        }
+        std::vector<float> s(file.size() / sizeof(float));
+        if (!s.empty()) {
+            std::memcpy(s.data(), file.data(), file.size());
+        }
+        return s;
+    }
+
+    static VectorDataset loadRaw(const std::string& path) {
+        std::shared_ptr<snapshot::MappedFile> file = std::make_shared<snapshot::MappedFile>(path);
+        snapshot::MemoryStream in(file->data(), file->size());
+        VectorDataset data;
+        bool withScalars;
+        size_t offset;
+        try {
+            snapshot::expectTag(in, RawMagic);
+            data.dim = (int)snapshot::read<uint32_t>(in);
+            data.count = (size_t)snapshot::read<uint64_t>(in);
+            withScalars = snapshot::read<uint32_t>(in) != 0;
+            snapshot::skipPad(in, RawAlignment);
+            offset = (size_t)in.tellg();
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(path + ": " + e.what());
+        }
+        size_t values = data.count * (size_t)data.dim;
+        size_t needed = offset + (values + (withScalars ? data.count : 0)) * sizeof(float);
+        if (data.dim <= 0 || needed > file->size()) {
+            throw std::runtime_error(path + ": truncated or corrupt vector file");
+        }
+        data.mappedRows = reinterpret_cast<const float*>(file->data() + offset);
+        data.mappedScalars = withScalars ? data.mappedRows + values : nullptr;
+        data.file = std::move(file);
+        return data;
+    }
+
+    /**
+     * @brief Writes @p data in the raw layout read by loadRaw().
+     */
+    static void saveRaw(const std::string& path, const VectorDataset& data) {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing");
+        }
+        snapshot::writeTag(out, RawMagic);
+        snapshot::write<uint32_t>(out, (uint32_t)data.dimension());
+        snapshot::write<uint64_t>(out, (uint64_t)data.size());
+        snapshot::write<uint32_t>(out, data.hasScalars() ? 1u : 0u);
+        snapshot::pad(out, RawAlignment);
+        snapshot::writeArray(out, data.rows(), data.size() * (size_t)data.dimension());
+        if (data.hasScalars()) {
+            snapshot::writeArray(out, data.scalars(), data.size());
+        }
+        if (!out) {
+            throw std::runtime_error("Failed writing " + path);
+        }
+    }
+
+private:
+    static constexpr const char* RawMagic = "VECROWS ";
+    static const size_t RawAlignment = 64;
+    // Smallest chunk of CSV worth a task of its own
+    static const size_t MinChunkBytes = 1 << 16;
+    // Records per task when converting .fvecs / .bvecs
+    static const size_t VecsPerTask = 4096;
+
+    static bool endsWith(const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // The start of the line after the one at p
+    static const char* nextLine(const char* p, const char* end) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', (size_t)(end - p)));
+        return newline ? newline + 1 : end;
+    }
+
+    static const char* skipSpaces(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        return p;
+    }
+
+    static bool isBlankLine(const char* p, const char* end) {
+        p = skipSpaces(p, end);
+        return p == end || *p == '\n' || *p == '\r';
+    }
+
+    static bool startsWithNumber(const char* p, const char* end) {
+        p = skipSpaces(p, end);
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p < end && *p == '.') {
+            p++;
+        }
+        return p < end && *p >= '0' && *p <= '9';
+    }
+
+    // Parses one number at p (after optional spaces and '+'); nullptr if there is none
+    static const char* parseField(const char* p, const char* end, float& value) {
+        p = skipSpaces(p, end);
+        if (p < end && *p == '+') {
+            p++;
+        }
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        std::from_chars_result result = std::from_chars(p, end, value);
+        return result.ec == std::errc() ? result.ptr : nullptr;
+#else
+        // strtof needs a terminated string; numbers longer than the buffer are malformed anyway
+        char buffer[64];
+        size_t n = 0;
+        while (p + n < end && n + 1 < sizeof(buffer) && p[n] != ',' && p[n] != '\n' && p[n] != '\r') {
+            buffer[n] = p[n];
+            n++;
+        }
+        buffer[n] = '\0';
+        char* stop = nullptr;
+        value = std::strtof(buffer, &stop);
+        return stop == buffer ? nullptr : p + (stop - buffer);
+#endif
+    }
+
+    // Shared by .fvecs and .bvecs: records of an int32 dimension and dim components of componentSize bytes
+    template <typename Convert>
+    static VectorDataset loadVecs(const std::string& path, size_t componentSize, int numThreads, Convert convert) {
+        snapshot::MappedFile file(path);
+        VectorDataset data;
+        if (file.size() == 0) {
+            return data;
+        }
+        int32_t dim;
+        if (file.size() < sizeof(dim)) {
+            throw std::runtime_error(path + ": truncated vector file");
+        }
+        std::memcpy(&dim, file.data(), sizeof(dim));
+        if (dim <= 0) {
+            throw std::runtime_error(path + ": invalid dimension " + std::to_string(dim));
+        }
+        size_t recordBytes = sizeof(dim) + (size_t)dim * componentSize;
+        if (file.size() % recordBytes != 0) {
+            throw std::runtime_error(path + ": size is not a whole number of " + std::to_string(dim) +
+                                     "-dimensional records");
+        }
+        data.dim = dim;
+        data.count = file.size() / recordBytes;
+        data.ownedRows.resize(data.count * (size_t)dim);
+
+        size_t tasks = (data.count + VecsPerTask - 1) / VecsPerTask;
+        parallelFor(tasks, numThreads, [&](size_t t) {
+            size_t last = std::min(data.count, (t + 1) * VecsPerTask);
+            for (size_t i = t * VecsPerTask; i < last; i++) {
+                const char* record = file.data() + i * recordBytes;
+                int32_t recordDim;
+                std::memcpy(&recordDim, record, sizeof(recordDim));
+                if (recordDim != dim) {
+                    throw std::runtime_error(path + ": record " + std::to_string(i + 1) + " has dimension " +
+                                             std::to_string(recordDim) + ", expected " + std::to_string(dim));
+                }
+                convert(record + sizeof(recordDim), &data.ownedRows[i * (size_t)dim], (size_t)dim);
+            }
+        });
+        return data;
+    }
+};
+
+#endif // DATA_LOADER_H
@@ -0,0 +1,488 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <cmath>
+#include <cstddef>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DISTANCE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define DISTANCE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Metrics supported by the vector indexes. Every metric is a distance:
+ *        smaller means closer.
+ *          L2           squared Euclidean distance
+ *          InnerProduct 1 - <a, b>
+ *          Cosine       1 - <a, b> / (|a| |b|), computed as InnerProduct on vectors
+ *                       the indexes normalize when they are inserted and queried
+ */
+enum class Metric { L2, InnerProduct, Cosine };
+
+/**
+ * @brief Vectorized float kernels shared by all vector indexes and their HNSW space.
+ *
+ *        Each instruction set provides a pair kernel (one vector against one vector)
+ *        and a quad kernel (one query against four rows, loading each block of the
+ *        query once). On x86 the AVX-512 and AVX2/FMA variants are compiled with
+ *        function target attributes and chosen at run time from the CPU, so a
+ *        portable build still uses the widest unit available. AArch64 uses NEON;
+ *        anything else falls back to scalar loops the compiler can vectorize.
+ */
+namespace distance {
+
+typedef float (*PairKernel)(const float* a, const float* b, size_t dim);
+typedef void (*QuadKernel)(const float* query, const float* const* rows, size_t dim, float* out);
+
+struct Kernels {
+    PairKernel l2;
+    PairKernel dot;
+    QuadKernel l2x4;
+    QuadKernel dotx4;
+    const char* name;
+};
+
+// -- Scalar --------------------------------------------------------------------
+
+inline float l2Scalar(const float* a, const float* b, size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float d0 = a[i] - b[i], d1 = a[i + 1] - b[i + 1];
+        float d2 = a[i + 2] - b[i + 2], d3 = a[i + 3] - b[i + 3];
+        s0 += d0 * d0; s1 += d1 * d1; s2 += d2 * d2; s3 += d3 * d3;
+    }
+    for (; i < dim; i++) {
+        float d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+inline float dotScalar(const float* a, const float* b, size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i]; s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2]; s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+inline void l2Scalarx4(const float* query, const float* const* rows, size_t dim, float* out) {
+    for (int r = 0; r < 4; r++) out[r] = l2Scalar(query, rows[r], dim);
+}
+
+inline void dotScalarx4(const float* query, const float* const* rows, size_t dim, float* out) {
+    for (int r = 0; r < 4; r++) out[r] = dotScalar(query, rows[r], dim);
+}
+
+#if defined(DISTANCE_X86)
+
+// -- AVX2 + FMA ----------------------------------------------------------------
+
+__attribute__((target("avx2,fma")))
+inline float hsumAvx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+inline float l2Avx2(const float* a, const float* b, size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    return hsumAvx2(_mm256_add_ps(acc0, acc1)) + l2Scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline float dotAvx2(const float* a, const float* b, size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    return hsumAvx2(_mm256_add_ps(acc0, acc1)) + dotScalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline void l2Avx2x4(const float* query, const float* const* rows, size_t dim, float* out) {
+    __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 q = _mm256_loadu_ps(query + i);
+        for (int r = 0; r < 4; r++) {
+            __m256 d = _mm256_sub_ps(q, _mm256_loadu_ps(rows[r] + i));
+            acc[r] = _mm256_fmadd_ps(d, d, acc[r]);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = hsumAvx2(acc[r]) + l2Scalar(query + i, rows[r] + i, dim - i);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void dotAvx2x4(const float* query, const float* const* rows, size_t dim, float* out) {
+    __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 q = _mm256_loadu_ps(query + i);
+        for (int r = 0; r < 4; r++) {
+            acc[r] = _mm256_fmadd_ps(q, _mm256_loadu_ps(rows[r] + i), acc[r]);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = hsumAvx2(acc[r]) + dotScalar(query + i, rows[r] + i, dim - i);
+    }
+}
+
+// -- AVX-512 -------------------------------------------------------------------
+// Tails use masked loads so no scalar loop is needed.
+
+__attribute__((target("avx512f")))
+inline __mmask16 tailMask512(size_t remaining) {
+    return (__mmask16)((1u << remaining) - 1);
+}
+
+// Horizontal sum: fold the 256- and 128-bit lanes with shuffles, then finish like
+// hsumAvx2. _mm512_reduce_add_ps, the 512-to-128 cast and the unmasked shuffles and
+// extracts start from an undefined register, which trips -Wuninitialized on GCC 12;
+// the zero-masked forms do not.
+__attribute__((target("avx512f")))
+inline float hsumAvx512(__m512 v) {
+    v = _mm512_add_ps(v, _mm512_maskz_shuffle_f32x4((__mmask16)0xFFFF, v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm512_add_ps(v, _mm512_maskz_shuffle_f32x4((__mmask16)0xFFFF, v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128 s = _mm512_maskz_extractf32x4_ps((__mmask8)0xF, v, 0);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx512f")))
+inline float l2Avx512(const float* a, const float* b, size_t dim) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return hsumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+inline float dotAvx512(const float* a, const float* b, size_t dim) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return hsumAvx512(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+inline void l2Avx512x4(const float* query, const float* const* rows, size_t dim, float* out) {
+    __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? (__mmask16)0xFFFF : tailMask512(dim - i);
+        __m512 q = _mm512_maskz_loadu_ps(m, query + i);
+        for (int r = 0; r < 4; r++) {
+            __m512 d = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(m, rows[r] + i));
+            acc[r] = _mm512_fmadd_ps(d, d, acc[r]);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = hsumAvx512(acc[r]);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void dotAvx512x4(const float* query, const float* const* rows, size_t dim, float* out) {
+    __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+    for (size_t i = 0; i < dim; i += 16) {
+        __mmask16 m = dim - i >= 16 ? (__mmask16)0xFFFF : tailMask512(dim - i);
+        __m512 q = _mm512_maskz_loadu_ps(m, query + i);
+        for (int r = 0; r < 4; r++) {
+            acc[r] = _mm512_fmadd_ps(q, _mm512_maskz_loadu_ps(m, rows[r] + i), acc[r]);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = hsumAvx512(acc[r]);
+    }
+}
+
+#elif defined(DISTANCE_NEON)
+
+// -- NEON ----------------------------------------------------------------------
+
+inline float l2Neon(const float* a, const float* b, size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d, d);
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + l2Scalar(a + i, b + i, dim - i);
+}
+
+inline float dotNeon(const float* a, const float* b, size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + dotScalar(a + i, b + i, dim - i);
+}
+
+inline void l2Neonx4(const float* query, const float* const* rows, size_t dim, float* out) {
+    float32x4_t acc[4] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t q = vld1q_f32(query + i);
+        for (int r = 0; r < 4; r++) {
+            float32x4_t d = vsubq_f32(q, vld1q_f32(rows[r] + i));
+            acc[r] = vfmaq_f32(acc[r], d, d);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = vaddvq_f32(acc[r]) + l2Scalar(query + i, rows[r] + i, dim - i);
+    }
+}
+
+inline void dotNeonx4(const float* query, const float* const* rows, size_t dim, float* out) {
+    float32x4_t acc[4] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t q = vld1q_f32(query + i);
+        for (int r = 0; r < 4; r++) {
+            acc[r] = vfmaq_f32(acc[r], q, vld1q_f32(rows[r] + i));
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        out[r] = vaddvq_f32(acc[r]) + dotScalar(query + i, rows[r] + i, dim - i);
+    }
+}
+
+#endif
+
+// -- Fixed dimensions ----------------------------------------------------------
+// Each kernel again with the dimension as a template argument (the dim parameter is
+// ignored). Inlined into a function of the same target, the loops get constant trip
+// counts: the compiler unrolls them and drops the tail handling when Dim is a
+// multiple of the vector width. Without a vector unit the run-time kernels are kept.
+
+#if defined(DISTANCE_X86)
+
+template <size_t Dim> __attribute__((target("avx2,fma")))
+inline float l2Avx2Fixed(const float* a, const float* b, size_t) { return l2Avx2(a, b, Dim); }
+template <size_t Dim> __attribute__((target("avx2,fma")))
+inline float dotAvx2Fixed(const float* a, const float* b, size_t) { return dotAvx2(a, b, Dim); }
+template <size_t Dim> __attribute__((target("avx2,fma")))
+inline void l2Avx2x4Fixed(const float* q, const float* const* rows, size_t, float* out) { l2Avx2x4(q, rows, Dim, out); }
+template <size_t Dim> __attribute__((target("avx2,fma")))
+inline void dotAvx2x4Fixed(const float* q, const float* const* rows, size_t, float* out) { dotAvx2x4(q, rows, Dim, out); }
+
+template <size_t Dim> __attribute__((target("avx512f")))
+inline float l2Avx512Fixed(const float* a, const float* b, size_t) { return l2Avx512(a, b, Dim); }
+template <size_t Dim> __attribute__((target("avx512f")))
+inline float dotAvx512Fixed(const float* a, const float* b, size_t) { return dotAvx512(a, b, Dim); }
+template <size_t Dim> __attribute__((target("avx512f")))
+inline void l2Avx512x4Fixed(const float* q, const float* const* rows, size_t, float* out) { l2Avx512x4(q, rows, Dim, out); }
+template <size_t Dim> __attribute__((target("avx512f")))
+inline void dotAvx512x4Fixed(const float* q, const float* const* rows, size_t, float* out) { dotAvx512x4(q, rows, Dim, out); }
+
+#elif defined(DISTANCE_NEON)
+
+template <size_t Dim> inline float l2NeonFixed(const float* a, const float* b, size_t) { return l2Neon(a, b, Dim); }
+template <size_t Dim> inline float dotNeonFixed(const float* a, const float* b, size_t) { return dotNeon(a, b, Dim); }
+template <size_t Dim> inline void l2Neonx4Fixed(const float* q, const float* const* rows, size_t, float* out) { l2Neonx4(q, rows, Dim, out); }
+template <size_t Dim> inline void dotNeonx4Fixed(const float* q, const float* const* rows, size_t, float* out) { dotNeonx4(q, rows, Dim, out); }
+
+#endif
+
+// -- Dispatch ------------------------------------------------------------------
+
+inline Kernels selectKernels() {
+#if defined(DISTANCE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {l2Avx512, dotAvx512, l2Avx512x4, dotAvx512x4, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {l2Avx2, dotAvx2, l2Avx2x4, dotAvx2x4, "avx2"};
+    }
+#elif defined(DISTANCE_NEON)
+    return {l2Neon, dotNeon, l2Neonx4, dotNeonx4, "neon"};
+#endif
+    return {l2Scalar, dotScalar, l2Scalarx4, dotScalarx4, "scalar"};
+}
+
+/**
+ * @brief The kernels for this CPU, selected on first use.
+ */
+inline const Kernels& kernels() {
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+// The fixed-dimension kernels for Dim on this CPU
+template <size_t Dim>
+inline Kernels selectFixedKernels() {
+#if defined(DISTANCE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {l2Avx512Fixed<Dim>, dotAvx512Fixed<Dim>, l2Avx512x4Fixed<Dim>, dotAvx512x4Fixed<Dim>, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {l2Avx2Fixed<Dim>, dotAvx2Fixed<Dim>, l2Avx2x4Fixed<Dim>, dotAvx2x4Fixed<Dim>, "avx2"};
+    }
+#elif defined(DISTANCE_NEON)
+    return {l2NeonFixed<Dim>, dotNeonFixed<Dim>, l2Neonx4Fixed<Dim>, dotNeonx4Fixed<Dim>, "neon"};
+#endif
+    return selectKernels();
+}
+
+/**
+ * @brief The kernels for vectors of @p dim floats: specialized at compile time for
+ *        the common embedding sizes (64, 128, 384, 768), the run-time kernels() for
+ *        any other dimension. Kernels of either kind must only be called with @p dim.
+ */
+inline const Kernels& kernels(size_t dim) {
+    switch (dim) {
+        case 64: { static const Kernels k = selectFixedKernels<64>(); return k; }
+        case 128: { static const Kernels k = selectFixedKernels<128>(); return k; }
+        case 384: { static const Kernels k = selectFixedKernels<384>(); return k; }
+        case 768: { static const Kernels k = selectFixedKernels<768>(); return k; }
+        default: return kernels();
+    }
+}
+
+/**
+ * @brief Scales @p vec to unit length in place (left unchanged if it is all zeros).
+ */
+inline void normalize(float* vec, size_t dim) {
+    float norm = std::sqrt(kernels().dot(vec, vec, dim));
+    if (norm > 0.0f) {
+        for (size_t i = 0; i < dim; i++) vec[i] /= norm;
+    }
+}
+
+} // namespace distance
+
+/**
+ * @brief Distance for one metric, bound to the dispatched kernels.
+ *        Cosine reports true() from normalizesInputs(): callers must store and query
+ *        unit vectors, and the distance is then computed as 1 - <a, b>.
+ */
+class DistanceFunction {
+public:
+    /**
+     * @param dim Dimension of the vectors it will be called on, if known, to bind
+     *            kernels specialized for it (see distance::kernels(dim)); 0 binds the
+     *            run-time kernels, which accept any dimension.
+     */
+    explicit DistanceFunction(Metric metric = Metric::L2, size_t dim = 0)
+        : metric(metric),
+          pair(metric == Metric::L2 ? distance::kernels(dim).l2 : distance::kernels(dim).dot),
+          quad(metric == Metric::L2 ? distance::kernels(dim).l2x4 : distance::kernels(dim).dotx4) {}
+
+    Metric getMetric() const { return metric; }
+    bool normalizesInputs() const { return metric == Metric::Cosine; }
+
+    float operator()(const float* a, const float* b, size_t dim) const {
+        return finish(pair(a, b, dim));
+    }
+
+    /**
+     * @brief Distances from @p query to rows[0..n), written to out[0..n).
+     *        Rows are processed four at a time so each block of the query is loaded once.
+     */
+    void batch(const float* query, const float* const* rows, size_t n, size_t dim, float* out) const {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            quad(query, rows + i, dim, out + i);
+            for (int r = 0; r < 4; r++) out[i + r] = finish(out[i + r]);
+        }
+        for (; i < n; i++) {
+            out[i] = finish(pair(query, rows[i], dim));
+        }
+    }
+
+    /**
+     * @brief Distances from @p query to @p n consecutive rows of a row-major block
+     *        with a stride of @p dim floats.
+     */
+    void batch(const float* query, const float* block, size_t n, size_t dim, float* out) const {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const float* rows[4] = {block + i * dim, block + (i + 1) * dim,
+                                    block + (i + 2) * dim, block + (i + 3) * dim};
+            quad(query, rows, dim, out + i);
+            for (int r = 0; r < 4; r++) out[i + r] = finish(out[i + r]);
+        }
+        for (; i < n; i++) {
+            out[i] = finish(pair(query, block + i * dim, dim));
+        }
+    }
+
+private:
+    Metric metric;
+    distance::PairKernel pair;
+    distance::QuadKernel quad;
+
+    // The dot kernel returns a similarity; turn it into a distance
+    float finish(float raw) const {
+        return metric == Metric::L2 ? raw : 1.0f - raw;
+    }
+};
+
+#endif // DISTANCE_H
@@ -0,0 +1,152 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/**
+ * @brief Epoch-based reclamation for structures that readers walk without locks.
+ *        A reader pins the current epoch for as long as it may hold pointers into
+ *        the structure. A writer that unlinks memory tags it with the epoch that
+ *        advance() closes, and frees it once oldestPinned() is past that tag: every
+ *        reader that could still reach it has unpinned by then.
+ *
+ *        Pins live in a fixed table of cache-line sized slots. Pinning is one
+ *        compare-and-swap on a slot picked from the thread id, so concurrent readers
+ *        rarely touch the same line, and it never waits on a writer. When all Slots
+ *        are pinned (more live readers or held snapshots than slots, possibly all on
+ *        one thread) the pin goes to a mutex-guarded overflow list instead of
+ *        waiting for a slot that may never be released.
+ */
+class EpochManager {
+public:
+    static const size_t Slots = 64;
+
+    // A pinned epoch; unpins when destroyed
+    class Guard {
+    public:
+        Guard() : manager(nullptr), slot(0), pinned(0) {}
+        Guard(Guard&& other) noexcept : manager(other.manager), slot(other.slot), pinned(other.pinned) {
+            other.manager = nullptr;
+        }
+        Guard& operator=(Guard&& other) noexcept {
+            if (this != &other) {
+                release();
+                manager = other.manager;
+                slot = other.slot;
+                pinned = other.pinned;
+                other.manager = nullptr;
+            }
+            return *this;
+        }
+        ~Guard() { release(); }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        void release() {
+            if (manager) {
+                manager->unpin(slot, pinned);
+                manager = nullptr;
+            }
+        }
+
+    private:
+        friend class EpochManager;
+
+        const EpochManager* manager;
+        size_t slot;     // Slots marks a pin in the overflow list
+        uint64_t pinned; // the pinned epoch
+
+        Guard(const EpochManager* manager, size_t slot, uint64_t pinned)
+            : manager(manager), slot(slot), pinned(pinned) {}
+    };
+
+    EpochManager() : epoch(1), overflowPins(0) {
+        for (Slot& s : slots) {
+            s.pinned.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Pins the current epoch. The pin is sequentially consistent, so a load made after
+    // it sees every pointer a writer unlinked before it scanned the pins.
+    Guard pin() const {
+        size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (size_t tries = 0; tries < Slots; tries++) {
+            size_t i = (start + tries) % Slots;
+            uint64_t expected = 0;
+            uint64_t current = epoch.load();
+            if (slots[i].pinned.load(std::memory_order_relaxed) == 0 &&
+                slots[i].pinned.compare_exchange_strong(expected, current)) {
+                return Guard(this, i, current);
+            }
+        }
+
+        // Every slot is pinned. The count goes up before the epoch is read, so a writer
+        // that still sees it at zero has advanced past anything this reader can reach.
+        overflowPins.fetch_add(1);
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        uint64_t current = epoch.load();
+        overflow.insert(current);
+        return Guard(this, Slots, current);
+    }
+
+    // Starts a new epoch and returns the one it closes, the tag of what was just unlinked
+    uint64_t advance() {
+        return epoch.fetch_add(1);
+    }
+
+    // The oldest epoch still pinned, or the current one when no reader is pinned.
+    // Anything tagged below it is unreachable.
+    uint64_t oldestPinned() const {
+        uint64_t oldest = epoch.load();
+        for (const Slot& s : slots) {
+            uint64_t pinned = s.pinned.load();
+            if (pinned != 0) {
+                oldest = std::min(oldest, pinned);
+            }
+        }
+        if (overflowPins.load() != 0) {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            if (!overflow.empty()) {
+                oldest = std::min(oldest, *overflow.begin());
+            }
+        }
+        return oldest;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> pinned; // 0 when free
+    };
+
+    std::atomic<uint64_t> epoch;
+    mutable Slot slots[Slots];
+    // Pins that found every slot taken
+    mutable std::atomic<size_t> overflowPins;
+    mutable std::mutex overflowMutex;
+    mutable std::multiset<uint64_t> overflow;
+
+    void unpin(size_t slot, uint64_t pinned) const {
+        if (slot < Slots) {
+            slots[slot].pinned.store(0, std::memory_order_release);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            overflow.erase(overflow.find(pinned));
+        }
+        overflowPins.fetch_sub(1);
+    }
+};
+
+#endif // EPOCH_H
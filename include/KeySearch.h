@@ -0,0 +1,234 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Position search within the sorted key array of a B+ tree node.
+ *        upperBound returns the index of the first key > x and lowerBound the index
+ *        of the first key >= x, like std::upper_bound / std::lower_bound.
+ *
+ *        The generic version works for any ordered key type. float, int32 and int64
+ *        keys get a branchless version instead: a binary search whose steps compile
+ *        to conditional moves narrows the array to a small block, and the block is
+ *        finished with a compare-and-count (AVX-512 or AVX2 when the compiler targets
+ *        them, a plain counting loop otherwise). This avoids the branch mispredictions
+ *        that dominate std::upper_bound on large nodes.
+ *
+ *        MaxKeys, when non-zero, is a compile-time bound on n (the key capacity of a
+ *        tree with a fixed order). Nodes that fit in one block then skip the halving
+ *        loop entirely, and larger ones run it for a fixed number of steps the
+ *        compiler can unroll.
+ */
+template <typename KeyType, int MaxKeys = 0>
+struct KeySearch {
+    static int upperBound(const KeyType* keys, int n, const KeyType& x) {
+        return (int)(std::upper_bound(keys, keys + n, x) - keys);
+    }
+    static int lowerBound(const KeyType* keys, int n, const KeyType& x) {
+        return (int)(std::lower_bound(keys, keys + n, x) - keys);
+    }
+};
+
+namespace keysearch {
+
+// Blocks at most this long are finished by counting instead of halving
+const int LinearBlock = 64;
+
+// Scalar counting loops, used for tails and when no SIMD target is enabled
+template <typename KeyType>
+inline int countLessOrEqualScalar(const KeyType* keys, int n, KeyType x) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        count += keys[i] <= x;
+    }
+    return count;
+}
+
+template <typename KeyType>
+inline int countLessScalar(const KeyType* keys, int n, KeyType x) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        count += keys[i] < x;
+    }
+    return count;
+}
+
+inline int countLessOrEqual(const float* keys, int n, float x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512 vx = _mm512_set1_ps(x);
+    for (; i + 16 <= n; i += 16) {
+        count += __builtin_popcount(_mm512_cmp_ps_mask(_mm512_loadu_ps(keys + i), vx, _CMP_LE_OQ));
+    }
+#elif defined(__AVX2__)
+    __m256 vx = _mm256_set1_ps(x);
+    for (; i + 8 <= n; i += 8) {
+        __m256 le = _mm256_cmp_ps(_mm256_loadu_ps(keys + i), vx, _CMP_LE_OQ);
+        count += __builtin_popcount(_mm256_movemask_ps(le));
+    }
+#endif
+    return count + countLessOrEqualScalar(keys + i, n - i, x);
+}
+
+inline int countLess(const float* keys, int n, float x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512 vx = _mm512_set1_ps(x);
+    for (; i + 16 <= n; i += 16) {
+        count += __builtin_popcount(_mm512_cmp_ps_mask(_mm512_loadu_ps(keys + i), vx, _CMP_LT_OQ));
+    }
+#elif defined(__AVX2__)
+    __m256 vx = _mm256_set1_ps(x);
+    for (; i + 8 <= n; i += 8) {
+        __m256 lt = _mm256_cmp_ps(_mm256_loadu_ps(keys + i), vx, _CMP_LT_OQ);
+        count += __builtin_popcount(_mm256_movemask_ps(lt));
+    }
+#endif
+    return count + countLessScalar(keys + i, n - i, x);
+}
+
+inline int countLessOrEqual(const std::int32_t* keys, int n, std::int32_t x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512i vx = _mm512_set1_epi32(x);
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void*)(keys + i));
+        count += __builtin_popcount(_mm512_cmple_epi32_mask(v, vx));
+    }
+#elif defined(__AVX2__)
+    __m256i vx = _mm256_set1_epi32(x);
+    for (; i + 8 <= n; i += 8) {
+        // key <= x  <=>  !(key > x)
+        __m256i gt = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(keys + i)), vx);
+        count += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(gt)));
+    }
+#endif
+    return count + countLessOrEqualScalar(keys + i, n - i, x);
+}
+
+inline int countLess(const std::int32_t* keys, int n, std::int32_t x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512i vx = _mm512_set1_epi32(x);
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void*)(keys + i));
+        count += __builtin_popcount(_mm512_cmplt_epi32_mask(v, vx));
+    }
+#elif defined(__AVX2__)
+    __m256i vx = _mm256_set1_epi32(x);
+    for (; i + 8 <= n; i += 8) {
+        // key < x  <=>  x > key
+        __m256i lt = _mm256_cmpgt_epi32(vx, _mm256_loadu_si256((const __m256i*)(keys + i)));
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+    }
+#endif
+    return count + countLessScalar(keys + i, n - i, x);
+}
+
+inline int countLessOrEqual(const std::int64_t* keys, int n, std::int64_t x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512i vx = _mm512_set1_epi64(x);
+    for (; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_loadu_si512((const void*)(keys + i));
+        count += __builtin_popcount(_mm512_cmple_epi64_mask(v, vx));
+    }
+#elif defined(__AVX2__)
+    __m256i vx = _mm256_set1_epi64x(x);
+    for (; i + 4 <= n; i += 4) {
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*)(keys + i)), vx);
+        count += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(gt)));
+    }
+#endif
+    return count + countLessOrEqualScalar(keys + i, n - i, x);
+}
+
+inline int countLess(const std::int64_t* keys, int n, std::int64_t x) {
+    int i = 0, count = 0;
+#if defined(__AVX512F__)
+    __m512i vx = _mm512_set1_epi64(x);
+    for (; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_loadu_si512((const void*)(keys + i));
+        count += __builtin_popcount(_mm512_cmplt_epi64_mask(v, vx));
+    }
+#elif defined(__AVX2__)
+    __m256i vx = _mm256_set1_epi64x(x);
+    for (; i + 4 <= n; i += 4) {
+        __m256i lt = _mm256_cmpgt_epi64(vx, _mm256_loadu_si256((const __m256i*)(keys + i)));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+    }
+#endif
+    return count + countLessScalar(keys + i, n - i, x);
+}
+
+// Halving steps that bring any n <= maxKeys down to one block (each step leaves ceil(len / 2))
+constexpr int halvingSteps(int maxKeys) {
+    return maxKeys <= LinearBlock ? 0 : 1 + halvingSteps(maxKeys - maxKeys / 2);
+}
+
+/**
+ * @brief Branchless search shared by the arithmetic specializations.
+ *        Invariant: every key before `base` satisfies the predicate and no key at or
+ *        after base + len does, so the answer is (base - keys) plus the count of
+ *        matching keys in the final block.
+ */
+template <typename KeyType, int MaxKeys>
+struct ArithmeticKeySearch {
+    static int upperBound(const KeyType* keys, int n, const KeyType& x) {
+        const KeyType* base = keys;
+        int len = n;
+        if (MaxKeys > 0) {
+            // A step on a block that is already small enough leaves it unchanged
+            for (int step = 0; step < halvingSteps(MaxKeys); step++) {
+                int half = len > LinearBlock ? len / 2 : 0;
+                base = (half > 0 && base[half - 1] <= x) ? base + half : base;
+                len -= half;
+            }
+        } else {
+            while (len > LinearBlock) {
+                int half = len / 2;
+                base = (base[half - 1] <= x) ? base + half : base;
+                len -= half;
+            }
+        }
+        return (int)(base - keys) + countLessOrEqual(base, len, x);
+    }
+
+    static int lowerBound(const KeyType* keys, int n, const KeyType& x) {
+        const KeyType* base = keys;
+        int len = n;
+        if (MaxKeys > 0) {
+            for (int step = 0; step < halvingSteps(MaxKeys); step++) {
+                int half = len > LinearBlock ? len / 2 : 0;
+                base = (half > 0 && base[half - 1] < x) ? base + half : base;
+                len -= half;
+            }
+        } else {
+            while (len > LinearBlock) {
+                int half = len / 2;
+                base = (base[half - 1] < x) ? base + half : base;
+                len -= half;
+            }
+        }
+        return (int)(base - keys) + countLess(base, len, x);
+    }
+};
+
+} // namespace keysearch
+
+template <int MaxKeys>
+struct KeySearch<float, MaxKeys> : keysearch::ArithmeticKeySearch<float, MaxKeys> {};
+
+template <int MaxKeys>
+struct KeySearch<std::int32_t, MaxKeys> : keysearch::ArithmeticKeySearch<std::int32_t, MaxKeys> {};
+
+template <int MaxKeys>
+struct KeySearch<std::int64_t, MaxKeys> : keysearch::ArithmeticKeySearch<std::int64_t, MaxKeys> {};
+
+#endif // KEY_SEARCH_H
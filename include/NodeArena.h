@@ -0,0 +1,297 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Slab allocator for the fixed-size node blocks of one B+ tree.
+ *        Blocks are carved out of large cache-line aligned slabs and recycled
+ *        through a free list, so building a tree costs one allocation per slab
+ *        and tearing it down releases a handful of slabs.
+ */
+class NodeArena {
+public:
+    static const size_t CacheLine = 64;
+
+    explicit NodeArena(size_t blockSize)
+        : blockSize(alignUp(std::max(blockSize, sizeof(FreeBlock)), CacheLine)),
+          blocksPerSlab(std::max<size_t>(16, (256 * 1024) / this->blockSize)),
+          cursor(nullptr), slabEnd(nullptr), freeList(nullptr) {}
+
+    ~NodeArena() {
+        for (void* slab : slabs) {
+            ::operator delete(slab, std::align_val_t(CacheLine));
+        }
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    // Returns an uninitialized block of blockSize bytes, aligned to a cache line
+    void* allocate() {
+        if (freeList) {
+            FreeBlock* block = freeList;
+            freeList = block->next;
+            return block;
+        }
+        if (cursor == slabEnd) {
+            char* slab = static_cast<char*>(::operator new(blockSize * blocksPerSlab, std::align_val_t(CacheLine)));
+            slabs.push_back(slab);
+            cursor = slab;
+            slabEnd = slab + blockSize * blocksPerSlab;
+        }
+        void* block = cursor;
+        cursor += blockSize;
+        return block;
+    }
+
+    // Returns a block to the arena; the memory is reused by later allocations
+    void deallocate(void* block) {
+        FreeBlock* freed = static_cast<FreeBlock*>(block);
+        freed->next = freeList;
+        freeList = freed;
+    }
+
+    size_t getBlockSize() const {
+        return blockSize;
+    }
+
+    static size_t alignUp(size_t n, size_t alignment) {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    size_t blockSize;
+    size_t blocksPerSlab;
+    std::vector<char*> slabs;
+    char* cursor;
+    char* slabEnd;
+    FreeBlock* freeList;
+};
+
+/**
+ * @brief A one-word reader/writer spin latch embedded in every node.
+ *        Held only for the short time an operation works on one node, so spinning
+ *        is cheaper than a kernel mutex. A waiting writer blocks new readers, which
+ *        keeps a steady stream of readers from starving inserts.
+ */
+class NodeLatch {
+public:
+    NodeLatch() : state(0), waitingWriters(0) {}
+
+    NodeLatch(const NodeLatch&) = delete;
+    NodeLatch& operator=(const NodeLatch&) = delete;
+
+    void lockShared() {
+        for (int spins = 0;; spins++) {
+            int s = state.load(std::memory_order_relaxed);
+            if (s >= 0 && waitingWriters.load(std::memory_order_relaxed) == 0 &&
+                state.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+                return;
+            }
+            backoff(spins);
+        }
+    }
+
+    void unlockShared() {
+        state.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() {
+        waitingWriters.fetch_add(1, std::memory_order_relaxed);
+        for (int spins = 0;; spins++) {
+            int expected = 0;
+            if (state.compare_exchange_weak(expected, -1, std::memory_order_acquire)) {
+                break;
+            }
+            backoff(spins);
+        }
+        waitingWriters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        state.store(0, std::memory_order_release);
+    }
+
+private:
+    std::atomic<int> state; // -1: held by a writer, n > 0: held by n readers
+    std::atomic<int> waitingWriters;
+
+    static void backoff(int spins) {
+        if (spins >= 64) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+/**
+ * @brief Byte offsets of the inline arrays inside a node block:
+ *        [ node header | keys[capacity] | children[capacity + 1] or values[capacity] ].
+ *        Leaves use the last region for values, internal nodes for child pointers.
+ */
+struct NodeLayout {
+    size_t keyOffset;
+    size_t slotOffset;
+    size_t blockSize;
+
+    template <typename Header, typename Key, typename Child, typename Value>
+    static NodeLayout make(int capacity) {
+        NodeLayout layout;
+        size_t slotAlign = std::max(alignof(Child), alignof(Value));
+        layout.keyOffset = NodeArena::alignUp(sizeof(Header), alignof(Key));
+        layout.slotOffset = NodeArena::alignUp(layout.keyOffset + capacity * sizeof(Key), slotAlign);
+        layout.blockSize = layout.slotOffset + std::max((capacity + 1) * sizeof(Child), capacity * sizeof(Value));
+        return layout;
+    }
+};
+
+/**
+ * @brief A vector-like array with a fixed capacity over storage it does not own.
+ *        Nodes use it for their inline key, child and value arrays; it supports the
+ *        subset of the std::vector interface the trees need and throws
+ *        std::length_error instead of growing.
+ */
+template <typename T>
+class FixedArray {
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    FixedArray() : items(nullptr), count(0), capacity(0) {}
+    FixedArray(void* storage, size_t capacity)
+        : items(static_cast<T*>(storage)), count(0), capacity(capacity) {}
+    ~FixedArray() { clear(); }
+
+    FixedArray(const FixedArray&) = delete;
+    FixedArray& operator=(const FixedArray&) = delete;
+
+    iterator begin() { return items; }
+    iterator end() { return items + count; }
+    const_iterator begin() const { return items; }
+    const_iterator end() const { return items + count; }
+
+    size_t size() const { return count; }
+    size_t max_size() const { return capacity; }
+    bool empty() const { return count == 0; }
+    T* data() { return items; }
+    const T* data() const { return items; }
+
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T& front() { return items[0]; }
+    const T& front() const { return items[0]; }
+    T& back() { return items[count - 1]; }
+    const T& back() const { return items[count - 1]; }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        reserveOne();
+        new (items + count) T(std::forward<Args>(args)...);
+        return items[count++];
+    }
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    void pop_back() {
+        items[--count].~T();
+    }
+
+    iterator insert(iterator pos, T value) {
+        size_t index = pos - items;
+        reserveOne();
+        if (index == count) {
+            new (items + count) T(std::move(value));
+        } else {
+            // Open a gap by moving the tail one slot to the right
+            new (items + count) T(std::move(items[count - 1]));
+            std::move_backward(items + index, items + count - 1, items + count);
+            items[index] = std::move(value);
+        }
+        count++;
+        return items + index;
+    }
+
+    template <typename InputIt>
+    void insert(iterator pos, InputIt first, InputIt last) {
+        size_t index = pos - items;
+        size_t n = std::distance(first, last);
+        if (count + n > capacity) {
+            throw std::length_error("FixedArray capacity exceeded");
+        }
+        // Append, then rotate the new elements into place
+        for (; first != last; ++first) {
+            new (items + count) T(*first);
+            count++;
+        }
+        std::rotate(items + index, items + count - n, items + count);
+    }
+
+    iterator erase(iterator pos) {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last) {
+        iterator newEnd = std::move(last, end(), first);
+        while (end() != newEnd) {
+            pop_back();
+        }
+        return first;
+    }
+
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
+
+    void resize(size_t n) {
+        if (n > capacity) {
+            throw std::length_error("FixedArray capacity exceeded");
+        }
+        while (count > n) {
+            pop_back();
+        }
+        while (count < n) {
+            new (items + count) T();
+            count++;
+        }
+    }
+
+    void clear() {
+        if (std::is_trivially_destructible<T>::value) {
+            count = 0;
+        }
+        while (count > 0) {
+            pop_back();
+        }
+    }
+
+private:
+    T* items;
+    size_t count;
+    size_t capacity;
+
+    void reserveOne() const {
+        if (count == capacity) {
+            throw std::length_error("FixedArray capacity exceeded");
+        }
+    }
+};
+
+#endif // NODE_ARENA_H
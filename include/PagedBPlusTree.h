@@ -0,0 +1,476 @@
+#ifndef PAGED_BPLUSTREE_H
+#define PAGED_BPLUSTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "BufferPool.h"
+
+/**
+ * @brief A B+ tree whose nodes are fixed-size pages of a file, cached by a BufferPool.
+ *
+ * Nodes refer to each other by PageId instead of pointers, so the tree lives on disk
+ * and only the pages the buffer pool's memory budget allows stay in RAM. The node
+ * capacity follows from the page size, which takes the role the order plays for
+ * BPlusTree4.
+ *
+ * Page 0 holds the metadata (root, height, number of entries); every other page is a
+ * node starting with a PageHeader:
+ *   leaf:     keys[leafCapacity], values[leafCapacity], next leaf
+ *   internal: keys[innerCapacity], children[innerCapacity + 1], counts[innerCapacity + 1]
+ * An internal node keeps the number of entries under each child next to the child's
+ * PageId, so counting never has to read a page off the descent path.
+ *
+ * Duplicate keys are stored as separate entries and may span leaves. A child's keys
+ * are >= the separator on its left and <= the separator on its right.
+ *
+ * KeyType and ValueType must be trivially copyable. Not thread-safe.
+ */
+template <typename KeyType, typename ValueType>
+class PagedBPlusTree {
+public:
+    static_assert(std::is_trivially_copyable<KeyType>::value, "Paged keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<ValueType>::value, "Paged values must be trivially copyable");
+
+    /**
+     * @brief Opens the tree stored in a file, or creates an empty one.
+     * @param path         The page file.
+     * @param pageSize     Page size in bytes, a multiple of 64. Must match an existing file.
+     * @param memoryBudget Memory the buffer pool may use for cached pages, in bytes.
+     * @throws std::invalid_argument if the page is too small to hold three keys.
+     * @throws std::runtime_error if the file cannot be opened or holds another tree.
+     */
+    PagedBPlusTree(const std::string& path, size_t pageSize = 4096, size_t memoryBudget = 64 << 20);
+
+    ~PagedBPlusTree();
+
+    PagedBPlusTree(const PagedBPlusTree&) = delete;
+    PagedBPlusTree& operator=(const PagedBPlusTree&) = delete;
+
+    // Insert a (key, value) pair
+    void insert(const KeyType& key, const ValueType& value);
+
+    // Count how many keys are ≤ x
+    int countLessOrEqual(const KeyType& x) const;
+
+    // Count how many keys are in [Smin, Smax]
+    int countInRange(const KeyType& Smin, const KeyType& Smax) const;
+
+    // Range query: return all values associated with keys in [Smin, Smax]
+    std::vector<ValueType> rangeQuery(const KeyType& Smin, const KeyType& Smax) const;
+
+    // Number of (key, value) pairs stored
+    size_t size() const { return entries; }
+
+    // Write all dirty pages and the metadata to the file
+    void flush();
+
+    size_t getPageSize() const { return pageSize; }
+    size_t getLeafCapacity() const { return leafCapacity; }
+    size_t getInnerCapacity() const { return innerCapacity; }
+    const BufferPool& getBufferPool() const { return pool; }
+
+private:
+    struct PageHeader {
+        uint32_t isLeaf;
+        uint32_t count;  // keys in the node
+        PageId next;     // next leaf, 0 if none (page 0 is never a node)
+        uint32_t unused;
+    };
+
+    struct Meta {
+        char magic[8];
+        uint32_t version;
+        uint32_t pageSize;
+        uint32_t keySize;
+        uint32_t valueSize;
+        PageId root;
+        uint32_t height; // 1 when the root is a leaf
+        uint64_t entries;
+    };
+
+    static const uint32_t FormatVersion = 1;
+
+    size_t pageSize;
+    mutable PageFile file;
+    mutable BufferPool pool;
+
+    // Node layout within a page
+    size_t leafCapacity;
+    size_t leafValuesOffset;
+    size_t innerCapacity;
+    size_t innerChildrenOffset;
+    size_t innerCountsOffset;
+
+    PageId root;
+    uint32_t height;
+    uint64_t entries;
+
+    static size_t alignUp(size_t n, size_t alignment) {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+    void computeLayout();
+    void writeMeta();
+
+    PageHeader* header(char* page) const { return reinterpret_cast<PageHeader*>(page); }
+    KeyType* keysOf(char* page) const { return reinterpret_cast<KeyType*>(page + sizeof(PageHeader)); }
+    ValueType* valuesOf(char* page) const { return reinterpret_cast<ValueType*>(page + leafValuesOffset); }
+    PageId* childrenOf(char* page) const { return reinterpret_cast<PageId*>(page + innerChildrenOffset); }
+    uint64_t* countsOf(char* page) const { return reinterpret_cast<uint64_t*>(page + innerCountsOffset); }
+
+    // Index of the first key > x (upper) or >= x (lower) among n keys
+    static size_t upperIndex(const KeyType* keys, size_t n, const KeyType& x) {
+        return std::upper_bound(keys, keys + n, x) - keys;
+    }
+    static size_t lowerIndex(const KeyType* keys, size_t n, const KeyType& x) {
+        return std::lower_bound(keys, keys + n, x) - keys;
+    }
+
+    // Number of keys < x (strict) or <= x
+    uint64_t countBelow(const KeyType& x, bool inclusive) const;
+};
+
+
+
+
+
+template <typename KeyType, typename ValueType>
+PagedBPlusTree<KeyType, ValueType>::PagedBPlusTree(const std::string& path, size_t pageSize, size_t memoryBudget)
+    : pageSize(pageSize), file(path, pageSize), pool(file, memoryBudget), root(0), height(1), entries(0) {
+
+    computeLayout();
+    if (file.pageCount() == 0) {
+        // New file: the metadata page and an empty root leaf
+        BufferPool::Page meta = pool.allocate();
+        BufferPool::Page leaf = pool.allocate();
+        header(leaf.data())->isLeaf = 1;
+        root = leaf.getId();
+        writeMeta();
+        return;
+    }
+
+    BufferPool::Page page = pool.fetch(0);
+    Meta meta;
+    std::memcpy(&meta, page.data(), sizeof(Meta));
+    if (std::memcmp(meta.magic, "BPTPAGED", 8) != 0 || meta.version != FormatVersion) {
+        throw std::runtime_error("Not a paged B+ tree file: " + path);
+    }
+    if (meta.pageSize != pageSize || meta.keySize != sizeof(KeyType) || meta.valueSize != sizeof(ValueType)) {
+        throw std::runtime_error("Paged B+ tree file " + path + " uses another page size or key/value types");
+    }
+    root = meta.root;
+    height = meta.height;
+    entries = meta.entries;
+}
+
+template <typename KeyType, typename ValueType>
+PagedBPlusTree<KeyType, ValueType>::~PagedBPlusTree() {
+    writeMeta();
+    // The buffer pool writes back the dirty pages when it is destroyed
+}
+
+template <typename KeyType, typename ValueType>
+void PagedBPlusTree<KeyType, ValueType>::computeLayout() {
+
+    /**
+     * @brief Fits as many entries as possible into a page, keeping each array aligned.
+     */
+
+    if (pageSize % 64 != 0) {
+        throw std::invalid_argument("Page size must be a multiple of 64 bytes");
+    }
+    size_t base = sizeof(PageHeader);
+
+    leafCapacity = (pageSize - base) / (sizeof(KeyType) + sizeof(ValueType));
+    while (leafCapacity > 0 &&
+           alignUp(base + leafCapacity * sizeof(KeyType), alignof(ValueType)) + leafCapacity * sizeof(ValueType) > pageSize) {
+        leafCapacity--;
+    }
+    leafValuesOffset = alignUp(base + leafCapacity * sizeof(KeyType), alignof(ValueType));
+
+    auto innerBytes = [&](size_t n) {
+        size_t children = alignUp(base + n * sizeof(KeyType), alignof(PageId));
+        size_t counts = alignUp(children + (n + 1) * sizeof(PageId), alignof(uint64_t));
+        return counts + (n + 1) * sizeof(uint64_t);
+    };
+    innerCapacity = (pageSize - base) / (sizeof(KeyType) + sizeof(PageId) + sizeof(uint64_t));
+    while (innerCapacity > 0 && innerBytes(innerCapacity) > pageSize) {
+        innerCapacity--;
+    }
+    innerChildrenOffset = alignUp(base + innerCapacity * sizeof(KeyType), alignof(PageId));
+    innerCountsOffset = alignUp(innerChildrenOffset + (innerCapacity + 1) * sizeof(PageId), alignof(uint64_t));
+
+    if (leafCapacity < 3 || innerCapacity < 3) {
+        throw std::invalid_argument("Page size too small for the key and value types");
+    }
+}
+
+template <typename KeyType, typename ValueType>
+void PagedBPlusTree<KeyType, ValueType>::writeMeta() {
+    Meta meta;
+    std::memset(&meta, 0, sizeof(Meta));
+    std::memcpy(meta.magic, "BPTPAGED", 8);
+    meta.version = FormatVersion;
+    meta.pageSize = (uint32_t)pageSize;
+    meta.keySize = sizeof(KeyType);
+    meta.valueSize = sizeof(ValueType);
+    meta.root = root;
+    meta.height = height;
+    meta.entries = entries;
+
+    BufferPool::Page page = pool.fetch(0);
+    std::memcpy(page.data(), &meta, sizeof(Meta));
+    page.markDirty();
+}
+
+template <typename KeyType, typename ValueType>
+void PagedBPlusTree<KeyType, ValueType>::flush() {
+    writeMeta();
+    pool.flush();
+}
+
+template <typename KeyType, typename ValueType>
+void PagedBPlusTree<KeyType, ValueType>::insert(const KeyType& key, const ValueType& value) {
+
+    /**
+     * @brief Inserts a key-value pair. Equal keys are kept in insertion order.
+     *        The descent bumps the per-child counts on the way down; a split then
+     *        divides the count of the child that split between the two halves.
+     * @param key The key to insert.
+     * @param value The value associated with the key.
+     */
+
+    std::vector<std::pair<PageId, size_t>> path; // internal pages and the child taken, root first
+    PageId id = root;
+    for (uint32_t level = 1; level < height; level++) {
+        BufferPool::Page page = pool.fetch(id);
+        char* p = page.data();
+        size_t i = upperIndex(keysOf(p), header(p)->count, key);
+        countsOf(p)[i]++;
+        page.markDirty();
+        path.push_back({id, i});
+        id = childrenOf(p)[i];
+    }
+    entries++;
+
+    // Insert into the leaf, splitting it if it is full
+    KeyType separator;
+    PageId newChild;
+    uint64_t leftCount, rightCount;
+    {
+        BufferPool::Page leaf = pool.fetch(id);
+        char* p = leaf.data();
+        size_t n = header(p)->count;
+        KeyType* keys = keysOf(p);
+        ValueType* values = valuesOf(p);
+        size_t pos = upperIndex(keys, n, key);
+        leaf.markDirty();
+        if (n < leafCapacity) {
+            std::memmove(keys + pos + 1, keys + pos, (n - pos) * sizeof(KeyType));
+            std::memmove(values + pos + 1, values + pos, (n - pos) * sizeof(ValueType));
+            keys[pos] = key;
+            values[pos] = value;
+            header(p)->count++;
+            return;
+        }
+
+        std::vector<KeyType> allKeys(keys, keys + n);
+        std::vector<ValueType> allValues(values, values + n);
+        allKeys.insert(allKeys.begin() + pos, key);
+        allValues.insert(allValues.begin() + pos, value);
+        size_t mid = (n + 1) / 2;
+
+        BufferPool::Page right = pool.allocate();
+        char* r = right.data();
+        header(r)->isLeaf = 1;
+        header(r)->count = (uint32_t)(n + 1 - mid);
+        std::copy(allKeys.begin() + mid, allKeys.end(), keysOf(r));
+        std::copy(allValues.begin() + mid, allValues.end(), valuesOf(r));
+        header(r)->next = header(p)->next;
+
+        header(p)->count = (uint32_t)mid;
+        std::copy(allKeys.begin(), allKeys.begin() + mid, keys);
+        std::copy(allValues.begin(), allValues.begin() + mid, values);
+        header(p)->next = right.getId();
+
+        separator = allKeys[mid];
+        newChild = right.getId();
+        leftCount = mid;
+        rightCount = n + 1 - mid;
+    }
+
+    // Insert the separator into the parents, splitting them as needed
+    while (!path.empty()) {
+        PageId parentId = path.back().first;
+        size_t i = path.back().second;
+        path.pop_back();
+
+        BufferPool::Page parent = pool.fetch(parentId);
+        char* p = parent.data();
+        parent.markDirty();
+        size_t n = header(p)->count;
+        KeyType* keys = keysOf(p);
+        PageId* children = childrenOf(p);
+        uint64_t* counts = countsOf(p);
+        if (n < innerCapacity) {
+            std::memmove(keys + i + 1, keys + i, (n - i) * sizeof(KeyType));
+            std::memmove(children + i + 2, children + i + 1, (n - i) * sizeof(PageId));
+            std::memmove(counts + i + 2, counts + i + 1, (n - i) * sizeof(uint64_t));
+            keys[i] = separator;
+            children[i + 1] = newChild;
+            counts[i] = leftCount;
+            counts[i + 1] = rightCount;
+            header(p)->count++;
+            return;
+        }
+
+        std::vector<KeyType> allKeys(keys, keys + n);
+        std::vector<PageId> allChildren(children, children + n + 1);
+        std::vector<uint64_t> allCounts(counts, counts + n + 1);
+        allKeys.insert(allKeys.begin() + i, separator);
+        allChildren.insert(allChildren.begin() + i + 1, newChild);
+        allCounts[i] = leftCount;
+        allCounts.insert(allCounts.begin() + i + 1, rightCount);
+
+        // n + 1 keys: the middle one moves up, the halves keep mid and n - mid keys
+        size_t mid = (n + 1) / 2;
+        BufferPool::Page right = pool.allocate();
+        char* r = right.data();
+        header(r)->isLeaf = 0;
+        header(r)->count = (uint32_t)(n - mid);
+        std::copy(allKeys.begin() + mid + 1, allKeys.end(), keysOf(r));
+        std::copy(allChildren.begin() + mid + 1, allChildren.end(), childrenOf(r));
+        std::copy(allCounts.begin() + mid + 1, allCounts.end(), countsOf(r));
+
+        header(p)->count = (uint32_t)mid;
+        std::copy(allKeys.begin(), allKeys.begin() + mid, keys);
+        std::copy(allChildren.begin(), allChildren.begin() + mid + 1, children);
+        std::copy(allCounts.begin(), allCounts.begin() + mid + 1, counts);
+
+        separator = allKeys[mid];
+        newChild = right.getId();
+        leftCount = 0;
+        rightCount = 0;
+        for (size_t c = 0; c <= mid; c++) leftCount += allCounts[c];
+        for (size_t c = mid + 1; c < allCounts.size(); c++) rightCount += allCounts[c];
+    }
+
+    // The root split: grow the tree by one level
+    BufferPool::Page newRoot = pool.allocate();
+    char* p = newRoot.data();
+    header(p)->isLeaf = 0;
+    header(p)->count = 1;
+    keysOf(p)[0] = separator;
+    childrenOf(p)[0] = root;
+    childrenOf(p)[1] = newChild;
+    countsOf(p)[0] = leftCount;
+    countsOf(p)[1] = rightCount;
+    root = newRoot.getId();
+    height++;
+}
+
+template <typename KeyType, typename ValueType>
+uint64_t PagedBPlusTree<KeyType, ValueType>::countBelow(const KeyType& x, bool inclusive) const {
+
+    /**
+     * @brief Counts the keys < x, or <= x if inclusive, from the per-child counts of
+     *        the internal nodes on one root-to-leaf path.
+     */
+
+    uint64_t count = 0;
+    PageId id = root;
+    for (uint32_t level = 1; level < height; level++) {
+        BufferPool::Page page = pool.fetch(id);
+        char* p = page.data();
+        size_t n = header(p)->count;
+        size_t i = inclusive ? upperIndex(keysOf(p), n, x) : lowerIndex(keysOf(p), n, x);
+        const uint64_t* counts = countsOf(p);
+        for (size_t c = 0; c < i; c++) {
+            count += counts[c];
+        }
+        id = childrenOf(p)[i];
+    }
+    BufferPool::Page leaf = pool.fetch(id);
+    char* p = leaf.data();
+    size_t n = header(p)->count;
+    count += inclusive ? upperIndex(keysOf(p), n, x) : lowerIndex(keysOf(p), n, x);
+    return count;
+}
+
+template <typename KeyType, typename ValueType>
+int PagedBPlusTree<KeyType, ValueType>::countLessOrEqual(const KeyType& x) const {
+
+    /**
+     * @brief Counts the number of keys less than or equal to a given value.
+     * @param x The value to compare.
+     * @return The count of keys less than or equal to x.
+     */
+
+    return (int)countBelow(x, true);
+}
+
+template <typename KeyType, typename ValueType>
+int PagedBPlusTree<KeyType, ValueType>::countInRange(const KeyType& Smin, const KeyType& Smax) const {
+
+    /**
+     * @brief Counts the number of keys within a specified range [Smin, Smax].
+     *        Works for any key type: the keys below Smin are counted directly
+     *        instead of as the keys <= Smin - 1.
+     * @param Smin The lower bound of the range.
+     * @param Smax The upper bound of the range.
+     * @return The count of keys within the range.
+     */
+
+    if (Smax < Smin) return 0;
+    return (int)(countBelow(Smax, true) - countBelow(Smin, false));
+}
+
+template <typename KeyType, typename ValueType>
+std::vector<ValueType> PagedBPlusTree<KeyType, ValueType>::rangeQuery(const KeyType& Smin, const KeyType& Smax) const {
+
+    /**
+     * @brief Retrieves all values associated with keys within a specified range [Smin, Smax].
+     *        Descends to the leftmost leaf that can hold Smin, then follows the leaf chain,
+     *        keeping one page pinned at a time.
+     * @param Smin The lower bound of the range.
+     * @param Smax The upper bound of the range.
+     * @return A vector of values associated with keys in the range, in key order.
+     */
+
+    std::vector<ValueType> results;
+    PageId id = root;
+    for (uint32_t level = 1; level < height; level++) {
+        BufferPool::Page page = pool.fetch(id);
+        char* p = page.data();
+        id = childrenOf(p)[lowerIndex(keysOf(p), header(p)->count, Smin)];
+    }
+
+    BufferPool::Page leaf = pool.fetch(id);
+    size_t pos = lowerIndex(keysOf(leaf.data()), header(leaf.data())->count, Smin);
+    while (true) {
+        char* p = leaf.data();
+        size_t n = header(p)->count;
+        const KeyType* keys = keysOf(p);
+        const ValueType* values = valuesOf(p);
+        for (; pos < n; pos++) {
+            if (Smax < keys[pos]) {
+                return results;
+            }
+            results.push_back(values[pos]);
+        }
+        PageId next = header(p)->next;
+        if (next == 0) {
+            return results;
+        }
+        leaf = pool.fetch(next);
+        pos = 0;
+    }
+}
+
+#endif // PAGED_BPLUSTREE_H
@@ -0,0 +1,253 @@
+#ifndef QUERY_PLANNER_H
+#define QUERY_PLANNER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "./BPlusTree4.h"
+#include "./Distance.h"
+#include "./TopK.h"
+#include "./RangeFilter.h"
+
+/**
+ * @brief The ways a filtered k-NN query can be answered.
+ *        ExactScan ranks every in-range row fetched from the B+ tree. FilteredAnn runs
+ *        HNSW with the range predicate inside the traversal. PostFilteredAnn fetches
+ *        O unfiltered HNSW neighbours and keeps the in-range ones. PartitionedAnn
+ *        searches only the per-range graphs overlapping [Smin, Smax] (see ScalarPartitions).
+ */
+enum class QueryPlan { ExactScan, FilteredAnn, PostFilteredAnn, PartitionedAnn };
+
+inline const char* toString(QueryPlan plan) {
+    switch (plan) {
+        case QueryPlan::ExactScan: return "ExactScan";
+        case QueryPlan::FilteredAnn: return "FilteredAnn";
+        case QueryPlan::PostFilteredAnn: return "PostFilteredAnn";
+        case QueryPlan::PartitionedAnn: return "PartitionedAnn";
+    }
+    return "Unknown";
+}
+
+/**
+ * @brief The plan chosen for one query and the estimated cost of each alternative
+ *        in nanoseconds (infinity when a plan is not allowed or cannot return k results).
+ */
+struct PlanEstimate {
+    QueryPlan plan;
+    int matching;  // rows with s in [Smin, Smax]
+    int total;     // rows in the index
+    double exactCost;
+    double filteredCost;
+    double postFilterCost;
+    double partitionedCost; // set by indexes with partitions, infinity otherwise
+};
+
+/**
+ * @brief Cost-based choice between exact scan, filtered ANN and post-filtered ANN.
+ *
+ * The selectivity σ = matching / total comes from the tree's countInRange. The
+ * estimates are:
+ *   - exact: matching × (rangeEntry + scanDistance + heapPush), since each in-range
+ *     row is fetched from a leaf, ranked by the batched kernel and offered to the heap.
+ *   - filtered: HNSW must expand about max(ef, k) / σ nodes to collect ef in-range
+ *     ones; each expansion evaluates up to `neighbours` distances at random addresses.
+ *   - post-filtered: max(ef, O) expansions, but only when the O neighbours are expected
+ *     to hold k matches (O × σ >= k); otherwise its recall is too low to be an option.
+ * Both graph estimates are capped at the cost of visiting every node once.
+ *
+ * The per-operation costs are measured once per dimension by a short micro-benchmark
+ * (calibrated()), so the crossover points follow the machine and the kernels in use.
+ */
+class QueryPlanner {
+public:
+    /**
+     * @brief Per-operation costs in nanoseconds.
+     */
+    struct Costs {
+        double scanDistance;   // one distance on rows visited in ascending address order
+        double randomDistance; // one distance on a row at a random address (graph traversal)
+        double rangeEntry;     // fetching one matching id from the tree and sorting it
+        double heapPush;       // one candidate offered to a bounded heap
+    };
+
+    /**
+     * @brief A planner with nominal costs for vectors of @p dim floats (no measurement).
+     */
+    explicit QueryPlanner(int dim = 0) : costs(nominalCosts(dim)) {}
+
+    explicit QueryPlanner(const Costs& costs) : costs(costs) {}
+
+    /**
+     * @brief The planner for vectors of @p dim floats, calibrated with measure() on first
+     *        use and shared by every index of that dimension afterwards.
+     */
+    static const QueryPlanner& calibrated(int dim) {
+        static std::mutex cacheMutex;
+        static std::map<int, QueryPlanner> cache;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(dim);
+        if (it == cache.end()) {
+            it = cache.emplace(dim, QueryPlanner(measure(dim))).first;
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief Times each operation of the cost model on synthetic data of dimension @p dim.
+     *        Takes a few milliseconds.
+     */
+    static Costs measure(int dim) {
+        typedef std::chrono::steady_clock Clock;
+        Costs result = nominalCosts(dim);
+        if (dim <= 0) {
+            return result;
+        }
+
+        // About 4 MiB of rows: past the L2 cache, so random access pays for its misses
+        const size_t n = std::max<size_t>(256, std::min<size_t>(16384, (4u << 20) / (dim * sizeof(float))));
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<float> block(n * dim);
+        for (float& x : block) x = uniform(rng);
+        std::vector<float> query(block.begin(), block.begin() + dim);
+        DistanceFunction distanceFn(Metric::L2, dim);
+        std::vector<float> dists(n);
+        volatile float sink = 0.0f;
+
+        // Every other row in address order, as rankExact sees the sorted ids of a range
+        std::vector<const float*> sorted;
+        for (size_t i = 0; i < n; i += 2) sorted.push_back(block.data() + i * dim);
+        auto start = Clock::now();
+        const int Repeats = 4;
+        for (int r = 0; r < Repeats; r++) {
+            distanceFn.batch(query.data(), sorted.data(), sorted.size(), dim, dists.data());
+            sink = sink + dists[0];
+        }
+        result.scanDistance = elapsed(start, Clock::now()) / (Repeats * sorted.size());
+
+        // The same rows one pair at a time in random order, as HNSW evaluates neighbours
+        std::vector<const float*> shuffled(sorted);
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        start = Clock::now();
+        for (int r = 0; r < Repeats; r++) {
+            for (const float* row : shuffled) {
+                sink = sink + distanceFn(query.data(), row, dim);
+            }
+        }
+        result.randomDistance = elapsed(start, Clock::now()) / (Repeats * shuffled.size());
+
+        TopK best;
+        start = Clock::now();
+        for (int r = 0; r < Repeats; r++) {
+            best.reset(10);
+            for (size_t i = 0; i < n; i++) {
+                best.push(dists[i % sorted.size()] + uniform(rng), (int)i);
+            }
+            sink = sink + best.threshold();
+        }
+        result.heapPush = elapsed(start, Clock::now()) / (Repeats * n);
+
+        // Range queries over a tree of n random keys, then sorting the ids they return
+        std::vector<std::pair<float, int>> entries(n);
+        for (size_t i = 0; i < n; i++) entries[i] = {uniform(rng), (int)i};
+        std::sort(entries.begin(), entries.end());
+        BPlusTree<float, int> tree(16);
+        tree.bulkLoad(entries);
+        size_t fetched = 0;
+        start = Clock::now();
+        for (int r = 0; r < Repeats; r++) {
+            std::vector<int> ids = tree.rangeQuery(0.25f, 0.75f);
+            std::sort(ids.begin(), ids.end());
+            fetched += ids.size();
+        }
+        if (fetched > 0) {
+            result.rangeEntry = elapsed(start, Clock::now()) / fetched;
+        }
+        (void)sink;
+        return result;
+    }
+
+    /**
+     * @brief Picks the cheapest plan allowed by @p mode.
+     * @param total       Rows in the index.
+     * @param matching    Rows with s in [Smin, Smax].
+     * @param k           Neighbours requested.
+     * @param ef          HNSW search breadth.
+     * @param neighbours  Links per node on the bottom layer (2 × M in hnswlib).
+     * @param postFilterO Unfiltered neighbours a post-filtered search would fetch.
+     * @param mode        Auto considers every plan; InGraph and PostFilter restrict the
+     *                    graph search to that variant. ExactScan is always allowed.
+     */
+    PlanEstimate plan(int total, int matching, int k, int ef, int neighbours, int postFilterO,
+                      FilterMode mode = FilterMode::Auto) const {
+        const double Infinity = std::numeric_limits<double>::infinity();
+        PlanEstimate estimate;
+        estimate.total = total;
+        estimate.matching = matching;
+        estimate.exactCost = matching * (costs.rangeEntry + costs.scanDistance + costs.heapPush);
+        estimate.filteredCost = Infinity;
+        estimate.postFilterCost = Infinity;
+        estimate.partitionedCost = Infinity;
+
+        if (total > 0 && matching > 0) {
+            double selectivity = (double)matching / total;
+            double breadth = std::max(ef, k);
+            if (mode != FilterMode::PostFilter) {
+                estimate.filteredCost = graphCost(breadth / selectivity, total, neighbours);
+            }
+            if (mode != FilterMode::InGraph && postFilterO * selectivity >= k) {
+                estimate.postFilterCost = graphCost(std::max<double>(breadth, postFilterO), total, neighbours);
+            }
+        }
+
+        estimate.plan = QueryPlan::ExactScan;
+        double best = estimate.exactCost;
+        if (estimate.filteredCost < best) {
+            estimate.plan = QueryPlan::FilteredAnn;
+            best = estimate.filteredCost;
+        }
+        if (estimate.postFilterCost < best) {
+            estimate.plan = QueryPlan::PostFilteredAnn;
+        }
+        return estimate;
+    }
+
+    const Costs& getCosts() const {
+        return costs;
+    }
+
+private:
+    Costs costs;
+
+    // Rough figures for a SIMD kernel on cached data, used until measured
+    static Costs nominalCosts(int dim) {
+        double d = std::max(dim, 1);
+        Costs nominal;
+        nominal.scanDistance = 0.1 * d + 2.0;
+        nominal.randomDistance = 0.15 * d + 20.0;
+        nominal.rangeEntry = 8.0;
+        nominal.heapPush = 3.0;
+        return nominal;
+    }
+
+    // Cost of expanding `expansions` graph nodes, each evaluating its unvisited
+    // neighbours; no search evaluates more than every node once
+    double graphCost(double expansions, int total, int neighbours) const {
+        expansions = std::min<double>(expansions, total);
+        double evaluations = std::min<double>(expansions * std::max(neighbours, 1), total);
+        return evaluations * costs.randomDistance + expansions * costs.heapPush;
+    }
+
+    static double elapsed(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    }
+};
+
+#endif // QUERY_PLANNER_H
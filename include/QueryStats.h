@@ -0,0 +1,154 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "./QueryPlanner.h"
+
+/**
+ * @brief What one filtered k-NN query did, filled in by the vector indexes when a
+ *        query is given a QueryStats out-parameter.
+ *
+ * Candidates are the ids a plan examined: the in-range rows of an exact scan, or the
+ * neighbours the graph searches returned. The filter pass rate is the fraction of
+ * them inside the range, 1 for plans that only fetch matching rows. Graph distances
+ * count the distances HNSW computed; its visited list evaluates each node at most
+ * once per layer, so they are also the number of graph nodes the searches reached.
+ */
+struct QueryStats {
+    QueryPlan plan = QueryPlan::ExactScan;
+    bool planned = false;      // false if the query returned before planning (no data, no match, k <= 0)
+    int matching = 0;          // rows satisfying the filter (countInRange, or the predicate's bitmap)
+    int fetched = 0;           // O of the last post-filtered search, 0 for the other plans
+    int graphSearches = 0;     // HNSW searches run (post-filter escalations, one per partition)
+    size_t candidates = 0;     // ids fetched from the tree or the graph
+    size_t passed = 0;         // candidates inside the filter
+    size_t scanDistances = 0;  // exact distances computed by scans and re-ranking
+    size_t codeDistances = 0;  // SQ8 distances computed to pick a re-ranking short list
+    size_t graphDistances = 0; // distances computed by HNSW, i.e. graph nodes visited
+    size_t results = 0;
+
+    // Time spent in each phase, in nanoseconds
+    double countNs = 0.0;  // counting the matching rows
+    double planNs = 0.0;   // choosing the plan (and sizing O)
+    double searchNs = 0.0; // fetching and ranking the candidates
+    double totalNs = 0.0;
+
+    double passRate() const {
+        return candidates > 0 ? (double)passed / candidates : 1.0;
+    }
+};
+
+/**
+ * @brief Totals of the QueryStats of every query an index answered since it was
+ *        created or reset(). Updated with relaxed atomic adds once per query, so
+ *        concurrent queries never wait on each other; a totals() taken while queries
+ *        run may mix fields from before and after one of them.
+ */
+class QueryCounters {
+public:
+    struct Totals {
+        uint64_t queries;
+        uint64_t plans[4]; // queries per QueryPlan, indexed by its value
+        uint64_t matching;
+        uint64_t candidates;
+        uint64_t passed;
+        uint64_t scanDistances;
+        uint64_t codeDistances;
+        uint64_t graphDistances;
+
+        double passRate() const {
+            return candidates > 0 ? (double)passed / candidates : 1.0;
+        }
+    };
+
+    QueryCounters() {
+        reset();
+    }
+
+    void record(const QueryStats& stats) {
+        const std::memory_order relaxed = std::memory_order_relaxed;
+        queries.fetch_add(1, relaxed);
+        if (stats.planned) {
+            plans[(int)stats.plan].fetch_add(1, relaxed);
+        }
+        matching.fetch_add((uint64_t)stats.matching, relaxed);
+        candidates.fetch_add(stats.candidates, relaxed);
+        passed.fetch_add(stats.passed, relaxed);
+        scanDistances.fetch_add(stats.scanDistances, relaxed);
+        codeDistances.fetch_add(stats.codeDistances, relaxed);
+        graphDistances.fetch_add(stats.graphDistances, relaxed);
+    }
+
+    Totals totals() const {
+        const std::memory_order relaxed = std::memory_order_relaxed;
+        Totals t;
+        t.queries = queries.load(relaxed);
+        for (int i = 0; i < 4; i++) {
+            t.plans[i] = plans[i].load(relaxed);
+        }
+        t.matching = matching.load(relaxed);
+        t.candidates = candidates.load(relaxed);
+        t.passed = passed.load(relaxed);
+        t.scanDistances = scanDistances.load(relaxed);
+        t.codeDistances = codeDistances.load(relaxed);
+        t.graphDistances = graphDistances.load(relaxed);
+        return t;
+    }
+
+    void reset() {
+        queries = 0;
+        for (auto& p : plans) {
+            p = 0;
+        }
+        matching = 0;
+        candidates = 0;
+        passed = 0;
+        scanDistances = 0;
+        codeDistances = 0;
+        graphDistances = 0;
+    }
+
+private:
+    std::atomic<uint64_t> queries;
+    std::atomic<uint64_t> plans[4];
+    std::atomic<uint64_t> matching;
+    std::atomic<uint64_t> candidates;
+    std::atomic<uint64_t> passed;
+    std::atomic<uint64_t> scanDistances;
+    std::atomic<uint64_t> codeDistances;
+    std::atomic<uint64_t> graphDistances;
+};
+
+/**
+ * @brief Splits a query into timed phases. Reads the clock only when enabled, i.e.
+ *        when the caller asked for a QueryStats, so untimed queries pay nothing.
+ */
+class PhaseTimer {
+public:
+    explicit PhaseTimer(bool enabled) : enabled(enabled) {
+        if (enabled) {
+            last = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Nanoseconds since the previous lap (or since construction), 0 when disabled
+    double lap() {
+        if (!enabled) {
+            return 0.0;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+        return ns;
+    }
+
+private:
+    bool enabled;
+    std::chrono::steady_clock::time_point last;
+};
+
+#endif // QUERY_STATS_H
@@ -0,0 +1,119 @@
+#ifndef RANGE_FILTER_H
+#define RANGE_FILTER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Include hnswlib
+#include "../hnswlib/hnswlib/hnswlib.h"
+
+#include "./Bitmap.h"
+
+/**
+ * @brief How the vector indexes apply the [Smin, Smax] predicate on the HNSW path.
+ *
+ * InGraph passes the predicate to hnswlib's searchKnn as a filter functor. The
+ * traversal still walks through non-matching nodes, so the graph stays connected,
+ * but only matching nodes enter the result set, and the search ends once it holds
+ * k of them (ef wide). PostFilter fetches a fixed number of unfiltered neighbours
+ * and drops the out-of-range ones afterwards. At low selectivity most of those
+ * are wasted, and fewer than k may survive. Auto lets the QueryPlanner pick
+ * whichever of the two is estimated to be cheaper.
+ */
+enum class FilterMode { Auto, InGraph, PostFilter };
+
+/**
+ * @brief hnswlib filter accepting the labels whose s value lies in [Smin, Smax].
+ *        SValueOf maps a label (row index) to its s value.
+ */
+template <typename SValueOf>
+class RangeFilter : public hnswlib::BaseFilterFunctor {
+public:
+    RangeFilter(SValueOf sValueOf, float Smin, float Smax) : sValueOf(sValueOf), Smin(Smin), Smax(Smax) {}
+
+    bool operator()(hnswlib::labeltype label) override {
+        float s = sValueOf(label);
+        return s >= Smin && s <= Smax;
+    }
+
+private:
+    SValueOf sValueOf;
+    float Smin;
+    float Smax;
+};
+
+template <typename SValueOf>
+RangeFilter<SValueOf> makeRangeFilter(SValueOf sValueOf, float Smin, float Smax) {
+    return RangeFilter<SValueOf>(sValueOf, Smin, Smax);
+}
+
+/**
+ * @brief hnswlib filter accepting the labels in a bitmap, e.g. the rows matching a
+ *        Predicate.
+ */
+class BitmapFilter : public hnswlib::BaseFilterFunctor {
+public:
+    explicit BitmapFilter(const Bitmap& rows) : rows(rows) {}
+
+    bool operator()(hnswlib::labeltype label) override {
+        return rows.contains((uint32_t)label);
+    }
+
+private:
+    const Bitmap& rows;
+};
+
+/**
+ * @brief A filter over the scalar columns of an index: ranges [lo, hi] on named
+ *        columns combined with all() (and) and any() (or).
+ *
+ *        Predicate::range("price", 10, 20) && (Predicate::range("category", 3, 3) ||
+ *                                              Predicate::range("category", 7, 7))
+ */
+struct Predicate {
+    enum class Kind { Range, All, Any };
+
+    Kind kind;
+    std::string column; // Range only
+    float lo;
+    float hi;
+    std::vector<Predicate> terms; // All and Any only
+
+    static Predicate range(std::string column, float lo, float hi) {
+        Predicate p;
+        p.kind = Kind::Range;
+        p.column = std::move(column);
+        p.lo = lo;
+        p.hi = hi;
+        return p;
+    }
+
+    static Predicate all(std::vector<Predicate> terms) {
+        return combine(Kind::All, std::move(terms));
+    }
+
+    static Predicate any(std::vector<Predicate> terms) {
+        return combine(Kind::Any, std::move(terms));
+    }
+
+private:
+    static Predicate combine(Kind kind, std::vector<Predicate> terms) {
+        Predicate p;
+        p.kind = kind;
+        p.lo = 0.0f;
+        p.hi = 0.0f;
+        p.terms = std::move(terms);
+        return p;
+    }
+};
+
+inline Predicate operator&&(Predicate a, Predicate b) {
+    return Predicate::all({std::move(a), std::move(b)});
+}
+
+inline Predicate operator||(Predicate a, Predicate b) {
+    return Predicate::any({std::move(a), std::move(b)});
+}
+
+#endif // RANGE_FILTER_H
@@ -0,0 +1,121 @@
+#ifndef SCALAR_PARTITIONS_H
+#define SCALAR_PARTITIONS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Include hnswlib
+#include "../hnswlib/hnswlib/hnswlib.h"
+
+/**
+ * @brief HNSW graphs over disjoint ranges of the scalar s.
+ *
+ * The boundaries b[0] < b[1] < ... < b[P-2] split the s axis into P partitions;
+ * partition i holds the rows with b[i-1] <= s < b[i] (the first one is open below,
+ * the last one above). Each partition has its own graph over the same row pointers
+ * and labels as the global one, so a query on [Smin, Smax] only searches the
+ * partitions it overlaps and its cost follows the width of the range, not the size
+ * of the dataset.
+ *
+ * Graphs grow independently. Slots are reserved with an atomic counter so that
+ * concurrent inserts never overrun a graph; growing one needs the caller to hold
+ * off every other operation on it, as resizeIndex does for the global graph.
+ */
+class ScalarPartitions {
+public:
+    /**
+     * @param space          The space shared with the global graph (row pointers).
+     * @param boundaries     Sorted, distinct split points (P - 1 of them for P partitions).
+     * @param capacities     Initial number of elements of each of the P graphs.
+     */
+    ScalarPartitions(hnswlib::SpaceInterface<float>* space, std::vector<float> boundaries,
+                     const std::vector<size_t>& capacities, int M, int efConstruction, int efSearch)
+        : bounds(std::move(boundaries)) {
+        for (size_t i = 0; i < bounds.size() + 1; i++) {
+            std::unique_ptr<Partition> part(new Partition());
+            part->graph.reset(new hnswlib::HierarchicalNSW<float>(space, std::max<size_t>(capacities[i], 1), M, efConstruction));
+            part->graph->setEf(efSearch);
+            part->reserved = 0;
+            parts.push_back(std::move(part));
+        }
+    }
+
+    size_t size() const { return parts.size(); }
+
+    // The partition holding the rows with scalar value s
+    size_t partitionOf(float s) const {
+        return std::upper_bound(bounds.begin(), bounds.end(), s) - bounds.begin();
+    }
+
+    // Inclusive lower and exclusive upper bound of partition i (infinite at the ends)
+    float lowerBound(size_t i) const {
+        return i == 0 ? -std::numeric_limits<float>::infinity() : bounds[i - 1];
+    }
+
+    float upperBound(size_t i) const {
+        return i == bounds.size() ? std::numeric_limits<float>::infinity() : bounds[i];
+    }
+
+    const std::vector<float>& boundaries() const { return bounds; }
+
+    hnswlib::HierarchicalNSW<float>& graph(size_t i) const { return *parts[i]->graph; }
+
+    // Rows added to partition i so far
+    size_t count(size_t i) const { return parts[i]->graph->getCurrentElementCount(); }
+
+    /**
+     * @brief Claims a slot in partition i for one addPoint. Returns false when the graph
+     *        is full; the caller then grows it with grow() and tries again.
+     */
+    bool tryReserve(size_t i) {
+        Partition& part = *parts[i];
+        if (part.reserved.fetch_add(1) < part.graph->getMaxElements()) {
+            return true;
+        }
+        part.reserved.fetch_sub(1);
+        return false;
+    }
+
+    /**
+     * @brief Makes room for @p extra more slots in partition i (at least doubling it)
+     *        and claims them. No other operation may run on the partitions meanwhile.
+     */
+    void grow(size_t i, size_t extra = 1) {
+        Partition& part = *parts[i];
+        size_t required = part.reserved + extra;
+        size_t current = part.graph->getMaxElements();
+        if (required > current) {
+            part.graph->resizeIndex(std::max(required, current * 2));
+        }
+        part.reserved += extra;
+    }
+
+    /**
+     * @brief grow() for a batch: makes room in each partition for the values of @p s
+     *        that fall into it.
+     */
+    void growFor(const float* s, size_t count) {
+        std::vector<size_t> extra(parts.size(), 0);
+        for (size_t i = 0; i < count; i++) {
+            extra[partitionOf(s[i])]++;
+        }
+        for (size_t i = 0; i < parts.size(); i++) {
+            grow(i, extra[i]);
+        }
+    }
+
+private:
+    struct Partition {
+        std::unique_ptr<hnswlib::HierarchicalNSW<float>> graph;
+        std::atomic<size_t> reserved;
+    };
+
+    std::vector<float> bounds;
+    std::vector<std::unique_ptr<Partition>> parts;
+};
+
+#endif // SCALAR_PARTITIONS_H
@@ -0,0 +1,237 @@
+#ifndef SCALAR_QUANTIZER_H
+#define SCALAR_QUANTIZER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "./Distance.h"
+#include "./vectorArena.h"
+
+/**
+ * @brief Distance kernels between a float query table and 8-bit codes.
+ *
+ *        Both forms are dot-product shaped once the decoding is folded into the table:
+ *          l2:  sum_j (a_j - scale_j * c_j)^2
+ *          dot: sum_j w_j * c_j
+ *        The AVX2 variants widen eight codes at a time to floats; like the float
+ *        kernels in Distance.h they are chosen at run time from the CPU.
+ */
+namespace sq8 {
+
+typedef float (*L2Kernel)(const float* a, const float* scale, const uint8_t* code, size_t dim);
+typedef float (*DotKernel)(const float* w, const uint8_t* code, size_t dim);
+
+inline float l2Scalar(const float* a, const float* scale, const uint8_t* code, size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float d0 = a[i] - scale[i] * code[i], d1 = a[i + 1] - scale[i + 1] * code[i + 1];
+        float d2 = a[i + 2] - scale[i + 2] * code[i + 2], d3 = a[i + 3] - scale[i + 3] * code[i + 3];
+        s0 += d0 * d0; s1 += d1 * d1; s2 += d2 * d2; s3 += d3 * d3;
+    }
+    for (; i < dim; i++) {
+        float d = a[i] - scale[i] * code[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+inline float dotScalar(const float* w, const uint8_t* code, size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += w[i] * code[i]; s1 += w[i + 1] * code[i + 1];
+        s2 += w[i + 2] * code[i + 2]; s3 += w[i + 3] * code[i + 3];
+    }
+    for (; i < dim; i++) {
+        s0 += w[i] * code[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#if defined(DISTANCE_X86)
+
+__attribute__((target("avx2,fma")))
+inline __m256 widenAvx2(const uint8_t* code) {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+__attribute__((target("avx2,fma")))
+inline float l2Avx2(const float* a, const float* scale, const uint8_t* code, size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_fnmadd_ps(_mm256_loadu_ps(scale + i), widenAvx2(code + i), _mm256_loadu_ps(a + i));
+        __m256 d1 = _mm256_fnmadd_ps(_mm256_loadu_ps(scale + i + 8), widenAvx2(code + i + 8), _mm256_loadu_ps(a + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d = _mm256_fnmadd_ps(_mm256_loadu_ps(scale + i), widenAvx2(code + i), _mm256_loadu_ps(a + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    return distance::hsumAvx2(_mm256_add_ps(acc0, acc1)) + l2Scalar(a + i, scale + i, code + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline float dotAvx2(const float* w, const uint8_t* code, size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + i), widenAvx2(code + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + i + 8), widenAvx2(code + i + 8), acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + i), widenAvx2(code + i), acc0);
+    }
+    return distance::hsumAvx2(_mm256_add_ps(acc0, acc1)) + dotScalar(w + i, code + i, dim - i);
+}
+
+#endif
+
+struct Kernels {
+    L2Kernel l2;
+    DotKernel dot;
+};
+
+inline const Kernels& kernels() {
+    static const Kernels selected = []() -> Kernels {
+#if defined(DISTANCE_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return {l2Avx2, dotAvx2};
+        }
+#endif
+        return {l2Scalar, dotScalar};
+    }();
+    return selected;
+}
+
+} // namespace sq8
+
+/**
+ * @brief 8-bit scalar quantization (SQ8) of an index's vectors, for the exact scans.
+ *
+ * Each dimension j is mapped linearly from [min_j, max_j] of the training rows onto
+ * the codes 0..255, so a row takes dim bytes instead of 4 × dim and a scan reads a
+ * quarter of the memory. Distances are asymmetric: the query stays in floats, and the
+ * decoding x_j ≈ min_j + scale_j c_j is folded into a per-query table (see Query), so
+ * a code costs one fused multiply-add per dimension and no lookups.
+ *
+ * The decoding error is at most scale_j / 2 per coordinate (more for values outside
+ * the training range, which are clamped), so the ranking over codes is only used to
+ * pick a short list that the indexes re-rank against the fp32 rows.
+ *
+ * Codes live in a VectorArena with (dim + 3) / 4 floats per row, reinterpreted as
+ * bytes: they get the same stable chunked storage as the vectors, and row i of the
+ * codes is the code of row i of the vectors. Appends follow the arena's rules.
+ */
+class ScalarQuantizer {
+public:
+    /**
+     * @brief The query side of the asymmetric distance, built by prepare().
+     *        For L2 table holds q_j - min_j; for the dot metrics it holds q_j scale_j
+     *        and bias = sum_j q_j min_j.
+     */
+    struct Query {
+        std::vector<float> table;
+        float bias;
+    };
+
+    /**
+     * @brief Fits the per-dimension ranges to rows [0, count) of @p rows and encodes them.
+     */
+    ScalarQuantizer(Metric metric, const VectorArena& rows, size_t count)
+        : metric(metric), dim(rows.dimension()), minimum(dim, std::numeric_limits<float>::infinity()),
+          scale(dim, 0.0f), buffer((dim + 3) / 4) {
+        std::vector<float> maximum(dim, -std::numeric_limits<float>::infinity());
+        rows.forEachRun(0, count, [&](size_t, size_t n, const float* data) {
+            for (size_t r = 0; r < n; r++) {
+                for (int j = 0; j < dim; j++) {
+                    minimum[j] = std::min(minimum[j], data[r * dim + j]);
+                    maximum[j] = std::max(maximum[j], data[r * dim + j]);
+                }
+            }
+        });
+        for (int j = 0; j < dim; j++) {
+            if (count == 0) {
+                minimum[j] = 0.0f;
+            } else if (maximum[j] > minimum[j]) {
+                scale[j] = (maximum[j] - minimum[j]) / 255.0f;
+            }
+        }
+        codes.setDimension((int)buffer.size());
+        codes.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            append(rows.row(i));
+        }
+    }
+
+    int dimension() const { return dim; }
+    size_t size() const { return codes.size(); }
+
+    // Bytes read per row by a scan over the codes
+    size_t codeBytes() const { return (size_t)dim; }
+
+    /**
+     * @brief Encodes @p vec as the next row. Same serialization rules as VectorArena::append.
+     */
+    size_t append(const float* vec) {
+        encode(vec, reinterpret_cast<uint8_t*>(buffer.data()));
+        return codes.append(buffer.data());
+    }
+
+    /**
+     * @brief Re-encodes row @p i in place; no scan may read it meanwhile.
+     */
+    void rewrite(size_t i, const float* vec) {
+        encode(vec, reinterpret_cast<uint8_t*>(codes.row(i)));
+    }
+
+    const uint8_t* code(size_t i) const {
+        return reinterpret_cast<const uint8_t*>(codes.row(i));
+    }
+
+    void prepare(const float* q, Query& query) const {
+        query.table.resize(dim);
+        query.bias = 0.0f;
+        for (int j = 0; j < dim; j++) {
+            if (metric == Metric::L2) {
+                query.table[j] = q[j] - minimum[j];
+            } else {
+                query.table[j] = q[j] * scale[j];
+                query.bias += q[j] * minimum[j];
+            }
+        }
+    }
+
+    // Approximate distance from the prepared query to a code, in the metric's units
+    float distance(const Query& query, const uint8_t* code) const {
+        if (metric == Metric::L2) {
+            return sq8::kernels().l2(query.table.data(), scale.data(), code, dim);
+        }
+        return 1.0f - (query.bias + sq8::kernels().dot(query.table.data(), code, dim));
+    }
+
+private:
+    Metric metric;
+    int dim;
+    std::vector<float> minimum;
+    std::vector<float> scale;
+    VectorArena codes;
+    std::vector<float> buffer; // one row of codes, for append
+
+    void encode(const float* vec, uint8_t* out) const {
+        for (int j = 0; j < dim; j++) {
+            float c = scale[j] > 0.0f ? std::nearbyint((vec[j] - minimum[j]) / scale[j]) : 0.0f;
+            out[j] = (uint8_t)std::min(255.0f, std::max(0.0f, c));
+        }
+    }
+};
+
+#endif // SCALAR_QUANTIZER_H
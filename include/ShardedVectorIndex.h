@@ -0,0 +1,319 @@
+#ifndef SHARDED_VECTOR_INDEX_H
+#define SHARDED_VECTOR_INDEX_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./Distance.h"
+#include "./ThreadPool.h"
+#include "./TopK.h"
+
+/**
+ * @brief How a ShardedVectorIndex reaches its shards. Every call names the shard it is
+ *        for and passes plain buffers, so an implementation may call an index in the
+ *        same process (LocalTransport) or serialize the call to another machine.
+ *
+ * The front end calls into several shards at once from its thread pool, and
+ * concurrent queries may call the same shard at the same time, so implementations
+ * must be safe to call from several threads. A remote transport blocks on its reply;
+ * failures surface as exceptions, which the front end passes on to its caller.
+ */
+class ShardTransport {
+public:
+    virtual ~ShardTransport() {}
+
+    virtual size_t shardCount() const = 0;
+
+    // Appends `count` rows of `dim` floats with their s values to the shard. Returns the
+    // shard's id of the first one; the others follow consecutively.
+    virtual int insert(size_t shard, const float* rows, size_t count, int dim, const float* s) = 0;
+
+    // Up to k (distance, shard id) pairs with Smin <= s <= Smax, closest first
+    virtual std::vector<std::pair<float, int>> query(size_t shard, const float* v, int dim, int k,
+                                                     float Smin, float Smax) = 0;
+
+    // Records of the shard with Smin <= s <= Smax
+    virtual int countInRange(size_t shard, float Smin, float Smax) = 0;
+};
+
+/**
+ * @brief ShardTransport over indexes held in this process, e.g. one per NUMA node.
+ *        Index is VectorIndex or ProbabilisticVectorIndex. The shards are reachable
+ *        through shard(i) to configure them (partitions, filter mode, quantization);
+ *        queries use each index's default post-filter parameter (O, alpha). Each
+ *        index's own rules on concurrent calls apply, e.g. ProbabilisticVectorIndex
+ *        takes no inserts while it is queried.
+ */
+template <typename Index>
+class LocalTransport : public ShardTransport {
+public:
+    // threadsPerShard: HNSW insertion threads of each shard's batches, which already
+    // run side by side
+    LocalTransport(size_t shards, int order, Metric metric = Metric::L2, int threadsPerShard = 1)
+        : threadsPerShard(threadsPerShard) {
+        if (shards == 0) {
+            throw std::invalid_argument("A sharded index needs at least one shard");
+        }
+        for (size_t i = 0; i < shards; i++) {
+            indexes.emplace_back(new Index(order, metric));
+        }
+    }
+
+    Index& shard(size_t i) { return *indexes.at(i); }
+    const Index& shard(size_t i) const { return *indexes.at(i); }
+
+    size_t shardCount() const override {
+        return indexes.size();
+    }
+
+    int insert(size_t shard, const float* rows, size_t count, int dim, const float* s) override {
+        return indexes.at(shard)->insertBatch(rows, count, dim, s, threadsPerShard);
+    }
+
+    std::vector<std::pair<float, int>> query(size_t shard, const float* v, int dim, int k,
+                                             float Smin, float Smax) override {
+        return indexes.at(shard)->queryWithDistances(std::vector<float>(v, v + dim), k, Smin, Smax);
+    }
+
+    int countInRange(size_t shard, float Smin, float Smax) override {
+        return indexes.at(shard)->countInRange(Smin, Smax);
+    }
+
+private:
+    std::vector<std::unique_ptr<Index>> indexes;
+    int threadsPerShard;
+};
+
+/**
+ * @brief Scatter-gather front end over N vector index shards behind a ShardTransport.
+ *
+ * Rows are placed either by hash (of the vector and s, so every shard gets an even
+ * share and a query visits all of them) or by s range: with boundaries
+ * b[0] < ... < b[N-2], shard i holds b[i-1] <= s < b[i], like ScalarPartitions, and
+ * a query only visits the shards its [Smin, Smax] overlaps. The visited shards are
+ * queried in parallel, each returns its own top k, and the k closest of those are
+ * the answer; distances come from the same metric everywhere, so they compare
+ * directly. countInRange() sums the shards' counts, for callers that plan on the
+ * size of the filtered set.
+ *
+ * A record's global id is shardId * N + shard, so the front end keeps no id map and
+ * several front ends over the same shards agree on ids. Shard ids must stay below
+ * INT_MAX / N.
+ */
+class ShardedVectorIndex {
+public:
+    enum class Placement { Hash, Range };
+
+    // Hash placement over every shard of the transport
+    explicit ShardedVectorIndex(std::unique_ptr<ShardTransport> transport, ThreadPool* pool = nullptr)
+        : transport(std::move(transport)), placementKind(Placement::Hash), pool(pool) {
+        checkTransport();
+    }
+
+    // Range placement; boundaries holds one split point fewer than there are shards
+    ShardedVectorIndex(std::unique_ptr<ShardTransport> transport, std::vector<float> boundaries,
+                       ThreadPool* pool = nullptr)
+        : transport(std::move(transport)), placementKind(Placement::Range), bounds(std::move(boundaries)), pool(pool) {
+        checkTransport();
+        if (bounds.size() + 1 != this->transport->shardCount()) {
+            throw std::invalid_argument("Range placement needs one boundary fewer than there are shards");
+        }
+        for (size_t i = 1; i < bounds.size(); i++) {
+            if (!(bounds[i - 1] < bounds[i])) {
+                throw std::invalid_argument("Shard boundaries must be strictly increasing");
+            }
+        }
+    }
+
+    size_t shardCount() const { return transport->shardCount(); }
+    Placement placement() const { return placementKind; }
+
+    // The shard a record with this vector and s value goes to
+    size_t shardFor(const float* vec, int dim, float s) const {
+        if (placementKind == Placement::Range) {
+            return std::upper_bound(bounds.begin(), bounds.end(), s) - bounds.begin();
+        }
+        return (size_t)(hashRow(vec, dim, s) % shardCount());
+    }
+
+    // Where a global id lives: its shard, and its id within the shard
+    size_t shardOf(int id) const { return (size_t)id % shardCount(); }
+    int shardId(int id) const { return id / (int)shardCount(); }
+
+    // Returns the global id of the record
+    int insert(const std::vector<float>& vec, float s) {
+        if (vec.empty()) {
+            throw std::invalid_argument("Cannot insert empty vector");
+        }
+        size_t shard = shardFor(vec.data(), (int)vec.size(), s);
+        return globalId(transport->insert(shard, vec.data(), 1, (int)vec.size(), &s), shard);
+    }
+
+    // Inserts many records with one call per shard, the shards in parallel. Returns the
+    // global id of each record, in input order.
+    std::vector<int> insertBatch(const std::vector<std::vector<float>>& vecs, const std::vector<float>& s) {
+        if (vecs.size() != s.size()) {
+            throw std::invalid_argument("Each vector needs exactly one s value");
+        }
+        size_t dim = vecs.empty() ? 0 : vecs[0].size();
+        std::vector<float> rows;
+        rows.reserve(vecs.size() * dim);
+        for (const auto& vec : vecs) {
+            if (vec.empty()) {
+                throw std::invalid_argument("Cannot insert empty vector");
+            }
+            if (vec.size() != dim) {
+                throw std::invalid_argument("All vectors must have the same dimension");
+            }
+            rows.insert(rows.end(), vec.begin(), vec.end());
+        }
+        return insertBatch(rows.data(), vecs.size(), (int)dim, s.data());
+    }
+
+    // Same for `count` rows of `dim` floats stored back to back
+    std::vector<int> insertBatch(const float* rows, size_t count, int dim, const float* s) {
+        if (count == 0) {
+            return {};
+        }
+        if (rows == nullptr || s == nullptr || dim <= 0) {
+            throw std::invalid_argument("A batch needs rows of a positive dimension and their s values");
+        }
+        // Gather each shard's rows into one contiguous buffer
+        size_t shards = shardCount();
+        std::vector<std::vector<size_t>> members(shards);
+        for (size_t i = 0; i < count; i++) {
+            members[shardFor(rows + i * (size_t)dim, dim, s[i])].push_back(i);
+        }
+        std::vector<size_t> targets;
+        for (size_t shard = 0; shard < shards; shard++) {
+            if (!members[shard].empty()) {
+                targets.push_back(shard);
+            }
+        }
+        std::vector<int> ids(count);
+        workers().parallelFor(targets.size(), [&](size_t t, int) {
+            size_t shard = targets[t];
+            const std::vector<size_t>& rowsOf = members[shard];
+            std::vector<float> buffer(rowsOf.size() * (size_t)dim);
+            std::vector<float> scalars(rowsOf.size());
+            for (size_t j = 0; j < rowsOf.size(); j++) {
+                std::memcpy(&buffer[j * (size_t)dim], rows + rowsOf[j] * (size_t)dim, (size_t)dim * sizeof(float));
+                scalars[j] = s[rowsOf[j]];
+            }
+            int first = transport->insert(shard, buffer.data(), rowsOf.size(), dim, scalars.data());
+            for (size_t j = 0; j < rowsOf.size(); j++) {
+                ids[rowsOf[j]] = globalId(first + (int)j, shard);
+            }
+        });
+        return ids;
+    }
+
+    std::vector<int> query(const std::vector<float>& v, int k, float Smin, float Smax) const {
+        std::vector<int> result;
+        for (const auto& hit : queryWithDistances(v, k, Smin, Smax)) {
+            result.push_back(hit.second);
+        }
+        return result;
+    }
+
+    // The k nearest records with Smin <= s <= Smax as (distance, global id) pairs,
+    // closest first
+    std::vector<std::pair<float, int>> queryWithDistances(const std::vector<float>& v, int k,
+                                                          float Smin, float Smax) const {
+        std::vector<size_t> targets = shardsOverlapping(Smin, Smax);
+        if (k <= 0 || targets.empty()) {
+            return {};
+        }
+        std::vector<std::vector<std::pair<float, int>>> hits(targets.size());
+        workers().parallelFor(targets.size(), [&](size_t t, int) {
+            hits[t] = transport->query(targets[t], v.data(), (int)v.size(), k, Smin, Smax);
+        });
+        TopK best(k);
+        for (size_t t = 0; t < targets.size(); t++) {
+            for (const auto& hit : hits[t]) {
+                best.push(hit.first, globalId(hit.second, targets[t]));
+            }
+        }
+        return best.take();
+    }
+
+    // Records with Smin <= s <= Smax over all shards; shards outside the range under
+    // range placement are not asked
+    int countInRange(float Smin, float Smax) const {
+        std::vector<size_t> targets = shardsOverlapping(Smin, Smax);
+        std::vector<int> counts(targets.size(), 0);
+        workers().parallelFor(targets.size(), [&](size_t t, int) {
+            counts[t] = transport->countInRange(targets[t], Smin, Smax);
+        });
+        int total = 0;
+        for (int count : counts) {
+            total += count;
+        }
+        return total;
+    }
+
+private:
+    std::unique_ptr<ShardTransport> transport;
+    Placement placementKind;
+    std::vector<float> bounds; // range placement only
+    ThreadPool* pool;          // nullptr: ThreadPool::shared()
+
+    void checkTransport() const {
+        if (!transport || transport->shardCount() == 0) {
+            throw std::invalid_argument("A sharded index needs at least one shard");
+        }
+    }
+
+    ThreadPool& workers() const {
+        return pool ? *pool : ThreadPool::shared();
+    }
+
+    // Every shard under hash placement, the ones [Smin, Smax] overlaps under range placement
+    std::vector<size_t> shardsOverlapping(float Smin, float Smax) const {
+        std::vector<size_t> targets;
+        if (Smax < Smin) {
+            return targets;
+        }
+        size_t first = 0, last = shardCount() - 1;
+        if (placementKind == Placement::Range) {
+            first = std::upper_bound(bounds.begin(), bounds.end(), Smin) - bounds.begin();
+            last = std::upper_bound(bounds.begin(), bounds.end(), Smax) - bounds.begin();
+        }
+        for (size_t shard = first; shard <= last; shard++) {
+            targets.push_back(shard);
+        }
+        return targets;
+    }
+
+    int globalId(int shardId, size_t shard) const {
+        int shards = (int)shardCount();
+        if (shardId < 0 || shardId > (INT_MAX - (int)shard) / shards) {
+            throw std::length_error("Shard id " + std::to_string(shardId) + " does not fit in a global id");
+        }
+        return shardId * shards + (int)shard;
+    }
+
+    // FNV-1a over the bytes of the row and of s
+    static uint64_t hashRow(const float* vec, int dim, float s) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t bytes) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < bytes; i++) {
+                hash = (hash ^ p[i]) * 1099511628211ull;
+            }
+        };
+        mix(vec, (size_t)dim * sizeof(float));
+        mix(&s, sizeof(s));
+        return hash;
+    }
+};
+
+#endif // SHARDED_VECTOR_INDEX_H
@@ -0,0 +1,192 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Binary snapshot helpers shared by the tree and the vector indexes.
+ *
+ * Every section of a snapshot starts with an 8-character magic and a format
+ * version, followed by fixed-width little-endian fields and flat arrays of
+ * trivially copyable values (no pointers), so a file can be read back with plain
+ * reads or used in place from a read-only memory mapping.
+ */
+namespace snapshot {
+
+// Bumped whenever the layout of any section changes
+const uint32_t Version = 1;
+
+template <typename T>
+void write(std::ostream& out, const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshots store trivially copyable types only");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeArray(std::ostream& out, const T* values, size_t n) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshots store trivially copyable types only");
+    out.write(reinterpret_cast<const char*>(values), n * sizeof(T));
+}
+
+template <typename T>
+T read(std::istream& in) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshots store trivially copyable types only");
+    T value;
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+        throw std::runtime_error("Unexpected end of snapshot");
+    }
+    return value;
+}
+
+template <typename T>
+void readArray(std::istream& in, T* values, size_t n) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshots store trivially copyable types only");
+    if (!in.read(reinterpret_cast<char*>(values), n * sizeof(T))) {
+        throw std::runtime_error("Unexpected end of snapshot");
+    }
+}
+
+// Starts a section: its magic (exactly 8 characters) and the format version
+inline void writeTag(std::ostream& out, const char* magic) {
+    out.write(magic, 8);
+    write<uint32_t>(out, Version);
+}
+
+// Checks a section's magic and version
+inline void expectTag(std::istream& in, const char* magic) {
+    char found[8];
+    readArray(in, found, 8);
+    if (std::memcmp(found, magic, 8) != 0) {
+        throw std::runtime_error(std::string("Not a ") + std::string(magic, 8) + " snapshot section");
+    }
+    uint32_t version = read<uint32_t>(in);
+    if (version != Version) {
+        throw std::runtime_error("Unsupported snapshot version " + std::to_string(version));
+    }
+}
+
+// Writes zeros up to the next multiple of `alignment` bytes from the start of the stream
+inline void pad(std::ostream& out, size_t alignment) {
+    size_t position = (size_t)out.tellp();
+    static const char zeros[64] = {};
+    size_t n = (alignment - position % alignment) % alignment;
+    while (n > 0) {
+        size_t chunk = std::min(n, sizeof(zeros));
+        out.write(zeros, chunk);
+        n -= chunk;
+    }
+}
+
+inline void skipPad(std::istream& in, size_t alignment) {
+    size_t position = (size_t)in.tellg();
+    in.seekg((alignment - position % alignment) % alignment, std::ios::cur);
+}
+
+/**
+ * @brief A whole file mapped read-only into memory. Pages are loaded lazily by the
+ *        OS, so opening is O(1) in the file size and several processes share them.
+ *        (Without mmap, on Windows, the file is read into memory instead.)
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : base(nullptr), length(0) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        length = (size_t)in.tellg();
+        buffer.resize(length);
+        in.seekg(0);
+        in.read(buffer.data(), length);
+        base = buffer.data();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + path);
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            base = static_cast<char*>(mapped);
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (base) ::munmap(base, length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    char* base;
+    size_t length;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+/**
+ * @brief An istream reading from a block of memory (e.g. part of a MappedFile).
+ */
+class MemoryStream : private std::streambuf, public std::istream {
+public:
+    MemoryStream(const char* data, size_t size) : std::istream(static_cast<std::streambuf*>(this)) {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    std::streampos seekoff(std::streamoff off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+        char* target = (dir == std::ios_base::beg ? eback() : dir == std::ios_base::cur ? gptr() : egptr()) + off;
+        if (target < eback() || target > egptr()) {
+            return std::streampos(std::streamoff(-1));
+        }
+        setg(eback(), target, egptr());
+        return std::streampos(target - eback());
+    }
+
+    std::streampos seekpos(std::streampos pos, std::ios_base::openmode mode) override {
+        return seekoff(std::streamoff(pos), std::ios_base::beg, mode);
+    }
+};
+
+} // namespace snapshot
+
+#endif // SNAPSHOT_H
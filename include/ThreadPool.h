@@ -0,0 +1,228 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed set of worker threads that is created once and reused for many
+ *        parallel loops, unlike parallelFor() which starts threads on every call.
+ *
+ *        Each worker owns a task deque. A loop is split into chunks spread over the
+ *        deques; a worker takes chunks from the back of its own deque and, when it
+ *        runs dry, steals from the front of the others, so a slow chunk (an
+ *        expensive query) does not leave the rest of the pool idle.
+ *
+ *        Every call of the loop body gets a worker slot in [0, slots()). Callers
+ *        index per-thread scratch buffers by it: within one loop, two calls running
+ *        at the same time never share a slot. A loop started from inside a loop body
+ *        runs inline on that worker: with the worker's slot when the body belongs to
+ *        this pool, with slot 0 when it belongs to another pool (whose slots may be
+ *        out of range here).
+ */
+class ThreadPool {
+public:
+    /**
+     * @param numThreads Number of worker threads; 0 means hardware concurrency.
+     *                   With 1 thread or less, loops run on the calling thread.
+     */
+    explicit ThreadPool(int numThreads = 0) : queued(0), stopping(false) {
+        if (numThreads <= 0) {
+            numThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (numThreads == 1) {
+            numThreads = 0;
+        }
+        queues.reserve(numThreads);
+        for (int i = 0; i < numThreads; i++) {
+            queues.emplace_back(new TaskQueue());
+        }
+        workers.reserve(numThreads);
+        for (int i = 0; i < numThreads; i++) {
+            workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers.size(); }
+
+    // Number of distinct worker slots passed to loop bodies
+    int slots() const { return std::max(1, size()); }
+
+    /**
+     * @brief A process-wide pool sized to the machine, created on first use.
+     */
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    /**
+     * @brief Runs fn(i, slot) for every i in [0, n) and returns once all calls finished.
+     * @throws Rethrows the first exception raised by fn; the remaining chunks are skipped.
+     */
+    template <typename Function>
+    void parallelFor(size_t n, Function fn) {
+        if (n == 0) {
+            return;
+        }
+        const Worker& caller = currentWorker();
+        if (workers.empty() || n == 1 || caller.pool != nullptr) {
+            int slot = caller.pool == this ? caller.slot : 0;
+            for (size_t i = 0; i < n; i++) {
+                fn(i, slot);
+            }
+            return;
+        }
+
+        // Several chunks per thread so stealing can even out uneven work
+        size_t chunks = std::min(n, (size_t)size() * 4);
+        size_t chunkSize = (n + chunks - 1) / chunks;
+        chunks = (n + chunkSize - 1) / chunkSize;
+
+        Batch batch;
+        batch.remaining = chunks;
+        for (size_t c = 0; c < chunks; c++) {
+            size_t begin = c * chunkSize;
+            size_t end = std::min(n, begin + chunkSize);
+            Task task = [&batch, &fn, begin, end](int slot) {
+                if (!batch.failed.load()) {
+                    try {
+                        for (size_t i = begin; i < end; i++) {
+                            fn(i, slot);
+                        }
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(batch.mutex);
+                        if (!batch.error) batch.error = std::current_exception();
+                        batch.failed = true;
+                    }
+                }
+                // Decrement under the lock: the caller may destroy the batch as soon
+                // as it observes zero
+                std::lock_guard<std::mutex> lock(batch.mutex);
+                if (--batch.remaining == 0) {
+                    batch.done.notify_all();
+                }
+            };
+            push(c % queues.size(), std::move(task));
+        }
+
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&batch]() { return batch.remaining.load() == 0; });
+        if (batch.error) {
+            std::rethrow_exception(batch.error);
+        }
+    }
+
+private:
+    typedef std::function<void(int)> Task;
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Batch {
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued; // tasks pushed and not yet popped
+    bool stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    // The pool and slot of the worker running on this thread; pool is null on
+    // threads that are not pool workers
+    struct Worker {
+        const ThreadPool* pool;
+        int slot;
+    };
+
+    static Worker& currentWorker() {
+        static thread_local Worker worker = {nullptr, -1};
+        return worker;
+    }
+
+    void push(size_t queue, Task task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+            queues[queue]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    // Pops from the back of the own queue, else steals from the front of another
+    bool tryPop(int own, Task& task) {
+        if (queued.load() == 0) {
+            return false;
+        }
+        int n = (int)queues.size();
+        for (int k = 0; k < n; k++) {
+            TaskQueue& queue = *queues[(own + k) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(int slot) {
+        currentWorker() = {this, slot};
+        Task task;
+        while (true) {
+            if (tryPop(slot, task)) {
+                task(slot);
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0) {
+                return;
+            }
+        }
+    }
+};
+
+#endif // THREAD_POOL_H
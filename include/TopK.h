@@ -0,0 +1,75 @@
+#ifndef TOP_K_H
+#define TOP_K_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Keeps the k closest (distance, id) pairs seen so far.
+ *        A bounded max-heap: the worst kept candidate sits at the top, so each push
+ *        costs one comparison once the heap is full and O(log k) when it is admitted.
+ *        This replaces collecting every candidate and sorting them all to keep k.
+ *        Ties on distance are broken by the smaller id, so results are deterministic.
+ */
+class TopK {
+public:
+    typedef std::pair<float, int> Entry;
+
+    explicit TopK(int k = 0) {
+        reset(k);
+    }
+
+    /**
+     * @brief Empties the heap and sets a new k, keeping the allocated storage so one
+     *        TopK can serve many queries (e.g. as per-thread scratch).
+     */
+    void reset(int newK) {
+        k = newK > 0 ? static_cast<size_t>(newK) : 0;
+        heap.clear();
+        heap.reserve(k);
+    }
+
+    /**
+     * @brief Offers a candidate; it is kept only if it beats the current k-th best.
+     */
+    void push(float dist, int id) {
+        if (heap.size() < k) {
+            heap.emplace_back(dist, id);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (k > 0 && Entry(dist, id) < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = Entry(dist, id);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    /**
+     * @brief Largest distance a candidate may have and still be admitted
+     *        (infinity until k candidates have been kept).
+     */
+    float threshold() const {
+        return heap.size() < k ? std::numeric_limits<float>::infinity() : heap.front().first;
+    }
+
+    size_t size() const { return heap.size(); }
+    bool full() const { return heap.size() == k; }
+
+    /**
+     * @brief Returns the kept candidates sorted by ascending distance and empties the heap.
+     */
+    std::vector<Entry> take() {
+        std::sort_heap(heap.begin(), heap.end());
+        std::vector<Entry> result(heap.begin(), heap.end());
+        heap.clear();
+        return result;
+    }
+
+private:
+    size_t k;
+    std::vector<Entry> heap;
+};
+
+#endif // TOP_K_H
@@ -0,0 +1,100 @@
+#ifndef ARENA_SPACE_H
+#define ARENA_SPACE_H
+
+#include <cstddef>
+#include <cstring>
+
+// Include hnswlib
+#include "../hnswlib/hnswlib/hnswlib.h"
+
+#include "./Distance.h"
+#include "./vectorArena.h"
+
+/**
+ * @brief hnswlib space whose elements are pointers to rows of a VectorArena.
+ *
+ * HNSW copies get_data_size() bytes per element into its own level-0 memory. With
+ * this space that is a single `const float*` instead of the whole vector, so each
+ * embedding is stored once, in the arena, and the graph reads it from there.
+ *
+ * Both distance arguments are addresses of row pointers, for stored elements and
+ * queries alike:
+ *     const float* row = arena.row(idx);   index->addPoint(&row, idx);
+ *     const float* q = query.data();       index->searchKnn(&q, k);
+ * The arena never moves rows, so the stored pointers stay valid.
+ */
+class ArenaSpace : public hnswlib::SpaceInterface<float> {
+public:
+    /**
+     * @param dim    Dimension of the vectors.
+     * @param metric L2, or InnerProduct (also used for Cosine on normalized vectors).
+     */
+    explicit ArenaSpace(size_t dim, Metric metric = Metric::L2) {
+        param.dim = dim;
+        param.kernel = metric == Metric::L2 ? distance::kernels(dim).l2 : distance::kernels(dim).dot;
+        distFunc = metric == Metric::L2 ? &ArenaSpace::l2Squared : &ArenaSpace::innerProduct;
+    }
+
+    size_t get_data_size() override {
+        return sizeof(const float*);
+    }
+
+    hnswlib::DISTFUNC<float> get_dist_func() override {
+        return distFunc;
+    }
+
+    void* get_dist_func_param() override {
+        return &param;
+    }
+
+    /**
+     * @brief Points every element of an index back at its row, labels being row indices.
+     *        A saved index holds the row pointers of the process that wrote it, so this
+     *        must run after loading one, before the first search.
+     */
+    static void relink(hnswlib::HierarchicalNSW<float>& index, const VectorArena& rows) {
+        size_t n = index.getCurrentElementCount();
+        for (size_t id = 0; id < n; id++) {
+            const float* row = rows.row(index.getExternalLabel((hnswlib::tableint)id));
+            std::memcpy(index.getDataByInternalId((hnswlib::tableint)id), &row, sizeof(row));
+        }
+    }
+
+    /**
+     * @brief Distances the calling thread has computed through any ArenaSpace. A search
+     *        runs on one thread, so the difference taken around it is the number of
+     *        distances (and graph nodes) that search evaluated.
+     */
+    static size_t evaluations() {
+        return evaluationCount();
+    }
+
+private:
+    // hnswlib reads the dimension from the start of the parameter block
+    struct Param {
+        size_t dim;
+        distance::PairKernel kernel;
+    };
+    Param param;
+    hnswlib::DISTFUNC<float> distFunc;
+
+    // Constant-initialized, so reading it costs no guard
+    static size_t& evaluationCount() {
+        static thread_local size_t count = 0;
+        return count;
+    }
+
+    static float l2Squared(const void* a, const void* b, const void* param) {
+        const Param* p = static_cast<const Param*>(param);
+        evaluationCount()++;
+        return p->kernel(*static_cast<const float* const*>(a), *static_cast<const float* const*>(b), p->dim);
+    }
+
+    static float innerProduct(const void* a, const void* b, const void* param) {
+        const Param* p = static_cast<const Param*>(param);
+        evaluationCount()++;
+        return 1.0f - p->kernel(*static_cast<const float* const*>(a), *static_cast<const float* const*>(b), p->dim);
+    }
+};
+
+#endif // ARENA_SPACE_H
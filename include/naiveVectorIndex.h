@@ -2,10 +2,18 @@
 #include <algorithm>
 #include <stdexcept>
 #include <cmath>
+#include <memory>
+
+#include "./vectorArena.h"
+#include "./Distance.h"
+#include "./TopK.h"
+#include "./ScalarQuantizer.h"
+#include "./ThreadPool.h"
 
 class NaiveVectorIndex {
 public:
-    NaiveVectorIndex() : dimension(0) {}
+    // With Metric::Cosine, vectors and queries are normalized and compared by inner product
+    NaiveVectorIndex(Metric metric = Metric::L2) : dimension(0), distanceFn(metric), rerankFactor(0) {}
 
     // Insert a record: vector and s
     void insert(const std::vector<float>& vec, float s) {
@@ -13,26 +21,156 @@ public:
             throw std::invalid_argument("Cannot insert empty vector");
         }
 
-        if (dataVectors.empty()) {
+        if (vectors.empty()) {
             // First inserted vector defines the dimension
             dimension = (int)vec.size();
+            vectors.setDimension(dimension);
+            distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dimension);
         } else {
             if ((int)vec.size() != dimension) {
                 throw std::invalid_argument("All vectors must have the same dimension");
             }
         }
 
-        dataVectors.push_back(vec);
-        sValues.push_back(s);
+        appendRecord(vec.data(), s);
+    }
+
+    // Insert `count` rows of `dim` floats stored back to back in `rows`, with their s
+    // values in `s` (e.g. straight from a DataLoader buffer); returns the first new id
+    int insertBatch(const float* rows, size_t count, int dim, const float* s) {
+        int first = (int)vectors.size();
+        if (count == 0) {
+            return first;
+        }
+        if (rows == nullptr || s == nullptr || dim <= 0) {
+            throw std::invalid_argument("A batch needs rows of a positive dimension and their s values");
+        }
+        if (vectors.empty()) {
+            dimension = dim;
+            vectors.setDimension(dimension);
+            distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dimension);
+        } else if (dim != dimension) {
+            throw std::invalid_argument("All vectors must have the same dimension");
+        }
+        vectors.reserve(vectors.size() + count);
+        sValues.reserve(sValues.size() + count);
+        for (size_t i = 0; i < count; i++) {
+            appendRecord(rows + i * (size_t)dim, s[i]);
+        }
+        return first;
+    }
+
+    // Scan 8-bit codes of the vectors instead of the fp32 rows (see ScalarQuantizer),
+    // then re-rank the best rerankFactor × k in-range rows exactly. The ranges are fitted
+    // to the current rows; 0 goes back to scanning the fp32 rows.
+    void quantize(int rerankFactor = 4) {
+        if (rerankFactor < 0) {
+            throw std::invalid_argument("Re-rank factor must not be negative");
+        }
+        if (rerankFactor == 0) {
+            quantizer.reset();
+        } else if (vectors.empty()) {
+            throw std::logic_error("Quantization needs some records to fit its ranges");
+        } else {
+            quantizer.reset(new ScalarQuantizer(distanceFn.getMetric(), vectors, vectors.size()));
+        }
+        this->rerankFactor = rerankFactor;
+    }
+
+    // Insert many records at once; they get consecutive ids and the first one is returned
+    int insertBatch(const std::vector<std::vector<float>>& vecs, const std::vector<float>& s) {
+        if (vecs.size() != s.size()) {
+            throw std::invalid_argument("Each vector needs exactly one s value");
+        }
+        int first = (int)vectors.size();
+        int batchDimension = vectors.empty() && !vecs.empty() ? (int)vecs[0].size() : dimension;
+        for (const auto& vec : vecs) {
+            if (vec.empty()) {
+                throw std::invalid_argument("Cannot insert empty vector");
+            }
+            if ((int)vec.size() != batchDimension) {
+                throw std::invalid_argument("All vectors must have the same dimension");
+            }
+        }
+        if (vectors.empty() && !vecs.empty()) {
+            dimension = batchDimension;
+            vectors.setDimension(dimension);
+        }
+        for (const auto& vec : vecs) {
+            vectors.append(vec.data());
+        }
+        sValues.insert(sValues.end(), s.begin(), s.end());
+        return first;
     }
 
     // Query: Given vector v, integer k, and range [Smin, Smax]
     // This is a naive approach:
     // 1. Compute the distance to all vectors.
     // 2. Filter by s in [Smin, Smax].
-    // 3. Sort by distance and take top k.
-    std::vector<int> query(const std::vector<float>& v, int k, float Smin, float Smax) {
-        if (dataVectors.empty()) {
+    // 3. Keep the k closest and return them sorted.
+    std::vector<int> query(const std::vector<float>& v, int k, float Smin, float Smax) const {
+        std::vector<int> result;
+        for (const auto& hit : queryWithDistances(v, k, Smin, Smax)) {
+            result.push_back(hit.second);
+        }
+        return result;
+    }
+
+    // Same as query, but returns (distance, index) pairs sorted by ascending distance
+    std::vector<std::pair<float, int>> queryWithDistances(const std::vector<float>& v, int k, float Smin, float Smax) const {
+        QueryScratch scratch;
+        return search(v, k, Smin, Smax, scratch);
+    }
+
+    // Answers queries[i] restricted to ranges[i] = [Smin, Smax] in parallel on the given
+    // pool (the shared pool by default). Must not overlap with inserts.
+    std::vector<std::vector<std::pair<float, int>>> queryBatch(const std::vector<std::vector<float>>& queries, int k,
+                                                               const std::vector<std::pair<float, float>>& ranges,
+                                                               ThreadPool* pool = nullptr) const {
+        if (queries.size() != ranges.size()) {
+            throw std::invalid_argument("Each query needs exactly one [Smin, Smax] range");
+        }
+        ThreadPool& workers = pool ? *pool : ThreadPool::shared();
+        std::vector<std::vector<std::pair<float, int>>> results(queries.size());
+        std::vector<QueryScratch> scratch(workers.slots());
+        workers.parallelFor(queries.size(), [&](size_t i, int slot) {
+            results[i] = search(queries[i], k, ranges[i].first, ranges[i].second, scratch[slot]);
+        });
+        return results;
+    }
+
+private:
+    VectorArena vectors;
+    std::vector<float> sValues;
+    int dimension;
+    DistanceFunction distanceFn;
+    std::unique_ptr<ScalarQuantizer> quantizer;
+    int rerankFactor;
+
+    void appendRecord(const float* vec, float s) {
+        size_t idx = vectors.append(vec);
+        if (distanceFn.normalizesInputs()) {
+            distance::normalize(vectors.row(idx), dimension);
+        }
+        sValues.push_back(s);
+        if (quantizer) {
+            quantizer->append(vectors.row(idx));
+        }
+    }
+
+    // Per-thread buffers reused across the queries of a batch
+    struct QueryScratch {
+        std::vector<float> q;
+        TopK best;
+        ScalarQuantizer::Query quantized;
+        std::vector<const float*> rows;
+        std::vector<int> ids;
+        std::vector<float> dists;
+    };
+
+    std::vector<std::pair<float, int>> search(const std::vector<float>& v, int k, float Smin, float Smax,
+                                              QueryScratch& scratch) const {
+        if (vectors.empty()) {
             return {};
         }
 
@@ -40,43 +178,66 @@ public:
             throw std::invalid_argument("Query vector dimension does not match index dimension");
         }
 
-        std::vector<std::pair<float, int>> distIndex; 
-        distIndex.reserve(dataVectors.size());
+        std::vector<float>& q = scratch.q;
+        q = v;
+        if (distanceFn.normalizesInputs()) {
+            distance::normalize(q.data(), dimension);
+        }
 
-        // Compute distances and filter by s
-        for (int i = 0; i < (int)dataVectors.size(); i++) {
-            float sVal = sValues[i];
-            if (sVal >= Smin && sVal <= Smax) {
-                float dist = euclideanDistSquared(v, dataVectors[i]);
-                distIndex.push_back({dist, i});
-            }
+        TopK& best = scratch.best;
+        if (quantizer) {
+            return searchCodes(q.data(), k, Smin, Smax, scratch);
         }
 
-        // Sort by distance
-        std::sort(distIndex.begin(), distIndex.end(), [](auto& a, auto& b) {
-            return a.first < b.first;
+        // Compute distances a block of contiguous arena rows at a time, filter by s
+        // and stream the survivors through a bounded heap
+        const size_t Block = 256;
+        float dists[Block];
+        best.reset(k);
+        vectors.forEachRun(0, vectors.size(), [&](size_t firstRow, size_t rows, const float* data) {
+            for (size_t start = 0; start < rows; start += Block) {
+                size_t n = std::min(Block, rows - start);
+                distanceFn.batch(q.data(), data + start * dimension, n, dimension, dists);
+                for (size_t r = 0; r < n; r++) {
+                    int i = (int)(firstRow + start + r);
+                    float sVal = sValues[i];
+                    if (sVal >= Smin && sVal <= Smax) {
+                        best.push(dists[r], i);
+                    }
+                }
+            }
         });
 
-        // Take top k
-        std::vector<int> result;
-        for (int i = 0; i < k && i < (int)distIndex.size(); i++) {
-            result.push_back(distIndex[i].second);
-        }
-
-        return result;
+        return best.take();
     }
 
-private:
-    std::vector<std::vector<float>> dataVectors;
-    std::vector<float> sValues;
-    int dimension;
+    // Ranks the codes of the in-range rows, then the surviving short list exactly
+    std::vector<std::pair<float, int>> searchCodes(const float* q, int k, float Smin, float Smax,
+                                                   QueryScratch& scratch) const {
+        TopK& best = scratch.best;
+        best.reset(k * rerankFactor);
+        quantizer->prepare(q, scratch.quantized);
+        for (size_t i = 0; i < sValues.size(); i++) {
+            if (sValues[i] >= Smin && sValues[i] <= Smax) {
+                best.push(quantizer->distance(scratch.quantized, quantizer->code(i)), (int)i);
+            }
+        }
 
-    float euclideanDistSquared(const std::vector<float>& a, const std::vector<float>& b) {
-        float dist = 0.0f;
-        for (size_t i = 0; i < a.size(); i++) {
-            float diff = a[i] - b[i];
-            dist += diff * diff;
+        scratch.ids.clear();
+        for (const auto& hit : best.take()) {
+            scratch.ids.push_back(hit.second);
+        }
+        std::sort(scratch.ids.begin(), scratch.ids.end());
+        scratch.rows.resize(scratch.ids.size());
+        scratch.dists.resize(scratch.ids.size());
+        for (size_t i = 0; i < scratch.ids.size(); i++) {
+            scratch.rows[i] = vectors.row(scratch.ids[i]);
+        }
+        distanceFn.batch(q, scratch.rows.data(), scratch.rows.size(), dimension, scratch.dists.data());
+        best.reset(k);
+        for (size_t i = 0; i < scratch.ids.size(); i++) {
+            best.push(scratch.dists[i], scratch.ids[i]);
         }
-        return dist;
+        return best.take();
     }
 };
@@ -0,0 +1,65 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Runs fn(i) for every i in [0, n) on up to numThreads threads.
+ *        Indices are handed out one at a time from a shared counter, so uneven
+ *        work per index (e.g. HNSW insertions) still balances across threads.
+ * @param n          Number of indices.
+ * @param numThreads Number of threads to use; 0 means hardware concurrency.
+ * @param fn         Callable taking a size_t index.
+ * @throws Rethrows the first exception raised by fn, after all threads have stopped.
+ */
+template <typename Function>
+void parallelFor(size_t n, int numThreads, Function fn) {
+    if (numThreads <= 0) {
+        numThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    }
+    numThreads = (int)std::min<size_t>((size_t)numThreads, n);
+
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < n; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> nextIndex(0);
+    std::exception_ptr error = nullptr;
+    std::mutex errorMutex;
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&]() {
+            while (true) {
+                size_t i = nextIndex.fetch_add(1);
+                if (i >= n) break;
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                    // Stop handing out work to the other threads
+                    nextIndex = n;
+                    break;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif // PARALLEL_FOR_H
@@ -7,13 +7,33 @@
 #include <iostream>
 #include <limits>
 #include <stdexcept>
+#include <utility>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
 
 // Include your B+ tree header (as before)
-#include "./bplustree4.h"
+#include "./BPlusTree4.h"
 
 // HNSW library
 #include "../hnswlib/hnswlib/hnswlib.h"
 
+#include "./vectorArena.h"
+#include "./Distance.h"
+#include "./arenaSpace.h"
+#include "./TopK.h"
+#include "./parallelFor.h"
+#include "./ThreadPool.h"
+#include "./Snapshot.h"
+#include "./RangeFilter.h"
+#include "./QueryPlanner.h"
+#include "./QueryStats.h"
+
 /**
  * @brief A vector index that combines a B+ Tree and HNSW, 
  *        using a probabilistic approach to pick the candidate size (O).
@@ -22,11 +42,14 @@ class ProbabilisticVectorIndex {
 public:
     /**
      * @brief Constructor.
-     * @param order B+ tree order (minimum number of children per internal node).
+     * @param order  B+ tree order (minimum number of children per internal node).
+     * @param metric Distance metric. With Metric::Cosine, vectors and queries are
+     *               normalized and compared by inner product.
      */
-    ProbabilisticVectorIndex(int order)
-        : tree(order), dimension(0), hnswIndex(nullptr), space(nullptr),
-          hnswM(16), hnswEfConstruction(200), hnswEfSearch(200)
+    ProbabilisticVectorIndex(int order, Metric metric = Metric::L2)
+        : tree(order), dimension(0), distanceFn(metric), hnswIndex(nullptr), space(nullptr),
+          hnswM(16), hnswEfConstruction(200), hnswEfSearch(200), initialCapacity(DefaultCapacity),
+          readOnly(false), filterMode(FilterMode::Auto)
     {}
 
     /**
@@ -42,23 +65,17 @@ public:
      * @param vec The data vector (feature vector).
      * @param s   The scalar value used for filtering (e.g., some property).
      * @throws std::invalid_argument if the vector is empty or dimension mismatches existing data.
+     * @throws std::logic_error if the index was loaded from a mapped snapshot.
      */
     void insert(const std::vector<float>& vec, float s) {
+        checkWritable();
         if (vec.empty()) {
             throw std::invalid_argument("Cannot insert empty vector");
         }
 
         // Initialize dimension and HNSW structures if this is the first insert
-        if (dataVectors.empty()) {
-            dimension = static_cast<int>(vec.size());
-
-            // Create an L2 space and an HNSW index with a max capacity
-            size_t maxElements = 100000; // You can adjust this based on expected dataset size
-            space = new hnswlib::L2Space(dimension);
-            hnswIndex = new hnswlib::HierarchicalNSW<float>(space, maxElements, hnswM, hnswEfConstruction);
-
-            // Set the search ef parameter
-            hnswIndex->setEf(hnswEfSearch);
+        if (hnswIndex == nullptr) {
+            initIndex(static_cast<int>(vec.size()), initialCapacity);
         } else {
             // Ensure dimension consistency
             if (static_cast<int>(vec.size()) != dimension) {
@@ -66,91 +83,333 @@ public:
             }
         }
 
-        // Index assignment
-        int idx = static_cast<int>(dataVectors.size());
-        dataVectors.push_back(vec);
+        // Index assignment, growing HNSW first if it is full
+        ensureCapacity(vectors.size() + 1);
+        int idx = static_cast<int>(appendVector(vec));
         sValues.push_back(s);
 
         // Insert into B+ Tree (key = s, value = idx)
         tree.insert(s, idx);
 
-        // Insert vector into HNSW
-        hnswIndex->addPoint(dataVectors[idx].data(), idx);
+        // Insert vector into HNSW (it keeps a pointer to the arena row)
+        const float* row = vectors.row(idx);
+        hnswIndex->addPoint(&row, idx);
     }
 
     /**
-     * @brief Performs a k-NN query for the vector @p v while filtering by s in [Smin, Smax].
-     *        Uses a probabilistic formula to pick the candidate size O for HNSW.
-     * @param v      The query vector.
-     * @param k      The number of neighbors to return.
-     * @param Smin   The lower bound of the scalar filter.
-     * @param Smax   The upper bound of the scalar filter.
-     * @param alpha  Confidence parameter (probability of missing >= k matches is <= alpha).
-     * @return A vector of up to k indices of nearest neighbors satisfying the scalar filter.
-     * @throws std::invalid_argument if the dimension of v does not match the index dimension.
+     * @brief Inserts many vectors and their scalar values at once.
+     *        The new records are sorted by s a single time: an empty B+ Tree is bulk-loaded
+     *        from them, otherwise they go through one applyBatch(). HNSW insertions run in parallel.
+     * @param vecs       The data vectors.
+     * @param s          The scalar value of each vector (same length as @p vecs).
+     * @param numThreads Number of threads for the HNSW insertions (0 = hardware concurrency).
+     * @return The id of the first new vector; the others follow consecutively.
+     * @throws std::invalid_argument if the sizes differ, a vector is empty or dimensions mismatch.
+     * @throws std::logic_error if the index was loaded from a mapped snapshot.
      */
-    std::vector<int> query(const std::vector<float>& v, int k,
-                           float Smin, float Smax, double alpha = 0.01)
+    int insertBatch(const std::vector<std::vector<float>>& vecs, const std::vector<float>& s,
+                    int numThreads = 0)
     {
-        // Sanity checks
-        if (hnswIndex == nullptr || dataVectors.empty()) {
-            return {}; // no data
+        checkWritable();
+        if (vecs.size() != s.size()) {
+            throw std::invalid_argument("Each vector needs exactly one s value");
         }
-        if (static_cast<int>(v.size()) != dimension) {
-            throw std::invalid_argument("Query vector dimension does not match index dimension");
+        if (vecs.empty()) {
+            return static_cast<int>(vectors.size());
         }
 
-        // Count how many data points satisfy [Smin, Smax]
-        int S = tree.countInRange(Smin, Smax); // number of valid points
-        std::cout << "S: " << S << std::endl;
-        if (S <= 0) {
-            return {}; // none satisfy the condition
+        // Validate the whole batch before modifying anything
+        int batchDimension = hnswIndex == nullptr ? static_cast<int>(vecs[0].size()) : dimension;
+        for (const auto& vec : vecs) {
+            if (vec.empty()) {
+                throw std::invalid_argument("Cannot insert empty vector");
+            }
+            if (static_cast<int>(vec.size()) != batchDimension) {
+                throw std::invalid_argument("All vectors must have the same dimension");
+            }
         }
+        return insertRows(vecs.size(), batchDimension, [&vecs](size_t i) { return vecs[i].data(); }, s.data(),
+                          numThreads);
+    }
 
-        // Next, let M = total number of data points.
-        int M = static_cast<int>(dataVectors.size());
+    /**
+     * @brief Same as insertBatch() above for rows stored back to back, e.g. in a
+     *        DataLoader buffer or a memory-mapped file; they are copied straight into
+     *        the arena, with no intermediate vector per row.
+     * @param rows       @p count rows of @p dim floats.
+     * @param count      Number of rows.
+     * @param dim        Dimension of the rows.
+     * @param s          The @p count scalar values.
+     * @param numThreads Number of threads for the HNSW insertions (0 = hardware concurrency).
+     * @return The id of the first new vector; the others follow consecutively.
+     * @throws std::invalid_argument if a pointer is null, dim is not positive or differs
+     *         from the dimension of the index.
+     * @throws std::logic_error if the index was loaded from a mapped snapshot.
+     */
+    int insertBatch(const float* rows, size_t count, int dim, const float* s, int numThreads = 0) {
+        checkWritable();
+        if (count == 0) {
+            return static_cast<int>(vectors.size());
+        }
+        if (rows == nullptr || s == nullptr || dim <= 0) {
+            throw std::invalid_argument("A batch needs rows of a positive dimension and their s values");
+        }
+        if (hnswIndex != nullptr && dim != dimension) {
+            throw std::invalid_argument("All vectors must have the same dimension");
+        }
+        return insertRows(count, dim, [rows, dim](size_t i) { return rows + i * static_cast<size_t>(dim); }, s,
+                          numThreads);
+    }
 
-        // We will choose O using our new "enhanced" method
-        int O = computeRequiredO_Enhanced(M, S, k, alpha);  
-        std::cout << "Chosen O: " << O << std::endl;
+    /**
+     * @brief Makes room for n records in HNSW, the vector arena and the s values, so
+     *        that inserts up to n never resize.
+     *        Before the first insert, n becomes the initial size of the index.
+     * @param n Number of records to hold.
+     */
+    void reserve(size_t n) {
+        checkWritable();
+        if (hnswIndex == nullptr) {
+            initialCapacity = std::max<size_t>(n, 1);
+            return;
+        }
+        if (n > hnswIndex->getMaxElements()) {
+            hnswIndex->resizeIndex(n);
+        }
+        vectors.reserve(n);
+        sValues.reserve(n);
+    }
+
+    /**
+     * @brief Number of records the index holds without growing.
+     */
+    size_t capacity() const {
+        return hnswIndex ? hnswIndex->getMaxElements() : initialCapacity;
+    }
+
+    /**
+     * @brief Writes a snapshot of the index, in the format VectorIndex uses as well.
+     *        @p path holds a header, the vectors, the s values and the flattened B+ Tree;
+     *        path + ".hnsw" holds the graph as serialized by hnswlib.
+     * @param path File to write.
+     * @throws std::runtime_error if a file cannot be written.
+     */
+    void save(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing");
+        }
+        snapshot::writeTag(out, "VECINDEX");
+        snapshot::write<uint32_t>(out, static_cast<uint32_t>(distanceFn.getMetric()));
+        snapshot::write<uint64_t>(out, hnswIndex ? dimension : 0);
+        snapshot::write<uint64_t>(out, vectors.size());
+        // Rows start on an aligned offset so a mapped snapshot can be used in place
+        snapshot::pad(out, VectorArena::Alignment);
+        vectors.write(out);
+        snapshot::writeArray(out, sValues.data(), sValues.size());
+        tree.save(out);
+        if (!out) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+        if (hnswIndex) {
+            hnswIndex->saveIndex(path + ".hnsw");
+        }
+    }
 
-        // 1) Retrieve O approximate neighbors from HNSW
-        //    Make sure efSearch is at least O so we actually can retrieve that many
-        hnswIndex->setEf(std::max(hnswEfSearch, O + 50));  // ensure enough exploration
-        std::vector<int> annCandidates = approximateNearestNeighbors(v, O);
+    /**
+     * @brief Loads a snapshot written by save() into this (empty) index.
+     *        The tree is rebuilt bottom-up from its flattened form and the graph is read
+     *        by hnswlib, then pointed at the loaded rows. If loading fails the index must
+     *        be discarded.
+     * @param path   File written by save().
+     * @param mapped If true, the vectors are used in place from a read-only memory mapping
+     *               of the file instead of being read, so a replica starts without copying
+     *               them. The index is then read-only.
+     * @throws std::logic_error if the index is not empty.
+     * @throws std::invalid_argument if the snapshot was saved with another metric.
+     * @throws std::runtime_error if a file is missing, truncated or from another version.
+     */
+    void load(const std::string& path, bool mapped = false) {
+        if (hnswIndex != nullptr || !vectors.empty()) {
+            throw std::logic_error("Can only load a snapshot into an empty index");
+        }
+        std::unique_ptr<snapshot::MappedFile> file;
+        std::unique_ptr<std::istream> in;
+        if (mapped) {
+            file.reset(new snapshot::MappedFile(path));
+            in.reset(new snapshot::MemoryStream(file->data(), file->size()));
+        } else {
+            in.reset(new std::ifstream(path, std::ios::binary));
+            if (!*in) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+        }
 
-        // 2) Filter them by checking if sValues[idx] is in [Smin, Smax]
-        std::vector<std::pair<float,int>> distIndex;
-        distIndex.reserve(annCandidates.size());
-        for (int idx : annCandidates) {
-            float sVal = sOfIndex(idx);
-            if (sVal >= Smin && sVal <= Smax) {
-                float dist = euclideanDistSquared(v, dataVectors[idx]);
-                distIndex.push_back({dist, idx});
+        snapshot::expectTag(*in, "VECINDEX");
+        if (snapshot::read<uint32_t>(*in) != static_cast<uint32_t>(distanceFn.getMetric())) {
+            throw std::invalid_argument("Snapshot was saved with a different metric");
+        }
+        int dim = static_cast<int>(snapshot::read<uint64_t>(*in));
+        size_t count = snapshot::read<uint64_t>(*in);
+        snapshot::skipPad(*in, VectorArena::Alignment);
+        if (dim == 0) {
+            return; // saved empty
+        }
+
+        vectors.setDimension(dim);
+        if (mapped) {
+            size_t offset = static_cast<size_t>(in->tellg());
+            size_t bytes = count * dim * sizeof(float);
+            if (offset + bytes > file->size()) {
+                throw std::runtime_error("Truncated snapshot " + path);
             }
+            vectors.attach(reinterpret_cast<const float*>(file->data() + offset), count);
+            in->seekg(bytes, std::ios::cur);
+        } else {
+            vectors.read(*in, count);
         }
+        sValues.resize(count);
+        snapshot::readArray(*in, sValues.data(), count);
+        tree.load(*in);
+
+        dimension = dim;
+        distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dim);
+        space = new ArenaSpace(dimension, distanceFn.getMetric());
+        hnswIndex = new hnswlib::HierarchicalNSW<float>(space, path + ".hnsw", false,
+                                                        std::max(count, initialCapacity));
+        ArenaSpace::relink(*hnswIndex, vectors);
+        hnswIndex->setEf(hnswEfSearch);
+        planner = QueryPlanner::calibrated(dimension);
+        mapping = std::move(file);
+        readOnly = mapped;
+    }
+
+    /**
+     * @brief Restricts the HNSW plans the query planner may choose. Auto (the default)
+     *        considers both; InGraph only filters inside the graph traversal, which needs
+     *        no O; PostFilter only fetches the binomially sized O neighbours and filters
+     *        them. An exact scan of the range is always considered.
+     *        Set it before querying; it is not synchronized with running queries.
+     */
+    void setFilterMode(FilterMode mode) {
+        filterMode = mode;
+    }
 
-        // 3) Sort by distance ascending
-        std::sort(distIndex.begin(), distIndex.end(),
-                  [](auto& a, auto& b) { return a.first < b.first; });
+    FilterMode getFilterMode() const {
+        return filterMode;
+    }
+
+    /**
+     * @brief The plan a query would use and the estimated cost of each alternative,
+     *        without running it.
+     * @param alpha Confidence parameter used to size the post-filter O, as in query().
+     */
+    PlanEstimate explain(int k, float Smin, float Smax, double alpha = 0.01) const {
+        int S = tree.countInRange(Smin, Smax);
+        return planFor(k, S, postFilterSize(k, S, alpha));
+    }
+
+    /**
+     * @brief Number of records with s in [Smin, Smax], from the B+ Tree's subtree counts.
+     */
+    int countInRange(float Smin, float Smax) const {
+        return tree.countInRange(Smin, Smax);
+    }
 
-        // 4) Return top-k
+    /**
+     * @brief Performs a k-NN query for the vector @p v while filtering by s in [Smin, Smax].
+     *        The query planner picks an exact scan of the range, a filtered HNSW search,
+     *        or a post-filtered one whose candidate size O comes from a probabilistic formula.
+     * @param v      The query vector.
+     * @param k      The number of neighbors to return.
+     * @param Smin   The lower bound of the scalar filter.
+     * @param Smax   The upper bound of the scalar filter.
+     * @param alpha  Confidence parameter (probability of missing >= k matches is <= alpha).
+     * @param stats  If given, receives what the query did: the plan, the number S of
+     *               matching rows, the O fetched, candidates kept, distances and timings.
+     * @return A vector of up to k indices of nearest neighbors satisfying the scalar filter.
+     * @throws std::invalid_argument if the dimension of v does not match the index dimension.
+     */
+    std::vector<int> query(const std::vector<float>& v, int k,
+                           float Smin, float Smax, double alpha = 0.01, QueryStats* stats = nullptr) const
+    {
         std::vector<int> result;
-        result.reserve(k);
-        for (int i = 0; i < k && i < static_cast<int>(distIndex.size()); i++) {
-            result.push_back(distIndex[i].second);
+        result.reserve(std::max(k, 0));
+        for (const auto& hit : queryWithDistances(v, k, Smin, Smax, alpha, stats)) {
+            result.push_back(hit.second);
         }
         return result;
     }
 
+    /**
+     * @brief Same as query(), but also returns the distance of each neighbor.
+     * @return Up to k (distance, index) pairs sorted by ascending distance.
+     * @throws std::invalid_argument if the dimension of v does not match the index dimension.
+     */
+    std::vector<std::pair<float, int>> queryWithDistances(const std::vector<float>& v, int k,
+                                                          float Smin, float Smax, double alpha = 0.01,
+                                                          QueryStats* stats = nullptr) const
+    {
+        QueryScratch scratch;
+        return search(v, k, Smin, Smax, alpha, scratch, stats);
+    }
+
+    /**
+     * @brief Answers a batch of queries in parallel. Queries only read the index (the HNSW
+     *        search breadth is passed per query instead of through setEf), so the batch can
+     *        use every thread of the pool, but it must not overlap with inserts.
+     * @param queries The query vectors.
+     * @param k       The number of neighbors to return per query.
+     * @param ranges  The [Smin, Smax] filter of each query (same length as @p queries).
+     * @param alpha   Confidence parameter, as in query().
+     * @param pool    Thread pool to run on (nullptr = ThreadPool::shared()).
+     * @return For each query, up to k (distance, index) pairs sorted by ascending distance.
+     * @throws std::invalid_argument if the sizes differ or a query has the wrong dimension.
+     */
+    std::vector<std::vector<std::pair<float, int>>> queryBatch(
+        const std::vector<std::vector<float>>& queries, int k,
+        const std::vector<std::pair<float, float>>& ranges,
+        double alpha = 0.01, ThreadPool* pool = nullptr) const
+    {
+        if (queries.size() != ranges.size()) {
+            throw std::invalid_argument("Each query needs exactly one [Smin, Smax] range");
+        }
+        ThreadPool& workers = pool ? *pool : ThreadPool::shared();
+        std::vector<std::vector<std::pair<float, int>>> results(queries.size());
+        std::vector<QueryScratch> scratch(workers.slots());
+        workers.parallelFor(queries.size(), [&](size_t i, int slot) {
+            results[i] = search(queries[i], k, ranges[i].first, ranges[i].second, alpha, scratch[slot], nullptr);
+        });
+        return results;
+    }
+
+    /**
+     * @brief Totals over every query answered so far, batches included (see QueryStats).
+     */
+    QueryCounters::Totals queryCounters() const {
+        return counters.totals();
+    }
+
+    void resetQueryCounters() {
+        counters.reset();
+    }
+
+    /**
+     * @brief Work done by reads of the s tree: counts, range scans, nodes and values visited.
+     */
+    BPlusTree<float, int>::ReadStats treeStats() const {
+        return tree.readStats();
+    }
+
 private:
     // -- B+ Tree for scalar queries --
     BPlusTree<float, int> tree;
 
     // -- In-memory storage for vectors and their scalar filter values --
-    std::vector<std::vector<float>> dataVectors;
+    VectorArena vectors; // shared with HNSW, which stores row pointers
     std::vector<float> sValues;
     int dimension; // dimension of all vectors
+    DistanceFunction distanceFn; // metric bound to the dispatched SIMD kernels
 
     // -- HNSW components --
     hnswlib::HierarchicalNSW<float>* hnswIndex;
@@ -159,6 +418,274 @@ private:
     int hnswEfConstruction;
     int hnswEfSearch;
 
+    // -- Capacity: HNSW starts small and at least doubles when it runs full --
+    static const size_t DefaultCapacity = 1024;
+    size_t initialCapacity;
+
+    // -- Snapshot state: set by load(path, true), the arena then points into the mapping --
+    std::unique_ptr<snapshot::MappedFile> mapping;
+    bool readOnly;
+
+    // -- How the s predicate is applied on the HNSW path --
+    FilterMode filterMode;
+
+    // -- Picks the cheapest plan per query; calibrated once the dimension is known --
+    QueryPlanner planner;
+
+    // -- Totals of the per-query stats --
+    mutable QueryCounters counters;
+
+    // -- Post-filter sizing: O memoized per (k, p bucket, alpha), see computeRequiredO_Enhanced --
+    static constexpr int MaxEscalations = 2;
+    static constexpr double PBucketsPerOctave = 8.0;
+    mutable std::shared_mutex requiredOLock;
+    mutable std::map<std::tuple<int, int, double>, int> requiredOCache;
+
+    void checkWritable() const {
+        if (readOnly) {
+            throw std::logic_error("Index was loaded from a mapped snapshot and is read-only");
+        }
+    }
+
+    /**
+     * @brief Grows HNSW to hold at least @p required elements. The new size is at least
+     *        twice the old one, so a stream of inserts resizes O(log n) times and the
+     *        graph is extended in place rather than rebuilt.
+     */
+    void ensureCapacity(size_t required) {
+        size_t current = hnswIndex->getMaxElements();
+        if (required > current) {
+            hnswIndex->resizeIndex(std::max(required, current * 2));
+        }
+        // Reserve the s values along with HNSW so they grow in the same steps
+        vectors.reserve(required);
+        sValues.reserve(hnswIndex->getMaxElements());
+    }
+
+    /**
+     * @brief Creates the arena-backed space and the HNSW index once the dimension is known.
+     */
+    void initIndex(int dim, size_t maxElements) {
+        dimension = dim;
+        distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dim);
+        vectors.setDimension(dim);
+        space = new ArenaSpace(dimension, distanceFn.getMetric());
+        hnswIndex = new hnswlib::HierarchicalNSW<float>(space, maxElements, hnswM, hnswEfConstruction);
+        hnswIndex->setEf(hnswEfSearch);
+        planner = QueryPlanner::calibrated(dim);
+    }
+
+    /**
+     * @brief Asks the planner for a query on @p S matching rows. The bottom HNSW layer
+     *        keeps up to 2 * M links per node.
+     */
+    PlanEstimate planFor(int k, int S, int O) const {
+        return planner.plan(static_cast<int>(vectors.size()), std::max(S, 0), k, hnswEfSearch,
+                            2 * hnswM, O, filterMode);
+    }
+
+    /**
+     * @brief The binomially sized O for a post-filtered search, or 0 when the filter
+     *        mode rules that plan out (so the binomial search is skipped).
+     */
+    int postFilterSize(int k, int S, double alpha) const {
+        if (filterMode == FilterMode::InGraph || S <= 0 || k <= 0) {
+            return 0;
+        }
+        return computeRequiredO_Enhanced(static_cast<int>(vectors.size()), S, k, alpha);
+    }
+
+    /**
+     * @brief The body of both insertBatch() overloads, on a validated batch;
+     *        rowAt(i) is the address of row i. Returns the id of the first row.
+     */
+    template <typename RowAt>
+    int insertRows(size_t count, int dim, RowAt rowAt, const float* s, int numThreads) {
+        int first = static_cast<int>(vectors.size());
+        int n = static_cast<int>(count);
+        if (hnswIndex == nullptr) {
+            initIndex(dim, std::max<size_t>(initialCapacity, count));
+        }
+        ensureCapacity(first + n);
+        for (size_t i = 0; i < count; i++) {
+            appendVector(rowAt(i));
+        }
+        sValues.insert(sValues.end(), s, s + count);
+
+        // Sort the new (s, idx) pairs once
+        std::vector<std::pair<float, int>> entries(n);
+        for (int i = 0; i < n; i++) {
+            entries[i] = {s[i], first + i};
+        }
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](auto& a, auto& b) { return a.first < b.first; });
+        if (first == 0) {
+            tree.bulkLoad(std::move(entries));
+        } else {
+            tree.applyBatch({}, std::move(entries));
+        }
+
+        // hnswlib supports concurrent addPoint calls
+        parallelFor(static_cast<size_t>(n), numThreads, [&](size_t i) {
+            int idx = first + static_cast<int>(i);
+            const float* row = vectors.row(idx);
+            hnswIndex->addPoint(&row, idx);
+        });
+        return first;
+    }
+
+    /**
+     * @brief Buffers reused by the queries one thread runs (one instance per pool slot).
+     */
+    struct QueryScratch {
+        std::vector<float> normalized;
+        std::vector<int> candidates;
+        TopK best;
+        QueryStats stats; // of the running query
+    };
+
+    /**
+     * @brief Query implementation shared by queryWithDistances() and queryBatch().
+     *        Does not modify the index, so several threads can run it at once.
+     *        Completes the stats filled in by searchRange(), records them in the
+     *        counters and copies them to @p out if given.
+     */
+    std::vector<std::pair<float, int>> search(const std::vector<float>& v, int k,
+                                              float Smin, float Smax, double alpha,
+                                              QueryScratch& scratch, QueryStats* out) const
+    {
+        scratch.stats = QueryStats();
+        PhaseTimer total(out != nullptr);
+        PhaseTimer phases(out != nullptr);
+        size_t graphBefore = ArenaSpace::evaluations();
+        std::vector<std::pair<float, int>> result = searchRange(v, k, Smin, Smax, alpha, scratch, phases);
+        QueryStats& stats = scratch.stats;
+        stats.graphDistances = ArenaSpace::evaluations() - graphBefore;
+        stats.results = result.size();
+        stats.totalNs = total.lap();
+        counters.record(stats);
+        if (out) {
+            *out = stats;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<float, int>> searchRange(const std::vector<float>& v, int k,
+                                                   float Smin, float Smax, double alpha,
+                                                   QueryScratch& scratch, PhaseTimer& timer) const
+    {
+        // Sanity checks
+        if (hnswIndex == nullptr || vectors.empty()) {
+            return {}; // no data
+        }
+        if (static_cast<int>(v.size()) != dimension) {
+            throw std::invalid_argument("Query vector dimension does not match index dimension");
+        }
+        if (k <= 0) {
+            return {};
+        }
+
+        // Count how many data points satisfy [Smin, Smax]
+        QueryStats& stats = scratch.stats;
+        int S = tree.countInRange(Smin, Smax); // number of valid points
+        stats.matching = std::max(S, 0);
+        stats.countNs = timer.lap();
+        if (S <= 0) {
+            return {}; // none satisfy the condition
+        }
+
+        const float* q = prepareQuery(v, scratch.normalized);
+        TopK& best = scratch.best;
+        best.reset(k);
+
+        // We will choose O using our new "enhanced" method (if post-filtering is allowed)
+        int O = postFilterSize(k, S, alpha);
+        QueryPlan plan = planFor(k, S, O).plan;
+        stats.planned = true;
+        stats.plan = plan;
+        stats.planNs = timer.lap();
+
+        if (plan == QueryPlan::ExactScan) {
+            // Few enough matches to rank them all: fetch them from the tree in row order
+            std::vector<int>& candidates = scratch.candidates;
+            candidates.clear();
+            tree.forEachInRange(Smin, Smax, [&](float, BPlusTree<float, int>::Postings ids) {
+                candidates.insert(candidates.end(), ids.begin(), ids.end());
+                return true;
+            });
+            std::sort(candidates.begin(), candidates.end());
+            stats.candidates += candidates.size();
+            stats.passed += candidates.size();
+            stats.scanDistances += candidates.size();
+            rankExact(q, candidates, best);
+            stats.searchNs = timer.lap();
+            return best.take();
+        }
+
+        if (plan == QueryPlan::FilteredAnn) {
+            filteredSearch(q, k, Smin, Smax, best, stats);
+            stats.searchNs = timer.lap();
+            return best.take();
+        }
+
+        // O comes without a safety margin: in the rare case (probability <= alpha) that
+        // fewer than k candidates are in range, the search is repeated with twice the
+        // breadth. hnswlib cannot resume a search, but the doubling keeps the total work
+        // below twice that of the last round.
+        int M = static_cast<int>(vectors.size());
+        for (int round = 0; ; round++) {
+            // 1) Retrieve O approximate neighbors from HNSW
+            //    Explore at least O + 50 candidates so we actually can retrieve that many
+            std::vector<std::pair<float, int>> annCandidates =
+                approximateNearestNeighbors(q, O, std::max(hnswEfSearch, O + 50));
+            stats.graphSearches++;
+            stats.fetched = O;
+            stats.candidates += annCandidates.size();
+
+            // 2) Keep the k closest candidates with sValues[idx] in [Smin, Smax].
+            //    HNSW computed their exact distances with our kernels, so they are reused.
+            best.reset(k);
+            for (const auto& hit : annCandidates) {
+                float sVal = sOfIndex(hit.second);
+                if (sVal >= Smin && sVal <= Smax) {
+                    stats.passed++;
+                    best.push(hit.first, hit.second);
+                }
+            }
+            if (best.full() || O >= M) {
+                break;
+            }
+            if (round == MaxEscalations) {
+                // Still short: let the traversal collect in-range nodes itself
+                best.reset(k);
+                filteredSearch(q, k, Smin, Smax, best, stats);
+                break;
+            }
+            O = std::min(M, 2 * O);
+        }
+
+        // 3) Sorted by distance ascending
+        stats.searchNs = timer.lap();
+        return best.take();
+    }
+
+    /**
+     * @brief Filtered HNSW search: the predicate is checked during the traversal, so
+     *        every node offered to @p best is in range. The search is added to @p stats.
+     */
+    void filteredSearch(const float* q, int k, float Smin, float Smax, TopK& best, QueryStats& stats) const {
+        auto filter = makeRangeFilter([this](hnswlib::labeltype label) {
+            return sOfIndex(static_cast<int>(label));
+        }, Smin, Smax);
+        std::vector<std::pair<float, int>> hits = approximateNearestNeighbors(q, k, hnswEfSearch, &filter);
+        stats.graphSearches++;
+        stats.candidates += hits.size();
+        stats.passed += hits.size();
+        for (const auto& hit : hits) {
+            best.push(hit.first, hit.second);
+        }
+    }
+
     /**
      * @brief Gets the scalar s-value for index idx.
      */
@@ -167,34 +694,81 @@ private:
     }
 
     /**
-     * @brief Computes squared Euclidean distance between two vectors of the same dimension.
+     * @brief Copies a vector into the arena, normalized if the metric works on unit vectors.
+     * @return The index of the new row.
      */
-    inline float euclideanDistSquared(const std::vector<float>& a, const std::vector<float>& b) const {
-        float dist = 0.0f;
-        for (size_t i = 0; i < a.size(); i++) {
-            float diff = a[i] - b[i];
-            dist += diff * diff;
+    size_t appendVector(const std::vector<float>& vec) {
+        return appendVector(vec.data());
+    }
+
+    size_t appendVector(const float* vec) {
+        size_t idx = vectors.append(vec);
+        if (distanceFn.normalizesInputs()) {
+            distance::normalize(vectors.row(idx), dimension);
+        }
+        return idx;
+    }
+
+    /**
+     * @brief Returns the query as the metric expects it: @p v itself, or a normalized
+     *        copy stored in @p scratch.
+     */
+    const float* prepareQuery(const std::vector<float>& v, std::vector<float>& scratch) const {
+        if (!distanceFn.normalizesInputs()) {
+            return v.data();
+        }
+        scratch = v;
+        distance::normalize(scratch.data(), dimension);
+        return scratch.data();
+    }
+
+    /**
+     * @brief Ranks the rows @p ids (ascending, so the arena is read forwards) with the
+     *        batched kernel, a block at a time, and offers them to @p best.
+     */
+    void rankExact(const float* q, const std::vector<int>& ids, TopK& best) const {
+        const size_t Block = 64;
+        const float* rows[Block];
+        float dists[Block];
+        for (size_t start = 0; start < ids.size(); start += Block) {
+            size_t n = std::min(Block, ids.size() - start);
+            for (size_t i = 0; i < n; i++) {
+                rows[i] = vectors.row(ids[start + i]);
+            }
+            distanceFn.batch(q, rows, n, dimension, dists);
+            for (size_t i = 0; i < n; i++) {
+                best.push(dists[i], ids[start + i]);
+            }
         }
-        return dist;
     }
 
     /**
      * @brief Approximate Nearest Neighbors from HNSW. Retrieves the top O candidates.
-     * @param query The query vector.
+     * @param query The query vector (dimension floats).
      * @param O     The number of candidates to retrieve.
-     * @return A vector of indices for the top O approximate neighbors.
+     * @param ef    Search breadth. hnswlib explores max(ef_, k) candidates, so asking for
+     *              max(O, ef) results widens the search without calling setEf, which would
+     *              race with concurrent queries; the extra results are dropped.
+     * @param filter If given, only labels it accepts are returned (checked during the traversal).
+     * @return The top O approximate neighbors as (distance, index), closest first.
      */
-    std::vector<int> approximateNearestNeighbors(const std::vector<float>& query, int O) {
+    std::vector<std::pair<float, int>> approximateNearestNeighbors(const float* query, int O, int ef,
+                                                                   hnswlib::BaseFilterFunctor* filter = nullptr) const {
         if (!hnswIndex || O <= 0) {
             return {};
         }
-        auto result = hnswIndex->searchKnn(query.data(), O);
+        // ArenaSpace expects the address of a row pointer for queries as well
+        auto result = hnswIndex->searchKnn(&query, std::max(O, ef), filter);
+        // Drop the farthest results beyond O
+        while (static_cast<int>(result.size()) > O) {
+            result.pop();
+        }
 
         // hnswlib returns a priority queue (max at top), so we collect in reverse
-        std::vector<int> candidates;
+        std::vector<std::pair<float, int>> candidates;
         candidates.reserve(result.size());
         while (!result.empty()) {
-            candidates.push_back(static_cast<int>(result.top().second));
+            candidates.push_back({result.top().first, static_cast<int>(result.top().second)});
             result.pop();
         }
         // The queue gives them in reverse order, so we flip it
@@ -206,43 +780,24 @@ private:
     //           BINOMIAL/PROBABILISTIC APPROACH FOR SELECTING O
     // ----------------------------------------------------------------
 
-    /**
-     * @brief Computes the binomial coefficient C(n, k) = n! / (k! * (n-k)!).
-     *        Uses a safe floating-point approach to reduce overflow.
-     */
-    double binomialCoefficient(int n, int k) const {
-        if (k > n) return 0.0;
-        if (k == 0 || k == n) return 1.0;
-        double result = 1.0;
-        // For efficiency, do k = min(k, n-k)
-        int kk = (k < (n - k)) ? k : (n - k);
-        for (int i = 1; i <= kk; i++) {
-            result = result * (n - (kk - i)) / i;
-        }
-        return result;
-    }
-
-    /**
-     * @brief Binomial PMF: P(X = k) for X ~ Binomial(n, p).
-     */
-    double binomialPMF(int n, int k, double p) const {
-        if (p < 0.0 || p > 1.0) return 0.0;
-        double c = binomialCoefficient(n, k);
-        double pk  = std::pow(p,   k);
-        double pmk = std::pow(1.0 - p, n - k);
-        return c * pk * pmk;
-    }
-
     /**
      * @brief Probability that a Binomial(n, p) random variable is less than k.
      *        i.e. P(X < k).
+     *        The terms are built in log space from P(X = 0) = (1 - p)^n with the ratio
+     *        P(X = i + 1) / P(X = i) = (n - i) / (i + 1) * p / (1 - p), so a call costs
+     *        O(k) without recomputing coefficients and powers, and large n cannot overflow.
      */
     double binomialCDFLessThan(int n, int k, double p) const {
+        if (p <= 0.0) return k > 0 ? 1.0 : 0.0;
+        if (p >= 1.0) return n < k ? 1.0 : 0.0;
+        double logOdds = std::log(p) - std::log1p(-p);
+        double logTerm = n * std::log1p(-p);
         double sumProb = 0.0;
-        for (int i = 0; i < k; i++) {
-            sumProb += binomialPMF(n, i, p);
+        for (int i = 0; i < k && i <= n; i++) {
+            sumProb += std::exp(logTerm);
+            logTerm += std::log(static_cast<double>(n - i)) - std::log(i + 1.0) + logOdds;
         }
-        return sumProb;
+        return std::min(sumProb, 1.0);
     }
 
     // ----------------------------------------------------------------
@@ -250,101 +805,46 @@ private:
     // ----------------------------------------------------------------
 
     /**
-     * @brief A direct (linear) approach as in your original code:
-     *        increments O until P(X < k) <= alpha or O reaches M.
-     *        (Kept here for reference; we’ll prefer the binary search version below.)
+     * @brief Normal approximation of the smallest O with P(X < k) <= alpha for
+     *        X ~ Binomial(O, p): with continuity correction the condition is
+     *        O p - |z| sqrt(O p (1 - p)) >= k - 0.5, a quadratic in sqrt(O) solved in O(1).
+     *        Used as the starting point of the exact search.
      */
-    int computeRequiredO_Linear(int M, int S, int k, double alpha) const {
+    int computeRequiredO_NormalApprox(int k, double p, double alpha) const {
         if (k <= 0) return 0;
-        if (S <= 0) return k;
-        if (S >= M) return k;
-        if (alpha <= 0.0) return k;
+        if (p >= 1.0 || alpha <= 0.0) return k;
 
-        double p = static_cast<double>(S) / M;
-        int O = k; 
-        while (O <= M) {
-            double probFewerThanK = binomialCDFLessThan(O, k, p);
-            if (probFewerThanK <= alpha) {
-                return O;
-            }
-            O++;
-        }
-        return M; 
+        double z = std::max(0.0, -invStdNormal(alpha));
+        double b = z * std::sqrt(p * (1.0 - p));
+        double c = k - 0.5;
+        double root = (b + std::sqrt(b * b + 4.0 * p * c)) / (2.0 * p);
+        return std::max(k, static_cast<int>(std::min(std::ceil(root * root), 1e9)));
     }
 
     /**
-     * @brief A faster binary-search-based approach to find the smallest O 
-     *        so that P(X < k) <= alpha for X ~ Binomial(O, p).
+     * @brief Smallest O with P(X < k) <= alpha for X ~ Binomial(O, p): starts from the
+     *        normal approximation, doubles until the bound holds, then binary-searches
+     *        the last interval with the exact CDF.
      */
-    int computeRequiredO_BinarySearch(int M, int S, int k, double alpha) const {
-        // Edge cases
-        if (k <= 0) return 0;
-        if (S <= 0) return k;
-        if (S >= M) return k;
-        if (alpha <= 0.0) return k;
-
-        double p = static_cast<double>(S) / M;
-        int left = k;
-        int right = M;
-        int best = M;
-
-        while (left <= right) {
-            int mid = (left + right) / 2;
-            double probFewerThanK = binomialCDFLessThan(mid, k, p);
-
-            if (probFewerThanK <= alpha) {
-                best = mid;      // mid is good enough
-                right = mid - 1; // try to find a smaller O
-            } else {
-                left = mid + 1;  // need bigger O
-            }
+    int requiredO(int k, double p, double alpha) const {
+        const int Limit = 1 << 30;
+        int low = k - 1; // P(X < k) = 1 for O < k
+        int high = computeRequiredO_NormalApprox(k, p, alpha);
+        while (high < Limit && binomialCDFLessThan(high, k, p) > alpha) {
+            low = high;
+            high = static_cast<int>(std::min<long long>(Limit, 2LL * high));
         }
-        return best;
-    }
-
-    /*  OPTIONAL: Normal approximation approach for large M, S, O
-    //--------------------------------------------------------------------
-    //  If you prefer to approximate Binomial(O, p) by Normal(Op, Op(1-p))
-    //  and solve for P(X < k) <= alpha, you can use this. Then in
-    //  computeRequiredO_Enhanced() you can call computeRequiredO_NormalApprox
-    //  instead of computeRequiredO_BinarySearch.
-    //--------------------------------------------------------------------
-    
-    int computeRequiredO_NormalApprox(int M, int S, int k, double alpha) const {
-        if (k <= 0) return 0;
-        if (S <= 0) return k;
-        if (S >= M) return k;
-        if (alpha <= 0.0) return k;
-
-        double p = static_cast<double>(S) / M;
-        int left = k;
-        int right = M;
-        int best = M;
-
-        // We convert alpha -> zAlpha for standard normal
-        // e.g. alpha=0.01 => zAlpha ~ -2.33 (but we want 'X < k')
-        // We'll define a simple function to get approximate zAlpha
-        double zAlpha = invStdNormal(alpha);
-
-        while (left <= right) {
-            int mid = (left + right) / 2;
-            double mean  = mid * p;
-            double var   = mid * p * (1.0 - p);
-            double stdev = std::sqrt(var + 1e-12);
-
-            // continuity correction: check if (k - 0.5 - mean)/stdev <= zAlpha
-            double lhs = (k - 0.5 - mean) / stdev;
-
-            if (lhs <= zAlpha) {
-                best = mid;
-                right = mid - 1;
+        // Invariant: low fails (or is below k), high satisfies the bound
+        while (high - low > 1) {
+            int mid = low + (high - low) / 2;
+            if (binomialCDFLessThan(mid, k, p) <= alpha) {
+                high = mid;
             } else {
-                left = mid + 1;
+                low = mid;
             }
         }
-        return best;
+        return high;
     }
-    */
 
     /**
      * @brief A small approximate inverse CDF for the standard normal distribution.
@@ -408,15 +908,32 @@ private:
     }
 
     /**
-     * @brief Final "enhanced" method that uses binary search (or normal approx) + margin.
+     * @brief Final "enhanced" method: requiredO() for the selectivity p = S / M, memoized.
+     *        p is rounded down to one of PBucketsPerOctave log-spaced buckets per factor of
+     *        two, which can only make O larger, so (k, bucket, alpha) identifies the answer
+     *        and repeated queries skip the search. No flat margin is added: search()
+     *        widens the search instead when too few candidates survive.
      */
     int computeRequiredO_Enhanced(int M, int S, int k, double alpha) const {
-        // Use the binary-search-based method
-        int O = computeRequiredO_BinarySearch(M, S, k, alpha);
+        if (k <= 0) return 0;
+        if (S <= 0) return k;
+        if (S >= M) return k;
+        if (alpha <= 0.0) return k;
 
-        // Add a safety margin
-        O += 100;
-        return O;
+        double p = static_cast<double>(S) / M;
+        int bucket = static_cast<int>(std::floor(std::log2(p) * PBucketsPerOctave));
+        auto key = std::make_tuple(k, bucket, alpha);
+        {
+            std::shared_lock<std::shared_mutex> lock(requiredOLock);
+            auto it = requiredOCache.find(key);
+            if (it != requiredOCache.end()) {
+                return std::min(it->second, M);
+            }
+        }
+        int O = requiredO(k, std::exp2(bucket / PBucketsPerOctave), alpha);
+        std::unique_lock<std::shared_mutex> lock(requiredOLock);
+        requiredOCache.emplace(key, O);
+        return std::min(O, M);
     }
 };
 
@@ -0,0 +1,191 @@
+#ifndef VECTOR_ARENA_H
+#define VECTOR_ARENA_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <new>
+#include <stdexcept>
+
+/**
+ * @brief Row-major storage for fixed-dimension float vectors.
+ *
+ * Rows live in 64-byte aligned chunks with a stride of `dimension` floats. Chunk c
+ * holds twice as many rows as chunk c - 1, so capacity grows geometrically while
+ * a row never moves once written: row pointers stay valid for the lifetime of the
+ * arena (the HNSW index stores them instead of copying the vectors) and a scan over
+ * consecutive rows reads memory sequentially within each chunk.
+ *
+ * Appends must be serialized by the caller, but may run while other threads read
+ * rows below size(): a new row is published only after it has been copied.
+ */
+class VectorArena {
+public:
+    static const size_t Alignment = 64;
+
+    VectorArena() : dim(0), count(0), reserved(0), baseShift(0), borrowed(false) {
+        chunks.fill(nullptr);
+    }
+
+    ~VectorArena() {
+        for (int c = borrowed ? 1 : 0; c < MaxChunks; c++) {
+            if (chunks[c]) ::operator delete(chunks[c], std::align_val_t(Alignment));
+        }
+    }
+
+    VectorArena(const VectorArena&) = delete;
+    VectorArena& operator=(const VectorArena&) = delete;
+
+    /**
+     * @brief Sets the dimension of the stored vectors. Only allowed while the arena is empty.
+     * @throws std::logic_error if rows have already been allocated.
+     */
+    void setDimension(int dimension) {
+        if (reserved > 0) {
+            throw std::logic_error("Cannot change the dimension of a non-empty arena");
+        }
+        dim = dimension;
+        // Size the first chunk to roughly 64 KiB, with at least 16 rows
+        size_t rowBytes = std::max<size_t>(1, dim) * sizeof(float);
+        baseShift = 4;
+        while (((size_t)2 << baseShift) * rowBytes <= 64 * 1024) {
+            baseShift++;
+        }
+    }
+
+    int dimension() const { return dim; }
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return reserved; }
+
+    /**
+     * @brief Makes room for at least `rows` rows without moving existing ones.
+     */
+    void reserve(size_t rows) {
+        if (borrowed && reserved < rows) {
+            throw std::logic_error("Cannot grow an arena over borrowed memory");
+        }
+        while (reserved < rows) {
+            int c = chunkOf(reserved);
+            if (c >= MaxChunks) {
+                throw std::length_error("VectorArena capacity exceeded");
+            }
+            size_t bytes = chunkRows(c) * dim * sizeof(float);
+            chunks[c] = static_cast<float*>(::operator new(bytes, std::align_val_t(Alignment)));
+            reserved += chunkRows(c);
+        }
+    }
+
+    /**
+     * @brief Copies a vector of `dimension` floats into the next row.
+     * @return The index of the new row.
+     */
+    size_t append(const float* vec) {
+        size_t idx = count.load(std::memory_order_relaxed);
+        reserve(idx + 1);
+        std::memcpy(row(idx), vec, dim * sizeof(float));
+        count.store(idx + 1, std::memory_order_release);
+        return idx;
+    }
+
+    /**
+     * @brief Makes the arena a read-only view of `rows` rows stored back to back at
+     *        `data` (e.g. in a memory-mapped snapshot). No copy is made; the memory must
+     *        outlive the arena, and appends throw. Only allowed while the arena is empty.
+     * @throws std::logic_error if rows have already been allocated.
+     */
+    void attach(const float* data, size_t rows) {
+        if (reserved > 0) {
+            throw std::logic_error("Cannot attach a non-empty arena");
+        }
+        // A single chunk 0 that covers every row, so row() needs no special case
+        baseShift = 0;
+        while (((size_t)1 << baseShift) < rows) {
+            baseShift++;
+        }
+        chunks[0] = const_cast<float*>(data);
+        borrowed = true;
+        reserved = rows;
+        count.store(rows, std::memory_order_release);
+    }
+
+    /**
+     * @brief Writes all rows to the stream, back to back.
+     */
+    void write(std::ostream& out) const {
+        forEachRun(0, size(), [&out, this](size_t, size_t rows, const float* data) {
+            out.write(reinterpret_cast<const char*>(data), rows * dim * sizeof(float));
+        });
+    }
+
+    /**
+     * @brief Appends `rows` rows read from the stream, as written by write().
+     * @throws std::runtime_error if the stream ends early.
+     */
+    void read(std::istream& in, size_t rows) {
+        size_t from = size();
+        size_t to = from + rows;
+        reserve(to);
+        while (from < to) {
+            int c = chunkOf(from);
+            size_t end = std::min(to, chunkStart(c) + chunkRows(c));
+            if (!in.read(reinterpret_cast<char*>(row(from)), (end - from) * dim * sizeof(float))) {
+                throw std::runtime_error("Unexpected end of VectorArena data");
+            }
+            count.store(end, std::memory_order_release);
+            from = end;
+        }
+    }
+
+    float* row(size_t i) {
+        int c = chunkOf(i);
+        return chunks[c] + (i - chunkStart(c)) * dim;
+    }
+
+    const float* row(size_t i) const {
+        int c = chunkOf(i);
+        return chunks[c] + (i - chunkStart(c)) * dim;
+    }
+
+    /**
+     * @brief Visits rows [from, to) as contiguous runs: fn(firstRow, rowCount, data),
+     *        where data points at firstRow and the run's rows follow it back to back.
+     */
+    template <typename Function>
+    void forEachRun(size_t from, size_t to, Function fn) const {
+        while (from < to) {
+            int c = chunkOf(from);
+            size_t end = std::min(to, chunkStart(c) + chunkRows(c));
+            fn(from, end - from, row(from));
+            from = end;
+        }
+    }
+
+private:
+    static const int MaxChunks = 48;
+
+    int dim;
+    std::atomic<size_t> count; // rows written
+    size_t reserved;  // rows allocated
+    int baseShift;    // log2 of the number of rows in chunk 0
+    bool borrowed;    // chunk 0 is attached memory, not owned
+    std::array<float*, MaxChunks> chunks;
+
+    // Chunk c starts at row (2^c - 1) << baseShift and holds 2^c << baseShift rows
+    int chunkOf(size_t i) const {
+        size_t block = (i >> baseShift) + 1;
+        return 63 - __builtin_clzll((unsigned long long)block);
+    }
+    size_t chunkStart(int c) const {
+        return (((size_t)1 << c) - 1) << baseShift;
+    }
+    size_t chunkRows(int c) const {
+        return ((size_t)1 << c) << baseShift;
+    }
+};
+
+#endif // VECTOR_ARENA_H
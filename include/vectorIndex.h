@@ -5,108 +5,783 @@
 #include <limits>
 #include <stdexcept>
 #include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <functional>
+#include <map>
 
 
 // Include the B+ tree header file (from previous implementation, modified KeyType to float)
-#include "./bplustree4.h"
+#include "./BPlusTree4.h"
 
 // Include hnswlib
 #include "../hnswlib/hnswlib/hnswlib.h"
 
+#include "./vectorArena.h"
+#include "./Distance.h"
+#include "./arenaSpace.h"
+#include "./TopK.h"
+#include "./parallelFor.h"
+#include "./ThreadPool.h"
+#include "./Snapshot.h"
+#include "./RangeFilter.h"
+#include "./QueryPlanner.h"
+#include "./ScalarPartitions.h"
+#include "./ScalarQuantizer.h"
+#include "./QueryStats.h"
 
+
+// insert() and the queries are safe to call from several threads at once: the tree
+// runs in versioned mode, HNSW accepts concurrent addPoint/searchKnn, and rows are
+// appended to stable storage. A query runs on one snapshot: the tree version published
+// when it started, cut at the watermark of appended ids whose insert (tree and graph)
+// had finished by then, so it never waits on an insert and never sees one half done.
+// insertBatch() holds the index exclusively while it resizes HNSW and builds the tree.
+// remove() may run alongside them; removed rows are reused by later inserts, and the
+// graph is compacted in the background once enough of it is tombstones.
 class VectorIndex {
 public:
-    VectorIndex(int order) 
-        : tree(order), dimension(0), hnswIndex(nullptr), space(nullptr), hnswM(16), hnswEfConstruction(200), hnswEfSearch(200) 
-    {}
+    // With Metric::Cosine, vectors and queries are normalized and compared by inner product
+    VectorIndex(int order, Metric metric = Metric::L2) 
+        : tree(order), treeOrder(order), dimension(0), distanceFn(metric), hnswIndex(nullptr), space(nullptr), hnswM(16), hnswEfConstruction(200), hnswEfSearch(200),
+          initialCapacity(DefaultCapacity), readOnly(false), filterMode(FilterMode::Auto),
+          journaling(false), compactionThreshold(DefaultCompactionThreshold), backgroundRunning(false),
+          clusterThreshold(DefaultClusterThreshold), rerankFactor(0), visibleRows(0)
+    {
+        tree.setVersioned(true);
+    }
+
+    ~VectorIndex() {
+        {
+            std::lock_guard<std::mutex> guard(backgroundMutex);
+            if (background.joinable()) {
+                background.join();
+            }
+        }
+        delete hnswIndex;
+        delete space;
+    }
 
-    void insert(const std::vector<float>& vec, float s) {
+    // Returns the id of the record: a row freed by remove() if there is one, the next
+    // row otherwise. `attributes` holds the values of the columns added by addColumn(),
+    // in the order they were added; missing ones take the column's default.
+    int insert(const std::vector<float>& vec, float s, const std::vector<float>& attributes = {}) {
         if (vec.empty()) {
             throw std::invalid_argument("Cannot insert empty vector");
         }
 
-        if (dataVectors.empty()) {
-            dimension = (int)vec.size();
-            space = new hnswlib::L2Space(dimension);
-            size_t maxElements = 100000; 
-            hnswIndex = new hnswlib::HierarchicalNSW<float>(space, maxElements, hnswM, hnswEfConstruction);
-            hnswIndex->setEf(hnswEfSearch);
-        } else {
-            if ((int)vec.size() != dimension) {
+        ensureIndex((int)vec.size());
+
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        checkWritable();
+        if ((int)vec.size() != dimension) {
+            throw std::invalid_argument("All vectors must have the same dimension");
+        }
+        if (attributes.size() > columns.size()) {
+            throw std::invalid_argument("More attributes than columns");
+        }
+
+        int idx = reuseFreeRow(vec, s, attributes, lock);
+        bool reused = idx >= 0;
+        while (idx < 0) {
+            // Appends are serialized; readers never look past the rows already published
+            std::unique_lock<std::mutex> append(appendMutex);
+            size_t next = vectors.size();
+            if (next < hnswIndex->getMaxElements()) {
+                idx = (int)appendVector(vec);
+                sValues.append(&s);
+                if (quantizer) {
+                    quantizer->append(vectors.row(idx));
+                }
+                for (size_t c = 0; c < columns.size(); c++) {
+                    float value = attributeOf(attributes, c);
+                    columns[c]->values.append(&value);
+                }
+                if (journaling) {
+                    journal.push_back(idx);
+                }
+                break;
+            }
+            // Full: grow under the exclusive lock, then retry
+            append.unlock();
+            lock.unlock();
+            {
+                std::unique_lock<std::shared_mutex> exclusive(indexLock);
+                ensureCapacity(next + 1);
+            }
+            lock.lock();
+        }
+        tree.insert(s, idx);
+        if (!reused) {
+            for (size_t c = 0; c < columns.size(); c++) {
+                columns[c]->tree.insert(*columns[c]->values.row(idx), idx);
+            }
+        }
+        bool reclusterDue = false;
+        if (clustered) {
+            clustered->fresh.insert(s, idx);
+            reclusterDue = clusterThreshold > 0 && clustered->fresh.size() > clusterThreshold * clustered->ids.size();
+        }
+
+        // HNSW stores the row pointer, not a copy of the vector. A reused row is still
+        // in the graph as a tombstone, which addPoint revives with the new vector.
+        const float* row = vectors.row(idx);
+        hnswIndex->addPoint(&row, idx);
+        if (partitions) {
+            addToPartition(idx, s, lock);
+        }
+        if (!reused) {
+            finishAppend(idx, 1);
+        }
+        if (reclusterDue) {
+            startInBackground([this]() { recluster(); });
+        }
+        return idx;
+    }
+
+    // Insert many records at once: the tree is built (or extended) from one sort
+    // by s, and the HNSW insertions run on numThreads threads (0 = all cores).
+    // Batches never reuse removed rows: the records get consecutive ids from the
+    // returned one.
+    int insertBatch(const std::vector<std::vector<float>>& vecs, const std::vector<float>& s, int numThreads = 0) {
+        if (vecs.size() != s.size()) {
+            throw std::invalid_argument("Each vector needs exactly one s value");
+        }
+        size_t dim = vecs.empty() ? 0 : vecs[0].size();
+        for (const auto& vec : vecs) {
+            if (vec.empty()) {
+                throw std::invalid_argument("Cannot insert empty vector");
+            }
+            if (vec.size() != dim) {
                 throw std::invalid_argument("All vectors must have the same dimension");
             }
         }
+        return insertRows(vecs.size(), (int)dim, [&vecs](size_t i) { return vecs[i].data(); }, s.data(), numThreads);
+    }
 
-        int idx = (int)dataVectors.size();
-        dataVectors.push_back(vec);
-        sValues.push_back(s);
-        tree.insert(s, idx);
+    // Same as above for `count` rows of `dim` floats stored back to back in `rows`,
+    // with their s values in `s`; the rows are copied straight into the arena, e.g.
+    // from a DataLoader buffer or a memory-mapped file.
+    int insertBatch(const float* rows, size_t count, int dim, const float* s, int numThreads = 0) {
+        if (count > 0 && (rows == nullptr || s == nullptr || dim <= 0)) {
+            throw std::invalid_argument("A batch needs rows of a positive dimension and their s values");
+        }
+        return insertRows(count, dim, [rows, dim](size_t i) { return rows + i * (size_t)dim; }, s, numThreads);
+    }
 
-        hnswIndex->addPoint(dataVectors[idx].data(), idx);
+    // Deletes record `id`: its posting leaves the tree, so exact scans stop seeing it
+    // at once, and its graph nodes become tombstones that searches skip but still
+    // route through. The row is reused by a later insert. Removing an id twice is a
+    // no-op; ids the index never returned throw std::out_of_range.
+    void remove(int id) {
+        bool compactionDue;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexLock);
+            checkWritable();
+            if (id < 0 || (size_t)id >= vectors.size()) {
+                throw std::out_of_range("No record with id " + std::to_string(id));
+            }
+            {
+                std::lock_guard<std::mutex> append(appendMutex);
+                if (!freeRows.insert(id).second) {
+                    return;
+                }
+                if (journaling) {
+                    journal.push_back(id);
+                }
+            }
+            float s = *sValues.row(id);
+            tree.removeValue(s, id);
+            for (auto& column : columns) {
+                column->tree.removeValue(*column->values.row(id), id);
+            }
+            if (clustered) {
+                clustered->retire(id, s);
+            }
+            hnswIndex->markDelete(id);
+            if (partitions) {
+                partitions->graph(partitions->partitionOf(s)).markDelete(id);
+            }
+            compactionDue = compactionThreshold > 0 &&
+                hnswIndex->getDeletedCount() > compactionThreshold * hnswIndex->getCurrentElementCount();
+        }
+        if (compactionDue) {
+            startInBackground([this]() { compact(); });
+        }
     }
 
-    std::vector<int> query(const std::vector<float>& v, int k, float Smin, float Smax, int O = 1000) {
-        if (hnswIndex == nullptr || dataVectors.empty()) {
-            return {};
+    // Changes the s value of record `id`. Only the tree posting moves; the graph is
+    // left alone. Use updateScalars for bursts of updates.
+    void updateScalar(int id, float s) {
+        updateScalars(std::vector<int>{id}, std::vector<float>{s});
+    }
+
+    // Changes the s values of many records at once (the last value wins when an id
+    // repeats): one exclusive hold of the index and one tree batch, which sorts the
+    // moves and merges them into the leaves when there are many. A record moving to
+    // another partition leaves that partition's graph for the new one.
+    void updateScalars(const std::vector<int>& ids, const std::vector<float>& s) {
+        if (ids.size() != s.size()) {
+            throw std::invalid_argument("Each id needs exactly one s value");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        checkWritable();
+        for (int id : ids) {
+            if (id < 0 || (size_t)id >= vectors.size() || freeRows.count(id) != 0) {
+                throw std::out_of_range("No record with id " + std::to_string(id));
+            }
         }
 
-        if ((int)v.size() != dimension) {
-            throw std::invalid_argument("Query vector dimension does not match index dimension");
+        std::vector<std::pair<float, int>> removals, insertions, freshInsertions;
+        std::unordered_set<int> seen;
+        for (size_t i = ids.size(); i-- > 0;) {
+            int id = ids[i];
+            float old = *sValues.row(id);
+            if (!seen.insert(id).second || old == s[i]) {
+                continue;
+            }
+            removals.push_back({old, id});
+            insertions.push_back({s[i], id});
+            *sValues.row(id) = s[i];
+            if (journaling) {
+                // A clustered copy being built may hold the record at its old s
+                journal.push_back(id);
+            }
+            if (clustered) {
+                clustered->retire(id, old);
+                freshInsertions.push_back({s[i], id});
+            }
+            if (partitions) {
+                size_t from = partitions->partitionOf(old), to = partitions->partitionOf(s[i]);
+                if (from != to) {
+                    partitions->graph(from).markDelete(id);
+                    partitions->grow(to);
+                    const float* row = vectors.row(id);
+                    partitions->graph(to).addPoint(&row, id);
+                }
+            }
+        }
+        tree.applyBatch(std::move(removals), std::move(insertions));
+        if (clustered) {
+            clustered->fresh.applyBatch({}, std::move(freshInsertions));
         }
+    }
 
-        int count = tree.countInRange(Smin, Smax);
-        if (count <= 0) {
-            return {};
+    // Adds a scalar column, with its own B+ tree, that predicates can filter on next to
+    // s. Existing records get `defaultValue`; set their values with setColumn().
+    void addColumn(const std::string& name, float defaultValue = 0.0f) {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        checkWritable();
+        if (name == "s") {
+            throw std::invalid_argument("Column s is built in");
         }
+        for (const auto& column : columns) {
+            if (column->name == name) {
+                throw std::invalid_argument("Column " + name + " already exists");
+            }
+        }
+        std::unique_ptr<Column> column(new Column(name, defaultValue, treeOrder));
+        column->values.reserve(vectors.size());
+        std::vector<std::pair<float, int>> entries;
+        for (size_t i = 0; i < vectors.size(); i++) {
+            column->values.append(&defaultValue);
+            if (freeRows.count((int)i) == 0) {
+                entries.push_back({defaultValue, (int)i});
+            }
+        }
+        column->tree.bulkLoad(std::move(entries));
+        columns.push_back(std::move(column));
+    }
 
-        if (count < O) {
-            // Use the B+ tree's rangeQuery directly
-            std::vector<int> candidates = tree.rangeQuery(Smin, Smax);
+    // Sets the value of column `name` for records ids[i] to values[i], batched like
+    // updateScalars (which this is for the column "s")
+    void setColumn(const std::string& name, const std::vector<int>& ids, const std::vector<float>& values) {
+        if (name == "s") {
+            updateScalars(ids, values);
+            return;
+        }
+        if (ids.size() != values.size()) {
+            throw std::invalid_argument("Each id needs exactly one value");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        checkWritable();
+        Column& column = *findColumn(name);
+        for (int id : ids) {
+            if (id < 0 || (size_t)id >= vectors.size() || freeRows.count(id) != 0) {
+                throw std::out_of_range("No record with id " + std::to_string(id));
+            }
+        }
+        std::vector<std::pair<float, int>> removals, insertions;
+        std::unordered_set<int> seen;
+        for (size_t i = ids.size(); i-- > 0;) {
+            float* value = column.values.row(ids[i]);
+            if (!seen.insert(ids[i]).second || *value == values[i]) {
+                continue;
+            }
+            removals.push_back({*value, ids[i]});
+            insertions.push_back({values[i], ids[i]});
+            *value = values[i];
+        }
+        column.tree.applyBatch(std::move(removals), std::move(insertions));
+    }
 
-            std::vector<std::pair<float,int>> distIndex;
-            distIndex.reserve(candidates.size());
-            for (int idx : candidates) {
-                float dist = euclideanDistSquared(v, dataVectors[idx]);
-                distIndex.push_back({dist, idx});
+    // Rebuilds the graph (and the partition graphs) from the live rows, dropping the
+    // tombstones left by remove(). Inserts, removes and queries keep running during
+    // the build; the new graph, with their changes replayed, replaces the old one
+    // under a short exclusive lock. remove() calls this in the background when the
+    // tombstones pass the compaction threshold.
+    void compact(int numThreads = 0) {
+        std::lock_guard<std::mutex> serial(rebuildMutex);
+        std::unique_ptr<hnswlib::HierarchicalNSW<float>> fresh;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexLock);
+            checkWritable();
+            if (hnswIndex == nullptr || hnswIndex->getDeletedCount() == 0) {
+                return;
             }
-            std::sort(distIndex.begin(), distIndex.end(), [](auto& a, auto& b){
-                return a.first < b.first;
+            std::vector<int> live;
+            {
+                std::lock_guard<std::mutex> append(appendMutex);
+                journaling = true;
+                journal.clear();
+                for (size_t i = 0; i < vectors.size(); i++) {
+                    if (freeRows.count((int)i) == 0) {
+                        live.push_back((int)i);
+                    }
+                }
+            }
+            // Rows are only rewritten under the exclusive lock, so they are stable here
+            fresh.reset(new hnswlib::HierarchicalNSW<float>(space, hnswIndex->getMaxElements(), hnswM, hnswEfConstruction));
+            fresh->setEf(hnswEfSearch);
+            parallelFor(live.size(), numThreads, [&](size_t i) {
+                const float* row = vectors.row(live[i]);
+                fresh->addPoint(&row, live[i]);
             });
+        }
 
-            std::vector<int> result;
-            for (int i = 0; i < k && i < (int)distIndex.size(); i++) {
-                result.push_back(distIndex[i].second);
+        std::unique_lock<std::shared_mutex> exclusive(indexLock);
+        journaling = false;
+        if (fresh->getMaxElements() < hnswIndex->getMaxElements()) {
+            fresh->resizeIndex(hnswIndex->getMaxElements());
+        }
+        // Bring the new graph up to date with what changed during the build
+        std::sort(journal.begin(), journal.end());
+        journal.erase(std::unique(journal.begin(), journal.end()), journal.end());
+        for (int id : journal) {
+            const float* row = vectors.row(id);
+            if (freeRows.count(id) == 0) {
+                fresh->addPoint(&row, id);
+                continue;
             }
-            return result;
+            try {
+                fresh->markDelete(id);
+            } catch (const std::runtime_error&) {
+                // Removed before the build reached it: not in the new graph at all
+            }
+        }
+        journal.clear();
+        delete hnswIndex;
+        hnswIndex = fresh.release();
+        if (partitions) {
+            buildPartitions(partitions->boundaries(), numThreads);
+        }
+    }
+
+    // Physical order of the rows the exact scans read. InsertionOrder reads each
+    // in-range row where it was appended, one random access per candidate.
+    // ClusteredByS keeps a second copy of the live rows sorted by s, so an s range is
+    // one contiguous run that the scan reads sequentially; records inserted or moved
+    // afterwards are read from the arena until recluster() folds them in, which
+    // happens in the background once they pass the cluster threshold. The arena rows
+    // themselves never move, since the graph and the ids point at them. The copy is
+    // not part of snapshots.
+    enum class Layout { InsertionOrder, ClusteredByS };
+
+    void setLayout(Layout layout) {
+        if (layout == Layout::ClusteredByS) {
+            buildClustered(true);
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        clustered.reset();
+    }
+
+    Layout getLayout() const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        return clustered ? Layout::ClusteredByS : Layout::InsertionOrder;
+    }
+
+    // Rebuilds the clustered copy from the current rows (no-op in InsertionOrder).
+    // Inserts, removes and queries continue while it is built.
+    void recluster() {
+        buildClustered(false);
+    }
+
+    // Fraction of the clustered copy that records outside it may reach before inserts
+    // start a background recluster(); 0 turns it off
+    void setClusterThreshold(double fraction) {
+        if (fraction < 0) {
+            throw std::invalid_argument("Cluster threshold must not be negative");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        clusterThreshold = fraction;
+    }
+
+    // Fraction of tombstones in the graph above which remove() starts a background
+    // compact(); 0 turns background compaction off
+    void setCompactionThreshold(double fraction) {
+        if (fraction < 0) {
+            throw std::invalid_argument("Compaction threshold must not be negative");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        compactionThreshold = fraction;
+    }
+
+    // Splits the s axis at quantiles of the current s values into `count` ranges and
+    // builds one HNSW graph per range next to the global one (count = 1 removes them).
+    // Narrow queries then search only the graphs their range overlaps, when the
+    // planner estimates that to be cheaper. The boundaries stay fixed as records are
+    // added; call again to rebalance. Partitions are not part of snapshots.
+    void partition(int count, int numThreads = 0) {
+        if (count <= 0) {
+            throw std::invalid_argument("Number of partitions must be positive");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        std::vector<float> sorted;
+        for (size_t i = 0; i < vectors.size(); i++) {
+            if (freeRows.count((int)i) == 0) {
+                sorted.push_back(*sValues.row(i));
+            }
+        }
+        if (count > 1 && sorted.empty()) {
+            throw std::logic_error("Partitioning by quantiles needs the s values of some records");
+        }
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<float> boundaries;
+        for (int j = 1; j < count; j++) {
+            boundaries.push_back(sorted[sorted.size() * j / count]);
+        }
+        buildPartitions(std::move(boundaries), numThreads);
+    }
+
+    // Same with explicit split points: partition i holds b[i-1] <= s < b[i]
+    void partition(std::vector<float> boundaries, int numThreads = 0) {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        buildPartitions(std::move(boundaries), numThreads);
+    }
+
+    // Keeps an 8-bit copy of every vector (see ScalarQuantizer) for the exact scans:
+    // they rank the codes, reading a quarter of the memory, and re-rank only the best
+    // rerankFactor × k rows against the fp32 vectors. The code ranges are fitted to the
+    // current rows; call again to refit them once the data drifts. 0 drops the codes.
+    // Codes are not part of snapshots.
+    void quantize(int rerankFactor = DefaultRerankFactor) {
+        if (rerankFactor < 0) {
+            throw std::invalid_argument("Re-rank factor must not be negative");
+        }
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        if (rerankFactor == 0) {
+            quantizer.reset();
+        } else if (vectors.empty()) {
+            throw std::logic_error("Quantization needs some records to fit its ranges");
         } else {
-            std::vector<int> annCandidates = approximateNearestNeighbors(v, O);
-            std::vector<std::pair<float,int>> distIndex;
-            distIndex.reserve(annCandidates.size());
-            for (int idx : annCandidates) {
-                float sVal = sOfIndex(idx);
-                if (sVal >= Smin && sVal <= Smax) {
-                    float dist = euclideanDistSquared(v, dataVectors[idx]);
-                    distIndex.push_back({dist, idx});
-                }
+            quantizer.reset(new ScalarQuantizer(distanceFn.getMetric(), vectors, vectors.size()));
+        }
+        this->rerankFactor = rerankFactor;
+    }
+
+    bool isQuantized() const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        return quantizer != nullptr;
+    }
+
+    // Number of s ranges with their own graph (0 when not partitioned)
+    size_t partitionCount() const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        return partitions ? partitions->size() : 0;
+    }
+
+    // Makes room for n records in HNSW, the vector arena and the s values, so that
+    // inserts up to n never resize. Before the first insert, n becomes the initial size.
+    void reserve(size_t n) {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        checkWritable();
+        if (hnswIndex == nullptr) {
+            initialCapacity = std::max(n, (size_t)1);
+            return;
+        }
+        if (n > hnswIndex->getMaxElements()) {
+            hnswIndex->resizeIndex(n);
+        }
+        vectors.reserve(n);
+        sValues.reserve(n);
+    }
+
+    // Number of records the index holds without growing
+    size_t capacity() const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        return hnswIndex ? hnswIndex->getMaxElements() : initialCapacity;
+    }
+
+    // Writes a snapshot: `path` holds the header, the vectors, the s values and the tree,
+    // and `path`.hnsw the graph as serialized by hnswlib. Inserts wait until it is done.
+    void save(const std::string& path) const {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing");
+        }
+        snapshot::writeTag(out, "VECINDEX");
+        snapshot::write<uint32_t>(out, (uint32_t)distanceFn.getMetric());
+        snapshot::write<uint64_t>(out, hnswIndex ? dimension : 0);
+        snapshot::write<uint64_t>(out, vectors.size());
+        // Rows start on an aligned offset so a mapped snapshot can be used in place
+        snapshot::pad(out, VectorArena::Alignment);
+        vectors.write(out);
+        sValues.write(out);
+        tree.save(out);
+        if (!columns.empty()) {
+            snapshot::writeTag(out, "COLUMNS ");
+            snapshot::write<uint64_t>(out, columns.size());
+            for (const auto& column : columns) {
+                snapshot::write<uint64_t>(out, column->name.size());
+                snapshot::writeArray(out, column->name.data(), column->name.size());
+                snapshot::write<float>(out, column->defaultValue);
+                column->values.write(out);
+                column->tree.save(out);
             }
+        }
+        if (!out) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+        if (hnswIndex) {
+            hnswIndex->saveIndex(path + ".hnsw");
+        }
+    }
 
-            std::sort(distIndex.begin(), distIndex.end(), [](auto& a, auto& b){
-                return a.first < b.first;
-            });
+    // Loads a snapshot written by save() (by this class or ProbabilisticVectorIndex) into
+    // an empty index with the same metric. With mapped = true the vectors and s values are
+    // used in place from a read-only memory mapping instead of being read, so startup
+    // costs the tree and graph only; the index is then read-only and inserts throw.
+    // If loading fails the index must be discarded.
+    void load(const std::string& path, bool mapped = false) {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        if (hnswIndex != nullptr || !vectors.empty()) {
+            throw std::logic_error("Can only load a snapshot into an empty index");
+        }
+        std::unique_ptr<snapshot::MappedFile> file;
+        std::unique_ptr<std::istream> in;
+        if (mapped) {
+            file.reset(new snapshot::MappedFile(path));
+            in.reset(new snapshot::MemoryStream(file->data(), file->size()));
+        } else {
+            in.reset(new std::ifstream(path, std::ios::binary));
+            if (!*in) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+        }
+
+        snapshot::expectTag(*in, "VECINDEX");
+        if (snapshot::read<uint32_t>(*in) != (uint32_t)distanceFn.getMetric()) {
+            throw std::invalid_argument("Snapshot was saved with a different metric");
+        }
+        int dim = (int)snapshot::read<uint64_t>(*in);
+        size_t count = snapshot::read<uint64_t>(*in);
+        snapshot::skipPad(*in, VectorArena::Alignment);
+        if (dim == 0) {
+            return; // saved empty
+        }
 
-            std::vector<int> result;
-            for (int i = 0; i < k && i < (int)distIndex.size(); i++) {
-                result.push_back(distIndex[i].second);
+        vectors.setDimension(dim);
+        sValues.setDimension(1);
+        if (mapped) {
+            size_t offset = (size_t)in->tellg();
+            size_t bytes = count * (dim + 1) * sizeof(float);
+            if (offset + bytes > file->size()) {
+                throw std::runtime_error("Truncated snapshot " + path);
+            }
+            vectors.attach(reinterpret_cast<const float*>(file->data() + offset), count);
+            sValues.attach(reinterpret_cast<const float*>(file->data() + offset + count * dim * sizeof(float)), count);
+            in->seekg(bytes, std::ios::cur);
+        } else {
+            vectors.read(*in, count);
+            sValues.read(*in, count);
+        }
+        tree.load(*in);
+        // Added columns follow when there are any (older snapshots end here)
+        if (in->peek() != std::char_traits<char>::eof()) {
+            snapshot::expectTag(*in, "COLUMNS ");
+            size_t columnCount = snapshot::read<uint64_t>(*in);
+            for (size_t c = 0; c < columnCount; c++) {
+                std::string name(snapshot::read<uint64_t>(*in), '\0');
+                snapshot::readArray(*in, &name[0], name.size());
+                float defaultValue = snapshot::read<float>(*in);
+                std::unique_ptr<Column> column(new Column(name, defaultValue, treeOrder));
+                column->values.read(*in, count);
+                column->tree.load(*in);
+                columns.push_back(std::move(column));
+            }
+        }
+
+        dimension = dim;
+        distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dim);
+        space = new ArenaSpace(dimension, distanceFn.getMetric());
+        hnswIndex = new hnswlib::HierarchicalNSW<float>(space, path + ".hnsw", false, std::max(count, initialCapacity));
+        ArenaSpace::relink(*hnswIndex, vectors);
+        hnswIndex->setEf(hnswEfSearch);
+        // Removed rows are the ones whose node is a tombstone or was compacted away
+        std::vector<char> live(count, 0);
+        for (size_t i = 0; i < hnswIndex->getCurrentElementCount(); i++) {
+            if (!hnswIndex->isMarkedDeleted((hnswlib::tableint)i)) {
+                live[hnswIndex->getExternalLabel((hnswlib::tableint)i)] = 1;
             }
-            return result;
         }
+        for (size_t i = 0; i < count; i++) {
+            if (!live[i]) {
+                freeRows.insert((int)i);
+            }
+        }
+        planner = QueryPlanner::calibrated(dimension);
+        visibleRows.store(count, std::memory_order_release);
+        mapping = std::move(file);
+        readOnly = mapped;
+    }
+
+    // Which HNSW plans the planner may choose: both with Auto (the default), only the
+    // in-graph filter with InGraph, only fetching the O nearest neighbours and filtering
+    // them afterwards with PostFilter. An exact scan of the range is always considered.
+    // Set it before querying; it is not synchronized with running queries.
+    void setFilterMode(FilterMode mode) {
+        filterMode = mode;
+    }
+
+    FilterMode getFilterMode() const {
+        return filterMode;
+    }
+
+    // The plan search() would use for this query and the cost estimated for each
+    // alternative, without running it. O is the post-filter fetch size, as in query().
+    PlanEstimate explain(int k, float Smin, float Smax, int O = 1000) const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        std::vector<PartitionStep> steps;
+        BPlusTree<float, int>::Version version = tree.snapshot();
+        return planFor(k, Smin, Smax, version.countInRange(Smin, Smax), O, steps, version);
+    }
+
+    // Number of records with Smin <= s <= Smax, as the planner counts them: both
+    // bounds are read from one tree snapshot, so inserts running alongside are either
+    // counted at both or at neither
+    int countInRange(float Smin, float Smax) const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        return tree.snapshot().countInRange(Smin, Smax);
+    }
+
+    // If `stats` is given it receives what the query did: the plan, how many rows
+    // matched, candidates fetched and kept, distances computed and the time per phase.
+    std::vector<int> query(const std::vector<float>& v, int k, float Smin, float Smax, int O = 1000,
+                           QueryStats* stats = nullptr) const {
+        std::vector<int> result;
+        for (const auto& hit : queryWithDistances(v, k, Smin, Smax, O, stats)) {
+            result.push_back(hit.second);
+        }
+        return result;
+    }
+
+    // Same as query, but returns (distance, index) pairs sorted by ascending distance
+    std::vector<std::pair<float,int>> queryWithDistances(const std::vector<float>& v, int k, float Smin, float Smax, int O = 1000,
+                                                         QueryStats* stats = nullptr) const {
+        QueryScratch scratch;
+        return search(v, k, Smin, Smax, O, scratch, stats);
+    }
+
+    // The k nearest records matching a predicate over s and the added columns. Each
+    // range is read from its column's tree into a compressed bitmap and the bitmaps are
+    // combined; the result is the candidate list of an exact scan or the membership
+    // test of a filtered graph search, whichever the planner estimates cheaper.
+    std::vector<int> query(const std::vector<float>& v, int k, const Predicate& where, int O = 1000,
+                           QueryStats* stats = nullptr) const {
+        std::vector<int> result;
+        for (const auto& hit : queryWithDistances(v, k, where, O, stats)) {
+            result.push_back(hit.second);
+        }
+        return result;
+    }
+
+    std::vector<std::pair<float,int>> queryWithDistances(const std::vector<float>& v, int k, const Predicate& where, int O = 1000,
+                                                         QueryStats* stats = nullptr) const {
+        QueryScratch scratch;
+        return search(v, k, where, O, scratch, stats);
+    }
+
+    PlanEstimate explain(int k, const Predicate& where, int O = 1000) const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        std::vector<int> ids;
+        int total = hnswIndex ? (int)hnswIndex->getCurrentElementCount() : 0;
+        int matching = (int)evaluate(where, ids, visibleRows.load(std::memory_order_acquire)).cardinality();
+        return planner.plan(total, matching, k, hnswEfSearch, 2 * hnswM, O, filterMode);
+    }
+
+    // Answers queries[i] restricted to ranges[i] = [Smin, Smax] in parallel on the given
+    // pool (the shared pool by default). Inserts may run alongside the batch.
+    std::vector<std::vector<std::pair<float,int>>> queryBatch(const std::vector<std::vector<float>>& queries, int k,
+                                                              const std::vector<std::pair<float,float>>& ranges,
+                                                              int O = 1000, ThreadPool* pool = nullptr) const {
+        if (queries.size() != ranges.size()) {
+            throw std::invalid_argument("Each query needs exactly one [Smin, Smax] range");
+        }
+        ThreadPool& workers = pool ? *pool : ThreadPool::shared();
+        std::vector<std::vector<std::pair<float,int>>> results(queries.size());
+        std::vector<QueryScratch> scratch(workers.slots());
+        workers.parallelFor(queries.size(), [&](size_t i, int slot) {
+            results[i] = search(queries[i], k, ranges[i].first, ranges[i].second, O, scratch[slot], nullptr);
+        });
+        return results;
+    }
+
+    // Totals over every query answered so far (batches included), see QueryStats
+    QueryCounters::Totals queryCounters() const {
+        return counters.totals();
+    }
+
+    void resetQueryCounters() {
+        counters.reset();
+    }
+
+    // Work done by reads of the s tree: counts, range scans, nodes and values visited
+    BPlusTree<float, int>::ReadStats treeStats() const {
+        return tree.readStats();
     }
 
 private:
+    // A scalar column added by addColumn(), stored like s: one float per row and a
+    // tree over the values
+    struct Column {
+        std::string name;
+        float defaultValue;
+        BPlusTree<float, int> tree;
+        VectorArena values;
+
+        Column(const std::string& name, float defaultValue, int order) : name(name), defaultValue(defaultValue), tree(order) {
+            tree.setConcurrent(true);
+            values.setDimension(1);
+        }
+    };
+
     BPlusTree<float, int> tree;
-    std::vector<std::vector<float>> dataVectors;
-    std::vector<float> sValues;
+    int treeOrder;
+    VectorArena vectors;
+    VectorArena sValues; // one float per row; never moves, so readers need no lock
+    mutable std::shared_mutex indexLock; // exclusive to initialize or resize the index, or rewrite a reused row
+    std::mutex appendMutex; // also guards freeRows and the compaction journal
     int dimension;
+    DistanceFunction distanceFn;
 
     hnswlib::HierarchicalNSW<float>* hnswIndex;
     hnswlib::SpaceInterface<float>* space;
@@ -114,32 +789,859 @@ private:
     int hnswEfConstruction;
     int hnswEfSearch;
 
-    double sOfIndex(int idx) const {
-        return sValues[idx];
+    // HNSW starts this small and doubles when full (see ensureCapacity)
+    static const size_t DefaultCapacity = 1024;
+    size_t initialCapacity;
+
+    // Set by load(path, true): the arenas then point into the mapped snapshot
+    std::unique_ptr<snapshot::MappedFile> mapping;
+    bool readOnly;
+
+    FilterMode filterMode;
+    QueryPlanner planner; // calibrated for the dimension once it is known
+    mutable QueryCounters counters;
+
+    // Columns beyond s, in the order they were added (never removed)
+    std::vector<std::unique_ptr<Column>> columns;
+
+    // Per-range graphs set by partition(); they share the space and rows of hnswIndex
+    std::unique_ptr<ScalarPartitions> partitions;
+
+    // Rows released by remove(); their graph nodes are tombstones until reused or compacted
+    std::unordered_set<int> freeRows;
+
+    // While compact() or recluster() builds from a snapshot of the rows, the rows
+    // inserted, removed, reused or moved to another s meanwhile
+    bool journaling;
+    std::vector<int> journal;
+    std::mutex rebuildMutex; // one compact() or recluster() at a time
+
+    static constexpr double DefaultCompactionThreshold = 0.25;
+    double compactionThreshold;
+    std::mutex backgroundMutex; // guards the background thread
+    std::thread background;
+    std::atomic<bool> backgroundRunning;
+
+    // Set by setLayout(Layout::ClusteredByS): a copy of the live rows sorted by s, so
+    // the rows of an s range are one contiguous run. The copy itself never changes;
+    // entries removed or moved since it was built are flagged dead, and the records
+    // inserted or moved since are kept in `fresh` until the next recluster(). Like the
+    // main tree, `fresh` is versioned, so a query reads it from one snapshot.
+    struct ClusteredRows {
+        std::vector<float> s;      // ascending
+        std::vector<int> ids;      // the record stored at each position
+        VectorArena rows;
+        std::unique_ptr<std::atomic<bool>[]> dead;
+        std::vector<int> positionOf; // id -> position, -1 once dead; only writers use it
+        BPlusTree<float, int> fresh;
+
+        explicit ClusteredRows(int order) : fresh(order) {
+            fresh.setVersioned(true);
+        }
+
+        // Takes record id (with scalar value s) out of the copy or out of `fresh`
+        void retire(int id, float s) {
+            int p = (size_t)id < positionOf.size() ? positionOf[id] : -1;
+            if (p >= 0) {
+                dead[p].store(true, std::memory_order_relaxed);
+                positionOf[id] = -1;
+            } else {
+                fresh.removeValue(s, id);
+            }
+        }
+    };
+    static constexpr double DefaultClusterThreshold = 0.1;
+    std::unique_ptr<ClusteredRows> clustered;
+    double clusterThreshold;
+
+    // Set by quantize(): 8-bit codes of the rows, in the same order as `vectors`
+    static const int DefaultRerankFactor = 4;
+    std::unique_ptr<ScalarQuantizer> quantizer;
+    int rerankFactor;
+
+    // Appended ids below visibleRows are fully inserted, in the tree and the graph;
+    // queries ignore the ones above it. Appends finish out of order, so the ranges
+    // finished above the first unfinished id wait in finishedAppends (first -> end).
+    std::atomic<size_t> visibleRows;
+    std::map<size_t, size_t> finishedAppends; // guarded by appendMutex
+
+    void checkWritable() const {
+        if (readOnly) {
+            throw std::logic_error("Index was loaded from a mapped snapshot and is read-only");
+        }
+    }
+
+    // The body of both insertBatch overloads; rowAt(i) is the address of row i
+    template <typename RowAt>
+    int insertRows(size_t count, int dim, RowAt rowAt, const float* s, int numThreads) {
+        std::unique_lock<std::shared_mutex> lock(indexLock);
+        if (count == 0) {
+            return (int)vectors.size();
+        }
+        checkWritable();
+        if (hnswIndex != nullptr && dim != dimension) {
+            throw std::invalid_argument("All vectors must have the same dimension");
+        }
+
+        int first = (int)vectors.size();
+        int n = (int)count;
+        if (hnswIndex == nullptr) {
+            initIndex(dim, std::max<size_t>(initialCapacity, count));
+        }
+        ensureCapacity(first + n);
+        for (int i = 0; i < n; i++) {
+            size_t idx = appendVector(rowAt((size_t)i));
+            sValues.append(&s[i]);
+            if (quantizer) {
+                quantizer->append(vectors.row(idx));
+            }
+            for (auto& column : columns) {
+                column->values.append(&column->defaultValue);
+            }
+        }
+        if (journaling) {
+            std::lock_guard<std::mutex> append(appendMutex);
+            for (int i = 0; i < n; i++) {
+                journal.push_back(first + i);
+            }
+        }
+        if (partitions) {
+            partitions->growFor(s, count);
+        }
+
+        std::vector<std::pair<float, int>> entries(n);
+        for (int i = 0; i < n; i++) {
+            entries[i] = {s[i], first + i};
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](auto& a, auto& b){
+            return a.first < b.first;
+        });
+        for (auto& column : columns) {
+            std::vector<std::pair<float, int>> defaults(n);
+            for (int i = 0; i < n; i++) {
+                defaults[i] = {column->defaultValue, first + i};
+            }
+            column->tree.applyBatch({}, std::move(defaults));
+        }
+        if (clustered) {
+            clustered->fresh.applyBatch({}, entries);
+        }
+        if (first == 0) {
+            tree.bulkLoad(std::move(entries));
+        } else {
+            // One write, so the tree publishes a single new version for the batch
+            tree.applyBatch({}, std::move(entries));
+        }
+
+        // The graph insertions only need the shared lock, like single inserts
+        lock.unlock();
+        std::shared_lock<std::shared_mutex> shared(indexLock);
+        parallelFor((size_t)n, numThreads, [&](size_t i) {
+            int idx = first + (int)i;
+            const float* row = vectors.row(idx);
+            hnswIndex->addPoint(&row, idx);
+            if (partitions) {
+                partitions->graph(partitions->partitionOf(s[i])).addPoint(&row, idx);
+            }
+        });
+        finishAppend(first, n);
+        return first;
+    }
+
+    // Pops a free row and rewrites it with the record, under the exclusive lock so that
+    // no query reads it half-written. Returns -1 when there is no free row. `lock` is
+    // the caller's shared lock, held again on return.
+    int reuseFreeRow(const std::vector<float>& vec, float s, const std::vector<float>& attributes,
+                     std::shared_lock<std::shared_mutex>& lock) {
+        {
+            std::lock_guard<std::mutex> append(appendMutex);
+            if (freeRows.empty()) {
+                return -1;
+            }
+        }
+        int idx = -1;
+        lock.unlock();
+        {
+            std::unique_lock<std::shared_mutex> exclusive(indexLock);
+            if (!freeRows.empty()) {
+                idx = *freeRows.begin();
+                freeRows.erase(freeRows.begin());
+                if (journaling) {
+                    journal.push_back(idx);
+                }
+                std::copy(vec.begin(), vec.end(), vectors.row(idx));
+                if (distanceFn.normalizesInputs()) {
+                    distance::normalize(vectors.row(idx), dimension);
+                }
+                *sValues.row(idx) = s;
+                if (quantizer) {
+                    quantizer->rewrite(idx, vectors.row(idx));
+                }
+                // Columns added before the shared lock is back must see this row
+                // already, so its column postings go in here
+                for (size_t c = 0; c < columns.size(); c++) {
+                    *columns[c]->values.row(idx) = attributeOf(attributes, c);
+                    columns[c]->tree.insert(*columns[c]->values.row(idx), idx);
+                }
+            }
+        }
+        lock.lock();
+        return idx;
+    }
+
+    // Builds the clustered copy from a snapshot of the live rows under the shared lock,
+    // then swaps it in under the exclusive lock with the rows inserted, removed or
+    // moved meanwhile applied. Without `create`, only replaces an existing copy.
+    void buildClustered(bool create) {
+        std::lock_guard<std::mutex> serial(rebuildMutex);
+        std::unique_ptr<ClusteredRows> copy(new ClusteredRows(treeOrder));
+        size_t snapshotRows;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexLock);
+            if (!create && !clustered) {
+                return;
+            }
+            std::vector<std::pair<float, int>> order;
+            {
+                std::lock_guard<std::mutex> append(appendMutex);
+                journaling = true;
+                journal.clear();
+                // Appends still in flight go to `fresh` with the later ones
+                snapshotRows = visibleRows.load(std::memory_order_acquire);
+                for (size_t i = 0; i < snapshotRows; i++) {
+                    if (freeRows.count((int)i) == 0) {
+                        order.push_back({*sValues.row(i), (int)i});
+                    }
+                }
+                for (size_t i = snapshotRows; i < vectors.size(); i++) {
+                    journal.push_back((int)i);
+                }
+            }
+            // Ties keep arena order, so equal s values are still read forwards
+            std::sort(order.begin(), order.end());
+            copy->positionOf.assign(snapshotRows, -1);
+            copy->dead.reset(new std::atomic<bool>[std::max<size_t>(order.size(), 1)]);
+            copy->rows.setDimension(std::max(dimension, 1));
+            copy->rows.reserve(order.size());
+            for (size_t p = 0; p < order.size(); p++) {
+                copy->s.push_back(order[p].first);
+                copy->ids.push_back(order[p].second);
+                copy->positionOf[order[p].second] = (int)p;
+                copy->dead[p].store(false, std::memory_order_relaxed);
+                copy->rows.append(vectors.row(order[p].second));
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> exclusive(indexLock);
+        journaling = false;
+        std::sort(journal.begin(), journal.end());
+        journal.erase(std::unique(journal.begin(), journal.end()), journal.end());
+        std::vector<std::pair<float, int>> fresh;
+        for (int id : journal) {
+            // Whatever the copy holds for a journaled record is stale (removed, moved or
+            // rewritten since), so it goes, and a live record is read from `fresh`
+            int p = (size_t)id < snapshotRows ? copy->positionOf[id] : -1;
+            if (p >= 0) {
+                copy->retire(id, *sValues.row(id));
+            }
+            if (freeRows.count(id) == 0) {
+                fresh.push_back({*sValues.row(id), id});
+            }
+        }
+        journal.clear();
+        if (!create && !clustered) {
+            return;
+        }
+        copy->fresh.bulkLoad(std::move(fresh));
+        clustered = std::move(copy);
+    }
+
+    // Marks the appended ids [first, first + n) as fully inserted and moves the
+    // watermark past every finished id without a gap below it
+    void finishAppend(size_t first, size_t n) {
+        std::lock_guard<std::mutex> append(appendMutex);
+        finishedAppends[first] = first + n;
+        size_t visible = visibleRows.load(std::memory_order_relaxed);
+        auto it = finishedAppends.begin();
+        while (it != finishedAppends.end() && it->first == visible) {
+            visible = it->second;
+            it = finishedAppends.erase(it);
+        }
+        visibleRows.store(visible, std::memory_order_release);
+    }
+
+    float attributeOf(const std::vector<float>& attributes, size_t column) const {
+        return column < attributes.size() ? attributes[column] : columns[column]->defaultValue;
+    }
+
+    // The column with this name, nullptr for the built-in column "s"
+    Column* findColumn(const std::string& name) const {
+        if (name == "s") {
+            return nullptr;
+        }
+        for (const auto& column : columns) {
+            if (column->name == name) {
+                return column.get();
+            }
+        }
+        throw std::invalid_argument("No column named " + name);
+    }
+
+    // The rows below the watermark `visible` matching a predicate. Conjunctions
+    // evaluate their range terms from the most selective one (by countInRange) and
+    // stop as soon as the result is empty.
+    Bitmap evaluate(const Predicate& where, std::vector<int>& ids, size_t visible) const {
+        if (where.kind == Predicate::Kind::Range) {
+            const BPlusTree<float, int>& source = columnTree(findColumn(where.column));
+            ids.clear();
+            source.forEachInRange(where.lo, where.hi, [&ids](float, BPlusTree<float, int>::Postings postings) {
+                ids.insert(ids.end(), postings.begin(), postings.end());
+                return true;
+            });
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::lower_bound(ids.begin(), ids.end(), (int)visible), ids.end());
+            return Bitmap::fromSorted(ids);
+        }
+        if (where.terms.empty()) {
+            throw std::invalid_argument("Predicate combines no terms");
+        }
+        if (where.kind == Predicate::Kind::Any) {
+            Bitmap result = evaluate(where.terms[0], ids, visible);
+            for (size_t i = 1; i < where.terms.size(); i++) {
+                result = Bitmap::unite(result, evaluate(where.terms[i], ids, visible));
+            }
+            return result;
+        }
+        std::vector<std::pair<size_t, size_t>> order; // (estimated rows, term)
+        for (size_t i = 0; i < where.terms.size(); i++) {
+            const Predicate& term = where.terms[i];
+            size_t estimate = std::numeric_limits<size_t>::max();
+            if (term.kind == Predicate::Kind::Range) {
+                estimate = (size_t)columnTree(findColumn(term.column)).countInRange(term.lo, term.hi);
+            }
+            order.push_back({estimate, i});
+        }
+        std::sort(order.begin(), order.end());
+        Bitmap result = evaluate(where.terms[order[0].second], ids, visible);
+        for (size_t i = 1; i < order.size() && !result.empty(); i++) {
+            result = Bitmap::intersect(result, evaluate(where.terms[order[i].second], ids, visible));
+        }
+        return result;
+    }
+
+    const BPlusTree<float, int>& columnTree(const Column* column) const {
+        return column ? column->tree : tree;
+    }
+
+    // Runs compact() or recluster() on a background thread unless one is already running
+    void startInBackground(std::function<void()> task) {
+        std::lock_guard<std::mutex> guard(backgroundMutex);
+        if (backgroundRunning.exchange(true)) {
+            return;
+        }
+        if (background.joinable()) {
+            background.join();
+        }
+        background = std::thread([this, task]() {
+            try {
+                task();
+            } catch (const std::exception&) {
+                // The old structure stays in place; the next trigger retries
+            }
+            backgroundRunning = false;
+        });
+    }
+
+    // Creates the index on first use; several threads may race to do it
+    void ensureIndex(int dim) {
+        std::unique_lock<std::shared_mutex> lock(indexLock, std::defer_lock);
+        {
+            std::shared_lock<std::shared_mutex> shared(indexLock);
+            if (hnswIndex != nullptr) return;
+        }
+        lock.lock();
+        if (hnswIndex == nullptr) {
+            initIndex(dim, initialCapacity);
+        }
+    }
+
+    // Grows HNSW to hold at least `required` elements, at least doubling it so that a
+    // stream of inserts resizes O(log n) times. The caller holds indexLock exclusively:
+    // resizeIndex must not overlap with addPoint or searchKnn.
+    void ensureCapacity(size_t required) {
+        size_t current = hnswIndex->getMaxElements();
+        if (required > current) {
+            hnswIndex->resizeIndex(std::max(required, current * 2));
+        }
+        vectors.reserve(required);
+        sValues.reserve(required);
+    }
+
+    void initIndex(int dim, size_t maxElements) {
+        dimension = dim;
+        distanceFn = DistanceFunction(distanceFn.getMetric(), (size_t)dim);
+        vectors.setDimension(dim);
+        sValues.setDimension(1);
+        space = new ArenaSpace(dimension, distanceFn.getMetric());
+        hnswIndex = new hnswlib::HierarchicalNSW<float>(space, maxElements, hnswM, hnswEfConstruction);
+        hnswIndex->setEf(hnswEfSearch);
+        planner = QueryPlanner::calibrated(dim);
+    }
+
+    // How a partitioned query visits one partition: an exact scan of its part of the
+    // range, or a search of its graph (unfiltered when the range covers it)
+    struct PartitionStep {
+        size_t partition;
+        float lo;
+        float hi;
+        bool exact;
+        bool covered;
+    };
+
+    // The bottom HNSW layer keeps up to 2 * M links per node. With partitions, each
+    // overlapped one is planned on its own (exact scan or graph search of its share of
+    // the range) and the sum competes with the plans on the global graph.
+    PlanEstimate planFor(int k, float Smin, float Smax, int count, int O, std::vector<PartitionStep>& steps,
+                         const BPlusTree<float, int>::Version& version) const {
+        // The graph size, tombstones included: filtered searches walk through those too
+        int total = hnswIndex ? (int)hnswIndex->getCurrentElementCount() : 0;
+        PlanEstimate estimate = planner.plan(total, std::max(count, 0), k, hnswEfSearch, 2 * hnswM, O, filterMode);
+        if (!partitions || count <= 0 || filterMode == FilterMode::PostFilter) {
+            return estimate;
+        }
+        double cost = 0;
+        size_t last = partitions->partitionOf(Smax);
+        for (size_t p = partitions->partitionOf(Smin); p <= last; p++) {
+            PartitionStep step;
+            step.partition = p;
+            step.lo = std::max(Smin, partitions->lowerBound(p));
+            step.hi = std::min(Smax, partitions->upperBound(p));
+            step.covered = Smin <= partitions->lowerBound(p) && partitions->upperBound(p) <= Smax;
+            int size = (int)partitions->count(p);
+            int matching = std::min(size, version.countInRange(step.lo, step.hi));
+            if (matching <= 0) {
+                continue;
+            }
+            PlanEstimate part = planner.plan(size, matching, k, hnswEfSearch, 2 * hnswM, 0, FilterMode::InGraph);
+            step.exact = part.plan == QueryPlan::ExactScan;
+            cost += std::min(part.exactCost, part.filteredCost);
+            steps.push_back(step);
+        }
+        estimate.partitionedCost = cost;
+        if (cost < std::min({estimate.exactCost, estimate.filteredCost, estimate.postFilterCost})) {
+            estimate.plan = QueryPlan::PartitionedAnn;
+        }
+        return estimate;
     }
 
-    std::vector<int> approximateNearestNeighbors(const std::vector<float>& query, int O) {
+    // Builds the graphs of partition(); the caller holds indexLock exclusively
+    void buildPartitions(std::vector<float> boundaries, int numThreads) {
+        std::sort(boundaries.begin(), boundaries.end());
+        boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+        partitions.reset();
+        if (boundaries.empty()) {
+            return;
+        }
+        if (space == nullptr) {
+            throw std::logic_error("Cannot partition before the first insert sets the dimension");
+        }
+
+        const size_t Removed = std::numeric_limits<size_t>::max();
+        std::vector<size_t> rowPartition(vectors.size());
+        std::vector<size_t> counts(boundaries.size() + 1, 0);
+        auto partitionOf = [&](float s) {
+            return (size_t)(std::upper_bound(boundaries.begin(), boundaries.end(), s) - boundaries.begin());
+        };
+        for (size_t i = 0; i < rowPartition.size(); i++) {
+            if (freeRows.count((int)i) != 0) {
+                rowPartition[i] = Removed;
+                continue;
+            }
+            rowPartition[i] = partitionOf(*sValues.row(i));
+            counts[rowPartition[i]]++;
+        }
+        // Like the global graph, each one has room to grow before its first resize
+        std::vector<size_t> capacities(counts.size());
+        for (size_t p = 0; p < counts.size(); p++) {
+            capacities[p] = std::max(2 * counts[p], initialCapacity / counts.size());
+        }
+        partitions.reset(new ScalarPartitions(space, std::move(boundaries), capacities,
+                                              hnswM, hnswEfConstruction, hnswEfSearch));
+        for (size_t p = 0; p < counts.size(); p++) {
+            partitions->grow(p, counts[p]);
+        }
+        parallelFor(rowPartition.size(), numThreads, [&](size_t i) {
+            if (rowPartition[i] == Removed) {
+                return;
+            }
+            const float* row = vectors.row(i);
+            partitions->graph(rowPartition[i]).addPoint(&row, i);
+        });
+    }
+
+    // Adds an inserted row to its partition's graph, growing it under the exclusive
+    // lock when full. `lock` is the caller's shared lock on indexLock.
+    void addToPartition(int idx, float s, std::shared_lock<std::shared_mutex>& lock) {
+        const float* row = vectors.row(idx);
+        size_t p = partitions->partitionOf(s);
+        if (partitions->tryReserve(p)) {
+            partitions->graph(p).addPoint(&row, idx);
+            return;
+        }
+        lock.unlock();
+        {
+            // partition() may have rebuilt the graphs meanwhile; they then contain the
+            // row already and addPoint only updates it
+            std::unique_lock<std::shared_mutex> exclusive(indexLock);
+            if (partitions) {
+                p = partitions->partitionOf(s);
+                partitions->grow(p);
+                partitions->graph(p).addPoint(&row, idx);
+            }
+        }
+        lock.lock();
+    }
+
+    // Per-thread buffers reused across the queries of a batch
+    struct QueryScratch {
+        std::vector<float> normalized;
+        std::vector<int> candidates;
+        TopK best;
+        ScalarQuantizer::Query quantized;
+        TopK shortlist;
+        QueryStats stats; // of the running query
+    };
+
+    // Runs body(timer), which answers one query and fills scratch.stats, then adds the
+    // graph distances, records the stats in the counters and copies them to `out`
+    template <typename Body>
+    std::vector<std::pair<float,int>> instrumented(QueryScratch& scratch, QueryStats* out, Body body) const {
+        scratch.stats = QueryStats();
+        PhaseTimer total(out != nullptr);
+        PhaseTimer phases(out != nullptr);
+        size_t graphBefore = ArenaSpace::evaluations();
+        std::vector<std::pair<float,int>> result = body(phases);
+        QueryStats& stats = scratch.stats;
+        stats.graphDistances = ArenaSpace::evaluations() - graphBefore;
+        stats.results = result.size();
+        stats.totalNs = total.lap();
+        counters.record(stats);
+        if (out) {
+            *out = stats;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<float,int>> search(const std::vector<float>& v, int k, float Smin, float Smax, int O,
+                                             QueryScratch& scratch, QueryStats* out) const {
+        return instrumented(scratch, out, [&](PhaseTimer& timer) {
+            return searchRange(v, k, Smin, Smax, O, scratch, timer);
+        });
+    }
+
+    std::vector<std::pair<float,int>> search(const std::vector<float>& v, int k, const Predicate& where, int O,
+                                             QueryScratch& scratch, QueryStats* out) const {
+        return instrumented(scratch, out, [&](PhaseTimer& timer) {
+            return searchPredicate(v, k, where, O, scratch, timer);
+        });
+    }
+
+    std::vector<std::pair<float,int>> searchRange(const std::vector<float>& v, int k, float Smin, float Smax, int O,
+                                                  QueryScratch& scratch, PhaseTimer& timer) const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        if (hnswIndex == nullptr || vectors.empty()) {
+            return {};
+        }
+
+        if ((int)v.size() != dimension) {
+            throw std::invalid_argument("Query vector dimension does not match index dimension");
+        }
+
+        // The watermark first: every id below it is already in the version taken next
+        size_t visible = visibleRows.load(std::memory_order_acquire);
+        BPlusTree<float, int>::Version version = tree.snapshot();
+        QueryStats& stats = scratch.stats;
+        int count = version.countInRange(Smin, Smax);
+        stats.matching = std::max(count, 0);
+        stats.countNs = timer.lap();
+        if (count <= 0 || k <= 0) {
+            return {};
+        }
+
+        const float* q = prepareQuery(v, scratch.normalized);
+
+        TopK& best = scratch.best;
+        best.reset(k);
+        std::vector<PartitionStep> steps;
+        QueryPlan plan = planFor(k, Smin, Smax, count, O, steps, version).plan;
+        stats.planned = true;
+        stats.plan = plan;
+        stats.planNs = timer.lap();
+        if (plan == QueryPlan::PartitionedAnn) {
+            // Each partition contributes its nearest in-range rows to the same heap
+            for (const PartitionStep& step : steps) {
+                searchPartition(q, k, step, version, visible, scratch);
+            }
+        } else if (plan == QueryPlan::ExactScan) {
+            rankRange(q, Smin, Smax, std::numeric_limits<float>::infinity(), k, version, visible, scratch);
+        } else if (plan == QueryPlan::FilteredAnn) {
+            // Only in-range nodes enter the result set, so the k nearest are kept as is
+            auto filter = makeRangeFilter([this, visible](hnswlib::labeltype label) {
+                return visibleS(label, visible);
+            }, Smin, Smax);
+            auto hits = approximateNearestNeighbors(q, k, &filter);
+            stats.graphSearches++;
+            stats.candidates += hits.size();
+            stats.passed += hits.size();
+            for (const auto& hit : hits) {
+                best.push(hit.first, hit.second);
+            }
+        } else {
+            // HNSW already computed exact distances with the same kernel; reuse them
+            auto hits = approximateNearestNeighbors(q, O);
+            stats.graphSearches++;
+            stats.fetched = O;
+            stats.candidates += hits.size();
+            for (const auto& hit : hits) {
+                float sVal = visibleS(hit.second, visible);
+                if (sVal >= Smin && sVal <= Smax) {
+                    stats.passed++;
+                    best.push(hit.first, hit.second);
+                }
+            }
+        }
+        stats.searchNs = timer.lap();
+        return best.take();
+    }
+
+    std::vector<std::pair<float,int>> searchPredicate(const std::vector<float>& v, int k, const Predicate& where, int O,
+                                                      QueryScratch& scratch, PhaseTimer& timer) const {
+        std::shared_lock<std::shared_mutex> lock(indexLock);
+        if (hnswIndex == nullptr || vectors.empty() || k <= 0) {
+            return {};
+        }
+        if ((int)v.size() != dimension) {
+            throw std::invalid_argument("Query vector dimension does not match index dimension");
+        }
+
+        QueryStats& stats = scratch.stats;
+        Bitmap rows = evaluate(where, scratch.candidates, visibleRows.load(std::memory_order_acquire));
+        stats.matching = (int)rows.cardinality();
+        stats.countNs = timer.lap();
+        if (rows.empty()) {
+            return {};
+        }
+        const float* q = prepareQuery(v, scratch.normalized);
+        TopK& best = scratch.best;
+        best.reset(k);
+        int total = (int)hnswIndex->getCurrentElementCount();
+        QueryPlan plan = planner.plan(total, (int)rows.cardinality(), k, hnswEfSearch, 2 * hnswM, O, filterMode).plan;
+        stats.planned = true;
+        stats.plan = plan;
+        stats.planNs = timer.lap();
+        if (plan == QueryPlan::ExactScan) {
+            scratch.candidates.clear();
+            rows.toVector(scratch.candidates);
+            stats.candidates += scratch.candidates.size();
+            stats.passed += scratch.candidates.size();
+            rankCandidates(q, scratch.candidates, k, scratch);
+        } else if (plan == QueryPlan::FilteredAnn) {
+            BitmapFilter filter(rows);
+            auto hits = approximateNearestNeighbors(q, k, &filter);
+            stats.graphSearches++;
+            stats.candidates += hits.size();
+            stats.passed += hits.size();
+            for (const auto& hit : hits) {
+                best.push(hit.first, hit.second);
+            }
+        } else {
+            auto hits = approximateNearestNeighbors(q, O);
+            stats.graphSearches++;
+            stats.fetched = O;
+            stats.candidates += hits.size();
+            for (const auto& hit : hits) {
+                if (rows.contains((uint32_t)hit.second)) {
+                    stats.passed++;
+                    best.push(hit.first, hit.second);
+                }
+            }
+        }
+        stats.searchNs = timer.lap();
+        return best.take();
+    }
+
+    void searchPartition(const float* q, int k, const PartitionStep& step, const BPlusTree<float, int>::Version& version,
+                         size_t visible, QueryScratch& scratch) const {
+        TopK& best = scratch.best;
+        if (step.exact) {
+            // The upper bound itself belongs to the next partition
+            rankRange(q, step.lo, step.hi, partitions->upperBound(step.partition), k, version, visible, scratch);
+            return;
+        }
+        auto filter = makeRangeFilter([this, visible](hnswlib::labeltype label) {
+            return visibleS(label, visible);
+        }, step.lo, step.hi);
+        hnswlib::HierarchicalNSW<float>& graph = partitions->graph(step.partition);
+        auto hits = approximateNearestNeighbors(graph, q, k, step.covered ? nullptr : &filter);
+        scratch.stats.graphSearches++;
+        scratch.stats.candidates += hits.size();
+        for (const auto& hit : hits) {
+            // An unfiltered search may still return rows above the watermark
+            if ((size_t)hit.second < visible) {
+                scratch.stats.passed++;
+                best.push(hit.first, hit.second);
+            }
+        }
+    }
+
+    // The s value of a row below the watermark, NaN (outside every range) above it
+    float visibleS(size_t idx, size_t visible) const {
+        return idx < visible ? *sValues.row(idx) : std::numeric_limits<float>::quiet_NaN();
+    }
+
+    // The O approximate nearest neighbours as (distance, index), closest first,
+    // restricted to the labels the filter accepts if one is given
+    std::vector<std::pair<float,int>> approximateNearestNeighbors(const float* query, int O,
+                                                                  hnswlib::BaseFilterFunctor* filter = nullptr) const {
         if (!hnswIndex) {
             return {};
         }
-        auto result = hnswIndex->searchKnn(query.data(), O);
-        std::vector<int> candidates;
+        return approximateNearestNeighbors(*hnswIndex, query, O, filter);
+    }
+
+    std::vector<std::pair<float,int>> approximateNearestNeighbors(const hnswlib::HierarchicalNSW<float>& graph, const float* query, int O,
+                                                                  hnswlib::BaseFilterFunctor* filter) const {
+        auto result = graph.searchKnn(&query, O, filter);
+        std::vector<std::pair<float,int>> candidates;
         while (!result.empty()) {
             auto &item = result.top();
-            candidates.push_back((int)item.second);
+            candidates.push_back({item.first, (int)item.second});
             result.pop();
         }
         std::reverse(candidates.begin(), candidates.end());
         return candidates;
     }
 
-    inline float euclideanDistSquared(const std::vector<float>& a, const std::vector<float>& b) {
-        float dist = 0.0f;
-        for (size_t i = 0; i < a.size(); i++) {
-            float diff = a[i] - b[i];
-            dist += diff * diff;
+    // Copies vec into the arena, normalized when the metric asks for unit vectors
+    size_t appendVector(const std::vector<float>& vec) {
+        return appendVector(vec.data());
+    }
+
+    size_t appendVector(const float* vec) {
+        size_t idx = vectors.append(vec);
+        if (distanceFn.normalizesInputs()) {
+            distance::normalize(vectors.row(idx), dimension);
+        }
+        return idx;
+    }
+
+    const float* prepareQuery(const std::vector<float>& v, std::vector<float>& scratch) const {
+        if (!distanceFn.normalizesInputs()) {
+            return v.data();
+        }
+        scratch = v;
+        distance::normalize(scratch.data(), dimension);
+        return scratch.data();
+    }
+
+    // Offers the k nearest records below the watermark with Smin <= s <= Smax and
+    // s < below to scratch.best. In the clustered layout the copy holds most of them as
+    // one run of rows, scanned in order; only the records inserted or moved since the
+    // last recluster() come from a tree, the side tree instead of the version.
+    void rankRange(const float* q, float Smin, float Smax, float below, int k, const BPlusTree<float, int>::Version& version,
+                   size_t visible, QueryScratch& scratch) const {
+        // Collect the ids straight from the leaves into the reused buffer
+        std::vector<int>& candidates = scratch.candidates;
+        candidates.clear();
+        auto collect = [&](float s, BPlusTree<float, int>::Postings ids) {
+            if (!(s < below)) return false;
+            candidates.insert(candidates.end(), ids.begin(), ids.end());
+            return true;
+        };
+        if (clustered) {
+            clustered->fresh.snapshot().forEachInRange(Smin, Smax, collect);
+        } else {
+            version.forEachInRange(Smin, Smax, collect);
+        }
+        // Visit the rows in arena order so the scan walks memory forwards
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::lower_bound(candidates.begin(), candidates.end(), (int)visible), candidates.end());
+        scratch.stats.candidates += candidates.size();
+        scratch.stats.passed += candidates.size();
+        rankCandidates(q, candidates, k, scratch);
+        if (!clustered) {
+            return;
+        }
+
+        const ClusteredRows& copy = *clustered;
+        size_t from = std::lower_bound(copy.s.begin(), copy.s.end(), Smin) - copy.s.begin();
+        size_t to = std::min(std::upper_bound(copy.s.begin(), copy.s.end(), Smax),
+                             std::lower_bound(copy.s.begin(), copy.s.end(), below)) - copy.s.begin();
+        const size_t Block = 64;
+        float dists[Block];
+        TopK& best = scratch.best;
+        size_t live = 0;
+        copy.rows.forEachRun(from, std::max(from, to), [&](size_t firstRow, size_t rows, const float* data) {
+            for (size_t start = 0; start < rows; start += Block) {
+                size_t n = std::min(Block, rows - start);
+                distanceFn.batch(q, data + start * dimension, n, dimension, dists);
+                for (size_t r = 0; r < n; r++) {
+                    size_t p = firstRow + start + r;
+                    if (!copy.dead[p].load(std::memory_order_relaxed) && (size_t)copy.ids[p] < visible) {
+                        best.push(dists[r], copy.ids[p]);
+                        live++;
+                    }
+                }
+            }
+        });
+        // Dead entries of the run and those above the watermark count as filtered out
+        size_t scanned = std::max(from, to) - from;
+        scratch.stats.candidates += scanned;
+        scratch.stats.passed += live;
+        scratch.stats.scanDistances += scanned;
+    }
+
+    // Offers the k nearest of the sorted ids to scratch.best. With quantize(), the codes
+    // pick a short list first and only that is ranked against the fp32 rows.
+    void rankCandidates(const float* q, std::vector<int>& ids, int k, QueryScratch& scratch) const {
+        size_t shortlistSize = (size_t)k * rerankFactor;
+        if (!quantizer || ids.size() <= shortlistSize) {
+            scratch.stats.scanDistances += ids.size();
+            rankExact(q, ids, scratch.best);
+            return;
+        }
+        scratch.stats.codeDistances += ids.size();
+        quantizer->prepare(q, scratch.quantized);
+        TopK& shortlist = scratch.shortlist;
+        shortlist.reset((int)shortlistSize);
+        for (int id : ids) {
+            shortlist.push(quantizer->distance(scratch.quantized, quantizer->code(id)), id);
+        }
+        // Re-rank in ascending row order, like every other exact scan
+        ids.clear();
+        for (const auto& hit : shortlist.take()) {
+            ids.push_back(hit.second);
+        }
+        std::sort(ids.begin(), ids.end());
+        scratch.stats.scanDistances += ids.size();
+        rankExact(q, ids, scratch.best);
+    }
+
+    // Streams the given rows through the batched kernel into best, a block at a time
+    void rankExact(const float* q, const std::vector<int>& ids, TopK& best) const {
+        const size_t Block = 64;
+        const float* rows[Block];
+        float dists[Block];
+        for (size_t start = 0; start < ids.size(); start += Block) {
+            size_t n = std::min(Block, ids.size() - start);
+            for (size_t i = 0; i < n; i++) {
+                rows[i] = vectors.row(ids[start + i]);
+            }
+            distanceFn.batch(q, rows, n, dimension, dists);
+            for (size_t i = 0; i < n; i++) {
+                best.push(dists[i], ids[start + i]);
+            }
         }
-        return dist;
     }
 
     friend class BPlusTree<float,int>;
@@ -0,0 +1,89 @@
+#include "../../include/KeySearch.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// KeySearch::upperBound / lowerBound against std::upper_bound / std::lower_bound on
+// sorted arrays with duplicates, for every length up to a few halving steps and for
+// queries below, inside and above the keys. The arrays are searched from an odd offset
+// as well, since node key arrays need not be vector-aligned. Which block kernel is
+// tested depends on the build flags: build once plain, once with -mavx2 and once with
+// -mavx512f (or -march=native) to cover all three. With a fixed MaxKeys (the key
+// capacity of a fixed-order tree) every n up to that bound is checked.
+template <typename KeyType, int MaxKeys = 0>
+bool checkType(const string& name, mt19937& rng) {
+    for (int n = 0; n <= (MaxKeys > 0 ? MaxKeys : 300); n++) {
+        for (int offset = 0; offset < 2; offset++) {
+            // Few distinct values, so runs of equal keys straddle the block boundaries
+            vector<KeyType> storage(n + offset);
+            for (int i = 0; i < n; i++) {
+                storage[offset + i] = (KeyType)(rng() % (n / 3 + 2)) - (KeyType)(n / 6);
+            }
+            KeyType* keys = storage.data() + offset;
+            sort(keys, keys + n);
+
+            for (int q = -n / 6 - 2; q <= n / 3 + 2; q++) {
+                KeyType x = (KeyType)q;
+                int upper = (int)(upper_bound(keys, keys + n, x) - keys);
+                int lower = (int)(lower_bound(keys, keys + n, x) - keys);
+                if (KeySearch<KeyType, MaxKeys>::upperBound(keys, n, x) != upper ||
+                    KeySearch<KeyType, MaxKeys>::lowerBound(keys, n, x) != lower) {
+                    cout << name << ": mismatch for n = " << n << ", offset = " << offset
+                         << ", x = " << q << endl;
+                    return false;
+                }
+            }
+        }
+    }
+    cout << name << ": upperBound and lowerBound match the standard library" << endl;
+    return true;
+}
+
+int main() {
+#if defined(__AVX512F__)
+    cout << "Block kernel: AVX-512" << endl;
+#elif defined(__AVX2__)
+    cout << "Block kernel: AVX2" << endl;
+#else
+    cout << "Block kernel: scalar" << endl;
+#endif
+    mt19937 rng(5);
+    bool ok = checkType<float>("float", rng) &&
+              checkType<int32_t>("int32", rng) &&
+              checkType<int64_t>("int64", rng) &&
+              checkType<double>("double (generic)", rng);
+
+    // Fixed bounds below, at and above the counted block length (64), and the key
+    // capacities of orders withTreeOrder() compiles in
+    ok = ok && checkType<float, 3>("float, MaxKeys 3", rng) &&
+         checkType<float, 63>("float, MaxKeys 63", rng) &&
+         checkType<float, 64>("float, MaxKeys 64", rng) &&
+         checkType<float, 65>("float, MaxKeys 65", rng) &&
+         checkType<float, 255>("float, MaxKeys 255", rng) &&
+         checkType<int32_t, 31>("int32, MaxKeys 31", rng) &&
+         checkType<int32_t, 127>("int32, MaxKeys 127", rng) &&
+         checkType<int64_t, 7>("int64, MaxKeys 7", rng) &&
+         checkType<int64_t, 100>("int64, MaxKeys 100", rng) &&
+         checkType<double, 31>("double (generic), MaxKeys 31", rng);
+
+    // Keys near the ends of the int64 range, where a wrapping compare would fail
+    int64_t wide[] = {INT64_MIN, INT64_MIN + 1, -1, 0, 0, 1, INT64_MAX - 1, INT64_MAX};
+    for (int64_t x : wide) {
+        if (KeySearch<int64_t>::upperBound(wide, 8, x) != (int)(upper_bound(wide, wide + 8, x) - wide) ||
+            KeySearch<int64_t>::lowerBound(wide, 8, x) != (int)(lower_bound(wide, wide + 8, x) - wide)) {
+            cout << "int64: mismatch at the ends of the range for x = " << x << endl;
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    cout << "Key search matches the standard library." << endl;
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "../../include/Distance.h"
+#include "../../include/naiveVectorIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Every kernel set this CPU can run (scalar, AVX2, AVX-512 or NEON) against
+// l2Scalar / dotScalar, pair and quad kernels, for dimensions that exercise the
+// main loops and every tail length, from unaligned row addresses. Then
+// DistanceFunction for the three metrics and both batch layouts, and
+// NaiveVectorIndex queries under InnerProduct and Cosine against an exact scan.
+
+// Sums of dim products in float differ from the scalar order by rounding only
+bool close(float got, float want, size_t dim) {
+    return fabs(got - want) <= 1e-5f * (float)dim * max(1.0f, fabs(want));
+}
+
+bool checkKernels(const distance::Kernels& k, mt19937& rng) {
+    uniform_real_distribution<float> value(-1.0f, 1.0f);
+    vector<size_t> dims = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 128, 384, 768, 1000};
+    for (size_t dim : dims) {
+        // One float of padding in front so the rows start off any vector boundary
+        vector<float> storage(1 + 5 * dim);
+        for (float& x : storage) x = value(rng);
+        const float* query = storage.data() + 1;
+        const float* rows[4] = {query + dim, query + 2 * dim, query + 3 * dim, query + 4 * dim};
+
+        float l2Quad[4], dotQuad[4];
+        k.l2x4(query, rows, dim, l2Quad);
+        k.dotx4(query, rows, dim, dotQuad);
+        for (int r = 0; r < 4; r++) {
+            float l2 = distance::l2Scalar(query, rows[r], dim);
+            float dot = distance::dotScalar(query, rows[r], dim);
+            if (!close(k.l2(query, rows[r], dim), l2, dim) || !close(k.dot(query, rows[r], dim), dot, dim) ||
+                !close(l2Quad[r], l2, dim) || !close(dotQuad[r], dot, dim)) {
+                cout << k.name << ": mismatch at dimension " << dim << ", row " << r << endl;
+                return false;
+            }
+        }
+    }
+    cout << k.name << ": pair and quad kernels match the scalar reference" << endl;
+    return true;
+}
+
+bool checkMetric(Metric metric, const string& name, mt19937& rng) {
+    uniform_real_distribution<float> value(-1.0f, 1.0f);
+    const size_t dim = 37, n = 23;
+    vector<float> block(n * dim), query(dim);
+    for (float& x : block) x = value(rng);
+    for (float& x : query) x = value(rng);
+    DistanceFunction fn(metric);
+    if (metric == Metric::Cosine) {
+        distance::normalize(query.data(), dim);
+        for (size_t i = 0; i < n; i++) distance::normalize(block.data() + i * dim, dim);
+        float norm = sqrt(distance::dotScalar(query.data(), query.data(), dim));
+        if (fabs(norm - 1.0f) > 1e-5f) {
+            cout << name << ": normalize left a norm of " << norm << endl;
+            return false;
+        }
+    }
+
+    vector<const float*> rows(n);
+    for (size_t i = 0; i < n; i++) rows[i] = block.data() + i * dim;
+    vector<float> viaRows(n), viaBlock(n);
+    fn.batch(query.data(), rows.data(), n, dim, viaRows.data());
+    fn.batch(query.data(), block.data(), n, dim, viaBlock.data());
+    for (size_t i = 0; i < n; i++) {
+        float want = metric == Metric::L2 ? distance::l2Scalar(query.data(), rows[i], dim)
+                                          : 1.0f - distance::dotScalar(query.data(), rows[i], dim);
+        if (!close(fn(query.data(), rows[i], dim), want, dim) || !close(viaRows[i], want, dim) ||
+            !close(viaBlock[i], want, dim)) {
+            cout << name << ": distance mismatch for row " << i << endl;
+            return false;
+        }
+    }
+    cout << name << ": pair and batch distances match the scalar reference" << endl;
+    return true;
+}
+
+// Top-k from the naive index must have the same distances as an exact scan over the
+// rows in range (ids may differ only between rows at the same distance)
+bool checkNaiveIndex(Metric metric, const string& name, mt19937& rng) {
+    uniform_real_distribution<float> value(-1.0f, 1.0f);
+    const int dim = 24, n = 2000, k = 10;
+    NaiveVectorIndex index(metric);
+    vector<vector<float>> data(n, vector<float>(dim));
+    vector<float> s(n);
+    for (int i = 0; i < n; i++) {
+        for (float& x : data[i]) x = value(rng);
+        s[i] = (float)(rng() % 100);
+        index.insert(data[i], s[i]);
+    }
+
+    auto reference = [&](vector<float> a, vector<float> b) {
+        if (metric == Metric::Cosine) {
+            distance::normalize(a.data(), dim);
+            distance::normalize(b.data(), dim);
+        }
+        return 1.0f - distance::dotScalar(a.data(), b.data(), a.size());
+    };
+    for (int q = 0; q < 50; q++) {
+        vector<float> query(dim);
+        for (float& x : query) x = value(rng);
+        float lo = (float)(rng() % 60), hi = lo + 40.0f;
+        vector<float> expected;
+        for (int i = 0; i < n; i++) {
+            if (s[i] >= lo && s[i] <= hi) expected.push_back(reference(query, data[i]));
+        }
+        sort(expected.begin(), expected.end());
+        expected.resize(min<size_t>(expected.size(), k));
+
+        vector<int> result = index.query(query, k, lo, hi);
+        if (result.size() != expected.size()) {
+            cout << name << ": query " << q << " returned " << result.size() << " ids" << endl;
+            return false;
+        }
+        for (size_t r = 0; r < result.size(); r++) {
+            if (!close(reference(query, data[result[r]]), expected[r], dim)) {
+                cout << name << ": query " << q << ", rank " << r << " does not match the exact scan" << endl;
+                return false;
+            }
+        }
+    }
+    cout << name << ": naive index queries match the exact scan" << endl;
+    return true;
+}
+
+int main() {
+    mt19937 rng(7);
+    vector<distance::Kernels> sets = {
+        {distance::l2Scalar, distance::dotScalar, distance::l2Scalarx4, distance::dotScalarx4, "scalar"}};
+#if defined(DISTANCE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        sets.push_back({distance::l2Avx2, distance::dotAvx2, distance::l2Avx2x4, distance::dotAvx2x4, "avx2"});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        sets.push_back({distance::l2Avx512, distance::dotAvx512, distance::l2Avx512x4, distance::dotAvx512x4, "avx512"});
+    }
+#elif defined(DISTANCE_NEON)
+    sets.push_back({distance::l2Neon, distance::dotNeon, distance::l2Neonx4, distance::dotNeonx4, "neon"});
+#endif
+    cout << "Dispatched kernels: " << distance::kernels().name << endl;
+
+    bool ok = true;
+    for (const auto& k : sets) {
+        ok = ok && checkKernels(k, rng);
+    }
+    ok = ok && checkMetric(Metric::L2, "L2", rng) &&
+         checkMetric(Metric::InnerProduct, "InnerProduct", rng) &&
+         checkMetric(Metric::Cosine, "Cosine", rng) &&
+         checkNaiveIndex(Metric::InnerProduct, "InnerProduct", rng) &&
+         checkNaiveIndex(Metric::Cosine, "Cosine", rng);
+    if (!ok) {
+        return 1;
+    }
+    cout << "Distance kernels match the scalar reference." << endl;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "../../include/naiveVectorIndex.h"
+#include "../../include/vectorIndex.h"
+#include "../../include/probabilisticVectorIndex.h"
+#include "../../include/ThreadPool.h"
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef vector<vector<pair<float, int>>> Results;
+
+// queryBatch on pools of several sizes must return exactly what one query at a time
+// returns, for all three indexes. The batches are also started from inside the loop
+// bodies of other pools: a nested loop runs inline and must hand its body a slot
+// that is valid for the pool it was started on.
+bool sameResults(const Results& got, const Results& want, const string& what) {
+    if (got != want) {
+        cout << what << ": queryBatch differs from one query at a time" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    const int dim = 16, n = 3000, numQueries = 200, k = 10;
+    mt19937 rng(9);
+    uniform_real_distribution<float> value(0.0f, 1.0f);
+    vector<vector<float>> data(n, vector<float>(dim));
+    vector<float> s(n);
+    for (int i = 0; i < n; i++) {
+        for (float& x : data[i]) x = value(rng);
+        s[i] = (float)(rng() % 1000);
+    }
+    vector<vector<float>> queries(numQueries, vector<float>(dim));
+    vector<pair<float, float>> ranges(numQueries);
+    for (int q = 0; q < numQueries; q++) {
+        for (float& x : queries[q]) x = value(rng);
+        float lo = (float)(rng() % 900);
+        ranges[q] = {lo, lo + (float)(rng() % 400)};
+    }
+
+    NaiveVectorIndex naive;
+    VectorIndex hybrid(8);
+    ProbabilisticVectorIndex probabilistic(8);
+    naive.insertBatch(data, s);
+    hybrid.insertBatch(data, s);
+    probabilistic.insertBatch(data, s);
+
+    Results naiveWant(numQueries), hybridWant(numQueries), probabilisticWant(numQueries);
+    for (int q = 0; q < numQueries; q++) {
+        naiveWant[q] = naive.queryWithDistances(queries[q], k, ranges[q].first, ranges[q].second);
+        hybridWant[q] = hybrid.queryWithDistances(queries[q], k, ranges[q].first, ranges[q].second, 200);
+        probabilisticWant[q] = probabilistic.queryWithDistances(queries[q], k, ranges[q].first, ranges[q].second, 0.01);
+    }
+
+    auto checkOn = [&](ThreadPool* pool, const string& what) {
+        return sameResults(naive.queryBatch(queries, k, ranges, pool), naiveWant, what + ", naive") &&
+               sameResults(hybrid.queryBatch(queries, k, ranges, 200, pool), hybridWant, what + ", hybrid") &&
+               sameResults(probabilistic.queryBatch(queries, k, ranges, 0.01, pool), probabilisticWant,
+                           what + ", probabilistic");
+    };
+
+    for (int threads : {1, 2, 4, 8}) {
+        ThreadPool pool(threads);
+        if (!checkOn(&pool, to_string(threads) + " threads")) {
+            return 1;
+        }
+    }
+    if (!checkOn(nullptr, "shared pool")) {
+        return 1;
+    }
+    cout << "Batches on 1 to 8 threads and the shared pool match single queries" << endl;
+
+    // Batches started from the bodies of an 8-thread pool, on that pool, on a smaller
+    // pool and on a larger one
+    ThreadPool outer(8), smaller(2), larger(12);
+    atomic<bool> ok(true);
+    outer.parallelFor(16, [&](size_t i, int) {
+        ThreadPool* target = i % 3 == 0 ? &outer : i % 3 == 1 ? &smaller : &larger;
+        if (!checkOn(target, "nested batch " + to_string(i))) {
+            ok = false;
+        }
+        target->parallelFor(100, [&](size_t, int slot) {
+            if (slot < 0 || slot >= target->slots()) {
+                ok = false;
+            }
+        });
+    });
+    if (!ok) {
+        cout << "A nested loop got a slot outside its pool" << endl;
+        return 1;
+    }
+    cout << "Batches nested in another pool's loop match single queries" << endl;
+
+    // The first exception of a loop body reaches the caller, nested or not
+    bool threw = false;
+    try {
+        outer.parallelFor(100, [&](size_t i, int) {
+            smaller.parallelFor(10, [&](size_t j, int) {
+                if (i == 42 && j == 3) throw runtime_error("body failed");
+            });
+        });
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    if (!threw) {
+        cout << "An exception in a nested loop body was lost" << endl;
+        return 1;
+    }
+
+    cout << "queryBatch matches single queries." << endl;
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <set>
+
+using namespace std;
+
+// Concurrent mode: writer threads insert and remove while reader threads search and
+// count, then the tree must hold exactly what a std::multimap fed the same writes holds.
+// Every value v is stored under key v % Keys, so a reader can check what it finds.
+const int Keys = 500;
+
+int main() {
+    const int writers = 4, readers = 4, insertsPerWriter = 10000;
+    vector<int> orders = {3, 4, 8, 64};
+    for (int order : orders) {
+        BPlusTree<int, int> tree(order);
+        tree.setConcurrent(true);
+        multimap<int, int> reference;
+        mutex referenceMutex;
+
+        atomic<bool> stop(false);
+        atomic<bool> wrong(false);
+        vector<thread> threads;
+        for (int r = 0; r < readers; r++) {
+            threads.emplace_back([&, r] {
+                mt19937 rng(100 + r);
+                while (!stop.load()) {
+                    // searchAll's view may move under a writer; forEachInRange keeps the leaf latched
+                    int key = (int)(rng() % Keys);
+                    tree.forEachInRange(key, key, [&](int, BPlusTree<int, int>::Postings values) {
+                        for (int v : values) {
+                            if (v % Keys != key) {
+                                wrong = true;
+                            }
+                        }
+                        return true;
+                    });
+                    int lo = (int)(rng() % Keys), hi = lo + (int)(rng() % 50);
+                    for (int v : tree.rangeQuery(lo, hi)) {
+                        if (v % Keys < lo || v % Keys > hi) {
+                            wrong = true;
+                        }
+                    }
+                    int count = tree.countInRange(lo, hi);
+                    if (count < 0 || count > writers * insertsPerWriter) {
+                        wrong = true;
+                    }
+                }
+            });
+        }
+
+        vector<thread> inserters;
+        for (int w = 0; w < writers; w++) {
+            inserters.emplace_back([&, w] {
+                for (int i = 0; i < insertsPerWriter; i++) {
+                    int v = i * writers + w;
+                    tree.insert(v % Keys, v);
+                    lock_guard<mutex> guard(referenceMutex);
+                    reference.insert({v % Keys, v});
+                }
+            });
+        }
+        for (auto& t : inserters) {
+            t.join();
+        }
+        stop = true;
+        for (auto& t : threads) {
+            t.join();
+        }
+        threads.clear();
+
+        // Second phase: removals (which take the tree exclusively) next to inserts and reads
+        stop = false;
+        for (int r = 0; r < readers; r++) {
+            threads.emplace_back([&, r] {
+                mt19937 rng(200 + r);
+                while (!stop.load()) {
+                    int key = (int)(rng() % Keys);
+                    for (int v : tree.rangeQuery(key, key)) {
+                        if (v % Keys != key) {
+                            wrong = true;
+                        }
+                    }
+                    if (tree.countInRange(key, key + 10) < 0) {
+                        wrong = true;
+                    }
+                    // remove() waits for the tree exclusively, which back-to-back readers would starve
+                    this_thread::sleep_for(chrono::microseconds(50));
+                }
+            });
+        }
+        vector<thread> mixed;
+        for (int w = 0; w < writers; w++) {
+            mixed.emplace_back([&, w] {
+                mt19937 rng(300 + w);
+                for (int i = 0; i < insertsPerWriter / 4; i++) {
+                    int v = (int)(rng() % (Keys * 100));
+                    lock_guard<mutex> guard(referenceMutex);
+                    if (rng() % 3 == 0) {
+                        tree.removeValue(v % Keys, v);
+                        auto range = reference.equal_range(v % Keys);
+                        for (auto it = range.first; it != range.second; it++) {
+                            if (it->second == v) {
+                                reference.erase(it);
+                                break;
+                            }
+                        }
+                    } else {
+                        tree.insert(v % Keys, v);
+                        reference.insert({v % Keys, v});
+                    }
+                }
+            });
+        }
+        for (auto& t : mixed) {
+            t.join();
+        }
+        stop = true;
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        if (wrong) {
+            cout << "Order " << order << ": a reader saw an inconsistent tree" << endl;
+            return 1;
+        }
+        if (tree.size() != (int)reference.size()) {
+            cout << "Order " << order << ": size mismatch, tree " << tree.size()
+                 << ", multimap " << reference.size() << endl;
+            return 1;
+        }
+        for (int key = 0; key < Keys; key++) {
+            auto range = reference.equal_range(key);
+            multiset<int> expected, found;
+            for (auto it = range.first; it != range.second; it++) {
+                expected.insert(it->second);
+            }
+            for (int v : tree.searchAll(key)) {
+                found.insert(v);
+            }
+            if (expected != found) {
+                cout << "Order " << order << ": mismatch found for key: " << key << endl;
+                return 1;
+            }
+        }
+        cout << "Order " << order << ": " << tree.size() << " entries match the multimap" << endl;
+    }
+
+    cout << "Concurrent trees match the multimap." << endl;
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "../../include/vectorIndex.h"
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Snapshots: a tree saved and loaded again must match a std::multimap, and an index
+// loaded from a snapshot, read or mapped, must answer every query exactly like the
+// index that saved it, which itself is checked against an exact scan. The snapshot
+// files go to the system temp directory and are deleted at the end.
+const int Dim = 16, Rows = 3000, K = 10;
+
+// The k nearest rows with Smin <= s <= Smax by a full scan
+vector<int> exactNearest(const vector<vector<float>>& vecs, const vector<float>& s,
+                         const vector<float>& q, int k, float Smin, float Smax) {
+    vector<pair<float, int>> all;
+    for (size_t i = 0; i < vecs.size(); i++) {
+        if (s[i] < Smin || s[i] > Smax) continue;
+        float d = 0;
+        for (int j = 0; j < Dim; j++) {
+            d += (q[j] - vecs[i][j]) * (q[j] - vecs[i][j]);
+        }
+        all.push_back({d, (int)i});
+    }
+    sort(all.begin(), all.end());
+    vector<int> ids;
+    for (size_t i = 0; i < all.size() && (int)i < k; i++) {
+        ids.push_back(all[i].second);
+    }
+    return ids;
+}
+
+int main() {
+    mt19937 rng(12);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    string treePath = (filesystem::temp_directory_path() / "save_load_tree.bin").string();
+    string indexPath = (filesystem::temp_directory_path() / "save_load_index.bin").string();
+
+    // Tree round trip, duplicates included
+    BPlusTree<int, int> tree(8);
+    multimap<int, int> reference;
+    for (int i = 0; i < 20000; i++) {
+        int key = (int)(rng() % 3000);
+        tree.insert(key, i);
+        reference.insert({key, i});
+    }
+    tree.save(treePath);
+    BPlusTree<int, int> loadedTree(4);
+    loadedTree.load(treePath);
+    remove(treePath.c_str());
+    if (loadedTree.size() != (int)reference.size()) {
+        cout << "Loaded tree has " << loadedTree.size() << " entries, multimap " << reference.size() << endl;
+        return 1;
+    }
+    for (auto it = reference.begin(); it != reference.end(); it = reference.upper_bound(it->first)) {
+        auto range = reference.equal_range(it->first);
+        vector<int> expected;
+        for (auto e = range.first; e != range.second; e++) {
+            expected.push_back(e->second);
+        }
+        auto found = loadedTree.searchAll(it->first);
+        if (vector<int>(found.begin(), found.end()) != expected) {
+            cout << "Mismatch found for key: " << it->first << endl;
+            return 1;
+        }
+    }
+    cout << "Loaded tree matches the multimap." << endl;
+
+    // Index round trip
+    vector<vector<float>> vecs(Rows, vector<float>(Dim));
+    vector<float> s(Rows);
+    for (int i = 0; i < Rows; i++) {
+        for (float& x : vecs[i]) x = unit(rng);
+        s[i] = unit(rng);
+    }
+    VectorIndex index(16);
+    index.insertBatch(vecs, s);
+    index.save(indexPath);
+
+    VectorIndex loaded(16), mapped(16);
+    loaded.load(indexPath);
+    mapped.load(indexPath, true);
+
+    int hits = 0, total = 0;
+    for (int t = 0; t < 50; t++) {
+        vector<float> q(Dim);
+        for (float& x : q) x = unit(rng);
+        float Smin = unit(rng) * 0.8f, Smax = Smin + 0.01f + unit(rng) * 0.2f;
+        vector<int> original = index.query(q, K, Smin, Smax);
+        if (loaded.query(q, K, Smin, Smax) != original || mapped.query(q, K, Smin, Smax) != original) {
+            cout << "Loaded index answers [" << Smin << ", " << Smax << "] differently" << endl;
+            return 1;
+        }
+        int count = (int)count_if(s.begin(), s.end(), [&](float x) { return x >= Smin && x <= Smax; });
+        if (loaded.countInRange(Smin, Smax) != count || mapped.countInRange(Smin, Smax) != count) {
+            cout << "Count mismatch for [" << Smin << ", " << Smax << "]" << endl;
+            return 1;
+        }
+        vector<int> exact = exactNearest(vecs, s, q, K, Smin, Smax);
+        for (int id : exact) {
+            hits += find(original.begin(), original.end(), id) != original.end();
+        }
+        total += (int)exact.size();
+    }
+    double recall = total ? (double)hits / total : 1.0;
+    cout << "Recall@" << K << " against an exact scan: " << recall << endl;
+    if (recall < 0.9) {
+        cout << "Recall too low" << endl;
+        return 1;
+    }
+
+    // A mapped snapshot is read-only
+    bool threw = false;
+    try {
+        mapped.insert(vecs[0], 0.5f);
+    } catch (const logic_error&) {
+        threw = true;
+    }
+    remove(indexPath.c_str());
+    remove((indexPath + ".hnsw").c_str());
+    if (!threw) {
+        cout << "Insert into a mapped snapshot did not throw" << endl;
+        return 1;
+    }
+
+    cout << "Loaded and mapped indexes match the saved index." << endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Rank queries: countLess, countLessOrEqual, countInRange and select(i) against a
+// std::multimap after random inserts and removals, and sampleInRange checked for
+// staying in range and drawing every value of the range about equally often.
+int main() {
+    vector<int> orders = {3, 8, 64};
+    for (int order : orders) {
+        mt19937 rng(19 + order);
+        BPlusTree<int, int> tree(order);
+        multimap<int, int> reference;
+        vector<int> keyOf; // value -> key
+        for (int step = 0; step < 30000; step++) {
+            int key = (int)(rng() % 2000);
+            if (step % 4 == 3) {
+                auto it = reference.find(key);
+                if (it != reference.end()) {
+                    tree.removeValue(it->first, it->second);
+                    reference.erase(it);
+                }
+            } else {
+                tree.insert(key, (int)keyOf.size());
+                reference.insert({key, (int)keyOf.size()});
+                keyOf.push_back(key);
+            }
+        }
+
+        // select(i) walks the multimap order: by key, then by insertion
+        int i = 0;
+        for (auto& e : reference) {
+            if (tree.select(i) != e.second) {
+                cout << "Order " << order << ": select(" << i << ") mismatch" << endl;
+                return 1;
+            }
+            i++;
+        }
+        bool threw = false;
+        try {
+            tree.select((int)reference.size());
+        } catch (const out_of_range&) {
+            threw = true;
+        }
+        if (!threw) {
+            cout << "Order " << order << ": select past the end did not throw" << endl;
+            return 1;
+        }
+
+        for (int x = -1; x <= 2001; x += 7) {
+            int less = (int)distance(reference.begin(), reference.lower_bound(x));
+            int lessOrEqual = (int)distance(reference.begin(), reference.upper_bound(x));
+            int inRange = (int)distance(reference.lower_bound(x), reference.upper_bound(x + 40));
+            if (tree.countLess(x) != less || tree.countLessOrEqual(x) != lessOrEqual ||
+                tree.countInRange(x, x + 40) != inRange) {
+                cout << "Order " << order << ": count mismatch at " << x << endl;
+                return 1;
+            }
+        }
+
+        // Sampling with replacement: in range, and no value far from the expected frequency
+        for (int lo = 0; lo < 2000; lo += 250) {
+            int hi = lo + 5;
+            map<int, int> seen;
+            int entries = (int)distance(reference.lower_bound(lo), reference.upper_bound(hi));
+            const int perValue = 400;
+            vector<int> samples = tree.sampleInRange(lo, hi, entries * perValue, rng);
+            if ((int)samples.size() != entries * perValue) {
+                cout << "Order " << order << ": sampleInRange returned " << samples.size() << " values" << endl;
+                return 1;
+            }
+            for (int v : samples) {
+                if (keyOf[v] < lo || keyOf[v] > hi) {
+                    cout << "Order " << order << ": sample " << v << " is outside [" << lo << ", " << hi << "]" << endl;
+                    return 1;
+                }
+                seen[v]++;
+            }
+            for (auto it = reference.lower_bound(lo); it != reference.upper_bound(hi); it++) {
+                if (seen[it->second] < perValue / 2 || seen[it->second] > perValue * 3 / 2) {
+                    cout << "Order " << order << ": value " << it->second << " sampled " << seen[it->second]
+                         << " times, expected about " << perValue << endl;
+                    return 1;
+                }
+            }
+        }
+        if (!tree.sampleInRange(5000, 6000, 10, rng).empty()) {
+            cout << "Order " << order << ": sampling an empty range returned values" << endl;
+            return 1;
+        }
+        cout << "Order " << order << ": ranks, selects and samples match the multimap" << endl;
+    }
+
+    cout << "Rank queries match the multimap." << endl;
+    return 0;
+}
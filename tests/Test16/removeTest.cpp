@@ -0,0 +1,134 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+typedef BPlusTree<int, int> Tree;
+
+// Checks the shape of the subtree under node: keys ascending and inside the bounds the
+// parent gives, every internal node but the root at least minimally filled (a leaf split
+// for holding too many values may have fewer keys, but never none), sizes adding up
+// and all leaves at one depth. Returns an empty string or what is wrong.
+string checkNode(const Tree::Node* node, bool isRoot, int minKeys, const int* lo, const int* hi,
+                 int depth, int& leafDepth) {
+    for (size_t i = 0; i < node->keys.size(); i++) {
+        if ((i > 0 && !(node->keys[i - 1] < node->keys[i])) || (lo && node->keys[i] < *lo) ||
+            (hi && !(node->keys[i] < *hi))) {
+            return "keys out of order at depth " + to_string(depth);
+        }
+    }
+    if (!isRoot && ((int)node->keys.size() < (node->isLeaf ? 1 : minKeys))) {
+        return "underfull node at depth " + to_string(depth);
+    }
+    if (node->isLeaf) {
+        if (leafDepth < 0) leafDepth = depth;
+        if (leafDepth != depth) return "leaves at different depths";
+        if (node->valueEnds.size() != node->keys.size() ||
+            (!node->keys.empty() && node->valueEnds[node->keys.size() - 1] != (int)node->values.size())) {
+            return "value runs do not match the keys";
+        }
+        for (size_t i = 0; i < node->keys.size(); i++) {
+            if (node->valueEnds[i] <= node->valueBegin((int)i)) return "key without values";
+        }
+        return node->subtree_size == (int)node->values.size() ? "" : "wrong leaf size";
+    }
+    if (node->children.size() != node->keys.size() + 1) {
+        return "internal node with " + to_string(node->children.size()) + " children and " +
+               to_string(node->keys.size()) + " keys";
+    }
+    int size = 0;
+    for (size_t c = 0; c < node->children.size(); c++) {
+        const int* childLo = c == 0 ? lo : &node->keys[c - 1];
+        const int* childHi = c + 1 == node->children.size() ? hi : &node->keys[c];
+        string error = checkNode(node->children[c], false, minKeys, childLo, childHi, depth + 1, leafDepth);
+        if (!error.empty()) return error;
+        size += node->children[c]->subtree_size;
+    }
+    return node->subtree_size == size ? "" : "wrong subtree size at depth " + to_string(depth);
+}
+
+// The tree's values in key order, read through the leaf chain
+vector<pair<int, int>> leafChain(const Tree& tree) {
+    const Tree::Node* node = tree.getRoot();
+    while (!node->isLeaf) node = node->children[0];
+    vector<pair<int, int>> entries;
+    for (; node; node = node->next) {
+        for (size_t i = 0; i < node->keys.size(); i++) {
+            for (int v = node->valueBegin((int)i); v < node->valueEnds[i]; v++) {
+                entries.push_back({node->keys[i], node->values[v]});
+            }
+        }
+    }
+    return entries;
+}
+
+// Removal with rebalancing: random inserts, remove(key) and removeValue at small orders
+// (where merges and borrows happen on most removals) against a std::multimap, with the
+// tree's shape checked as it grows and as it is emptied again.
+int main() {
+    vector<int> orders = {3, 4, 5, 8, 32};
+    for (int order : orders) {
+        mt19937 rng(20 + order);
+        Tree tree(order);
+        multimap<int, int> reference;
+        int minKeys = (order - 1) / 2;
+        int next = 0;
+
+        // Grow, churn, then drain to empty
+        const int phases[3][2] = {{20000, 90}, {20000, 50}, {40000, 0}};
+        for (auto& phase : phases) {
+            for (int step = 0; step < phase[0]; step++) {
+                int key = (int)(rng() % 3000);
+                if ((int)(rng() % 100) < phase[1]) {
+                    tree.insert(key, next);
+                    reference.insert({key, next});
+                    next++;
+                } else if (rng() % 3 == 0) {
+                    tree.remove(key);
+                    reference.erase(key);
+                } else {
+                    // One value of the key, or one it does not have
+                    auto range = reference.equal_range(key);
+                    int value = range.first != range.second && rng() % 4 ? range.first->second : -1;
+                    bool removed = tree.removeValue(key, value);
+                    if (removed != (value >= 0)) {
+                        cout << "Order " << order << ": removeValue(" << key << ", " << value
+                             << ") returned " << removed << endl;
+                        return 1;
+                    }
+                    if (removed) reference.erase(range.first);
+                }
+
+                if (step % 100 == 0) {
+                    int leafDepth = -1;
+                    string error = checkNode(tree.getRoot(), true, minKeys, nullptr, nullptr, 0, leafDepth);
+                    if (!error.empty()) {
+                        cout << "Order " << order << ": " << error << endl;
+                        return 1;
+                    }
+                }
+                if (step % 1000 == 0 && leafChain(tree) != vector<pair<int, int>>(reference.begin(), reference.end())) {
+                    cout << "Order " << order << ": mismatch with the multimap after " << step << " steps" << endl;
+                    return 1;
+                }
+            }
+        }
+        for (auto it = reference.begin(); it != reference.end();) {
+            int key = it->first;
+            tree.remove(key);
+            it = reference.upper_bound(key);
+        }
+        if (tree.size() != 0 || !tree.getRoot()->isLeaf || !tree.rangeQuery(0, 3000).empty()) {
+            cout << "Order " << order << ": tree not empty after removing every key" << endl;
+            return 1;
+        }
+        cout << "Order " << order << ": removals match the multimap" << endl;
+    }
+
+    cout << "Removals match the multimap." << endl;
+    return 0;
+}
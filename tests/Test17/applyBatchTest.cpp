@@ -0,0 +1,102 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Every key with its values sorted, so trees and maps compare regardless of the order
+// a batch put equal keys in
+map<int, vector<int>> contents(const BPlusTree<int, int>& tree) {
+    map<int, vector<int>> result;
+    tree.forEachInRange(numeric_limits<int>::min(), numeric_limits<int>::max(),
+                        [&](int key, BPlusTree<int, int>::Postings values) {
+        vector<int>& sorted = result[key];
+        sorted.assign(values.begin(), values.end());
+        sort(sorted.begin(), sorted.end());
+        return true;
+    });
+    return result;
+}
+
+map<int, vector<int>> contents(const multimap<int, int>& reference) {
+    map<int, vector<int>> result;
+    for (auto& e : reference) {
+        result[e.first].push_back(e.second);
+    }
+    for (auto& e : result) {
+        sort(e.second.begin(), e.second.end());
+    }
+    return result;
+}
+
+// Batched writes: applyBatch with small batches (applied pair by pair) and batches as
+// large as the tree (merged into the leaves in one pass) against a std::multimap,
+// removals of pairs that are not in the tree included.
+int main() {
+    vector<int> orders = {3, 4, 16, 64};
+    for (int order : orders) {
+        mt19937 rng(21 + order);
+        BPlusTree<int, int> tree(order);
+        multimap<int, int> reference;
+        int next = 0;
+        for (int round = 0; round < 200; round++) {
+            // Mostly small batches, every tenth one about the size of the tree
+            int size = round % 10 == 9 ? (int)reference.size() + 50 : 1 + (int)(rng() % 20);
+            vector<pair<int, int>> removals, insertions;
+            for (int i = 0; i < size; i++) {
+                int key = (int)(rng() % 5000);
+                if (rng() % 2 && !reference.empty()) {
+                    // An existing pair, or a key with a value it does not have
+                    auto it = reference.lower_bound(key);
+                    if (it == reference.end()) it = reference.begin();
+                    removals.push_back({it->first, rng() % 5 ? it->second : -1});
+                } else {
+                    insertions.push_back({key, next++});
+                }
+            }
+
+            int expected = 0;
+            for (auto& r : removals) {
+                auto range = reference.equal_range(r.first);
+                for (auto it = range.first; it != range.second; it++) {
+                    if (it->second == r.second) {
+                        reference.erase(it);
+                        expected++;
+                        break;
+                    }
+                }
+            }
+            reference.insert(insertions.begin(), insertions.end());
+
+            int removed = tree.applyBatch(removals, insertions);
+            if (removed != expected) {
+                cout << "Order " << order << ": applyBatch removed " << removed << " pairs, expected "
+                     << expected << endl;
+                return 1;
+            }
+            if (tree.size() != (int)reference.size() || (round % 10 == 9 && contents(tree) != contents(reference))) {
+                cout << "Order " << order << ": mismatch with the multimap after batch " << round << endl;
+                return 1;
+            }
+        }
+        if (contents(tree) != contents(reference)) {
+            cout << "Order " << order << ": mismatch with the multimap" << endl;
+            return 1;
+        }
+        for (int x = 0; x < 5000; x += 37) {
+            int count = (int)distance(reference.lower_bound(x), reference.upper_bound(x + 100));
+            if (tree.countInRange(x, x + 100) != count) {
+                cout << "Order " << order << ": count mismatch at " << x << endl;
+                return 1;
+            }
+        }
+        cout << "Order " << order << ": " << tree.size() << " entries match the multimap" << endl;
+    }
+
+    cout << "Batched trees match the multimap." << endl;
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "../../include/vectorIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Scalar updates: after rounds of updateScalars (repeated ids included, the last value
+// winning) every count must equal an exact count over the current s values, every hit
+// must be in range by its current s, and the hits must agree with an exact scan. Run
+// in the insertion-order, partitioned and clustered layouts.
+const int Dim = 16, Rows = 3000, K = 10;
+
+vector<int> exactNearest(const vector<vector<float>>& vecs, const vector<float>& s,
+                         const vector<float>& q, int k, float Smin, float Smax) {
+    vector<pair<float, int>> all;
+    for (size_t i = 0; i < vecs.size(); i++) {
+        if (s[i] < Smin || s[i] > Smax) continue;
+        float d = 0;
+        for (int j = 0; j < Dim; j++) {
+            d += (q[j] - vecs[i][j]) * (q[j] - vecs[i][j]);
+        }
+        all.push_back({d, (int)i});
+    }
+    sort(all.begin(), all.end());
+    vector<int> ids;
+    for (size_t i = 0; i < all.size() && (int)i < k; i++) {
+        ids.push_back(all[i].second);
+    }
+    return ids;
+}
+
+int main() {
+    const string layouts[] = {"insertion order", "partitioned", "clustered"};
+    for (int layout = 0; layout < 3; layout++) {
+        mt19937 rng(21);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        vector<vector<float>> vecs(Rows, vector<float>(Dim));
+        vector<float> s(Rows);
+        for (int i = 0; i < Rows; i++) {
+            for (float& x : vecs[i]) x = unit(rng);
+            s[i] = unit(rng);
+        }
+        VectorIndex index(16);
+        index.insertBatch(vecs, s);
+        if (layout == 1) {
+            index.partition(4);
+        } else if (layout == 2) {
+            index.setLayout(VectorIndex::Layout::ClusteredByS);
+        }
+
+        int hits = 0, total = 0;
+        for (int round = 0; round < 20; round++) {
+            vector<int> ids;
+            vector<float> values;
+            for (int i = 0; i < 200; i++) {
+                ids.push_back((int)(rng() % Rows));
+                values.push_back(unit(rng));
+            }
+            index.updateScalars(ids, values);
+            for (size_t i = 0; i < ids.size(); i++) {
+                s[ids[i]] = values[i];
+            }
+            if (layout == 2 && round == 10) {
+                index.recluster();
+            }
+
+            for (int t = 0; t < 5; t++) {
+                vector<float> q(Dim);
+                for (float& x : q) x = unit(rng);
+                float Smin = unit(rng) * 0.8f, Smax = Smin + 0.01f + unit(rng) * 0.2f;
+                int count = (int)count_if(s.begin(), s.end(), [&](float x) { return x >= Smin && x <= Smax; });
+                if (index.countInRange(Smin, Smax) != count) {
+                    cout << layouts[layout] << ": count mismatch for [" << Smin << ", " << Smax << "]" << endl;
+                    return 1;
+                }
+                vector<int> found = index.query(q, K, Smin, Smax);
+                for (int id : found) {
+                    if (s[id] < Smin || s[id] > Smax) {
+                        cout << layouts[layout] << ": hit " << id << " has s " << s[id] << ", outside ["
+                             << Smin << ", " << Smax << "]" << endl;
+                        return 1;
+                    }
+                }
+                vector<int> exact = exactNearest(vecs, s, q, K, Smin, Smax);
+                if (found.size() != exact.size()) {
+                    cout << layouts[layout] << ": " << found.size() << " hits, expected " << exact.size() << endl;
+                    return 1;
+                }
+                for (int id : exact) {
+                    hits += find(found.begin(), found.end(), id) != found.end();
+                }
+                total += (int)exact.size();
+            }
+        }
+        double recall = total ? (double)hits / total : 1.0;
+        cout << layouts[layout] << ": recall@" << K << " against an exact scan " << recall << endl;
+        if (recall < 0.9) {
+            cout << "Recall too low" << endl;
+            return 1;
+        }
+    }
+
+    cout << "Updated indexes match the exact scan." << endl;
+    return 0;
+}
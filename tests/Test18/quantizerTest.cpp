@@ -0,0 +1,103 @@
+#include "../../include/vectorIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// SQ8 codes: exact scans over the codes, re-ranked against the fp32 rows, must find
+// nearly the same k nearest as an exact scan of the fp32 rows, also for rows inserted
+// after quantize(), and quantize(0) must bring back the exact answer.
+const int Dim = 32, Rows = 20000, K = 10;
+
+vector<int> exactNearest(const vector<vector<float>>& vecs, const vector<float>& s,
+                         const vector<float>& q, int k, float Smin, float Smax) {
+    vector<pair<float, int>> all;
+    for (size_t i = 0; i < vecs.size(); i++) {
+        if (s[i] < Smin || s[i] > Smax) continue;
+        float d = 0;
+        for (int j = 0; j < Dim; j++) {
+            d += (q[j] - vecs[i][j]) * (q[j] - vecs[i][j]);
+        }
+        all.push_back({d, (int)i});
+    }
+    sort(all.begin(), all.end());
+    vector<int> ids;
+    for (size_t i = 0; i < all.size() && (int)i < k; i++) {
+        ids.push_back(all[i].second);
+    }
+    return ids;
+}
+
+int main() {
+    mt19937 rng(22);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    normal_distribution<float> gaussian(0.0f, 1.0f);
+    vector<vector<float>> vecs(Rows, vector<float>(Dim));
+    vector<float> s(Rows);
+    for (int i = 0; i < Rows; i++) {
+        for (float& x : vecs[i]) x = gaussian(rng);
+        s[i] = unit(rng);
+    }
+    VectorIndex index(16);
+    index.insertBatch(vecs, s);
+    index.quantize();
+    // Rows appended after fitting get codes too
+    for (int i = 0; i < 500; i++) {
+        vector<float> v(Dim);
+        for (float& x : v) x = gaussian(rng);
+        vecs.push_back(v);
+        s.push_back(unit(rng));
+        index.insert(v, s.back());
+    }
+
+    // Ranges of 1-3% of the rows: exact scans, with more candidates than the short list
+    int hits = 0, total = 0, quantizedScans = 0;
+    vector<pair<vector<float>, pair<float, float>>> queries;
+    for (int t = 0; t < 100; t++) {
+        vector<float> q(Dim);
+        for (float& x : q) x = gaussian(rng);
+        float Smin = unit(rng) * 0.95f, Smax = Smin + 0.01f + unit(rng) * 0.02f;
+        queries.push_back({q, {Smin, Smax}});
+
+        QueryStats stats;
+        vector<int> found;
+        for (auto& hit : index.queryWithDistances(q, K, Smin, Smax, 1000, &stats)) {
+            found.push_back(hit.second);
+        }
+        if (stats.plan == QueryPlan::ExactScan && stats.codeDistances > 0) {
+            quantizedScans++;
+        }
+        vector<int> exact = exactNearest(vecs, s, q, K, Smin, Smax);
+        for (int id : exact) {
+            hits += find(found.begin(), found.end(), id) != found.end();
+        }
+        total += (int)exact.size();
+    }
+    double recall = total ? (double)hits / total : 1.0;
+    cout << quantizedScans << " of " << queries.size() << " queries scanned the codes, recall@" << K
+         << " against the fp32 scan: " << recall << endl;
+    if (quantizedScans == 0 || recall < 0.95) {
+        cout << "Quantized scans missed too many neighbours" << endl;
+        return 1;
+    }
+
+    // Without codes the exact scans are exact again
+    index.quantize(0);
+    for (auto& query : queries) {
+        QueryStats stats;
+        vector<int> found;
+        for (auto& hit : index.queryWithDistances(query.first, K, query.second.first, query.second.second, 1000, &stats)) {
+            found.push_back(hit.second);
+        }
+        if (stats.plan == QueryPlan::ExactScan &&
+            found != exactNearest(vecs, s, query.first, K, query.second.first, query.second.second)) {
+            cout << "Exact scan without codes differs from the fp32 scan" << endl;
+            return 1;
+        }
+    }
+
+    cout << "Quantized scans match the fp32 scan." << endl;
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "../../include/vectorIndex.h"
+#include "../../include/Bitmap.h"
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// Predicates: Bitmap unions and intersections against std::set_union and
+// std::set_intersection, then index queries filtered on s and two added columns,
+// where the matching count must equal a brute-force count, every hit must satisfy the
+// predicate and the hits must agree with an exact filtered scan.
+const int Dim = 16, Rows = 5000, K = 10;
+
+struct Row {
+    float s, price, category;
+};
+
+bool matches(const Predicate& p, const Row& row) {
+    switch (p.kind) {
+    case Predicate::Kind::Range: {
+        float value = p.column == "s" ? row.s : p.column == "price" ? row.price : row.category;
+        return value >= p.lo && value <= p.hi;
+    }
+    case Predicate::Kind::All:
+        return all_of(p.terms.begin(), p.terms.end(), [&](const Predicate& t) { return matches(t, row); });
+    case Predicate::Kind::Any:
+        return any_of(p.terms.begin(), p.terms.end(), [&](const Predicate& t) { return matches(t, row); });
+    }
+    return false;
+}
+
+vector<int> sortedIds(mt19937& rng, int count, int universe) {
+    vector<int> ids;
+    for (int i = 0; i < count; i++) {
+        ids.push_back((int)(rng() % universe));
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+int main() {
+    mt19937 rng(23);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Sparse and dense containers across several 2^16 blocks
+    for (int round = 0; round < 50; round++) {
+        vector<int> a = sortedIds(rng, (int)(rng() % 40000), 300000);
+        vector<int> b = sortedIds(rng, (int)(rng() % 40000), round % 2 ? 300000 : 70000);
+        vector<int> both, either, found;
+        set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(both));
+        set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(either));
+        Bitmap x = Bitmap::fromSorted(a), y = Bitmap::fromSorted(b);
+        Bitmap::intersect(x, y).toVector(found);
+        if (found != both || Bitmap::intersect(x, y).cardinality() != both.size()) {
+            cout << "Bitmap intersection mismatch in round " << round << endl;
+            return 1;
+        }
+        found.clear();
+        Bitmap::unite(x, y).toVector(found);
+        if (found != either || Bitmap::unite(x, y).cardinality() != either.size()) {
+            cout << "Bitmap union mismatch in round " << round << endl;
+            return 1;
+        }
+        for (int t = 0; t < 100; t++) {
+            int id = (int)(rng() % 300000);
+            if (x.contains(id) != binary_search(a.begin(), a.end(), id)) {
+                cout << "Bitmap contains(" << id << ") mismatch" << endl;
+                return 1;
+            }
+        }
+    }
+    cout << "Bitmaps match the sorted sets." << endl;
+
+    // Columns added after the first batch, set for it, then given on insert
+    vector<vector<float>> vecs(Rows, vector<float>(Dim));
+    vector<Row> rows(Rows);
+    for (int i = 0; i < Rows; i++) {
+        for (float& x : vecs[i]) x = unit(rng);
+        rows[i] = {unit(rng), unit(rng) * 100.0f, (float)(rng() % 10)};
+    }
+    VectorIndex index(16);
+    vector<float> s;
+    for (int i = 0; i < Rows / 2; i++) {
+        s.push_back(rows[i].s);
+    }
+    index.insertBatch(vector<vector<float>>(vecs.begin(), vecs.begin() + Rows / 2), s);
+    index.addColumn("price");
+    index.addColumn("category", -1.0f);
+    vector<int> ids;
+    vector<float> prices, categories;
+    for (int i = 0; i < Rows / 2; i++) {
+        ids.push_back(i);
+        prices.push_back(rows[i].price);
+        categories.push_back(rows[i].category);
+    }
+    index.setColumn("price", ids, prices);
+    index.setColumn("category", ids, categories);
+    for (int i = Rows / 2; i < Rows; i++) {
+        index.insert(vecs[i], rows[i].s, {rows[i].price, rows[i].category});
+    }
+
+    int hits = 0, total = 0;
+    for (int t = 0; t < 200; t++) {
+        float lo = unit(rng) * 80.0f, s0 = unit(rng) * 0.7f;
+        int c1 = (int)(rng() % 10), c2 = (int)(rng() % 10);
+        Predicate where;
+        switch (t % 4) {
+        case 0: where = Predicate::range("price", lo, lo + 20.0f); break;
+        case 1: where = Predicate::range("price", lo, lo + 20.0f) && Predicate::range("category", (float)c1, (float)c1); break;
+        case 2: where = Predicate::range("s", s0, s0 + 0.3f) &&
+                        (Predicate::range("category", (float)c1, (float)c1) || Predicate::range("category", (float)c2, (float)c2)); break;
+        default: where = Predicate::any({Predicate::range("s", s0, s0 + 0.05f), Predicate::range("price", lo, lo + 2.0f)}); break;
+        }
+
+        vector<pair<float, int>> exact;
+        vector<float> q(Dim);
+        for (float& x : q) x = unit(rng);
+        for (int i = 0; i < Rows; i++) {
+            if (!matches(where, rows[i])) continue;
+            float d = 0;
+            for (int j = 0; j < Dim; j++) {
+                d += (q[j] - vecs[i][j]) * (q[j] - vecs[i][j]);
+            }
+            exact.push_back({d, i});
+        }
+        sort(exact.begin(), exact.end());
+
+        QueryStats stats;
+        vector<int> found = index.query(q, K, where, 1000, &stats);
+        if (stats.matching != (int)exact.size()) {
+            cout << "Predicate " << t << " matched " << stats.matching << " rows, expected " << exact.size() << endl;
+            return 1;
+        }
+        for (int id : found) {
+            if (!matches(where, rows[id])) {
+                cout << "Predicate " << t << " returned row " << id << ", which does not match it" << endl;
+                return 1;
+            }
+        }
+        if (found.size() != min(exact.size(), (size_t)K)) {
+            cout << "Predicate " << t << " returned " << found.size() << " rows" << endl;
+            return 1;
+        }
+        for (size_t i = 0; i < found.size(); i++) {
+            hits += find(found.begin(), found.end(), exact[i].second) != found.end();
+        }
+        total += (int)found.size();
+    }
+    double recall = total ? (double)hits / total : 1.0;
+    cout << "Recall@" << K << " against the exact filtered scan: " << recall << endl;
+    if (recall < 0.9) {
+        cout << "Recall too low" << endl;
+        return 1;
+    }
+
+    cout << "Predicate queries match the exact filtered scan." << endl;
+    return 0;
+}
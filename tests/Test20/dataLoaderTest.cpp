@@ -0,0 +1,223 @@
+#include "../../include/DataLoader.h"
+#include "../../include/naiveVectorIndex.h"
+#include "../../include/vectorIndex.h"
+#include "../../include/probabilisticVectorIndex.h"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// DataLoader on every format: CSV with and without a header, CRLF line ends and blank
+// lines, large enough to be parsed in several chunks; .fvecs and .bvecs; the raw layout
+// saved and mapped back. Malformed inputs of each format must throw std::runtime_error.
+// Finally the rows go through the flat insertBatch() of the three indexes, which must
+// return the id of the first row. The files go to the system temp directory and are
+// deleted at the end.
+const int Dim = 6, Rows = 20000;
+
+// Multiples of 1/4, so the CSV text parses back to exactly the same floats
+float component(int row, int j) { return (float)((row * 7 + j * 13) % 4001) / 4.0f - 500.0f; }
+float scalar(int row) { return (float)(row % 997) / 4.0f; }
+
+string tempPath(const string& name) {
+    return (filesystem::temp_directory_path() / name).string();
+}
+
+void writeFile(const string& path, const string& contents) {
+    ofstream out(path, ios::binary);
+    out << contents;
+}
+
+bool matches(const VectorDataset& data, int rows, bool withScalars, const string& what) {
+    if (data.size() != (size_t)rows || data.dimension() != Dim || data.hasScalars() != withScalars) {
+        cout << what << ": loaded " << data.size() << " rows of dimension " << data.dimension() << endl;
+        return false;
+    }
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < Dim; j++) {
+            if (data.row(i)[j] != component(i, j)) {
+                cout << what << ": row " << i << ", component " << j << " differs" << endl;
+                return false;
+            }
+        }
+        if (withScalars && data.scalars()[i] != scalar(i)) {
+            cout << what << ": s of row " << i << " differs" << endl;
+            return false;
+        }
+    }
+    cout << what << ": " << rows << " rows match" << endl;
+    return true;
+}
+
+template <typename Error = runtime_error>
+bool throws(const function<void()>& load, const string& what) {
+    try {
+        load();
+    } catch (const Error&) {
+        return true;
+    }
+    cout << what << ": no exception of the expected type" << endl;
+    return false;
+}
+
+template <typename T>
+void writeRecord(ofstream& out, int32_t dim, const vector<T>& components) {
+    out.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+    out.write(reinterpret_cast<const char*>(components.data()), components.size() * sizeof(T));
+}
+
+int main() {
+    string csvPath = tempPath("data_loader_test.csv");
+    string fvecsPath = tempPath("data_loader_test.fvecs");
+    string bvecsPath = tempPath("data_loader_test.bvecs");
+    string rawPath = tempPath("data_loader_test.f32");
+    bool ok = true;
+
+    // CSV: a header, CRLF line ends, blank lines and spaces around the fields
+    string csv = "v1,v2,v3,v4,v5,v6,s\r\n\r\n";
+    for (int i = 0; i < Rows; i++) {
+        for (int j = 0; j < Dim; j++) {
+            csv += to_string(component(i, j)) + (j == 2 ? " , " : ",");
+        }
+        csv += to_string(scalar(i)) + (i % 2 ? "\r\n" : "\n");
+        if (i % 1000 == 999) csv += "\n";
+    }
+    writeFile(csvPath, csv);
+    for (int threads : {1, 4}) {
+        ok = ok && matches(DataLoader::load(csvPath, DataLoader::Format::Auto, threads), Rows, true,
+                           "CSV on " + to_string(threads) + " threads");
+    }
+
+    // No header, no trailing newline, and every column a vector component
+    csv.clear();
+    for (int i = 0; i < 10; i++) {
+        if (i > 0) csv += "\n";
+        for (int j = 0; j < Dim; j++) {
+            csv += (j > 0 ? "," : "") + to_string(component(i, j));
+        }
+    }
+    writeFile(csvPath, csv);
+    ok = ok && matches(DataLoader::loadCsv(csvPath, false), 10, false, "CSV without header or s");
+
+    writeFile(csvPath, "1,2,3\n4,x,6\n");
+    ok = ok && throws([&] { DataLoader::loadCsv(csvPath); }, "CSV with a non-number");
+    writeFile(csvPath, "1,2,3\n4,5\n");
+    ok = ok && throws([&] { DataLoader::loadCsv(csvPath); }, "CSV with a short row");
+    writeFile(csvPath, "1,2,3\n4,5,6,7\n");
+    ok = ok && throws([&] { DataLoader::loadCsv(csvPath); }, "CSV with a long row");
+    writeFile(csvPath, "1\n2\n");
+    ok = ok && throws([&] { DataLoader::loadCsv(csvPath); }, "CSV with only an s column");
+    ok = ok && throws([&] { DataLoader::loadCsv(tempPath("data_loader_missing.csv")); }, "missing CSV file");
+
+    // .fvecs and .bvecs, with s values attached afterwards
+    {
+        ofstream fvecs(fvecsPath, ios::binary), bvecs(bvecsPath, ios::binary);
+        for (int i = 0; i < Rows; i++) {
+            vector<float> row(Dim);
+            vector<uint8_t> bytes(Dim);
+            for (int j = 0; j < Dim; j++) {
+                row[j] = component(i, j);
+                bytes[j] = (uint8_t)((i + j) % 256);
+            }
+            writeRecord(fvecs, Dim, row);
+            writeRecord(bvecs, Dim, bytes);
+        }
+    }
+    VectorDataset fromFvecs = DataLoader::load(fvecsPath);
+    vector<float> s(Rows);
+    for (int i = 0; i < Rows; i++) s[i] = scalar(i);
+    ok = ok && !fromFvecs.hasScalars();
+    fromFvecs.setScalars(s);
+    ok = ok && matches(fromFvecs, Rows, true, ".fvecs");
+    ok = ok && throws<invalid_argument>([&] { fromFvecs.setScalars(vector<float>(Rows - 1)); }, "too few s values");
+
+    VectorDataset fromBvecs = DataLoader::load(bvecsPath, DataLoader::Format::Auto, 4);
+    bool bytesMatch = fromBvecs.size() == (size_t)Rows && fromBvecs.dimension() == Dim;
+    for (int i = 0; bytesMatch && i < Rows; i++) {
+        for (int j = 0; j < Dim; j++) {
+            bytesMatch = bytesMatch && fromBvecs.row(i)[j] == (float)((i + j) % 256);
+        }
+    }
+    if (!bytesMatch) {
+        cout << ".bvecs: components differ" << endl;
+        ok = false;
+    }
+
+    {
+        ofstream fvecs(fvecsPath, ios::binary);
+        writeRecord(fvecs, Dim, vector<float>(Dim));
+        writeRecord(fvecs, Dim + 1, vector<float>(Dim - 1));
+    }
+    ok = ok && throws([&] { DataLoader::loadFvecs(fvecsPath); }, ".fvecs with mixed dimensions");
+    {
+        ofstream fvecs(fvecsPath, ios::binary);
+        writeRecord(fvecs, Dim, vector<float>(Dim - 1));
+    }
+    ok = ok && throws([&] { DataLoader::loadFvecs(fvecsPath); }, "truncated .fvecs");
+
+    // The raw layout: saved from an owned dataset, mapped back in place, and saved
+    // again from the mapped one
+    DataLoader::saveRaw(rawPath, fromFvecs);
+    VectorDataset mapped = DataLoader::load(rawPath);
+    ok = ok && matches(mapped, Rows, true, "raw round trip");
+    string rawCopyPath = rawPath + ".copy.f32";
+    DataLoader::saveRaw(rawCopyPath, mapped);
+    ok = ok && matches(DataLoader::loadRaw(rawCopyPath), Rows, true, "raw round trip of a mapped dataset");
+    DataLoader::saveRaw(rawCopyPath, fromBvecs);
+    VectorDataset noScalars = DataLoader::loadRaw(rawCopyPath);
+    if (noScalars.size() != (size_t)Rows || noScalars.hasScalars() ||
+        noScalars.row(Rows - 1)[0] != fromBvecs.row(Rows - 1)[0]) {
+        cout << "raw round trip without s values differs" << endl;
+        ok = false;
+    }
+
+    filesystem::resize_file(rawCopyPath, filesystem::file_size(rawCopyPath) - 4);
+    ok = ok && throws([&] { DataLoader::loadRaw(rawCopyPath); }, "truncated raw file");
+    writeFile(rawCopyPath, "NOTVECS and some more bytes after the wrong magic");
+    ok = ok && throws([&] { DataLoader::loadRaw(rawCopyPath); }, "raw file with a wrong magic");
+
+    // The rows straight into the three indexes: two batches each, the second must
+    // start where the first ended
+    size_t half = Rows / 2;
+    const float* second = mapped.row(half);
+    NaiveVectorIndex naive;
+    VectorIndex hybrid(8);
+    ProbabilisticVectorIndex probabilistic(8);
+    int firstIds[] = {
+        naive.insertBatch(mapped.rows(), half, Dim, mapped.scalars()),
+        naive.insertBatch(second, Rows - half, Dim, mapped.scalars() + half),
+        hybrid.insertBatch(mapped.rows(), half, Dim, mapped.scalars()),
+        hybrid.insertBatch(second, Rows - half, Dim, mapped.scalars() + half),
+        probabilistic.insertBatch(mapped.rows(), half, Dim, mapped.scalars()),
+        probabilistic.insertBatch(second, Rows - half, Dim, mapped.scalars() + half)};
+    for (int i = 0; i < 6; i++) {
+        if (firstIds[i] != (i % 2 ? (int)half : 0)) {
+            cout << "insertBatch " << i << " returned " << firstIds[i] << " as its first id" << endl;
+            ok = false;
+        }
+    }
+    vector<float> query(mapped.row(123), mapped.row(123) + Dim);
+    float s123 = mapped.scalars()[123];
+    if (naive.queryWithDistances(query, 1, s123, s123)[0].first != 0.0f ||
+        hybrid.queryWithDistances(query, 1, s123, s123, 200)[0].first != 0.0f ||
+        probabilistic.queryWithDistances(query, 1, s123, s123, 0.01)[0].first != 0.0f) {
+        cout << "A loaded row is not its own nearest neighbour" << endl;
+        ok = false;
+    }
+
+    for (const string& path : {csvPath, fvecsPath, bvecsPath, rawPath, rawCopyPath}) {
+        remove(path.c_str());
+    }
+    if (!ok) {
+        return 1;
+    }
+    cout << "DataLoader reads every format back exactly." << endl;
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Trees with a compile-time Order: random inserts, removeValue, remove(key) and
+// applyBatch on float keys against a std::multimap and against a run-time-order tree
+// of the same order, which runs the same splits and merges and so must agree on every
+// count, select() and rangeQuery(). Then withTreeOrder() must hand each order to the
+// fixed variant compiled for it (or to Order = 0), and a fixed tree must refuse a
+// different run-time order.
+const float Lowest = numeric_limits<float>::lowest(), Highest = numeric_limits<float>::max();
+
+// Every key with its values sorted, so trees and maps compare regardless of the order
+// a batch put equal keys in
+template <typename Tree>
+map<float, vector<int>> contents(const Tree& tree) {
+    map<float, vector<int>> result;
+    tree.forEachInRange(Lowest, Highest, [&](float key, typename Tree::Postings values) {
+        vector<int>& sorted = result[key];
+        sorted.assign(values.begin(), values.end());
+        sort(sorted.begin(), sorted.end());
+        return true;
+    });
+    return result;
+}
+
+map<float, vector<int>> contents(const multimap<float, int>& reference) {
+    map<float, vector<int>> result;
+    for (auto& e : reference) {
+        result[e.first].push_back(e.second);
+    }
+    for (auto& e : result) {
+        sort(e.second.begin(), e.second.end());
+    }
+    return result;
+}
+
+template <typename Fixed>
+bool agree(const Fixed& fixed, const BPlusTree<float, int>& dynamic, const multimap<float, int>& reference,
+           mt19937& rng, const string& what) {
+    if (contents(fixed) != contents(reference) || contents(dynamic) != contents(reference)) {
+        cout << what << ": contents differ from the multimap" << endl;
+        return false;
+    }
+    int size = (int)reference.size();
+    if (fixed.size() != size) {
+        cout << what << ": size " << fixed.size() << ", expected " << size << endl;
+        return false;
+    }
+    for (int q = 0; q < 20; q++) {
+        float a = (float)(rng() % 1100) - 50.0f, b = a + (float)(rng() % 300);
+        int expected = (int)distance(reference.lower_bound(a), reference.upper_bound(b));
+        if (fixed.countInRange(a, b) != expected || fixed.countLess(a) != dynamic.countLess(a) ||
+            fixed.rangeQuery(a, b) != dynamic.rangeQuery(a, b)) {
+            cout << what << ": counts or range query for [" << a << ", " << b << "] differ" << endl;
+            return false;
+        }
+        if (size > 0) {
+            int i = (int)(rng() % size);
+            if (fixed.select(i) != dynamic.select(i)) {
+                cout << what << ": select(" << i << ") differs" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <int Order>
+bool checkOrder() {
+    string what = "Order " + to_string(Order);
+    mt19937 rng(28 + Order);
+    BPlusTree<float, int, Order> fixed;
+    BPlusTree<float, int> dynamic(Order);
+    multimap<float, int> reference;
+    int next = 0;
+
+    // Grow with single inserts and batches, removing now and then
+    for (int round = 0; round < 300; round++) {
+        float key = (float)(rng() % 1000);
+        if (round % 25 == 24) {
+            vector<pair<float, int>> removals, insertions;
+            int batch = round % 100 == 99 ? (int)reference.size() + 50 : 1 + (int)(rng() % 20);
+            for (int i = 0; i < batch; i++) {
+                auto it = reference.lower_bound((float)(rng() % 1000));
+                if (rng() % 3 == 0 && it != reference.end()) {
+                    removals.push_back(*it);
+                } else {
+                    insertions.push_back({(float)(rng() % 1000), next++});
+                }
+            }
+            fixed.applyBatch(removals, insertions);
+            dynamic.applyBatch(removals, insertions);
+            for (auto& r : removals) {
+                auto range = reference.equal_range(r.first);
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (it->second == r.second) {
+                        reference.erase(it);
+                        break;
+                    }
+                }
+            }
+            reference.insert(insertions.begin(), insertions.end());
+        } else if (round % 7 == 6 && !reference.empty()) {
+            auto it = reference.lower_bound(key);
+            if (it == reference.end()) it = reference.begin();
+            pair<float, int> victim = *it;
+            if (!fixed.removeValue(victim.first, victim.second) || !dynamic.removeValue(victim.first, victim.second)) {
+                cout << what << ": removeValue missed a pair" << endl;
+                return false;
+            }
+            reference.erase(it);
+        } else {
+            for (int i = 0; i < 20; i++) {
+                float k = (float)(rng() % 1000);
+                fixed.insert(k, next);
+                dynamic.insert(k, next);
+                reference.insert({k, next++});
+            }
+        }
+        if (round % 50 == 49 && !agree(fixed, dynamic, reference, rng, what + " while growing")) {
+            return false;
+        }
+    }
+
+    // Drain by whole keys
+    while (!reference.empty()) {
+        auto it = reference.lower_bound((float)(rng() % 1000));
+        float key = (it == reference.end() ? reference.begin() : it)->first;
+        fixed.remove(key);
+        dynamic.remove(key);
+        reference.erase(key);
+        if (reference.size() % 200 < 10 && !agree(fixed, dynamic, reference, rng, what + " while draining")) {
+            return false;
+        }
+    }
+    if (!agree(fixed, dynamic, reference, rng, what + " when empty")) {
+        return false;
+    }
+
+    // Bulk-loaded
+    vector<pair<float, int>> entries;
+    for (int i = 0; i < 5000; i++) {
+        entries.push_back({(float)(i / 3), i});
+        reference.insert({(float)(i / 3), i});
+    }
+    BPlusTree<float, int, Order> loaded(Order, entries, 0.7);
+    BPlusTree<float, int> loadedDynamic(Order, entries, 0.7);
+    if (!agree(loaded, loadedDynamic, reference, rng, what + " bulk-loaded")) {
+        return false;
+    }
+
+    cout << what << ": fixed and run-time trees agree with the multimap" << endl;
+    return true;
+}
+
+int main() {
+    bool ok = checkOrder<3>() && checkOrder<4>() && checkOrder<16>() && checkOrder<64>();
+
+    // withTreeOrder: the powers of two from 4 to 256 are compiled in, the rest run at Order = 0
+    for (int order : {3, 4, 5, 8, 16, 32, 64, 100, 128, 256, 512}) {
+        bool isFixed = order >= 4 && order <= 256 && (order & (order - 1)) == 0;
+        int picked = withTreeOrder(order, [&](auto fixed) {
+            BPlusTree<float, int, decltype(fixed)::value> tree(order);
+            for (int i = 0; i < 1000; i++) tree.insert((float)(i % 97), i);
+            return tree.countInRange(10.0f, 19.0f) == 110 ? decltype(fixed)::value : -1;
+        });
+        if (picked != (isFixed ? order : 0)) {
+            cout << "withTreeOrder(" << order << ") ran Order " << picked << endl;
+            ok = false;
+        }
+    }
+
+    bool threw = false;
+    try {
+        BPlusTree<float, int, 16> mismatched(32);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    if (!threw) {
+        cout << "A fixed-order tree accepted a different run-time order" << endl;
+        ok = false;
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    cout << "Fixed-order trees match the multimap." << endl;
+    return 0;
+}
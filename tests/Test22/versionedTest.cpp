@@ -0,0 +1,221 @@
+#include "../../include/BPlusTree4.h"
+#include "../../include/Epoch.h"
+#include <iostream>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+typedef BPlusTree<int, int> Tree;
+
+vector<pair<int, int>> contents(const Tree::Version& version) {
+    vector<pair<int, int>> entries;
+    version.forEachInRange(numeric_limits<int>::min(), numeric_limits<int>::max(),
+                           [&](int key, Tree::Postings values) {
+        for (int v : values) {
+            entries.push_back({key, v});
+        }
+        return true;
+    });
+    return entries;
+}
+
+// Versioned mode: random inserts, removals and batches against a std::multimap, with
+// snapshots held across hundreds of writes (so the nodes they read must survive epoch
+// reclamation) still reading exactly what the multimap held when they were taken.
+// Reader threads then check that every snapshot they take agrees with itself while a
+// writer runs, and switching back to plain mode must keep the contents. One thread
+// holding more snapshots than EpochManager has slots must not block.
+int main() {
+    // Epochs: a pin holds back the oldest pinned epoch until it is released
+    {
+        EpochManager epochs;
+        uint64_t start = epochs.oldestPinned();
+        EpochManager::Guard guard = epochs.pin();
+        epochs.advance();
+        epochs.advance();
+        if (epochs.oldestPinned() != start) {
+            cout << "A pinned epoch was not the oldest pinned one" << endl;
+            return 1;
+        }
+        guard.release();
+        if (epochs.oldestPinned() != start + 2) {
+            cout << "Releasing the only pin did not free every epoch" << endl;
+            return 1;
+        }
+    }
+
+    // More pins than slots, all from one thread: the extra ones overflow instead of
+    // waiting for a slot this thread itself holds
+    {
+        EpochManager epochs;
+        vector<EpochManager::Guard> guards;
+        for (size_t i = 0; i < 3 * EpochManager::Slots; i++) {
+            guards.push_back(epochs.pin());
+            epochs.advance();
+        }
+        uint64_t first = epochs.oldestPinned();
+        // Release the slot pins first, so the oldest left is an overflow pin
+        for (size_t i = 0; i < EpochManager::Slots; i++) {
+            guards[i].release();
+        }
+        if (epochs.oldestPinned() != first + EpochManager::Slots) {
+            cout << "An overflow pin was not the oldest pinned one" << endl;
+            return 1;
+        }
+        guards.clear();
+        if (epochs.oldestPinned() != first + 3 * EpochManager::Slots) {
+            cout << "Releasing the overflow pins did not free every epoch" << endl;
+            return 1;
+        }
+    }
+    {
+        Tree tree(4);
+        tree.setVersioned(true);
+        vector<Tree::Version> snapshots;
+        for (int i = 0; i < 2 * (int)EpochManager::Slots; i++) {
+            tree.insert(i, i);
+            snapshots.push_back(tree.snapshot());
+        }
+        for (int i = 0; i < (int)snapshots.size(); i++) {
+            if (snapshots[i].size() != i + 1 || snapshots[i].countInRange(0, 1000) != i + 1) {
+                cout << "Snapshot " << i << " of one thread's " << snapshots.size() << " changed" << endl;
+                return 1;
+            }
+        }
+    }
+
+    vector<int> orders = {3, 4, 8, 64};
+    for (int order : orders) {
+        mt19937 rng(29 + order);
+        Tree tree(order);
+        tree.setVersioned(true);
+        multimap<int, int> reference;
+        int next = 0;
+
+        vector<pair<Tree::Version, vector<pair<int, int>>>> held;
+        for (int step = 0; step < 20000; step++) {
+            int key = (int)(rng() % 2000);
+            int op = (int)(rng() % 10);
+            if (op < 6) {
+                tree.insert(key, next);
+                reference.insert({key, next++});
+            } else if (op < 7) {
+                tree.remove(key);
+                reference.erase(key);
+            } else if (op < 9) {
+                auto it = reference.find(key);
+                if (it != reference.end()) {
+                    tree.removeValue(it->first, it->second);
+                    reference.erase(it);
+                }
+            } else {
+                vector<pair<int, int>> removals, insertions;
+                for (int i = 0; i < 20; i++) {
+                    auto it = reference.lower_bound((int)(rng() % 2000));
+                    if (it != reference.end() && i % 2) {
+                        removals.push_back(*it);
+                        reference.erase(it);
+                    } else {
+                        insertions.push_back({(int)(rng() % 2000), next++});
+                    }
+                }
+                reference.insert(insertions.begin(), insertions.end());
+                tree.applyBatch(removals, insertions);
+            }
+
+            // Keep a few snapshots alive for a while, then drop the oldest
+            if (step % 500 == 0) {
+                held.push_back({tree.snapshot(), vector<pair<int, int>>(reference.begin(), reference.end())});
+                if (held.size() > 4) {
+                    held.erase(held.begin());
+                }
+            }
+            if (step % 250 == 0) {
+                for (auto& h : held) {
+                    if (contents(h.first) != h.second || h.first.size() != (int)h.second.size()) {
+                        cout << "Order " << order << ": a held snapshot changed by step " << step << endl;
+                        return 1;
+                    }
+                }
+                Tree::Version now = tree.snapshot();
+                if (contents(now) != vector<pair<int, int>>(reference.begin(), reference.end()) ||
+                    tree.size() != (int)reference.size()) {
+                    cout << "Order " << order << ": mismatch with the multimap after " << step << " steps" << endl;
+                    return 1;
+                }
+                for (int x = 0; x < 2000; x += 97) {
+                    int count = (int)distance(reference.lower_bound(x), reference.upper_bound(x + 50));
+                    if (tree.countInRange(x, x + 50) != count || now.countInRange(x, x + 50) != count) {
+                        cout << "Order " << order << ": count mismatch at " << x << endl;
+                        return 1;
+                    }
+                }
+            }
+        }
+        held.clear();
+
+        // Back to plain mode: same contents, and writes work in place again
+        tree.setVersioned(false);
+        tree.insert(1000, next);
+        reference.insert({1000, next++});
+        vector<int> expected;
+        for (auto& e : reference) {
+            expected.push_back(e.second);
+        }
+        if (tree.rangeQuery(0, 2000) != expected) {
+            cout << "Order " << order << ": mismatch after leaving versioned mode" << endl;
+            return 1;
+        }
+        cout << "Order " << order << ": versions match the multimap" << endl;
+    }
+
+    // One writer, several readers, each snapshot checked against itself
+    Tree tree(8);
+    tree.setVersioned(true);
+    atomic<bool> stop(false), wrong(false);
+    atomic<int> snapshots(0);
+    vector<thread> readers;
+    for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&] {
+            while (!stop.load()) {
+                Tree::Version version = tree.snapshot();
+                int size = version.size();
+                if ((int)version.rangeQuery(numeric_limits<int>::min(), numeric_limits<int>::max()).size() != size ||
+                    version.countInRange(numeric_limits<int>::min(), numeric_limits<int>::max()) != size ||
+                    (int)contents(version).size() != size) {
+                    wrong = true;
+                }
+                // Values are stored under key value % 1000
+                for (auto& e : contents(version)) {
+                    if (e.second % 1000 != e.first) {
+                        wrong = true;
+                    }
+                }
+                snapshots++;
+            }
+        });
+    }
+    mt19937 rng(290);
+    for (int i = 0; i < 40000; i++) {
+        tree.insert(i % 1000, i);
+        if (i % 3 == 0) {
+            tree.remove((int)(rng() % 1000));
+        }
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    if (wrong) {
+        cout << "A reader saw a snapshot that disagrees with itself" << endl;
+        return 1;
+    }
+    cout << snapshots.load() << " snapshots read while writing were consistent" << endl;
+
+    cout << "Versioned trees match the multimap." << endl;
+    return 0;
+}
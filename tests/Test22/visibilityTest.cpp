@@ -0,0 +1,127 @@
+#include "../../include/vectorIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// The visibility watermark: queries run while threads insert and batch-insert, in the
+// insertion-order and the clustered layout (reclustered in the background as rows
+// arrive). Every row is (s, s, ..., s), so a hit's distance to the origin gives its s
+// back and readers can check each hit against the range they asked for. Once the
+// writers are done, counts and nearest hits must match the exact answer.
+const int Dim = 4;
+
+int main() {
+    const char* layouts[] = {"insertion order", "clustered"};
+    for (int layout = 0; layout < 2; layout++) {
+        VectorIndex index(16);
+        vector<float> initial;
+        mt19937 rng(29);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int i = 0; i < 2000; i++) {
+            initial.push_back(unit(rng));
+        }
+        vector<vector<float>> rows;
+        for (float s : initial) {
+            rows.push_back(vector<float>(Dim, s));
+        }
+        index.insertBatch(rows, initial);
+        if (layout == 1) {
+            index.setLayout(VectorIndex::Layout::ClusteredByS);
+            index.setClusterThreshold(0.05);
+        }
+
+        atomic<bool> stop(false), wrong(false);
+        atomic<int> queries(0);
+        vector<thread> readers;
+        for (int r = 0; r < 3; r++) {
+            readers.emplace_back([&, r] {
+                mt19937 local(300 + r);
+                uniform_real_distribution<float> u(0.0f, 1.0f);
+                const vector<float> origin(Dim, 0.0f);
+                while (!stop.load()) {
+                    float Smin = u(local) * 0.9f, Smax = Smin + 0.01f + u(local) * 0.1f;
+                    float last = 0.0f;
+                    for (auto& hit : index.queryWithDistances(origin, 10, Smin, Smax, 200)) {
+                        float s = sqrt(hit.first / Dim);
+                        if (s < Smin - 1e-4f || s > Smax + 1e-4f || hit.first < last) {
+                            wrong = true;
+                        }
+                        last = hit.first;
+                    }
+                    queries++;
+                    // Writers wait for the index exclusively now and then; let them in
+                    this_thread::sleep_for(chrono::microseconds(200));
+                }
+            });
+        }
+
+        vector<vector<float>> written(2);
+        vector<thread> writers;
+        for (int w = 0; w < 2; w++) {
+            writers.emplace_back([&, w] {
+                mt19937 local(400 + w);
+                uniform_real_distribution<float> u(0.0f, 1.0f);
+                for (int i = 0; i < 1500; i++) {
+                    float s = u(local);
+                    index.insert(vector<float>(Dim, s), s);
+                    written[w].push_back(s);
+                    if (i % 300 == 0) {
+                        vector<float> batch;
+                        for (int j = 0; j < 100; j++) {
+                            batch.push_back(u(local));
+                        }
+                        vector<vector<float>> batchRows;
+                        for (float b : batch) {
+                            batchRows.push_back(vector<float>(Dim, b));
+                        }
+                        index.insertBatch(batchRows, batch);
+                        written[w].insert(written[w].end(), batch.begin(), batch.end());
+                    }
+                }
+            });
+        }
+        for (auto& t : writers) {
+            t.join();
+        }
+        stop = true;
+        for (auto& t : readers) {
+            t.join();
+        }
+        if (wrong) {
+            cout << layouts[layout] << ": a query returned a row outside its range" << endl;
+            return 1;
+        }
+
+        vector<float> all = initial;
+        for (auto& w : written) {
+            all.insert(all.end(), w.begin(), w.end());
+        }
+        sort(all.begin(), all.end());
+        for (float Smin = 0.0f; Smin < 0.95f; Smin += 0.05f) {
+            float Smax = Smin + 0.02f;
+            auto first = lower_bound(all.begin(), all.end(), Smin);
+            auto end = upper_bound(all.begin(), all.end(), Smax);
+            if (index.countInRange(Smin, Smax) != (int)(end - first)) {
+                cout << layouts[layout] << ": count mismatch for [" << Smin << ", " << Smax << "]" << endl;
+                return 1;
+            }
+            // The nearest row to the origin is the one with the smallest s in range
+            auto hits = index.queryWithDistances(vector<float>(Dim, 0.0f), 1, Smin, Smax);
+            if (first != end && (hits.empty() || fabs(sqrt(hits[0].first / Dim) - *first) > 1e-4f)) {
+                cout << layouts[layout] << ": nearest hit mismatch for [" << Smin << ", " << Smax << "]" << endl;
+                return 1;
+            }
+        }
+        cout << layouts[layout] << ": " << queries.load() << " queries during the writes saw only rows in range" << endl;
+    }
+
+    cout << "Concurrent queries match the exact answer." << endl;
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "../../include/ShardedVectorIndex.h"
+#include "../../include/vectorIndex.h"
+#include "../../include/probabilisticVectorIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// The sharded front end: over four local shards of either index type, hashed or placed
+// by s range, every global id must name one inserted row, counts must equal an exact
+// count, and the merged hits must agree with an exact scan about as well as one
+// unsharded index over the same rows does.
+const int Dim = 16, Rows = 4000, K = 10;
+
+vector<pair<float, int>> exactNearest(const vector<vector<float>>& vecs, const vector<float>& s,
+                                      const vector<float>& q, int k, float Smin, float Smax) {
+    vector<pair<float, int>> all;
+    for (size_t i = 0; i < vecs.size(); i++) {
+        if (s[i] < Smin || s[i] > Smax) continue;
+        float d = 0;
+        for (int j = 0; j < Dim; j++) {
+            d += (q[j] - vecs[i][j]) * (q[j] - vecs[i][j]);
+        }
+        all.push_back({d, (int)i});
+    }
+    sort(all.begin(), all.end());
+    all.resize(min(all.size(), (size_t)k));
+    return all;
+}
+
+template <typename Index>
+bool run(const char* name, bool byRange) {
+    mt19937 rng(30);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    vector<vector<float>> vecs(Rows, vector<float>(Dim));
+    vector<float> s(Rows);
+    for (int i = 0; i < Rows; i++) {
+        for (float& x : vecs[i]) x = unit(rng);
+        s[i] = unit(rng);
+    }
+
+    unique_ptr<ShardTransport> transport(new LocalTransport<Index>(4, 16));
+    unique_ptr<ShardedVectorIndex> sharded(byRange ? new ShardedVectorIndex(move(transport), {0.25f, 0.5f, 0.75f})
+                                                   : new ShardedVectorIndex(move(transport)));
+    vector<int> ids = sharded->insertBatch(vecs, s);
+    for (int i = 0; i < 100; i++) {
+        vector<float> v(Dim);
+        for (float& x : v) x = unit(rng);
+        vecs.push_back(v);
+        s.push_back(unit(rng));
+        ids.push_back(sharded->insert(v, s.back()));
+    }
+    Index unsharded(16);
+    unsharded.insertBatch(vecs, s);
+
+    // Global id -> row
+    map<int, int> rowOf;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!rowOf.emplace(ids[i], (int)i).second) {
+            cout << name << ": global id " << ids[i] << " given twice" << endl;
+            return false;
+        }
+    }
+
+    int shardedHits = 0, unshardedHits = 0, total = 0;
+    for (int t = 0; t < 100; t++) {
+        vector<float> q(Dim);
+        for (float& x : q) x = unit(rng);
+        float Smin = unit(rng) * 0.8f, Smax = Smin + 0.01f + unit(rng) * 0.4f;
+        int count = (int)count_if(s.begin(), s.end(), [&](float x) { return x >= Smin && x <= Smax; });
+        if (sharded->countInRange(Smin, Smax) != count) {
+            cout << name << ": count mismatch for [" << Smin << ", " << Smax << "]" << endl;
+            return false;
+        }
+
+        vector<pair<float, int>> exact = exactNearest(vecs, s, q, K, Smin, Smax);
+        auto found = sharded->queryWithDistances(q, K, Smin, Smax);
+        if (found.size() != exact.size()) {
+            cout << name << ": " << found.size() << " merged hits, expected " << exact.size() << endl;
+            return false;
+        }
+        vector<int> shardedRows;
+        for (size_t i = 0; i < found.size(); i++) {
+            auto it = rowOf.find(found[i].second);
+            if (it == rowOf.end() || s[it->second] < Smin || s[it->second] > Smax ||
+                (i > 0 && found[i].first < found[i - 1].first)) {
+                cout << name << ": merged hit " << found[i].second << " is unknown, out of range or out of order" << endl;
+                return false;
+            }
+            shardedRows.push_back(it->second);
+        }
+        vector<int> unshardedRows = unsharded.query(q, K, Smin, Smax);
+        for (auto& e : exact) {
+            shardedHits += find(shardedRows.begin(), shardedRows.end(), e.second) != shardedRows.end();
+            unshardedHits += find(unshardedRows.begin(), unshardedRows.end(), e.second) != unshardedRows.end();
+        }
+        total += (int)exact.size();
+    }
+    if (!sharded->query(vecs[0], K, 0.9f, 0.1f).empty()) {
+        cout << name << ": an empty range returned hits" << endl;
+        return false;
+    }
+
+    double shardedRecall = total ? (double)shardedHits / total : 1.0;
+    double unshardedRecall = total ? (double)unshardedHits / total : 1.0;
+    cout << name << (byRange ? ", placed by s" : ", hashed") << ": recall@" << K << " sharded " << shardedRecall
+         << ", unsharded " << unshardedRecall << endl;
+    // Each shard searches a quarter of the rows, so the merge should do no worse
+    if (shardedRecall < 0.9 || shardedRecall < unshardedRecall - 0.02) {
+        cout << name << ": sharded recall too low" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    if (!run<VectorIndex>("VectorIndex", false) || !run<VectorIndex>("VectorIndex", true) ||
+        !run<ProbabilisticVectorIndex>("ProbabilisticVectorIndex", false) ||
+        !run<ProbabilisticVectorIndex>("ProbabilisticVectorIndex", true)) {
+        return 1;
+    }
+
+    cout << "Sharded indexes match the exact scan." << endl;
+    return 0;
+}
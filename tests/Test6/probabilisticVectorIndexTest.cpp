@@ -8,55 +8,28 @@
 
 // Include your vector index and B+ tree headers
 #include "../../hnswlib/hnswlib/hnswlib.h"
-#include "../../include/probabilisticvectorindex.h" // The VectorIndex class as discussed earlier
+#include "../../include/probabilisticVectorIndex.h" // The VectorIndex class as discussed earlier
+#include "../../include/DataLoader.h"
 
 int main() {
-    // Open data.csv
-    std::ifstream dataFile("../_Data/_data3.csv");
-    if (!dataFile.is_open()) {
-        std::cerr << "Error: cannot open data.csv\n";
+    // Load data.csv (header, then v1,...,vD,s per line) into flat buffers
+    VectorDataset data;
+    try {
+        data = DataLoader::loadCsv("../_Data/_data3.csv");
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << "\n";
         return 1;
     }
-
-    std::string line;
-    // Read the header of data.csv
-    if (!std::getline(dataFile, line)) {
+    if (data.size() == 0) {
         std::cerr << "Error: data.csv is empty\n";
         return 1;
     }
-    // Count columns to deduce D
-    {
-        std::stringstream ss(line);
-        std::string col;
-        std::vector<std::string> headers;
-        while (std::getline(ss, col, ',')) {
-            headers.push_back(col);
-        }
-        // last column is 's', so dimension D = headers.size() - 1
-        int D = (int)headers.size() - 1;
 
+    std::string line;
+    std::string col;
+    {
         ProbabilisticVectorIndex index(4); // B+ tree order = 4
-
-        // Read data vectors
-        while (std::getline(dataFile, line)) {
-            std::stringstream dataSS(line);
-            std::vector<float> vec(D);
-            for (int i = 0; i < D; i++) {
-                if (!std::getline(dataSS, col, ',')) {
-                    std::cerr << "Error reading vector value\n";
-                    return 1;
-                }
-                vec[i] = std::stof(col);
-            }
-            if (!std::getline(dataSS, col, ',')) {
-                std::cerr << "Error reading s value\n";
-                return 1;
-            }
-            float s = std::stof(col);
-
-            index.insert(vec, s);
-        }
-        dataFile.close();
+        index.insertBatch(data.rows(), data.size(), data.dimension(), data.scalars());
 
         std::cout << "Data vectors loaded and index built! \n";
 
@@ -0,0 +1,67 @@
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+int main() {
+    ifstream infile("../_Data/key_value_pairs.txt");
+    if (!infile) {
+        cerr << "Failed to open key_value_pairs.txt" << endl;
+        return 1;
+    }
+
+    vector<pair<int, string>> entries;
+    map<int, vector<string>> mp;
+    int key; string value;
+    while (infile >> key >> value) {
+        entries.push_back({key, value});
+        mp[key].push_back(value);
+    }
+    infile.close();
+    cout << "Loaded " << entries.size() << " key-value pairs." << endl;
+
+    vector<int> orders = {3, 4, 10, 50, 1000};
+    for (int order : orders) {
+        // One insert per pair
+        auto start = chrono::high_resolution_clock::now();
+        BPlusTree<int, string> inserted(order);
+        for (auto& e : entries) {
+            inserted.insert(e.first, e.second);
+        }
+        chrono::duration<double> insertTime = chrono::high_resolution_clock::now() - start;
+
+        // Bottom-up bulk load
+        start = chrono::high_resolution_clock::now();
+        BPlusTree<int, string> loaded(order, entries);
+        chrono::duration<double> loadTime = chrono::high_resolution_clock::now() - start;
+
+        cout << "Order " << order << ": insert " << insertTime.count() << "s, bulk load "
+             << loadTime.count() << "s" << endl;
+
+        // Both trees must hold exactly the values of the map, in insertion order
+        for (auto it = mp.begin(); it != mp.end(); it++) {
+            auto vals = loaded.searchAll(it->first);
+            if (vector<string>(vals.begin(), vals.end()) != it->second) {
+                cout << "Mismatch found for key: " << it->first << endl;
+                return 1;
+            }
+        }
+        int lo = mp.begin()->first, hi = mp.rbegin()->first;
+        for (int a = lo; a <= hi; a += (hi - lo) / 100 + 1) {
+            int b = a + (hi - lo) / 10;
+            if (loaded.countInRange(a, b) != inserted.countInRange(a, b) ||
+                loaded.rangeQuery(a, b) != inserted.rangeQuery(a, b)) {
+                cout << "Range mismatch for [" << a << ", " << b << "]" << endl;
+                return 1;
+            }
+        }
+    }
+
+    cout << "Bulk-loaded trees match the inserted trees." << endl;
+    return 0;
+}
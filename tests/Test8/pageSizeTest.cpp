@@ -0,0 +1,92 @@
+#include "../../include/PagedBPlusTree.h"
+#include "../../include/BPlusTree4.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Page-size counterpart of the order sweep in Test4: each page size is built on
+// disk with a small buffer pool, then checked against the in-memory tree. The page
+// files go to the system temp directory and are deleted once checked.
+int main() {
+    ifstream infile("../_Data/key_value_pairs.txt");
+    if (!infile) {
+        cerr << "Failed to open key_value_pairs.txt" << endl;
+        return 1;
+    }
+
+    vector<int> keys;
+    int key; string value;
+    while (infile >> key >> value) {
+        keys.push_back(key);
+    }
+    infile.close();
+    cout << "Loaded " << keys.size() << " keys." << endl;
+    if (keys.empty()) {
+        return 1;
+    }
+
+    // Values are line numbers: paged trees store trivially copyable values only
+    BPlusTree<int, int> reference(64);
+    for (int i = 0; i < (int)keys.size(); i++) {
+        reference.insert(keys[i], i);
+    }
+    int lo = keys[0], hi = keys[0];
+    for (int k : keys) {
+        lo = min(lo, k);
+        hi = max(hi, k);
+    }
+
+    ofstream outputFile("../_Output/paged_page_size_times.txt");
+    const size_t budget = 1 << 20; // 1 MiB of cached pages
+    vector<size_t> pageSizes = {512, 1024, 2048, 4096, 8192, 16384, 65536};
+    for (size_t pageSize : pageSizes) {
+        string path = (filesystem::temp_directory_path() / ("paged_tree_" + to_string(pageSize) + ".db")).string();
+        remove(path.c_str());
+
+        // The tree closes its file at the end of the block, before the file is deleted
+        bool matches = true;
+        {
+            auto start = chrono::high_resolution_clock::now();
+            PagedBPlusTree<int, int> tree(path, pageSize, budget);
+            for (int i = 0; i < (int)keys.size(); i++) {
+                tree.insert(keys[i], i);
+            }
+            tree.flush();
+            chrono::duration<double> insertTime = chrono::high_resolution_clock::now() - start;
+
+            start = chrono::high_resolution_clock::now();
+            int queries = 0;
+            for (int a = lo; a <= hi && matches; a += (hi - lo) / 1000 + 1) {
+                int b = a + (hi - lo) / 100;
+                if (tree.countInRange(a, b) != reference.countInRange(a, b) ||
+                    tree.rangeQuery(a, b) != reference.rangeQuery(a, b)) {
+                    cout << "Range mismatch for [" << a << ", " << b << "] with page size " << pageSize << endl;
+                    matches = false;
+                }
+                queries++;
+            }
+            chrono::duration<double> queryTime = chrono::high_resolution_clock::now() - start;
+
+            const BufferPool& pool = tree.getBufferPool();
+            cout << "Page size " << pageSize << " (leaf " << tree.getLeafCapacity() << ", inner "
+                 << tree.getInnerCapacity() << "): insert " << insertTime.count() << "s, "
+                 << queries << " range queries " << queryTime.count() << "s, pool hits "
+                 << pool.hitCount() << ", misses " << pool.missCount() << endl;
+            outputFile << "Paged B+Tree (Page " << pageSize << ") Insert: " << insertTime.count()
+                       << "s, Queries: " << queryTime.count() << "s\n";
+        }
+        remove(path.c_str());
+        if (!matches) {
+            return 1;
+        }
+    }
+
+    cout << "Paged trees match the in-memory tree." << endl;
+    return 0;
+}
@@ -0,0 +1,568 @@
+// Unified benchmark: B+ tree insert throughput and range latency per order, and
+// hybrid query QPS, latency percentiles and recall@k for every vector index, with
+// NaiveVectorIndex as the ground truth. Results are written as CSV or JSON rows
+// so that runs can be compared (see printUsage for the options).
+//
+//   g++ -std=c++17 -O2 -o benchmark tests/Test9/benchmark.cpp -I include -lpthread
+//   cd tests/Test9 && ../../benchmark --threads=1,4 --format=json
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "../../hnswlib/hnswlib/hnswlib.h"
+#include "../../include/BPlusTree4.h"
+#include "../../include/naiveVectorIndex.h"
+#include "../../include/vectorIndex.h"
+#include "../../include/probabilisticVectorIndex.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string data = "../_Data/_data3.csv"; // v1..vD,s rows; ignored when synthetic > 0
+    int synthetic = 0;                        // rows of uniform random data instead of a file
+    int dim = 32;                             // dimension of the synthetic rows
+    int queries = 200;
+    std::vector<int> orders = {4, 16, 64, 256};
+    std::vector<double> selectivities = {0.001, 0.01, 0.1, 0.5};
+    std::vector<int> ks = {1, 10, 100};
+    std::vector<int> Os = {100, 1000};
+    std::vector<double> alphas = {0.01, 0.1};
+    std::vector<int> threads = {1, 4};
+    int indexOrder = 16; // tree order of the vector indexes
+    bool tree = true;
+    bool hybrid = true;
+    std::string format = "csv";
+    std::string out = "../_Output/benchmark.csv";
+    unsigned seed = 42;
+};
+
+struct Dataset {
+    std::string name;
+    int dim = 0;
+    std::vector<std::vector<float>> vectors;
+    std::vector<float> s;
+};
+
+// One queried range per query of a sweep point
+struct Window {
+    float Smin;
+    float Smax;
+};
+
+// One row of output. Fields that do not apply to an operation are left empty.
+struct Result {
+    std::string suite;     // tree or hybrid
+    std::string index;     // BPlusTree, NaiveVectorIndex, VectorIndex, ProbabilisticVectorIndex
+    std::string operation; // insert, bulkLoad, build, countInRange, rangeQuery, query
+    int order = 0;
+    int threads = 1;
+    int k = 0;
+    double selectivity = -1.0;
+    std::string param;     // O or alpha
+    double paramValue = 0.0;
+    size_t operations = 0;
+    double seconds = 0.0;
+    double throughput = 0.0; // operations per second (QPS for queries)
+    double meanUs = -1.0;
+    double p50Us = -1.0;
+    double p95Us = -1.0;
+    double p99Us = -1.0;
+    double recall = -1.0;
+};
+
+static double secondsBetween(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+// Operations per second, 0 when the clock did not advance
+static double rate(size_t operations, double seconds) {
+    return seconds > 0.0 ? operations / seconds : 0.0;
+}
+
+template <typename T>
+static std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        std::stringstream is(item);
+        T value;
+        if (!(is >> value)) {
+            throw std::invalid_argument("Bad list value: " + item);
+        }
+        values.push_back(value);
+    }
+    return values;
+}
+
+static void printUsage() {
+    std::cout <<
+        "Options (lists are comma separated):\n"
+        "  --data=PATH            CSV with columns v1..vD,s (default ../_Data/_data3.csv)\n"
+        "  --synthetic=N          use N uniform random rows instead of --data\n"
+        "  --dim=D                dimension of the synthetic rows (default 32)\n"
+        "  --queries=Q            queries per sweep point (default 200)\n"
+        "  --orders=LIST          tree orders of the tree suite (default 4,16,64,256)\n"
+        "  --index-order=N        tree order of the vector indexes (default 16)\n"
+        "  --selectivity=LIST     fractions of the rows inside each range (default 0.001,0.01,0.1,0.5)\n"
+        "  --k=LIST               neighbours per query (default 1,10,100)\n"
+        "  --O=LIST               candidates fetched by VectorIndex (default 100,1000)\n"
+        "  --alpha=LIST           miss probability of ProbabilisticVectorIndex (default 0.01,0.1)\n"
+        "  --threads=LIST         concurrent query threads (default 1,4)\n"
+        "  --suite=tree|hybrid|all\n"
+        "  --format=csv|json\n"
+        "  --out=PATH             output file, - for stdout (default ../_Output/benchmark.csv)\n"
+        "  --seed=N\n";
+}
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    bool outGiven = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            std::exit(0);
+        }
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            throw std::invalid_argument("Expected --name=value, got " + arg);
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "data") options.data = value;
+        else if (name == "synthetic") options.synthetic = std::stoi(value);
+        else if (name == "dim") options.dim = std::stoi(value);
+        else if (name == "queries") options.queries = std::stoi(value);
+        else if (name == "orders") options.orders = parseList<int>(value);
+        else if (name == "index-order") options.indexOrder = std::stoi(value);
+        else if (name == "selectivity") options.selectivities = parseList<double>(value);
+        else if (name == "k") options.ks = parseList<int>(value);
+        else if (name == "O") options.Os = parseList<int>(value);
+        else if (name == "alpha") options.alphas = parseList<double>(value);
+        else if (name == "threads") options.threads = parseList<int>(value);
+        else if (name == "format") options.format = value;
+        else if (name == "out") { options.out = value; outGiven = true; }
+        else if (name == "seed") options.seed = (unsigned)std::stoul(value);
+        else if (name == "suite") {
+            options.tree = value == "tree" || value == "all";
+            options.hybrid = value == "hybrid" || value == "all";
+            if (!options.tree && !options.hybrid) {
+                throw std::invalid_argument("Unknown suite: " + value);
+            }
+        } else {
+            throw std::invalid_argument("Unknown option --" + name);
+        }
+    }
+    if (options.format != "csv" && options.format != "json") {
+        throw std::invalid_argument("Unknown format: " + options.format);
+    }
+    if (!outGiven && options.format == "json") {
+        options.out = "../_Output/benchmark.json";
+    }
+    if (options.queries <= 0) {
+        throw std::invalid_argument("--queries must be positive");
+    }
+    return options;
+}
+
+static Dataset loadCsv(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    Dataset data;
+    data.name = path;
+    std::string line;
+    if (!std::getline(file, line)) {
+        throw std::runtime_error(path + " is empty");
+    }
+    // The last column is s
+    data.dim = (int)std::count(line.begin(), line.end(), ',');
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        std::stringstream ss(line);
+        std::string col;
+        std::vector<float> vec(data.dim);
+        for (int i = 0; i < data.dim; i++) {
+            if (!std::getline(ss, col, ',')) {
+                throw std::runtime_error("Short row in " + path);
+            }
+            vec[i] = std::stof(col);
+        }
+        if (!std::getline(ss, col, ',')) {
+            throw std::runtime_error("Missing s value in " + path);
+        }
+        data.vectors.push_back(std::move(vec));
+        data.s.push_back(std::stof(col));
+    }
+    return data;
+}
+
+static Dataset makeSynthetic(int n, int dim, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    Dataset data;
+    data.name = "synthetic";
+    data.dim = dim;
+    data.vectors.resize(n, std::vector<float>(dim));
+    data.s.resize(n);
+    for (int i = 0; i < n; i++) {
+        for (float& x : data.vectors[i]) x = uniform(rng);
+        data.s[i] = 100.0f * uniform(rng);
+    }
+    return data;
+}
+
+// Query vectors drawn uniformly from the bounding box of the data
+static std::vector<std::vector<float>> makeQueries(const Dataset& data, int count, std::mt19937& rng) {
+    std::vector<float> lo(data.dim, std::numeric_limits<float>::infinity());
+    std::vector<float> hi(data.dim, -std::numeric_limits<float>::infinity());
+    for (const auto& vec : data.vectors) {
+        for (int j = 0; j < data.dim; j++) {
+            lo[j] = std::min(lo[j], vec[j]);
+            hi[j] = std::max(hi[j], vec[j]);
+        }
+    }
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<std::vector<float>> queries(count, std::vector<float>(data.dim));
+    for (auto& q : queries) {
+        for (int j = 0; j < data.dim; j++) q[j] = lo[j] + (hi[j] - lo[j]) * uniform(rng);
+    }
+    return queries;
+}
+
+// Ranges holding about selectivity × n rows each, at random positions of the s axis
+static std::vector<Window> makeWindows(const std::vector<float>& sortedS, double selectivity, int count,
+                                       std::mt19937& rng) {
+    size_t n = sortedS.size();
+    size_t width = std::min(n, std::max<size_t>(1, (size_t)std::llround(selectivity * n)));
+    std::uniform_int_distribution<size_t> start(0, n - width);
+    std::vector<Window> windows(count);
+    for (auto& w : windows) {
+        size_t p = start(rng);
+        w.Smin = sortedS[p];
+        w.Smax = sortedS[p + width - 1];
+    }
+    return windows;
+}
+
+/**
+ * Runs op(i) for i in [0, count) on `threads` threads, each taking the next query
+ * from a shared counter, and fills the result's timing fields from the per-query
+ * latencies and the wall time.
+ */
+static void timeQueries(int count, int threads, const std::function<void(int)>& op, Result& result) {
+    std::vector<double> latencies(count);
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            auto start = Clock::now();
+            op(i);
+            latencies[i] = secondsBetween(start, Clock::now()) * 1e6;
+        }
+    };
+    auto start = Clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+    result.seconds = secondsBetween(start, Clock::now());
+
+    result.threads = threads;
+    result.operations = count;
+    result.throughput = rate(count, result.seconds);
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for (double us : latencies) sum += us;
+    result.meanUs = sum / count;
+    // Nearest-rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p * count);
+        return latencies[std::min<size_t>(count - 1, rank > 0 ? rank - 1 : 0)];
+    };
+    result.p50Us = percentile(0.50);
+    result.p95Us = percentile(0.95);
+    result.p99Us = percentile(0.99);
+}
+
+// Mean over the queries of |found ∩ truth| / min(k, |truth|); queries with no match count as 1
+static double recallAtK(const std::vector<std::vector<int>>& found, const std::vector<std::vector<int>>& truth, int k) {
+    double sum = 0.0;
+    for (size_t i = 0; i < truth.size(); i++) {
+        size_t expected = std::min<size_t>(k, truth[i].size());
+        if (expected == 0) {
+            sum += 1.0;
+            continue;
+        }
+        std::unordered_set<int> relevant(truth[i].begin(), truth[i].begin() + expected);
+        size_t hits = 0;
+        for (int id : found[i]) hits += relevant.count(id);
+        sum += (double)std::min(hits, expected) / expected;
+    }
+    return truth.empty() ? 1.0 : sum / truth.size();
+}
+
+static void runTreeSuite(const Options& options, const Dataset& data, const std::vector<float>& sortedS,
+                         std::mt19937& rng, std::vector<Result>& results) {
+    const int n = (int)data.s.size();
+    std::vector<std::pair<float, int>> entries(n);
+    for (int i = 0; i < n; i++) entries[i] = {data.s[i], i};
+    std::vector<std::pair<float, int>> sortedEntries(entries);
+    std::sort(sortedEntries.begin(), sortedEntries.end());
+
+    for (int order : options.orders) {
+        // Orders compiled in run on the fixed-order tree, see withTreeOrder()
+        withTreeOrder(order, [&](auto fixed) {
+            using Tree = BPlusTree<float, int, decltype(fixed)::value>;
+            Tree tree(order);
+            Result insert;
+            insert.suite = "tree";
+            insert.index = "BPlusTree";
+            insert.operation = "insert";
+            insert.order = order;
+            auto start = Clock::now();
+            for (const auto& e : entries) tree.insert(e.first, e.second);
+            insert.seconds = secondsBetween(start, Clock::now());
+            insert.operations = n;
+            insert.throughput = rate(n, insert.seconds);
+            results.push_back(insert);
+
+            Result bulk = insert;
+            bulk.operation = "bulkLoad";
+            Tree loaded(order);
+            start = Clock::now();
+            loaded.bulkLoad(sortedEntries);
+            bulk.seconds = secondsBetween(start, Clock::now());
+            bulk.throughput = rate(n, bulk.seconds);
+            results.push_back(bulk);
+            std::cout << "order " << order << ": " << insert.throughput << " inserts/s, "
+                      << bulk.throughput << " bulk-loaded rows/s\n";
+
+            tree.setConcurrent(true);
+            for (double selectivity : options.selectivities) {
+                std::vector<Window> windows = makeWindows(sortedS, selectivity, options.queries, rng);
+                for (int threads : options.threads) {
+                    Result count = insert;
+                    count.operation = "countInRange";
+                    count.selectivity = selectivity;
+                    std::atomic<long long> sink(0);
+                    timeQueries(options.queries, threads, [&](int i) {
+                        sink += tree.countInRange(windows[i].Smin, windows[i].Smax);
+                    }, count);
+                    results.push_back(count);
+
+                    Result range = count;
+                    range.operation = "rangeQuery";
+                    timeQueries(options.queries, threads, [&](int i) {
+                        sink += (long long)tree.rangeQuery(windows[i].Smin, windows[i].Smax).size();
+                    }, range);
+                    results.push_back(range);
+                }
+            }
+        });
+    }
+}
+
+template <typename Index>
+static double timeBuild(Index& index, const Dataset& data) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < data.vectors.size(); i++) index.insert(data.vectors[i], data.s[i]);
+    return secondsBetween(start, Clock::now());
+}
+
+static void runHybridSuite(const Options& options, const Dataset& data, const std::vector<float>& sortedS,
+                           std::mt19937& rng, std::vector<Result>& results) {
+    const size_t n = data.vectors.size();
+    NaiveVectorIndex naive;
+    VectorIndex vectorIndex(options.indexOrder);
+    ProbabilisticVectorIndex probabilistic(options.indexOrder);
+
+    Result build;
+    build.suite = "hybrid";
+    build.operation = "build";
+    build.order = options.indexOrder;
+    build.operations = n;
+    std::pair<const char*, std::function<double()>> builders[] = {
+        {"NaiveVectorIndex", [&]() { return timeBuild(naive, data); }},
+        {"VectorIndex", [&]() { return timeBuild(vectorIndex, data); }},
+        {"ProbabilisticVectorIndex", [&]() { return timeBuild(probabilistic, data); }},
+    };
+    for (auto& builder : builders) {
+        build.index = builder.first;
+        build.seconds = builder.second();
+        build.throughput = rate(n, build.seconds);
+        results.push_back(build);
+        std::cout << builder.first << " built in " << build.seconds << "s\n";
+    }
+
+    std::vector<std::vector<float>> queries = makeQueries(data, options.queries, rng);
+    const int maxK = *std::max_element(options.ks.begin(), options.ks.end());
+    for (double selectivity : options.selectivities) {
+        std::vector<Window> windows = makeWindows(sortedS, selectivity, options.queries, rng);
+
+        // Exact answers at the largest k; the top k of those are the answers at k
+        std::vector<std::vector<int>> truthAtMax(options.queries);
+        for (int i = 0; i < options.queries; i++) {
+            truthAtMax[i] = naive.query(queries[i], maxK, windows[i].Smin, windows[i].Smax);
+        }
+
+        for (int k : options.ks) {
+            std::vector<std::vector<int>> truth(options.queries);
+            for (int i = 0; i < options.queries; i++) {
+                truth[i].assign(truthAtMax[i].begin(), truthAtMax[i].begin() + std::min<size_t>(k, truthAtMax[i].size()));
+            }
+            for (int threads : options.threads) {
+                Result base;
+                base.suite = "hybrid";
+                base.operation = "query";
+                base.order = options.indexOrder;
+                base.k = k;
+                base.selectivity = selectivity;
+                std::vector<std::vector<int>> found(options.queries);
+
+                Result exact = base;
+                exact.index = "NaiveVectorIndex";
+                timeQueries(options.queries, threads, [&](int i) {
+                    found[i] = naive.query(queries[i], k, windows[i].Smin, windows[i].Smax);
+                }, exact);
+                exact.recall = recallAtK(found, truth, k);
+                results.push_back(exact);
+
+                for (int O : options.Os) {
+                    Result r = base;
+                    r.index = "VectorIndex";
+                    r.param = "O";
+                    r.paramValue = O;
+                    timeQueries(options.queries, threads, [&](int i) {
+                        found[i] = vectorIndex.query(queries[i], k, windows[i].Smin, windows[i].Smax, O);
+                    }, r);
+                    r.recall = recallAtK(found, truth, k);
+                    results.push_back(r);
+                }
+
+                for (double alpha : options.alphas) {
+                    Result r = base;
+                    r.index = "ProbabilisticVectorIndex";
+                    r.param = "alpha";
+                    r.paramValue = alpha;
+                    timeQueries(options.queries, threads, [&](int i) {
+                        found[i] = probabilistic.query(queries[i], k, windows[i].Smin, windows[i].Smax, alpha);
+                    }, r);
+                    r.recall = recallAtK(found, truth, k);
+                    results.push_back(r);
+                }
+            }
+            std::cout << "selectivity " << selectivity << ", k " << k << " done\n";
+        }
+    }
+}
+
+// Empty for the fields marked as not applicable
+static std::string number(double value, bool applies = true) {
+    if (!applies) return "";
+    std::ostringstream os;
+    os.precision(6);
+    os << value;
+    return os.str();
+}
+
+static void writeCsv(std::ostream& out, const Dataset& data, const std::vector<Result>& results) {
+    out << "suite,index,operation,dataset,n,dim,order,threads,k,selectivity,param,param_value,"
+           "operations,seconds,throughput,mean_us,p50_us,p95_us,p99_us,recall\n";
+    for (const Result& r : results) {
+        out << r.suite << ',' << r.index << ',' << r.operation << ',' << data.name << ','
+            << data.s.size() << ',' << data.dim << ',' << r.order << ',' << r.threads << ','
+            << (r.k > 0 ? std::to_string(r.k) : "") << ',' << number(r.selectivity, r.selectivity >= 0) << ','
+            << r.param << ',' << number(r.paramValue, !r.param.empty()) << ','
+            << r.operations << ',' << number(r.seconds) << ',' << number(r.throughput) << ','
+            << number(r.meanUs, r.meanUs >= 0) << ',' << number(r.p50Us, r.p50Us >= 0) << ','
+            << number(r.p95Us, r.p95Us >= 0) << ',' << number(r.p99Us, r.p99Us >= 0) << ','
+            << number(r.recall, r.recall >= 0) << '\n';
+    }
+}
+
+static void writeJson(std::ostream& out, const Dataset& data, const std::vector<Result>& results) {
+    auto field = [&out](const char* name, const std::string& value, bool last = false) {
+        out << '"' << name << "\": " << (value.empty() ? "null" : value) << (last ? "" : ", ");
+    };
+    auto text = [](const std::string& value) { return value.empty() ? value : '"' + value + '"'; };
+    out << "{\"dataset\": \"" << data.name << "\", \"n\": " << data.s.size() << ", \"dim\": " << data.dim
+        << ", \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "  {";
+        field("suite", text(r.suite));
+        field("index", text(r.index));
+        field("operation", text(r.operation));
+        field("order", std::to_string(r.order));
+        field("threads", std::to_string(r.threads));
+        field("k", r.k > 0 ? std::to_string(r.k) : "");
+        field("selectivity", number(r.selectivity, r.selectivity >= 0));
+        field("param", text(r.param));
+        field("param_value", number(r.paramValue, !r.param.empty()));
+        field("operations", std::to_string(r.operations));
+        field("seconds", number(r.seconds));
+        field("throughput", number(r.throughput));
+        field("mean_us", number(r.meanUs, r.meanUs >= 0));
+        field("p50_us", number(r.p50Us, r.p50Us >= 0));
+        field("p95_us", number(r.p95Us, r.p95Us >= 0));
+        field("p99_us", number(r.p99Us, r.p99Us >= 0));
+        field("recall", number(r.recall, r.recall >= 0), true);
+        out << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options options = parseOptions(argc, argv);
+        std::mt19937 rng(options.seed);
+        Dataset data = options.synthetic > 0 ? makeSynthetic(options.synthetic, options.dim, rng) : loadCsv(options.data);
+        if (data.s.empty()) {
+            throw std::runtime_error("No rows in " + data.name);
+        }
+        std::cout << data.s.size() << " rows of dimension " << data.dim << " from " << data.name << "\n";
+
+        std::vector<float> sortedS(data.s);
+        std::sort(sortedS.begin(), sortedS.end());
+        std::vector<Result> results;
+        if (options.tree) runTreeSuite(options, data, sortedS, rng, results);
+        if (options.hybrid) runHybridSuite(options, data, sortedS, rng, results);
+
+        std::ofstream file;
+        if (options.out != "-") {
+            file.open(options.out);
+            if (!file.is_open()) {
+                throw std::runtime_error("Cannot open " + options.out);
+            }
+        }
+        std::ostream& out = options.out == "-" ? std::cout : file;
+        if (options.format == "json") {
+            writeJson(out, data, results);
+        } else {
+            writeCsv(out, data, results);
+        }
+        if (options.out != "-") {
+            std::cout << results.size() << " results saved to " << options.out << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}